@@ -0,0 +1,562 @@
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+
+extern ngx_module_t  ngx_core_module;
+extern ngx_module_t  ngx_errlog_module;
+extern ngx_module_t  ngx_conf_module;
+extern ngx_module_t  ngx_dso_module;
+extern ngx_module_t  ngx_syslog_module;
+extern ngx_module_t  ngx_events_module;
+extern ngx_module_t  ngx_event_core_module;
+extern ngx_module_t  ngx_epoll_module;
+extern ngx_module_t  ngx_procs_module;
+extern ngx_module_t  ngx_proc_core_module;
+extern ngx_module_t  ngx_http_module;
+extern ngx_module_t  ngx_http_core_module;
+extern ngx_module_t  ngx_http_log_module;
+extern ngx_module_t  ngx_http_upstream_module;
+extern ngx_module_t  ngx_http_static_module;
+extern ngx_module_t  ngx_http_autoindex_module;
+extern ngx_module_t  ngx_http_index_module;
+extern ngx_module_t  ngx_http_auth_basic_module;
+extern ngx_module_t  ngx_http_access_module;
+extern ngx_module_t  ngx_http_limit_conn_module;
+extern ngx_module_t  ngx_http_limit_req_module;
+extern ngx_module_t  ngx_http_geo_module;
+extern ngx_module_t  ngx_http_map_module;
+extern ngx_module_t  ngx_http_split_clients_module;
+extern ngx_module_t  ngx_http_referer_module;
+extern ngx_module_t  ngx_http_proxy_module;
+extern ngx_module_t  ngx_http_fastcgi_module;
+extern ngx_module_t  ngx_http_uwsgi_module;
+extern ngx_module_t  ngx_http_scgi_module;
+extern ngx_module_t  ngx_http_memcached_module;
+extern ngx_module_t  ngx_http_empty_gif_module;
+extern ngx_module_t  ngx_http_browser_module;
+extern ngx_module_t  ngx_http_user_agent_module;
+extern ngx_module_t  ngx_http_slice_module;
+extern ngx_module_t  ngx_http_upstream_ip_hash_module;
+extern ngx_module_t  ngx_http_upstream_consistent_hash_module;
+extern ngx_module_t  ngx_http_upstream_check_module;
+extern ngx_module_t  ngx_http_upstream_least_conn_module;
+extern ngx_module_t  ngx_http_upstream_ewma_module;
+extern ngx_module_t  ngx_http_upstream_keepalive_module;
+extern ngx_module_t  ngx_http_stub_status_module;
+extern ngx_module_t  ngx_http_cache_status_module;
+extern ngx_module_t  ngx_http_write_filter_module;
+extern ngx_module_t  ngx_http_header_filter_module;
+extern ngx_module_t  ngx_http_chunked_filter_module;
+extern ngx_module_t  ngx_http_range_header_filter_module;
+extern ngx_module_t  ngx_http_gzip_filter_module;
+extern ngx_module_t  ngx_http_postpone_filter_module;
+extern ngx_module_t  ngx_http_ssi_filter_module;
+extern ngx_module_t  ngx_http_charset_filter_module;
+extern ngx_module_t  ngx_http_userid_filter_module;
+extern ngx_module_t  ngx_http_slice_range_filter_module;
+extern ngx_module_t  ngx_http_footer_filter_module;
+extern ngx_module_t  ngx_http_trim_filter_module;
+extern ngx_module_t  ngx_http_headers_filter_module;
+extern ngx_module_t  ngx_http_upstream_session_sticky_module;
+extern ngx_module_t  ngx_http_copy_filter_module;
+extern ngx_module_t  ngx_http_range_body_filter_module;
+extern ngx_module_t  ngx_http_not_modified_filter_module;
+
+ngx_module_t *ngx_modules[] = {
+    &ngx_core_module,
+    &ngx_errlog_module,
+    &ngx_conf_module,
+    &ngx_dso_module,
+    &ngx_syslog_module,
+    &ngx_events_module,
+    &ngx_event_core_module,
+    &ngx_epoll_module,
+    &ngx_procs_module,
+    &ngx_proc_core_module,
+    &ngx_http_module,
+    &ngx_http_core_module,
+    &ngx_http_log_module,
+    &ngx_http_upstream_module,
+    &ngx_http_static_module,
+    &ngx_http_autoindex_module,
+    &ngx_http_index_module,
+    &ngx_http_auth_basic_module,
+    &ngx_http_access_module,
+    &ngx_http_limit_conn_module,
+    &ngx_http_limit_req_module,
+    &ngx_http_geo_module,
+    &ngx_http_map_module,
+    &ngx_http_split_clients_module,
+    &ngx_http_referer_module,
+    &ngx_http_proxy_module,
+    &ngx_http_fastcgi_module,
+    &ngx_http_uwsgi_module,
+    &ngx_http_scgi_module,
+    &ngx_http_memcached_module,
+    &ngx_http_empty_gif_module,
+    &ngx_http_browser_module,
+    &ngx_http_user_agent_module,
+    &ngx_http_slice_module,
+    &ngx_http_upstream_ip_hash_module,
+    &ngx_http_upstream_consistent_hash_module,
+    &ngx_http_upstream_check_module,
+    &ngx_http_upstream_least_conn_module,
+    &ngx_http_upstream_ewma_module,
+    &ngx_http_upstream_keepalive_module,
+    &ngx_http_stub_status_module,
+    &ngx_http_cache_status_module,
+    &ngx_http_write_filter_module,
+    &ngx_http_header_filter_module,
+    &ngx_http_chunked_filter_module,
+    &ngx_http_range_header_filter_module,
+    &ngx_http_gzip_filter_module,
+    &ngx_http_postpone_filter_module,
+    &ngx_http_ssi_filter_module,
+    &ngx_http_charset_filter_module,
+    &ngx_http_userid_filter_module,
+    &ngx_http_slice_range_filter_module,
+    &ngx_http_footer_filter_module,
+    &ngx_http_trim_filter_module,
+    &ngx_http_headers_filter_module,
+    &ngx_http_upstream_session_sticky_module,
+    &ngx_http_copy_filter_module,
+    &ngx_http_range_body_filter_module,
+    &ngx_http_not_modified_filter_module,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
+u_char *ngx_module_names[] = {
+    (u_char *) "ngx_core_module",
+    (u_char *) "ngx_errlog_module",
+    (u_char *) "ngx_conf_module",
+    (u_char *) "ngx_dso_module",
+    (u_char *) "ngx_syslog_module",
+    (u_char *) "ngx_events_module",
+    (u_char *) "ngx_event_core_module",
+    (u_char *) "ngx_epoll_module",
+    (u_char *) "ngx_procs_module",
+    (u_char *) "ngx_proc_core_module",
+    (u_char *) "ngx_http_module",
+    (u_char *) "ngx_http_core_module",
+    (u_char *) "ngx_http_log_module",
+    (u_char *) "ngx_http_upstream_module",
+    (u_char *) "ngx_http_static_module",
+    (u_char *) "ngx_http_autoindex_module",
+    (u_char *) "ngx_http_index_module",
+    (u_char *) "ngx_http_auth_basic_module",
+    (u_char *) "ngx_http_access_module",
+    (u_char *) "ngx_http_limit_conn_module",
+    (u_char *) "ngx_http_limit_req_module",
+    (u_char *) "ngx_http_geo_module",
+    (u_char *) "ngx_http_map_module",
+    (u_char *) "ngx_http_split_clients_module",
+    (u_char *) "ngx_http_referer_module",
+    (u_char *) "ngx_http_proxy_module",
+    (u_char *) "ngx_http_fastcgi_module",
+    (u_char *) "ngx_http_uwsgi_module",
+    (u_char *) "ngx_http_scgi_module",
+    (u_char *) "ngx_http_memcached_module",
+    (u_char *) "ngx_http_empty_gif_module",
+    (u_char *) "ngx_http_browser_module",
+    (u_char *) "ngx_http_user_agent_module",
+    (u_char *) "ngx_http_slice_module",
+    (u_char *) "ngx_http_upstream_ip_hash_module",
+    (u_char *) "ngx_http_upstream_consistent_hash_module",
+    (u_char *) "ngx_http_upstream_check_module",
+    (u_char *) "ngx_http_upstream_least_conn_module",
+    (u_char *) "ngx_http_upstream_ewma_module",
+    (u_char *) "ngx_http_upstream_keepalive_module",
+    (u_char *) "ngx_http_stub_status_module",
+    (u_char *) "ngx_http_cache_status_module",
+    (u_char *) "ngx_http_write_filter_module",
+    (u_char *) "ngx_http_header_filter_module",
+    (u_char *) "ngx_http_chunked_filter_module",
+    (u_char *) "ngx_http_range_header_filter_module",
+    (u_char *) "ngx_http_gzip_filter_module",
+    (u_char *) "ngx_http_postpone_filter_module",
+    (u_char *) "ngx_http_ssi_filter_module",
+    (u_char *) "ngx_http_charset_filter_module",
+    (u_char *) "ngx_http_userid_filter_module",
+    (u_char *) "ngx_http_slice_range_filter_module",
+    (u_char *) "ngx_http_footer_filter_module",
+    (u_char *) "ngx_http_trim_filter_module",
+    (u_char *) "ngx_http_headers_filter_module",
+    (u_char *) "ngx_http_upstream_session_sticky_module",
+    (u_char *) "ngx_http_copy_filter_module",
+    (u_char *) "ngx_http_range_body_filter_module",
+    (u_char *) "ngx_http_not_modified_filter_module",
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
+
+const char *ngx_all_module_names[] = {
+    "ngx_core_module",
+    "ngx_errlog_module",
+    "ngx_conf_module",
+    "ngx_events_module",
+    "ngx_event_core_module",
+    "ngx_rtsig_module",
+    "ngx_epoll_module",
+    "ngx_select_module",
+    "ngx_poll_module",
+    "ngx_openssl_module",
+    "ngx_regex_module",
+    "ngx_http_module",
+    "ngx_http_core_module",
+    "ngx_http_log_module",
+    "ngx_http_upstream_module",
+    "ngx_http_static_module",
+    "ngx_http_gzip_static_module",
+    "ngx_http_dav_module",
+    "ngx_http_autoindex_module",
+    "ngx_http_index_module",
+    "ngx_http_random_index_module",
+    "ngx_http_auth_basic_module",
+    "ngx_http_access_module",
+    "ngx_http_limit_conn_module",
+    "ngx_http_limit_req_module",
+    "ngx_http_realip_module",
+    "ngx_http_sysguard_module",
+    "ngx_http_geo_module",
+    "ngx_http_geoip_module",
+    "ngx_http_map_module",
+    "ngx_http_split_clients_module",
+    "ngx_http_user_agent_module",
+    "ngx_http_referer_module",
+    "ngx_http_rewrite_module",
+    "ngx_http_ssl_module",
+    "ngx_http_proxy_module",
+    "ngx_http_fastcgi_module",
+    "ngx_http_uwsgi_module",
+    "ngx_http_scgi_module",
+    "ngx_http_perl_module",
+    "ngx_http_memcached_module",
+    "ngx_http_empty_gif_module",
+    "ngx_http_browser_module",
+    "ngx_http_secure_link_module",
+    "ngx_http_degradation_module",
+    "ngx_http_flv_module",
+    "ngx_http_mp4_module",
+    "ngx_http_slice_module",
+    "ngx_http_concat_module",
+    "ngx_http_tfs_module",
+    "ngx_http_upstream_ip_hash_module",
+    "ngx_http_upstream_least_conn_module",
+    "ngx_http_upstream_ewma_module",
+    "ngx_http_upstream_keepalive_module",
+    "ngx_http_upstream_check_module",
+    "ngx_http_upstream_session_sticky_module",
+    "ngx_http_upstream_consistent_hash_module",
+    "ngx_http_stub_status_module",
+    "ngx_http_write_filter_module",
+    "ngx_http_header_filter_module",
+    "ngx_http_chunked_filter_module",
+    "ngx_http_range_header_filter_module",
+    "ngx_http_gzip_filter_module",
+    "ngx_http_postpone_filter_module",
+    "ngx_http_ssi_filter_module",
+    "ngx_http_charset_filter_module",
+    "ngx_http_xslt_filter_module",
+    "ngx_http_image_filter_module",
+    "ngx_http_sub_filter_module",
+    "ngx_http_addition_filter_module",
+    "ngx_http_userid_filter_module",
+    "ngx_http_footer_filter_module",
+    "ngx_http_trim_filter_module",
+    "ngx_http_headers_filter_module",
+    "ngx_http_copy_filter_module",
+    "ngx_http_range_body_filter_module",
+    "ngx_http_not_modified_filter_module",
+    "ngx_mail_module",
+    "ngx_mail_core_module",
+    "ngx_mail_ssl_module",
+    "ngx_mail_pop3_module",
+    "ngx_mail_imap_module",
+    "ngx_mail_smtp_module",
+    "ngx_mail_auth_http_module",
+    "ngx_mail_proxy_module",
+    "ngx_google_perftools_module",
+    "ngx_backtrace_module",
+    NULL
+};
+
+
+const char *ngx_dso_abi_all_tags[] = {
+    "with-debug",
+    "with-http",
+    "with-http-cache",
+    "with-ipv6",
+    "with-syslog",
+    "with-http-gzip",
+    "with-http-gzip-satic",
+    "with-http-ssi",
+    "with-http-dav",
+    "with-http-realip",
+    "with-http-geoip",
+    "with-http-geo",
+    "with-http-ssl",
+    "with-http-proxy",
+    "with-http-degradation",
+    "with-http-upstream-check",
+    "with-http-stat-stub",
+    NULL
+};
+
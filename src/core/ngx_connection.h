@@ -160,6 +160,7 @@ struct ngx_connection_s {
     unsigned            idle:1;
     unsigned            reusable:1;
     unsigned            close:1;
+    unsigned            shared:1;        /* the descriptor is not owned */
 
     unsigned            sendfile:1;
     unsigned            sndlowat:1;
@@ -31,6 +31,20 @@ ngx_write_chain_to_temp_file(ngx_temp_file_t *tf, ngx_chain_t *chain)
             ngx_log_error(tf->log_level, tf->file.log, 0, "%s %V",
                           tf->warn, &tf->file.name);
         }
+
+#if (NGX_HAVE_FALLOCATE)
+
+        /* preallocation is advisory, a write error is reported anyway */
+
+        if (tf->preallocate
+            && ngx_preallocate_file(&tf->file, tf->preallocate) != NGX_OK)
+        {
+            ngx_log_debug2(NGX_LOG_DEBUG_CORE, tf->file.log, ngx_errno,
+                           ngx_preallocate_file_n " \"%s\" %O failed",
+                           tf->file.name.data, tf->preallocate);
+        }
+
+#endif
     }
 
     return ngx_write_chain_to_file(&tf->file, chain, tf->offset, tf->pool);
@@ -332,6 +346,7 @@ ngx_conf_merge_path_value(ngx_conf_t *cf, ngx_path_t **path, ngx_path_t *prev,
 
     (*path)->manager = NULL;
     (*path)->loader = NULL;
+    (*path)->loader_delay = 0;
     (*path)->conf_file = NULL;
 
     if (ngx_add_path(cf, path) != NGX_OK) {
@@ -46,6 +46,7 @@ typedef struct {
 
     ngx_path_manager_pt        manager;
     ngx_path_loader_pt         loader;
+    ngx_msec_t                 loader_delay;
     void                      *data;
 
     u_char                    *conf_file;
@@ -68,6 +69,8 @@ typedef struct {
 
     ngx_uint_t                 access;
 
+    off_t                      preallocate;
+
     unsigned                   log_level:8;
     unsigned                   persistent:1;
     unsigned                   clean:1;
@@ -18,6 +18,38 @@ static ngx_int_t ngx_event_pipe_write_chain_to_temp_file(ngx_event_pipe_t *p);
 static ngx_inline void ngx_event_pipe_remove_shadow_links(ngx_buf_t *buf);
 static ngx_int_t ngx_event_pipe_drain_chains(ngx_event_pipe_t *p);
 
+static size_t ngx_event_pipe_buf_size(ngx_event_pipe_t *p);
+static ngx_uint_t ngx_event_pipe_grow(ngx_event_pipe_t *p);
+static ngx_chain_t *ngx_event_pipe_alloc_raw_buf(ngx_event_pipe_t *p,
+    size_t size);
+static ngx_uint_t ngx_event_pipe_buf_class(size_t size);
+static void ngx_event_pipe_free_pooled(void *data);
+
+
+/*
+ * Adaptive raw bufs are allocated on demand: the first buf is a quarter
+ * of the configured size and each next one is twice as large, up to the
+ * configured size, or a buf is sized to the rest of the response if its
+ * length is known.  The total size rather than the number of bufs is
+ * limited.  The bufs of power of two sizes are kept per worker process
+ * and are reused by the next requests.
+ */
+
+#define NGX_EVENT_PIPE_MIN_BUF_SIZE  1024
+#define NGX_EVENT_PIPE_BUF_CLASSES   11
+#define NGX_EVENT_PIPE_FREE_MAX      (4 * 1024 * 1024)
+
+
+struct ngx_event_pipe_buf_s {
+    ngx_event_pipe_buf_t  *next;
+    size_t                 size;
+};
+
+
+static ngx_event_pipe_buf_t  *ngx_event_pipe_free_list[
+                                                  NGX_EVENT_PIPE_BUF_CLASSES];
+static size_t                 ngx_event_pipe_nfree;
+
 
 ngx_int_t
 ngx_event_pipe(ngx_event_pipe_t *p, ngx_int_t do_write)
@@ -179,25 +211,15 @@ ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
                     p->free_raw_bufs = NULL;
                 }
 
-            } else if (p->allocated < p->bufs.num) {
+            } else if ((size = ngx_event_pipe_buf_size(p)) != 0) {
 
                 /* allocate a new buf if it's still allowed */
 
-                b = ngx_create_temp_buf(p->pool, p->bufs.size);
-                if (b == NULL) {
-                    return NGX_ABORT;
-                }
-
-                p->allocated++;
-
-                chain = ngx_alloc_chain_link(p->pool);
+                chain = ngx_event_pipe_alloc_raw_buf(p, size);
                 if (chain == NULL) {
                     return NGX_ABORT;
                 }
 
-                chain->buf = b;
-                chain->next = NULL;
-
             } else if (!p->cacheable
                        && p->downstream->data == p->output_ctx
                        && p->downstream->write->ready
@@ -215,6 +237,18 @@ ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
 
                 break;
 
+            } else if (ngx_event_pipe_grow(p)) {
+
+                /*
+                 * the client keeps reading, so the bufs are kept in memory
+                 * rather than written to a temporary file
+                 */
+
+                chain = ngx_event_pipe_alloc_raw_buf(p, p->bufs.size);
+                if (chain == NULL) {
+                    return NGX_ABORT;
+                }
+
             } else if (p->cacheable
                        || p->temp_file->offset < p->max_temp_file_size)
             {
@@ -687,6 +721,24 @@ ngx_event_pipe_write_chain_to_temp_file(ngx_event_pipe_t *p)
     ngx_uint_t    prev_last_shadow;
     ngx_chain_t  *cl, *tl, *next, *out, **ll, **last_out, **last_free, fl;
 
+    if (p->cacheable_limit
+        && p->temp_file->offset >= p->max_temp_file_size)
+    {
+        /*
+         * the temporary file has reached its maximum size,
+         * so the rest of the response is passed to a downstream as usual
+         */
+
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                       "pipe temp file limit");
+
+        p->cacheable = 0;
+        p->cacheable_limit = 0;
+        p->upstream_blocked = 1;
+
+        return NGX_BUSY;
+    }
+
     if (p->buf_to_file) {
         fl.buf = p->buf_to_file;
         fl.next = p->in;
@@ -1024,3 +1076,198 @@ ngx_event_pipe_drain_chains(ngx_event_pipe_t *p)
         }
     }
 }
+
+
+static size_t
+ngx_event_pipe_buf_size(ngx_event_pipe_t *p)
+{
+    off_t       rest;
+    size_t      size, n;
+    ngx_int_t   i;
+
+    if (!p->adaptive) {
+        return (p->allocated < p->bufs.num) ? p->bufs.size : 0;
+    }
+
+    if (p->allocated_size >= (size_t) p->bufs.num * p->bufs.size) {
+        return 0;
+    }
+
+    rest = p->content_length - p->read_length;
+
+    if (p->content_length >= 0 && rest > 0) {
+
+        if (rest >= (off_t) p->bufs.size) {
+            return p->bufs.size;
+        }
+
+        size = (size_t) rest;
+
+    } else {
+        size = p->bufs.size / 4;
+
+        for (i = 0; i < p->allocated && size < p->bufs.size; i++) {
+            size *= 2;
+        }
+    }
+
+    for (n = NGX_EVENT_PIPE_MIN_BUF_SIZE; n < size; n *= 2) { /* void */ }
+
+    return ngx_min(n, p->bufs.size);
+}
+
+
+/*
+ * The limit grows by one buf if at least a buf size was sent to the client
+ * since it last grew, up to twice the configured size.
+ */
+
+static ngx_uint_t
+ngx_event_pipe_grow(ngx_event_pipe_t *p)
+{
+    off_t  sent;
+
+    if (!p->adaptive
+        || p->cacheable
+        || p->allocated_size >= 2 * (size_t) p->bufs.num * p->bufs.size)
+    {
+        return 0;
+    }
+
+    sent = p->downstream->sent;
+
+    if (sent - p->drained < (off_t) p->bufs.size) {
+        return 0;
+    }
+
+    p->drained = sent;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                   "pipe grow: %uz", p->allocated_size);
+
+    return 1;
+}
+
+
+static ngx_chain_t *
+ngx_event_pipe_alloc_raw_buf(ngx_event_pipe_t *p, size_t size)
+{
+    ngx_uint_t             i;
+    ngx_buf_t             *b;
+    ngx_chain_t           *cl;
+    ngx_pool_cleanup_t    *cln;
+    ngx_event_pipe_buf_t  *pb;
+
+    i = ngx_event_pipe_buf_class(size);
+
+    if (!p->adaptive || i == NGX_EVENT_PIPE_BUF_CLASSES) {
+        b = ngx_create_temp_buf(p->pool, size);
+        if (b == NULL) {
+            return NULL;
+        }
+
+    } else {
+        b = ngx_calloc_buf(p->pool);
+        if (b == NULL) {
+            return NULL;
+        }
+
+        if (p->pooled == NULL) {
+            cln = ngx_pool_cleanup_add(p->pool, 0);
+            if (cln == NULL) {
+                return NULL;
+            }
+
+            cln->handler = ngx_event_pipe_free_pooled;
+            cln->data = p;
+        }
+
+        pb = ngx_event_pipe_free_list[i];
+
+        if (pb) {
+            ngx_event_pipe_free_list[i] = pb->next;
+            ngx_event_pipe_nfree -= size;
+
+        } else {
+            pb = ngx_alloc(sizeof(ngx_event_pipe_buf_t) + size, p->log);
+            if (pb == NULL) {
+                return NULL;
+            }
+
+            pb->size = size;
+        }
+
+        pb->next = p->pooled;
+        p->pooled = pb;
+
+        b->start = (u_char *) pb + sizeof(ngx_event_pipe_buf_t);
+        b->pos = b->start;
+        b->last = b->start;
+        b->end = b->start + size;
+        b->temporary = 1;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                   "pipe buf alloc: %uz", size);
+
+    p->allocated++;
+    p->allocated_size += size;
+
+    cl = ngx_alloc_chain_link(p->pool);
+    if (cl == NULL) {
+        return NULL;
+    }
+
+    cl->buf = b;
+    cl->next = NULL;
+
+    return cl;
+}
+
+
+static ngx_uint_t
+ngx_event_pipe_buf_class(size_t size)
+{
+    size_t      n;
+    ngx_uint_t  i;
+
+    n = NGX_EVENT_PIPE_MIN_BUF_SIZE;
+
+    for (i = 0; i < NGX_EVENT_PIPE_BUF_CLASSES; i++) {
+        if (n == size) {
+            return i;
+        }
+
+        n *= 2;
+    }
+
+    return NGX_EVENT_PIPE_BUF_CLASSES;
+}
+
+
+static void
+ngx_event_pipe_free_pooled(void *data)
+{
+    ngx_event_pipe_t *p = data;
+
+    ngx_uint_t             i;
+    ngx_event_pipe_buf_t  *pb, *next;
+
+    for (pb = p->pooled; pb; pb = next) {
+        next = pb->next;
+
+        if (ngx_event_pipe_nfree + pb->size <= NGX_EVENT_PIPE_FREE_MAX) {
+            i = ngx_event_pipe_buf_class(pb->size);
+
+            pb->next = ngx_event_pipe_free_list[i];
+            ngx_event_pipe_free_list[i] = pb;
+            ngx_event_pipe_nfree += pb->size;
+
+            continue;
+        }
+
+        ngx_free(pb);
+    }
+
+    p->pooled = NULL;
+}
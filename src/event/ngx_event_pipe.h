@@ -15,6 +15,7 @@
 
 
 typedef struct ngx_event_pipe_s  ngx_event_pipe_t;
+typedef struct ngx_event_pipe_buf_s  ngx_event_pipe_buf_t;
 
 typedef ngx_int_t (*ngx_event_pipe_input_filter_pt)(ngx_event_pipe_t *p,
                                                     ngx_buf_t *buf);
@@ -47,6 +48,7 @@ struct ngx_event_pipe_s {
 
     unsigned           read:1;
     unsigned           cacheable:1;
+    unsigned           cacheable_limit:1;
     unsigned           single_buf:1;
     unsigned           free_bufs:1;
     unsigned           upstream_done:1;
@@ -56,11 +58,18 @@ struct ngx_event_pipe_s {
     unsigned           downstream_done:1;
     unsigned           downstream_error:1;
     unsigned           cyclic_temp_file:1;
+    unsigned           adaptive:1;
 
     ngx_int_t          allocated;
     ngx_bufs_t         bufs;
     ngx_buf_tag_t      tag;
 
+    /* adaptive bufs */
+    size_t             allocated_size;
+    off_t              content_length;
+    off_t              drained;
+    ngx_event_pipe_buf_t  *pooled;
+
     ssize_t            busy_size;
 
     off_t              read_length;
@@ -29,6 +29,7 @@
 
 static void ngx_http_lua_body_filter_by_lua_env(lua_State *L,
     ngx_http_request_t *r, ngx_chain_t *in);
+static int ngx_http_lua_body_filter_get_buffers(lua_State *L);
 static ngx_http_output_body_filter_pt ngx_http_next_body_filter;
 
 
@@ -381,6 +382,19 @@ ngx_http_lua_body_filter_param_get(lua_State *L)
     int                  idx;
     ngx_chain_t         *in;
 
+    if (lua_type(L, 2) == LUA_TSTRING) {
+        p = (u_char *) lua_tolstring(L, 2, &size);
+
+        if (size == sizeof("buffers") - 1
+            && ngx_strncmp(p, "buffers", sizeof("buffers") - 1) == 0)
+        {
+            return ngx_http_lua_body_filter_get_buffers(L);
+        }
+
+        lua_pushnil(L);
+        return 1;
+    }
+
     idx = luaL_checkint(L, 2);
 
     dd("index: %d", idx);
@@ -459,6 +473,52 @@ ngx_http_lua_body_filter_param_get(lua_State *L)
 }
 
 
+/*
+ * ngx.arg.buffers exposes the current chunk without copying it into a Lua
+ * string: a flat array of (lightuserdata pointer, length) pairs, one pair per
+ * in-memory buffer, meant for read-only inspection through the LuaJIT FFI.
+ * The pointers are only valid during the current body filter call.
+ */
+static int
+ngx_http_lua_body_filter_get_buffers(lua_State *L)
+{
+    int                  n;
+    ngx_buf_t           *b;
+    ngx_chain_t         *cl, *in;
+
+    lua_pushlightuserdata(L, &ngx_http_lua_body_filter_chain_key);
+    lua_rawget(L, LUA_GLOBALSINDEX);
+    in = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+
+    for (n = 0, cl = in; cl; cl = cl->next) {
+        n++;
+    }
+
+    lua_createtable(L, n * 2 /* narr */, 0 /* nrec */);
+
+    for (n = 0, cl = in; cl; cl = cl->next) {
+        b = cl->buf;
+
+        if (!ngx_buf_in_memory(b) || b->last == b->pos) {
+            continue;
+        }
+
+        lua_pushlightuserdata(L, b->pos);
+        lua_rawseti(L, -2, ++n);
+
+        lua_pushinteger(L, b->last - b->pos);
+        lua_rawseti(L, -2, ++n);
+
+        if (b->last_buf || b->last_in_chain) {
+            break;
+        }
+    }
+
+    return 1;
+}
+
+
 int
 ngx_http_lua_body_filter_param_set(lua_State *L, ngx_http_request_t *r,
         ngx_http_lua_ctx_t *ctx)
@@ -468,6 +528,7 @@ ngx_http_lua_body_filter_param_set(lua_State *L, ngx_http_request_t *r,
     u_char                  *data;
     size_t                   size;
     unsigned                 last;
+    ngx_buf_t               *b;
     ngx_chain_t             *cl;
     ngx_chain_t             *in;
     ngx_buf_tag_t            tag;
@@ -600,6 +661,38 @@ ngx_http_lua_body_filter_param_set(lua_State *L, ngx_http_request_t *r,
     in = lua_touserdata(L, -1);
     lua_pop(L, 1);
 
+    if (size && in && in->next == NULL) {
+
+        /*
+         * the new chunk is no larger than the single incoming buffer:
+         * overwrite its memory in place and pass the original chain on
+         * instead of allocating a new buffer
+         */
+
+        b = in->buf;
+
+        if (b->temporary && !b->in_file && !b->mmap
+            && (size_t) (b->last - b->pos) >= size)
+        {
+            if (type == LUA_TTABLE) {
+                b->last = ngx_http_lua_copy_str_in_table(L, 3, b->pos);
+
+            } else {
+                b->last = ngx_cpymem(b->pos, data, size);
+            }
+
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "lua body filter reused buffer in place, size %uz",
+                           size);
+
+            if (b->last_buf || b->last_in_chain) {
+                ctx->seen_last_in_filter = 1;
+            }
+
+            return 0;
+        }
+    }
+
     last = 0;
     for (cl = in; cl; cl = cl->next) {
         if (cl->buf->last_buf || cl->buf->last_in_chain) {
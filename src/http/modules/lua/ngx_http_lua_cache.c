@@ -19,6 +19,16 @@
 #include "ngx_http_lua_util.h"
 
 
+typedef struct {
+    ngx_fd_t        fd;
+    ngx_uint_t      ok;
+} ngx_http_lua_cache_dump_ctx_t;
+
+
+static int ngx_http_lua_cache_loadfile_bytecode(lua_State *L,
+    const char *script);
+static int ngx_http_lua_cache_dump_writer(lua_State *L, const void *p,
+    size_t size, void *ud);
 static void ngx_http_lua_clear_package_loaded(lua_State *L);
 
 
@@ -214,7 +224,12 @@ ngx_http_lua_cache_loadfile(lua_State *L, const u_char *script,
     }
 
     /*  load closure factory of script file to the top of lua stack, sp++ */
-    rc = ngx_http_lua_clfactory_loadfile(L, (char *) script);
+    if (enabled) {
+        rc = ngx_http_lua_cache_loadfile_bytecode(L, (char *) script);
+
+    } else {
+        rc = ngx_http_lua_clfactory_loadfile(L, (char *) script);
+    }
 
     if (rc != 0) {
         /*  Oops! error occured when loading Lua script */
@@ -258,6 +273,221 @@ ngx_http_lua_cache_loadfile(lua_State *L, const u_char *script,
 }
 
 
+ngx_int_t
+ngx_http_lua_cache_precompile_add(ngx_conf_t *cf,
+    ngx_http_lua_loc_conf_t *llcf, ngx_str_t *path, u_char *key)
+{
+    ngx_http_lua_main_conf_t    *lmcf;
+    ngx_http_lua_precompile_t   *pc;
+
+    lmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_lua_module);
+
+    if (lmcf->precompiled == NULL) {
+        lmcf->precompiled = ngx_array_create(cf->pool, 4,
+                                             sizeof(ngx_http_lua_precompile_t));
+        if (lmcf->precompiled == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    pc = ngx_array_push(lmcf->precompiled);
+    if (pc == NULL) {
+        return NGX_ERROR;
+    }
+
+    pc->conf = llcf;
+    pc->path = *path;
+    pc->key = key;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_http_lua_cache_precompile(ngx_conf_t *cf, ngx_http_lua_main_conf_t *lmcf)
+{
+    int                          top;
+    char                        *err;
+    u_char                      *script;
+    ngx_int_t                    rc;
+    ngx_uint_t                   i;
+    lua_State                   *L;
+    ngx_http_lua_loc_conf_t     *llcf;
+    ngx_http_lua_precompile_t   *pc;
+
+    if (lmcf->precompiled == NULL) {
+        return NGX_OK;
+    }
+
+    L = lmcf->lua;
+    pc = lmcf->precompiled->elts;
+
+    for (i = 0; i < lmcf->precompiled->nelts; i++) {
+        llcf = pc[i].conf;
+
+        /* the http{} level conf is never merged, unset means enabled */
+
+        if (llcf->enable_code_cache == 0) {
+            continue;
+        }
+
+        script = ngx_http_lua_rebase_path(cf->pool, pc[i].path.data,
+                                          pc[i].path.len);
+        if (script == NULL) {
+            return NGX_ERROR;
+        }
+
+        top = lua_gettop(L);
+        err = "unknown error";
+
+        rc = ngx_http_lua_cache_loadfile(L, script, pc[i].key, &err, 1);
+
+        if (rc != NGX_OK) {
+            ngx_log_error(NGX_LOG_WARN, cf->log, 0,
+                          "failed to precompile Lua file \"%s\": %s",
+                          script, err);
+        }
+
+        lua_settop(L, top);
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * Load the closure factory of a script file through the on-disk bytecode
+ * cache configured by "lua_code_cache_path".  Cached chunks are named after
+ * the script path digest, mtime and size, so an edited script simply misses
+ * and gets compiled again.  Any failure falls back to the script itself.
+ */
+static int
+ngx_http_lua_cache_loadfile_bytecode(lua_State *L, const char *script)
+{
+    int                             rc;
+    u_char                         *name, *tmp, *p;
+    size_t                          len;
+    ngx_str_t                       dir;
+    ngx_file_info_t                 fi;
+    ngx_http_lua_cache_dump_ctx_t   ctx;
+
+    lua_pushlightuserdata(L, &ngx_http_lua_code_cache_path_key);
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    dir.data = (u_char *) lua_tolstring(L, -1, &dir.len);
+
+    /* the string is still anchored in the registry */
+    lua_pop(L, 1);
+
+    if (dir.data == NULL
+        || ngx_file_info(script, &fi) == NGX_FILE_ERROR)
+    {
+        return ngx_http_lua_clfactory_loadfile(L, script);
+    }
+
+    len = dir.len + sizeof("/-") + 2 * MD5_DIGEST_LENGTH + NGX_TIME_T_LEN
+          + sizeof("-.luac") + NGX_OFF_T_LEN;
+
+    /* room for both the cached chunk name and its temporary name */
+
+    name = ngx_alloc(2 * len + sizeof(".") + NGX_INT64_LEN, ngx_cycle->log);
+    if (name == NULL) {
+        return ngx_http_lua_clfactory_loadfile(L, script);
+    }
+
+    p = ngx_cpymem(name, dir.data, dir.len);
+    *p++ = '/';
+    p = ngx_http_lua_digest_hex(p, (u_char *) script, ngx_strlen(script));
+    p = ngx_sprintf(p, "-%T-%O.luac%Z", ngx_file_mtime(&fi),
+                    ngx_file_size(&fi));
+
+    len = p - name - 1;
+
+    if (ngx_file_info(name, &fi) != NGX_FILE_ERROR) {
+        rc = ngx_http_lua_clfactory_loadfile(L, (char *) name);
+
+        if (rc == 0) {
+            ngx_free(name);
+            return 0;
+        }
+
+        /* pop the error message and rebuild the cached chunk */
+        lua_pop(L, 1);
+    }
+
+    if (luaL_loadfile(L, script) != 0) {
+        /* let the closure factory report the error */
+        lua_pop(L, 1);
+        ngx_free(name);
+        return ngx_http_lua_clfactory_loadfile(L, script);
+    }
+
+    /* dump into "<name>.<pid>" and rename it in place afterwards */
+
+    tmp = name + len + 1;
+    ngx_sprintf(tmp, "%*s.%P%Z", len, name, ngx_pid);
+
+    ctx.ok = 0;
+    ctx.fd = ngx_open_file(tmp, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                           NGX_FILE_DEFAULT_ACCESS);
+
+    if (ctx.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", tmp);
+
+    } else {
+        ctx.ok = (lua_dump(L, ngx_http_lua_cache_dump_writer, &ctx) == 0);
+
+        if (ngx_close_file(ctx.fd) == NGX_FILE_ERROR) {
+            ctx.ok = 0;
+        }
+
+        if (ctx.ok && ngx_rename_file(tmp, name) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, ngx_errno,
+                          ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                          tmp, name);
+            ctx.ok = 0;
+        }
+
+        if (!ctx.ok) {
+            (void) ngx_delete_file(tmp);
+        }
+    }
+
+    /* pop the plain chunk */
+    lua_pop(L, 1);
+
+    if (ctx.ok) {
+        rc = ngx_http_lua_clfactory_loadfile(L, (char *) name);
+
+        if (rc == 0) {
+            ngx_free(name);
+            return 0;
+        }
+
+        lua_pop(L, 1);
+    }
+
+    ngx_free(name);
+
+    return ngx_http_lua_clfactory_loadfile(L, script);
+}
+
+
+static int
+ngx_http_lua_cache_dump_writer(lua_State *L, const void *p, size_t size,
+    void *ud)
+{
+    ngx_http_lua_cache_dump_ctx_t  *ctx = ud;
+
+    if (ngx_write_fd(ctx->fd, (void *) p, size) != (ssize_t) size) {
+        ctx->ok = 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+
 static void
 ngx_http_lua_clear_package_loaded(lua_State *L)
 {
@@ -17,6 +17,10 @@ ngx_int_t ngx_http_lua_cache_loadbuffer(lua_State *L, const u_char *src,
     char **err, unsigned enabled);
 ngx_int_t ngx_http_lua_cache_loadfile(lua_State *L, const u_char *script,
     const u_char *cache_key, char **err, unsigned enabled);
+ngx_int_t ngx_http_lua_cache_precompile_add(ngx_conf_t *cf,
+    ngx_http_lua_loc_conf_t *llcf, ngx_str_t *path, u_char *key);
+ngx_int_t ngx_http_lua_cache_precompile(ngx_conf_t *cf,
+    ngx_http_lua_main_conf_t *lmcf);
 
 
 #endif /* _NGX_HTTP_LUA_CACHE_H_INCLUDED_ */
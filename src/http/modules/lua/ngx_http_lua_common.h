@@ -80,6 +80,7 @@ typedef struct {
 
 
 typedef struct ngx_http_lua_main_conf_s ngx_http_lua_main_conf_t;
+typedef struct ngx_http_lua_stats_s ngx_http_lua_stats_t;
 
 
 typedef ngx_int_t (*ngx_http_lua_conf_handler_pt)(ngx_log_t *log,
@@ -92,6 +93,13 @@ typedef struct {
 } ngx_http_lua_preload_hook_t;
 
 
+typedef struct {
+    void                *conf;      /* ngx_http_lua_loc_conf_t */
+    ngx_str_t            path;
+    u_char              *key;
+} ngx_http_lua_precompile_t;
+
+
 struct ngx_http_lua_main_conf_s {
     lua_State       *lua;
 
@@ -109,6 +117,9 @@ struct ngx_http_lua_main_conf_s {
 
     ngx_array_t     *preload_hooks; /* of ngx_http_lua_preload_hook_t */
 
+    ngx_array_t     *precompiled;   /* of ngx_http_lua_precompile_t */
+    ngx_str_t        code_cache_path;
+
     ngx_flag_t       postponed_to_rewrite_phase_end;
     ngx_flag_t       postponed_to_access_phase_end;
 
@@ -116,6 +127,11 @@ struct ngx_http_lua_main_conf_s {
     ngx_str_t                       init_src;
     ngx_uint_t                      shm_zones_inited;
 
+    ngx_flag_t       stats_enabled;
+    ngx_uint_t       stats_sample_rate;
+    ngx_uint_t       stats_ticks;
+    ngx_array_t     *stats;      /* of ngx_http_lua_stats_t* */
+
     unsigned         requires_header_filter:1;
     unsigned         requires_body_filter:1;
     unsigned         requires_capture_filter:1;
@@ -161,6 +177,9 @@ typedef struct {
 
     u_char                 *content_src_key; /* cached key for content_src */
 
+    ngx_http_lua_stats_t   *rewrite_stats;
+    ngx_http_lua_stats_t   *access_stats;
+    ngx_http_lua_stats_t   *content_stats;
 
     ngx_http_complex_value_t     log_src;     /* log_by_lua inline script/script
                                                  file path */
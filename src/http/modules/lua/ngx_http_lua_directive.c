@@ -23,6 +23,7 @@
 #include "ngx_http_lua_bodyfilterby.h"
 #include "ngx_http_lua_initby.h"
 #include "ngx_http_lua_shdict.h"
+#include "ngx_http_lua_stats.h"
 
 #if defined(NDK) && NDK
 #include "ngx_http_lua_setby.h"
@@ -455,11 +456,24 @@ ngx_http_lua_rewrite_by_lua(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             p = ngx_copy(p, NGX_HTTP_LUA_FILE_TAG, NGX_HTTP_LUA_FILE_TAG_LEN);
             p = ngx_http_lua_digest_hex(p, value[1].data, value[1].len);
             *p = '\0';
+
+            if (ngx_http_lua_cache_precompile_add(cf, llcf, &value[1],
+                                                  llcf->rewrite_src_key)
+                != NGX_OK)
+            {
+                return NGX_CONF_ERROR;
+            }
         }
     }
 
     llcf->rewrite_handler = cmd->post;
 
+    llcf->rewrite_stats = ngx_http_lua_stats_add(cf,
+                                                 NGX_HTTP_LUA_CONTEXT_REWRITE);
+    if (llcf->rewrite_stats == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
     lmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_lua_module);
 
     lmcf->requires_rewrite = 1;
@@ -537,11 +551,24 @@ ngx_http_lua_access_by_lua(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             p = ngx_copy(p, NGX_HTTP_LUA_FILE_TAG, NGX_HTTP_LUA_FILE_TAG_LEN);
             p = ngx_http_lua_digest_hex(p, value[1].data, value[1].len);
             *p = '\0';
+
+            if (ngx_http_lua_cache_precompile_add(cf, llcf, &value[1],
+                                                  llcf->access_src_key)
+                != NGX_OK)
+            {
+                return NGX_CONF_ERROR;
+            }
         }
     }
 
     llcf->access_handler = cmd->post;
 
+    llcf->access_stats = ngx_http_lua_stats_add(cf,
+                                                NGX_HTTP_LUA_CONTEXT_ACCESS);
+    if (llcf->access_stats == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
     lmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_lua_module);
 
     lmcf->requires_access = 1;
@@ -619,11 +646,24 @@ ngx_http_lua_content_by_lua(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             p = ngx_copy(p, NGX_HTTP_LUA_FILE_TAG, NGX_HTTP_LUA_FILE_TAG_LEN);
             p = ngx_http_lua_digest_hex(p, value[1].data, value[1].len);
             *p = '\0';
+
+            if (ngx_http_lua_cache_precompile_add(cf, llcf, &value[1],
+                                                  llcf->content_src_key)
+                != NGX_OK)
+            {
+                return NGX_CONF_ERROR;
+            }
         }
     }
 
     llcf->content_handler = cmd->post;
 
+    llcf->content_stats = ngx_http_lua_stats_add(cf,
+                                                 NGX_HTTP_LUA_CONTEXT_CONTENT);
+    if (llcf->content_stats == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
     lmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_lua_module);
 
     lmcf->requires_capture_filter = 1;
@@ -708,6 +748,13 @@ ngx_http_lua_log_by_lua(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             p = ngx_copy(p, NGX_HTTP_LUA_FILE_TAG, NGX_HTTP_LUA_FILE_TAG_LEN);
             p = ngx_http_lua_digest_hex(p, value[1].data, value[1].len);
             *p = '\0';
+
+            if (ngx_http_lua_cache_precompile_add(cf, llcf, &value[1],
+                                                  llcf->log_src_key)
+                != NGX_OK)
+            {
+                return NGX_CONF_ERROR;
+            }
         }
     }
 
@@ -789,6 +836,13 @@ ngx_http_lua_header_filter_by_lua(ngx_conf_t *cf, ngx_command_t *cmd,
             p = ngx_copy(p, NGX_HTTP_LUA_FILE_TAG, NGX_HTTP_LUA_FILE_TAG_LEN);
             p = ngx_http_lua_digest_hex(p, value[1].data, value[1].len);
             *p = '\0';
+
+            if (ngx_http_lua_cache_precompile_add(cf, llcf, &value[1],
+                                                  llcf->header_filter_src_key)
+                != NGX_OK)
+            {
+                return NGX_CONF_ERROR;
+            }
         }
     }
 
@@ -870,6 +924,13 @@ ngx_http_lua_body_filter_by_lua(ngx_conf_t *cf, ngx_command_t *cmd,
             p = ngx_copy(p, NGX_HTTP_LUA_FILE_TAG, NGX_HTTP_LUA_FILE_TAG_LEN);
             p = ngx_http_lua_digest_hex(p, value[1].data, value[1].len);
             *p = '\0';
+
+            if (ngx_http_lua_cache_precompile_add(cf, llcf, &value[1],
+                                                  llcf->body_filter_src_key)
+                != NGX_OK)
+            {
+                return NGX_CONF_ERROR;
+            }
         }
     }
 
@@ -22,6 +22,8 @@
 #include "ngx_http_lua_bodyfilterby.h"
 #include "ngx_http_lua_initby.h"
 #include "ngx_http_lua_probe.h"
+#include "ngx_http_lua_stats.h"
+#include "ngx_http_lua_cache.h"
 
 
 #if !defined(nginx_version) || nginx_version < 8054
@@ -63,6 +65,27 @@ static ngx_command_t ngx_http_lua_cmds[] = {
       NULL },
 #endif
 
+    { ngx_string("lua_stats"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_lua_main_conf_t, stats_enabled),
+      NULL },
+
+    { ngx_string("lua_stats_sample_rate"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_lua_main_conf_t, stats_sample_rate),
+      NULL },
+
+    { ngx_string("lua_stats_show"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_lua_stats_show,
+      0,
+      0,
+      NULL },
+
     { ngx_string("lua_package_cpath"),
       NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
       ngx_http_lua_package_cpath,
@@ -85,6 +108,13 @@ static ngx_command_t ngx_http_lua_cmds[] = {
       offsetof(ngx_http_lua_loc_conf_t, enable_code_cache),
       NULL },
 
+    { ngx_string("lua_code_cache_path"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_str_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_lua_main_conf_t, code_cache_path),
+      NULL },
+
     { ngx_string("lua_need_request_body"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF
                         |NGX_CONF_FLAG,
@@ -439,6 +469,16 @@ ngx_http_lua_init(ngx_conf_t *cf)
             }
         }
 
+        /*
+         * load the *_by_lua_file scripts into the code cache now, so that
+         * the workers inherit the compiled chunks instead of each of them
+         * reading and parsing every file on first use
+         */
+
+        if (ngx_http_lua_cache_precompile(cf, lmcf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
         dd("Lua VM initialized!");
     }
 
@@ -495,6 +535,8 @@ ngx_http_lua_create_main_conf(ngx_conf_t *cf)
      *      lmcf->init_src = { 0, NULL };
      *      lmcf->shm_zones_inited = 0;
      *      lmcf->preload_hooks = NULL;
+     *      lmcf->precompiled = NULL;
+     *      lmcf->code_cache_path = { 0, NULL };
      *      lmcf->requires_header_filter = 0;
      *      lmcf->requires_body_filter = 0;
      *      lmcf->requires_capture_filter = 0;
@@ -502,6 +544,8 @@ ngx_http_lua_create_main_conf(ngx_conf_t *cf)
      *      lmcf->requires_access = 0;
      *      lmcf->requires_log = 0;
      *      lmcf->requires_shm = 0;
+     *      lmcf->stats_ticks = 0;
+     *      lmcf->stats = NULL;
      */
 
     lmcf->pool = cf->pool;
@@ -509,6 +553,8 @@ ngx_http_lua_create_main_conf(ngx_conf_t *cf)
     lmcf->regex_cache_max_entries = NGX_CONF_UNSET;
 #endif
     lmcf->postponed_to_rewrite_phase_end = NGX_CONF_UNSET;
+    lmcf->stats_enabled = NGX_CONF_UNSET;
+    lmcf->stats_sample_rate = NGX_CONF_UNSET_UINT;
 
     dd("nginx Lua module main config structure initialized!");
 
@@ -519,9 +565,25 @@ ngx_http_lua_create_main_conf(ngx_conf_t *cf)
 static char *
 ngx_http_lua_init_main_conf(ngx_conf_t *cf, void *conf)
 {
-#if (NGX_PCRE)
     ngx_http_lua_main_conf_t *lmcf = conf;
 
+    if (lmcf->stats_enabled == NGX_CONF_UNSET) {
+        lmcf->stats_enabled = 0;
+    }
+
+    if (lmcf->stats_sample_rate == NGX_CONF_UNSET_UINT
+        || lmcf->stats_sample_rate == 0)
+    {
+        lmcf->stats_sample_rate = 1;
+    }
+
+    if (lmcf->code_cache_path.len
+        && ngx_conf_full_name(cf->cycle, &lmcf->code_cache_path, 0) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+#if (NGX_PCRE)
     if (lmcf->regex_cache_max_entries == NGX_CONF_UNSET) {
         lmcf->regex_cache_max_entries = 1024;
     }
@@ -552,6 +614,10 @@ ngx_http_lua_create_loc_conf(ngx_conf_t *cf)
      *      conf->content_src_key = NULL
      *      conf->content_handler = NULL;
      *
+     *      conf->rewrite_stats = NULL;
+     *      conf->access_stats = NULL;
+     *      conf->content_stats = NULL;
+     *
      *      conf->log_src = {{ 0, NULL }, NULL, NULL, NULL};
      *      conf->log_src_key = NULL
      *      conf->log_handler = NULL;
@@ -596,18 +662,21 @@ ngx_http_lua_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
         conf->rewrite_src = prev->rewrite_src;
         conf->rewrite_handler = prev->rewrite_handler;
         conf->rewrite_src_key = prev->rewrite_src_key;
+        conf->rewrite_stats = prev->rewrite_stats;
     }
 
     if (conf->access_src.value.len == 0) {
         conf->access_src = prev->access_src;
         conf->access_handler = prev->access_handler;
         conf->access_src_key = prev->access_src_key;
+        conf->access_stats = prev->access_stats;
     }
 
     if (conf->content_src.value.len == 0) {
         conf->content_src = prev->content_src;
         conf->content_handler = prev->content_handler;
         conf->content_src_key = prev->content_src_key;
+        conf->content_stats = prev->content_stats;
     }
 
     if (conf->log_src.value.len == 0) {
@@ -15,6 +15,7 @@
 #include "ngx_http_lua_util.h"
 #include "ngx_http_lua_exception.h"
 #include "ngx_http_lua_cache.h"
+#include "ngx_http_lua_stats.h"
 
 
 static ngx_int_t ngx_http_lua_rewrite_by_chunk(lua_State *L,
@@ -303,6 +304,8 @@ ngx_http_lua_rewrite_by_chunk(lua_State *L, ngx_http_request_t *r)
         r->read_event_handler = ngx_http_block_reading;
     }
 
+    ngx_http_lua_stats_invoked(r, ctx);
+
     rc = ngx_http_lua_run_thread(L, r, ctx, 0);
 
     if (rc == NGX_ERROR || rc > NGX_OK) {
@@ -0,0 +1,321 @@
+
+/*
+ * Copyright (C) 2010-2013 Alibaba Group Holding Limited
+ */
+
+
+#ifndef DDEBUG
+#define DDEBUG 0
+#endif
+#include "ddebug.h"
+
+
+#include "ngx_http_lua_stats.h"
+
+
+static uint64_t ngx_http_lua_stats_wall_time(void);
+static uint64_t ngx_http_lua_stats_cpu_time(void);
+static size_t ngx_http_lua_stats_gc_bytes(lua_State *L);
+static ngx_int_t ngx_http_lua_stats_handler(ngx_http_request_t *r);
+static const char *ngx_http_lua_stats_context_name(ngx_uint_t context);
+
+
+ngx_http_lua_stats_t *
+ngx_http_lua_stats_add(ngx_conf_t *cf, ngx_uint_t context)
+{
+    ngx_http_lua_stats_t       *st, **stp;
+    ngx_http_lua_main_conf_t   *lmcf;
+    ngx_http_core_loc_conf_t   *clcf;
+
+    lmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_lua_module);
+
+    if (lmcf->stats == NULL) {
+        lmcf->stats = ngx_array_create(cf->pool, 16,
+                                       sizeof(ngx_http_lua_stats_t *));
+        if (lmcf->stats == NULL) {
+            return NULL;
+        }
+    }
+
+    st = ngx_pcalloc(cf->pool, sizeof(ngx_http_lua_stats_t));
+    if (st == NULL) {
+        return NULL;
+    }
+
+    if (cf->cmd_type & NGX_HTTP_MAIN_CONF) {
+        ngx_str_set(&st->name, "http");
+
+    } else if (cf->cmd_type & NGX_HTTP_SRV_CONF) {
+        ngx_str_set(&st->name, "server");
+
+    } else {
+        clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+        st->name = clcf->name;
+
+        if (st->name.len == 0) {
+            ngx_str_set(&st->name, "if");
+        }
+    }
+
+    st->context = context;
+
+    stp = ngx_array_push(lmcf->stats);
+    if (stp == NULL) {
+        return NULL;
+    }
+
+    *stp = st;
+
+    return st;
+}
+
+
+ngx_http_lua_stats_t *
+ngx_http_lua_stats_get(ngx_http_request_t *r, ngx_http_lua_ctx_t *ctx)
+{
+    ngx_http_lua_loc_conf_t    *llcf;
+    ngx_http_lua_main_conf_t   *lmcf;
+
+    lmcf = ngx_http_get_module_main_conf(r, ngx_http_lua_module);
+
+    if (!lmcf->stats_enabled) {
+        return NULL;
+    }
+
+    llcf = ngx_http_get_module_loc_conf(r, ngx_http_lua_module);
+
+    switch (ctx->context) {
+
+    case NGX_HTTP_LUA_CONTEXT_REWRITE:
+        return llcf->rewrite_stats;
+
+    case NGX_HTTP_LUA_CONTEXT_ACCESS:
+        return llcf->access_stats;
+
+    case NGX_HTTP_LUA_CONTEXT_CONTENT:
+        return llcf->content_stats;
+
+    default:
+        return NULL;
+    }
+}
+
+
+void
+ngx_http_lua_stats_invoked(ngx_http_request_t *r, ngx_http_lua_ctx_t *ctx)
+{
+    ngx_http_lua_stats_t  *st;
+
+    st = ngx_http_lua_stats_get(r, ctx);
+
+    if (st) {
+        st->invocations++;
+    }
+}
+
+
+void
+ngx_http_lua_stats_resume_start(ngx_http_request_t *r,
+    ngx_http_lua_stats_t *st, lua_State *L, ngx_http_lua_stats_snapshot_t *ss)
+{
+    ngx_http_lua_main_conf_t   *lmcf;
+
+    st->resumes++;
+
+    lmcf = ngx_http_get_module_main_conf(r, ngx_http_lua_module);
+
+    if (lmcf->stats_sample_rate > 1
+        && lmcf->stats_ticks++ % lmcf->stats_sample_rate)
+    {
+        ss->sampled = 0;
+        return;
+    }
+
+    ss->sampled = 1;
+    ss->gc_bytes = ngx_http_lua_stats_gc_bytes(L);
+    ss->cpu_time = ngx_http_lua_stats_cpu_time();
+    ss->wall_time = ngx_http_lua_stats_wall_time();
+}
+
+
+void
+ngx_http_lua_stats_resume_done(ngx_http_lua_stats_t *st, lua_State *L,
+    ngx_http_lua_stats_snapshot_t *ss)
+{
+    uint64_t  now;
+    size_t    gc;
+
+    if (!ss->sampled) {
+        return;
+    }
+
+    now = ngx_http_lua_stats_wall_time();
+    if (now > ss->wall_time) {
+        st->wall_time += now - ss->wall_time;
+    }
+
+    now = ngx_http_lua_stats_cpu_time();
+    if (now > ss->cpu_time) {
+        st->cpu_time += now - ss->cpu_time;
+    }
+
+    /* a GC cycle during the resume may shrink the heap, count growth only */
+
+    gc = ngx_http_lua_stats_gc_bytes(L);
+    if (gc > ss->gc_bytes) {
+        st->gc_bytes += gc - ss->gc_bytes;
+    }
+
+    st->sampled++;
+}
+
+
+static uint64_t
+ngx_http_lua_stats_wall_time(void)
+{
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+static uint64_t
+ngx_http_lua_stats_cpu_time(void)
+{
+    struct rusage  ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) == -1) {
+        return 0;
+    }
+
+    return (uint64_t) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000
+           + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+
+static size_t
+ngx_http_lua_stats_gc_bytes(lua_State *L)
+{
+    return (size_t) lua_gc(L, LUA_GCCOUNT, 0) * 1024
+           + lua_gc(L, LUA_GCCOUNTB, 0);
+}
+
+
+static const char *
+ngx_http_lua_stats_context_name(ngx_uint_t context)
+{
+    switch (context) {
+
+    case NGX_HTTP_LUA_CONTEXT_REWRITE:
+        return "rewrite";
+
+    case NGX_HTTP_LUA_CONTEXT_ACCESS:
+        return "access";
+
+    case NGX_HTTP_LUA_CONTEXT_CONTENT:
+        return "content";
+
+    default:
+        return "unknown";
+    }
+}
+
+
+char *
+ngx_http_lua_stats_show(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_lua_stats_handler;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_lua_stats_handler(ngx_http_request_t *r)
+{
+    size_t                      size;
+    ngx_int_t                   rc;
+    ngx_buf_t                  *b;
+    ngx_uint_t                  i;
+    ngx_chain_t                 out;
+    ngx_http_lua_stats_t      **stp, *st;
+    ngx_http_lua_main_conf_t   *lmcf;
+
+    if (r->method != NGX_HTTP_GET && r->method != NGX_HTTP_HEAD) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    lmcf = ngx_http_get_module_main_conf(r, ngx_http_lua_module);
+
+    size = sizeof("pid: \n") + NGX_INT64_LEN
+           + sizeof("sample rate: \n") + NGX_INT_T_LEN
+           + sizeof("location phase invocations resumes sampled "
+                    "wall_us cpu_us gc_bytes\n");
+
+    if (lmcf->stats) {
+        stp = lmcf->stats->elts;
+
+        for (i = 0; i < lmcf->stats->nelts; i++) {
+            size += stp[i]->name.len + sizeof(" content \n")
+                    + 3 * (NGX_ATOMIC_T_LEN + 1) + 3 * (NGX_INT64_LEN + 1);
+        }
+    }
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->last = ngx_sprintf(b->last, "pid: %P\n", ngx_pid);
+    b->last = ngx_sprintf(b->last, "sample rate: %ui\n",
+                          lmcf->stats_sample_rate);
+    b->last = ngx_cpymem(b->last, "location phase invocations resumes sampled "
+                         "wall_us cpu_us gc_bytes\n",
+                         sizeof("location phase invocations resumes sampled "
+                                "wall_us cpu_us gc_bytes\n") - 1);
+
+    if (lmcf->stats) {
+        stp = lmcf->stats->elts;
+
+        for (i = 0; i < lmcf->stats->nelts; i++) {
+            st = stp[i];
+
+            b->last = ngx_sprintf(b->last, "%V %s %ui %ui %ui %uL %uL %uL\n",
+                                  &st->name,
+                                  ngx_http_lua_stats_context_name(st->context),
+                                  st->invocations, st->resumes, st->sampled,
+                                  st->wall_time, st->cpu_time, st->gc_bytes);
+        }
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    b->last_buf = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+/* vi:set ft=c ts=4 sw=4 et fdm=marker: */
@@ -0,0 +1,51 @@
+
+/*
+ * Copyright (C) 2010-2013 Alibaba Group Holding Limited
+ */
+
+
+#ifndef _NGX_HTTP_LUA_STATS_H_INCLUDED_
+#define _NGX_HTTP_LUA_STATS_H_INCLUDED_
+
+
+#include "ngx_http_lua_common.h"
+
+
+struct ngx_http_lua_stats_s {
+    ngx_str_t                name;        /* location name */
+    ngx_uint_t               context;     /* NGX_HTTP_LUA_CONTEXT_* */
+
+    ngx_uint_t               invocations;
+    ngx_uint_t               resumes;
+    ngx_uint_t               sampled;     /* number of timed resumes */
+
+    uint64_t                 wall_time;   /* in microseconds */
+    uint64_t                 cpu_time;    /* in microseconds */
+    uint64_t                 gc_bytes;    /* Lua GC heap growth in bytes */
+};
+
+
+typedef struct {
+    uint64_t                 wall_time;
+    uint64_t                 cpu_time;
+    size_t                   gc_bytes;
+    unsigned                 sampled:1;
+} ngx_http_lua_stats_snapshot_t;
+
+
+ngx_http_lua_stats_t *ngx_http_lua_stats_add(ngx_conf_t *cf,
+    ngx_uint_t context);
+ngx_http_lua_stats_t *ngx_http_lua_stats_get(ngx_http_request_t *r,
+    ngx_http_lua_ctx_t *ctx);
+void ngx_http_lua_stats_invoked(ngx_http_request_t *r,
+    ngx_http_lua_ctx_t *ctx);
+void ngx_http_lua_stats_resume_start(ngx_http_request_t *r,
+    ngx_http_lua_stats_t *st, lua_State *L, ngx_http_lua_stats_snapshot_t *ss);
+void ngx_http_lua_stats_resume_done(ngx_http_lua_stats_t *st, lua_State *L,
+    ngx_http_lua_stats_snapshot_t *ss);
+char *ngx_http_lua_stats_show(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+
+
+#endif /* _NGX_HTTP_LUA_STATS_H_INCLUDED_ */
+
+/* vi:set ft=c ts=4 sw=4 et fdm=marker: */
@@ -58,7 +58,10 @@ static ngx_int_t ngx_http_lua_subrequest_resume(ngx_http_request_t *r);
 static void ngx_http_lua_handle_subreq_responses(ngx_http_request_t *r,
     ngx_http_lua_ctx_t *ctx);
 static void ngx_http_lua_cancel_subreq(ngx_http_request_t *r);
+static void ngx_http_lua_abort_subreq(ngx_http_request_t *r);
 static ngx_int_t ngx_http_post_request_to_head(ngx_http_request_t *r);
+static void ngx_http_lua_subrequest_timeout_handler(ngx_event_t *ev);
+static void ngx_http_lua_subrequest_cleanup(void *data);
 static ngx_int_t ngx_http_lua_copy_in_file_request_body(ngx_http_request_t *r);
 
 
@@ -123,6 +126,8 @@ ngx_http_lua_ngx_location_capture_multi(lua_State *L)
     size_t                           sr_headers_len;
     size_t                           sr_bodies_len;
     unsigned                         custom_ctx;
+    ngx_msec_t                       timeout;
+    ngx_pool_cleanup_t              *cln;
     ngx_http_lua_co_ctx_t           *coctx;
 
     ngx_http_lua_post_subrequest_data_t      *psr_data;
@@ -234,6 +239,8 @@ ngx_http_lua_ngx_location_capture_multi(lua_State *L)
 
         custom_ctx = 0;
 
+        timeout = 0;
+
         if (nargs == 2) {
             /* check out the options table */
 
@@ -369,6 +376,24 @@ ngx_http_lua_ngx_location_capture_multi(lua_State *L)
 
             dd("queries query uri opts: %d", lua_gettop(L));
 
+            /* check the "timeout" option */
+
+            lua_getfield(L, 4, "timeout");
+
+            type = lua_type(L, -1);
+
+            if (type != LUA_TNIL) {
+                if (type != LUA_TNUMBER || lua_tonumber(L, -1) < 0) {
+                    return luaL_error(L, "Bad timeout option value");
+                }
+
+                timeout = (ngx_msec_t) lua_tonumber(L, -1);
+            }
+
+            lua_pop(L, 1);
+
+            dd("queries query uri opts: %d", lua_gettop(L));
+
             /* check the "ctx" option */
 
             lua_getfield(L, 4, "ctx");
@@ -531,6 +556,8 @@ ngx_http_lua_ngx_location_capture_multi(lua_State *L)
         sr_ctx->index = index;
         sr_ctx->last_body = &sr_ctx->body;
 
+        ngx_memzero(psr_data, sizeof(ngx_http_lua_post_subrequest_data_t));
+
         psr_data->ctx = sr_ctx;
         psr_data->pr_co_ctx = coctx;
 
@@ -554,6 +581,24 @@ ngx_http_lua_ngx_location_capture_multi(lua_State *L)
                               (int) rc);
         }
 
+        psr_data->request = sr;
+
+        if (timeout) {
+            cln = ngx_pool_cleanup_add(r->pool, 0);
+            if (cln == NULL) {
+                return luaL_error(L, "out of memory");
+            }
+
+            cln->handler = ngx_http_lua_subrequest_cleanup;
+            cln->data = psr_data;
+
+            psr_data->timeout.handler = ngx_http_lua_subrequest_timeout_handler;
+            psr_data->timeout.data = psr_data;
+            psr_data->timeout.log = r->connection->log;
+
+            ngx_add_timer(&psr_data->timeout, timeout);
+        }
+
         dd("queries query uri opts ctx? %d", lua_gettop(L));
 
         /* stack: queries query uri ctx? */
@@ -891,6 +936,24 @@ ngx_http_lua_post_subrequest(ngx_http_request_t *r, void *data, ngx_int_t rc)
 
     ctx->run_post_subrequest = 1;
 
+    if (psr_data->timeout.timer_set) {
+        ngx_del_timer(&psr_data->timeout);
+    }
+
+    if (psr_data->timedout) {
+        /* the parent coroutine has already got a 504 for us */
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "lua discarding timed out subrequest \"%V\"",
+                       &r->uri);
+
+        if (rc == NGX_ERROR || rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+            return NGX_OK;
+        }
+
+        return rc;
+    }
+
     pr = r->parent;
 
     pr_ctx = ngx_http_get_module_ctx(pr, ngx_http_lua_module);
@@ -1193,6 +1256,12 @@ ngx_http_lua_handle_subreq_responses(ngx_http_request_t *r,
 
         sr_headers = coctx->sr_headers[index];
 
+        if (sr_headers == NULL) {
+            /* the subrequest timed out */
+            lua_setfield(co, -2, "header");
+            continue;
+        }
+
         dd("saving subrequest response headers");
 
         part = &sr_headers->headers.part;
@@ -1549,6 +1618,132 @@ ngx_http_lua_cancel_subreq(ngx_http_request_t *r)
 }
 
 
+static void
+ngx_http_lua_abort_subreq(ngx_http_request_t *r)
+{
+    ngx_uint_t            count;
+    ngx_http_cleanup_t   *cln;
+
+    /*
+     * a background subrequest neither sends its output through the
+     * postpone filter nor wakes up its parent when it is finalized
+     */
+
+    r->background = 1;
+    r->done = 1;
+
+    r->read_event_handler = ngx_http_request_empty_handler;
+    r->write_event_handler = ngx_http_request_empty_handler;
+
+    count = r->main->count;
+
+    for (cln = r->cleanup; cln; cln = cln->next) {
+        if (cln->handler) {
+            cln->handler(cln->data);
+            cln->handler = NULL;
+        }
+    }
+
+    r->cleanup = NULL;
+
+    if (r->main->count == count) {
+        /* none of the cleanup handlers has finalized the subrequest */
+        r->main->count--;
+        r->main->subrequests++;
+    }
+}
+
+
+static void
+ngx_http_lua_subrequest_timeout_handler(ngx_event_t *ev)
+{
+    ngx_connection_t            *c;
+    ngx_http_request_t          *sr, *pr;
+    ngx_http_log_ctx_t          *log_ctx;
+    ngx_http_lua_ctx_t          *ctx, *pr_ctx;
+    ngx_http_lua_co_ctx_t       *pr_coctx;
+
+    ngx_http_lua_post_subrequest_data_t    *psr_data;
+
+    psr_data = ev->data;
+
+    sr = psr_data->request;
+    ctx = psr_data->ctx;
+
+    if (ctx->run_post_subrequest) {
+        return;
+    }
+
+    pr = sr->parent;
+    c = sr->connection;
+
+    pr_ctx = ngx_http_get_module_ctx(pr, ngx_http_lua_module);
+    if (pr_ctx == NULL) {
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                  "lua subrequest \"%V?%V\" timed out", &sr->uri, &sr->args);
+
+    /*
+     * the subrequest is aborted and detached from the connection, so
+     * neither its output nor its finalization hold up the parent
+     */
+
+    psr_data->timedout = 1;
+
+    if (c->data == sr) {
+        c->data = pr;
+    }
+
+    ngx_http_lua_abort_subreq(sr);
+
+    pr_coctx = psr_data->pr_co_ctx;
+
+    pr_coctx->sr_statuses[ctx->index] = NGX_HTTP_GATEWAY_TIME_OUT;
+    pr_coctx->sr_headers[ctx->index] = NULL;
+    pr_coctx->sr_bodies[ctx->index].len = 0;
+    pr_coctx->sr_bodies[ctx->index].data = NULL;
+
+    pr_coctx->pending_subreqs--;
+
+    if (pr_coctx->pending_subreqs) {
+        return;
+    }
+
+    dd("all subrequests are done or timed out");
+
+    log_ctx = c->log->data;
+    log_ctx->current_request = pr;
+
+    c->data = pr;
+
+    pr_ctx->no_abort = 0;
+    pr_ctx->cur_co_ctx = pr_coctx;
+
+    if (pr_ctx->entered_content_phase) {
+        (void) ngx_http_lua_subrequest_resume(pr);
+
+    } else {
+        pr_ctx->resume_handler = ngx_http_lua_subrequest_resume;
+        ngx_http_core_run_phases(pr);
+    }
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static void
+ngx_http_lua_subrequest_cleanup(void *data)
+{
+    ngx_http_lua_post_subrequest_data_t    *psr_data = data;
+
+    if (psr_data->timeout.timer_set) {
+        ngx_del_timer(&psr_data->timeout);
+    }
+}
+
+
 static ngx_int_t
 ngx_http_post_request_to_head(ngx_http_request_t *r)
 {
@@ -29,6 +29,12 @@ typedef struct ngx_http_lua_post_subrequest_data_s {
     ngx_http_lua_ctx_t          *ctx;
     ngx_http_lua_co_ctx_t       *pr_co_ctx;
 
+    ngx_http_request_t          *request;  /* the subrequest itself */
+    ngx_event_t                  timeout;  /* for the "timeout" option */
+
+    unsigned                     timedout:1; /* the parent coroutine has
+                                                stopped waiting for this
+                                                subrequest */
 } ngx_http_lua_post_subrequest_data_t;
 
 
@@ -45,6 +45,7 @@
 #include "ngx_http_lua_probe.h"
 #include "ngx_http_lua_uthread.h"
 #include "ngx_http_lua_contentby.h"
+#include "ngx_http_lua_stats.h"
 
 
 #if 1
@@ -54,6 +55,7 @@
 
 
 char ngx_http_lua_code_cache_key;
+char ngx_http_lua_code_cache_path_key;
 char ngx_http_lua_ctx_tables_key;
 char ngx_http_lua_regex_cache_key;
 char ngx_http_lua_socket_pool_key;
@@ -683,6 +685,8 @@ send:
 static void
 ngx_http_lua_init_registry(ngx_conf_t *cf, lua_State *L)
 {
+    ngx_http_lua_main_conf_t    *lmcf;
+
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0,
                    "lua initializing lua registry");
 
@@ -717,6 +721,15 @@ ngx_http_lua_init_registry(ngx_conf_t *cf, lua_State *L)
     lua_rawset(L, LUA_REGISTRYINDEX);
     /* }}} */
 
+    lmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_lua_module);
+
+    if (lmcf->code_cache_path.len) {
+        lua_pushlightuserdata(L, &ngx_http_lua_code_cache_path_key);
+        lua_pushlstring(L, (char *) lmcf->code_cache_path.data,
+                        lmcf->code_cache_path.len);
+        lua_rawset(L, LUA_REGISTRYINDEX);
+    }
+
     lua_pushlightuserdata(L, &ngx_http_lua_cf_log_key);
     lua_pushlightuserdata(L, cf->log);
     lua_rawset(L, LUA_REGISTRYINDEX);
@@ -976,10 +989,13 @@ ngx_http_lua_run_thread(lua_State *L, ngx_http_request_t *r,
     lua_State               *old_co;
     const char              *err, *msg, *trace;
     ngx_int_t                rc;
+    ngx_http_lua_stats_t    *st;
 #if (NGX_PCRE)
     ngx_pool_t              *old_pool = NULL;
 #endif
 
+    ngx_http_lua_stats_snapshot_t  ss;
+
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "lua run thread, top:%d c:%ud", lua_gettop(L),
                    r->main->count);
@@ -989,6 +1005,8 @@ ngx_http_lua_run_thread(lua_State *L, ngx_http_request_t *r,
 
     dd("ctx = %p", ctx);
 
+    st = ngx_http_lua_stats_get(r, ctx);
+
     NGX_LUA_EXCEPTION_TRY {
 
         if (ctx->cur_co_ctx->thread_spawn_yielded) {
@@ -1016,8 +1034,17 @@ ngx_http_lua_run_thread(lua_State *L, ngx_http_request_t *r,
             dd("cur co: %p", ctx->cur_co_ctx->co);
 
             orig_coctx = ctx->cur_co_ctx;
+
+            if (st) {
+                ngx_http_lua_stats_resume_start(r, st, L, &ss);
+            }
+
             rv = lua_resume(orig_coctx->co, nrets);
 
+            if (st) {
+                ngx_http_lua_stats_resume_done(st, L, &ss);
+            }
+
 #if (NGX_PCRE)
             /* XXX: work-around to nginx regex subsystem */
             ngx_http_lua_pcre_malloc_done(old_pool);
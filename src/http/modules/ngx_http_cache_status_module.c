@@ -0,0 +1,228 @@
+
+/*
+ * Copyright (C) 2010-2013 Alibaba Group Holding Limited
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_CACHE_STATUS_ZONE_LEN                                       \
+    (1024 + 24 * NGX_ATOMIC_T_LEN + 2 * NGX_OFF_T_LEN                          \
+     + NGX_HTTP_CACHE_NSTATUS * (64 + 2 * NGX_ATOMIC_T_LEN)                    \
+     + NGX_HTTP_CACHE_READ_BUCKETS * (16 + NGX_ATOMIC_T_LEN))
+
+#define NGX_HTTP_CACHE_STATUS_SHARD_LEN                                      \
+    (96 + 4 * NGX_ATOMIC_T_LEN)
+
+
+static size_t ngx_http_cache_status_size(ngx_http_request_t *r);
+static u_char *ngx_http_cache_status_write(ngx_http_request_t *r, u_char *p,
+    u_char *last);
+static u_char *ngx_http_cache_status_zone(u_char *p, u_char *last,
+    ngx_http_file_cache_t *cache);
+static char *ngx_http_set_cache_status(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_cache_status_commands[] = {
+
+    { ngx_string("cache_status"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_set_cache_status,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_cache_status_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_cache_status_module = {
+    NGX_MODULE_V1,
+    &ngx_http_cache_status_module_ctx,     /* module context */
+    ngx_http_cache_status_commands,        /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_cache_status_handler(ngx_http_request_t *r)
+{
+    return ngx_http_send_json(r, ngx_http_cache_status_size,
+                              ngx_http_cache_status_write);
+}
+
+
+static size_t
+ngx_http_cache_status_size(ngx_http_request_t *r)
+{
+    size_t                          size;
+    ngx_uint_t                      i;
+    ngx_http_file_cache_t         **caches;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+
+    caches = umcf->caches.elts;
+
+    size = sizeof("{\"caches\": {\n}}\n");
+
+    for (i = 0; i < umcf->caches.nelts; i++) {
+        size += caches[i]->shm_zone->shm.name.len
+                + NGX_HTTP_CACHE_STATUS_ZONE_LEN
+                + caches[i]->sh->nshards * NGX_HTTP_CACHE_STATUS_SHARD_LEN;
+    }
+
+    return size;
+}
+
+
+static u_char *
+ngx_http_cache_status_write(ngx_http_request_t *r, u_char *p, u_char *last)
+{
+    ngx_uint_t                      i;
+    ngx_http_file_cache_t         **caches;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+
+    caches = umcf->caches.elts;
+
+    p = ngx_cpymem(p, "{\"caches\": {\n", sizeof("{\"caches\": {\n") - 1);
+
+    for (i = 0; i < umcf->caches.nelts; i++) {
+        p = ngx_http_cache_status_zone(p, last, caches[i]);
+
+        if (i != umcf->caches.nelts - 1) {
+            *p++ = ',';
+        }
+
+        *p++ = '\n';
+    }
+
+    return ngx_cpymem(p, "}}\n", sizeof("}}\n") - 1);
+}
+
+
+static u_char *
+ngx_http_cache_status_zone(u_char *p, u_char *last,
+    ngx_http_file_cache_t *cache)
+{
+    ngx_uint_t                     i;
+    ngx_http_file_cache_sh_t      *sh;
+    ngx_http_file_cache_shard_t   *shard;
+    ngx_http_file_cache_mem_sh_t  *mem;
+
+    sh = cache->sh;
+
+    /* sizes are kept in file system blocks, "max_size" is 0 if unlimited */
+
+    p = ngx_slprintf(p, last,
+                     "  \"%V\": {\n"
+                     "    \"size\": %O,\n"
+                     "    \"max_size\": %O,\n"
+                     "    \"cold\": %uA,\n"
+                     "    \"loaded\": %uA,\n"
+                     "    \"lookups\": {\"hits\": %uA, \"misses\": %uA},\n"
+                     "    \"hit_bytes\": %uA,\n"
+                     "    \"miss_bytes\": %uA,\n"
+                     "    \"manager\": {\"expired\": %uA, \"evicted\": %uA},\n"
+                     "    \"responses\": {",
+                     &cache->shm_zone->shm.name,
+                     (off_t) sh->size * cache->bsize,
+                     cache->max_size == NGX_MAX_OFF_T_VALUE
+                                        / (off_t) cache->bsize
+                         ? 0 : cache->max_size * (off_t) cache->bsize,
+                     sh->cold, sh->loaded, sh->hits, sh->misses,
+                     sh->hit_bytes, sh->miss_bytes,
+                     sh->expired, sh->evicted);
+
+    for (i = 1; i < NGX_HTTP_CACHE_NSTATUS; i++) {
+        p = ngx_slprintf(p, last,
+                         "%s\"%V\": {\"requests\": %uA, \"bytes\": %uA}",
+                         i == 1 ? "" : ", ",
+                         &ngx_http_cache_status[i - 1],
+                         sh->requests[i], sh->bytes[i]);
+    }
+
+    /* the upper bound of each bucket in microseconds */
+
+    p = ngx_slprintf(p, last, "},\n    \"read_usec\": {");
+
+    for (i = 0; i < NGX_HTTP_CACHE_READ_BUCKETS; i++) {
+
+        if (ngx_http_cache_read_usec[i]) {
+            p = ngx_slprintf(p, last, "\"%ui\": %uA, ",
+                             ngx_http_cache_read_usec[i], sh->reads[i]);
+
+        } else {
+            p = ngx_slprintf(p, last, "\"inf\": %uA", sh->reads[i]);
+        }
+    }
+
+    p = ngx_slprintf(p, last, "},\n    \"shards\": [");
+
+    for (i = 0; i < sh->nshards; i++) {
+        shard = &sh->shards[i];
+
+        p = ngx_slprintf(p, last,
+                         "%s{\"locks\": %uA, \"contended\": %uA, "
+                         "\"hold_usec\": %uA, \"max_hold_usec\": %uA}",
+                         i == 0 ? "" : ", ",
+                         shard->locks, shard->contended,
+                         shard->hold_usec, shard->max_hold_usec);
+    }
+
+    p = ngx_slprintf(p, last, "]");
+
+    mem = cache->mem;
+
+    if (mem) {
+        p = ngx_slprintf(p, last,
+                         ",\n    \"memory\": {\"size\": %uz, \"hits\": %uA, "
+                         "\"misses\": %uA, \"stores\": %uA, "
+                         "\"evictions\": %uA}",
+                         mem->size, mem->hits, mem->misses,
+                         mem->stores, mem->evictions);
+    }
+
+    return ngx_slprintf(p, last, "\n  }");
+}
+
+
+static char *
+ngx_http_set_cache_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_cache_status_handler;
+
+    return NGX_CONF_OK;
+}
@@ -92,6 +92,9 @@ typedef struct {
 #define NGX_HTTP_FASTCGI_STDOUT         6
 #define NGX_HTTP_FASTCGI_STDERR         7
 #define NGX_HTTP_FASTCGI_DATA           8
+#define NGX_HTTP_FASTCGI_GET_VALUES     9
+#define NGX_HTTP_FASTCGI_GET_VALUES_RESULT  10
+#define NGX_HTTP_FASTCGI_UNKNOWN_TYPE   11
 
 
 typedef struct {
@@ -129,6 +132,133 @@ typedef struct {
 } ngx_http_fastcgi_request_start_t;
 
 
+/*
+ * A multiplexed connection carries the requests of several clients at
+ * once, each of them with a FastCGI request id of its own.  Every request
+ * is given a virtual connection: the records it sends are tagged with its
+ * request id, and the records received for this id are passed to it with
+ * the request id 1, so the rest of the module is not aware of sharing.
+ *
+ * Whether an application multiplexes requests is asked with FCGI_GET_VALUES
+ * once a connection is established.  Until it is answered, and for the
+ * applications which do not multiplex requests, a connection is used
+ * by one request at a time, but it is kept open between the requests.
+ *
+ * FastCGI has no flow control for a request, so a multiplexed connection
+ * is never paused for a request which does not read its response: instead,
+ * the request is aborted once 1m of its response is buffered.
+ */
+
+#define NGX_HTTP_FASTCGI_MUX_CHUNK      8192
+#define NGX_HTTP_FASTCGI_MUX_BUSY       65536
+#define NGX_HTTP_FASTCGI_MUX_BUFFERED   1048576
+#define NGX_HTTP_FASTCGI_MUX_ABORTED    ((ngx_http_fastcgi_mux_stream_t *) -1)
+
+
+typedef struct ngx_http_fastcgi_mux_s         ngx_http_fastcgi_mux_t;
+typedef struct ngx_http_fastcgi_mux_stream_s  ngx_http_fastcgi_mux_stream_t;
+
+
+typedef struct {
+    ngx_uint_t                     connections;
+    ngx_uint_t                     requests;
+    ngx_msec_t                     timeout;
+
+    ngx_queue_t                    peers;        /* local to a process */
+
+    ngx_http_upstream_init_pt      original_init_upstream;
+    ngx_http_upstream_init_peer_pt original_init_peer;
+} ngx_http_fastcgi_srv_conf_t;
+
+
+typedef struct {
+    ngx_queue_t                    queue;
+    ngx_queue_t                    conns;
+    ngx_uint_t                     nconns;
+
+    struct sockaddr               *sockaddr;
+    socklen_t                      socklen;
+    ngx_str_t                      name;
+} ngx_http_fastcgi_mux_peer_t;
+
+
+typedef struct {
+    ngx_chain_t                   *head;
+    ngx_chain_t                   *tail;
+    size_t                         size;
+} ngx_http_fastcgi_mux_queue_t;
+
+
+struct ngx_http_fastcgi_mux_s {
+    ngx_queue_t                    queue;
+    ngx_peer_connection_t          peer;
+    ngx_http_fastcgi_srv_conf_t   *conf;
+    ngx_http_fastcgi_mux_peer_t   *mux_peer;
+
+    ngx_msec_t                     connect_timeout;
+    ngx_msec_t                     send_timeout;
+    ngx_msec_t                     read_timeout;
+
+    ngx_http_fastcgi_mux_stream_t **streams;
+    ngx_uint_t                     active;
+    ngx_uint_t                     capacity;
+
+    ngx_http_fastcgi_mux_queue_t   out;
+    ngx_queue_t                    waiting;
+    ngx_event_t                    flush;
+
+    u_char                         header[8];
+    ngx_uint_t                     hlen;
+    ngx_uint_t                     type;
+    ngx_uint_t                     id;
+    size_t                         rest;
+    ngx_http_fastcgi_mux_stream_t *stream;
+
+    u_char                         values[256];
+    size_t                         nvalues;
+
+    unsigned                       connected:1;
+    unsigned                       multiplexed:1;
+    unsigned                       blocked:1;
+};
+
+
+struct ngx_http_fastcgi_mux_stream_s {
+    ngx_connection_t               connection;
+    ngx_event_t                    read;
+    ngx_event_t                    write;
+
+    ngx_http_fastcgi_mux_t        *mux;
+    ngx_uint_t                     id;
+    ngx_queue_t                    queue;
+
+    ngx_http_fastcgi_mux_queue_t   in;
+
+    u_char                         header[8];
+    ngx_uint_t                     hlen;
+    ngx_uint_t                     type;
+    size_t                         rest;
+    size_t                         offset;
+
+    unsigned                       begun:1;
+    unsigned                       waiting:1;
+    unsigned                       eof:1;
+    unsigned                       error:1;
+};
+
+
+typedef struct {
+    ngx_http_fastcgi_srv_conf_t   *conf;
+    ngx_http_request_t            *request;
+    ngx_http_fastcgi_mux_stream_t *stream;
+
+    void                          *data;
+
+    ngx_event_get_peer_pt          original_get_peer;
+    ngx_event_free_peer_pt         original_free_peer;
+} ngx_http_fastcgi_mux_peer_data_t;
+
+
 static ngx_int_t ngx_http_fastcgi_eval(ngx_http_request_t *r,
     ngx_http_fastcgi_loc_conf_t *flcf);
 #if (NGX_HTTP_CACHE)
@@ -150,6 +280,7 @@ static void ngx_http_fastcgi_finalize_request(ngx_http_request_t *r,
     ngx_int_t rc);
 
 static ngx_int_t ngx_http_fastcgi_add_variables(ngx_conf_t *cf);
+static void *ngx_http_fastcgi_create_srv_conf(ngx_conf_t *cf);
 static void *ngx_http_fastcgi_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_fastcgi_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
@@ -176,9 +307,54 @@ static char *ngx_http_fastcgi_cache_key(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 #endif
 
+static char *ngx_http_fastcgi_multiplex(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
 static char *ngx_http_fastcgi_lowat_check(ngx_conf_t *cf, void *post,
     void *data);
 
+static ngx_int_t ngx_http_fastcgi_mux_init(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_fastcgi_mux_init_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_fastcgi_mux_get_peer(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_fastcgi_mux_free_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static ngx_http_fastcgi_mux_peer_t *ngx_http_fastcgi_mux_find_peer(
+    ngx_http_fastcgi_srv_conf_t *fscf, ngx_peer_connection_t *pc);
+static ngx_http_fastcgi_mux_t *ngx_http_fastcgi_mux_connect(
+    ngx_http_fastcgi_mux_peer_data_t *mp, ngx_http_fastcgi_mux_peer_t *peer,
+    ngx_peer_connection_t *pc);
+static ngx_http_fastcgi_mux_stream_t *ngx_http_fastcgi_mux_attach(
+    ngx_http_fastcgi_mux_t *mux, ngx_http_request_t *r);
+static void ngx_http_fastcgi_mux_detach(ngx_http_fastcgi_mux_stream_t *s);
+static ngx_int_t ngx_http_fastcgi_mux_abort(ngx_http_fastcgi_mux_stream_t *s);
+static void ngx_http_fastcgi_mux_flush_handler(ngx_event_t *ev);
+static void ngx_http_fastcgi_mux_write_handler(ngx_event_t *wev);
+static void ngx_http_fastcgi_mux_read_handler(ngx_event_t *rev);
+static ngx_int_t ngx_http_fastcgi_mux_send(ngx_http_fastcgi_mux_t *mux);
+static ngx_int_t ngx_http_fastcgi_mux_parse(ngx_http_fastcgi_mux_t *mux,
+    u_char *p, u_char *last);
+static ngx_int_t ngx_http_fastcgi_mux_end_record(ngx_http_fastcgi_mux_t *mux);
+static void ngx_http_fastcgi_mux_values(ngx_http_fastcgi_mux_t *mux);
+static ngx_int_t ngx_http_fastcgi_mux_write(ngx_http_fastcgi_mux_stream_t *s,
+    u_char *p, size_t size);
+static void ngx_http_fastcgi_mux_idle(ngx_http_fastcgi_mux_t *mux);
+static void ngx_http_fastcgi_mux_close(ngx_http_fastcgi_mux_t *mux);
+static ngx_int_t ngx_http_fastcgi_mux_append(ngx_http_fastcgi_mux_queue_t *q,
+    u_char *p, size_t size);
+static void ngx_http_fastcgi_mux_free_chunks(ngx_http_fastcgi_mux_queue_t *q,
+    ngx_uint_t all);
+static ssize_t ngx_http_fastcgi_mux_recv(ngx_connection_t *c, u_char *buf,
+    size_t size);
+static ssize_t ngx_http_fastcgi_mux_recv_chain(ngx_connection_t *c,
+    ngx_chain_t *in);
+static ssize_t ngx_http_fastcgi_mux_send_buf(ngx_connection_t *c, u_char *buf,
+    size_t size);
+static ngx_chain_t *ngx_http_fastcgi_mux_send_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+
 
 static ngx_conf_post_t  ngx_http_fastcgi_lowat_post =
     { ngx_http_fastcgi_lowat_check };
@@ -258,6 +434,13 @@ static ngx_command_t  ngx_http_fastcgi_commands[] = {
       offsetof(ngx_http_fastcgi_loc_conf_t, upstream.local),
       NULL },
 
+    { ngx_string("fastcgi_hedge"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      ngx_http_upstream_hedge_set_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_fastcgi_loc_conf_t, upstream.hedge),
+      NULL },
+
     { ngx_string("fastcgi_connect_timeout"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_msec_slot,
@@ -321,6 +504,13 @@ static ngx_command_t  ngx_http_fastcgi_commands[] = {
       offsetof(ngx_http_fastcgi_loc_conf_t, upstream.bufs),
       NULL },
 
+    { ngx_string("fastcgi_adaptive_buffers"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_fastcgi_loc_conf_t, upstream.adaptive_buffers),
+      NULL },
+
     { ngx_string("fastcgi_busy_buffers_size"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_size_slot,
@@ -407,6 +597,41 @@ static ngx_command_t  ngx_http_fastcgi_commands[] = {
       offsetof(ngx_http_fastcgi_loc_conf_t, upstream.cache_lock_timeout),
       NULL },
 
+    { ngx_string("fastcgi_cache_collapse"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_fastcgi_loc_conf_t, upstream.cache_collapse),
+      &ngx_http_upstream_cache_collapse },
+
+    { ngx_string("fastcgi_cache_revalidate"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_fastcgi_loc_conf_t, upstream.cache_revalidate),
+      NULL },
+
+    { ngx_string("fastcgi_cache_background_update"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_fastcgi_loc_conf_t, upstream.cache_background_update),
+      NULL },
+
+    { ngx_string("fastcgi_cache_purge"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_set_predicate_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_fastcgi_loc_conf_t, upstream.cache_purge),
+      NULL },
+
+    { ngx_string("fastcgi_cache_tag"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_set_complex_value_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_fastcgi_loc_conf_t, upstream.cache_tag),
+      NULL },
+
 #endif
 
     { ngx_string("fastcgi_temp_path"),
@@ -486,6 +711,13 @@ static ngx_command_t  ngx_http_fastcgi_commands[] = {
       offsetof(ngx_http_fastcgi_loc_conf_t, keep_conn),
       NULL },
 
+    { ngx_string("fastcgi_multiplex"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_1MORE,
+      ngx_http_fastcgi_multiplex,
+      0,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -497,7 +729,7 @@ static ngx_http_module_t  ngx_http_fastcgi_module_ctx = {
     NULL,                                  /* create main configuration */
     NULL,                                  /* init main configuration */
 
-    NULL,                                  /* create server configuration */
+    ngx_http_fastcgi_create_srv_conf,      /* create server configuration */
     NULL,                                  /* merge server configuration */
 
     ngx_http_fastcgi_create_loc_conf,      /* create location configuration */
@@ -572,9 +804,11 @@ static ngx_str_t  ngx_http_fastcgi_hide_headers[] = {
 #if (NGX_HTTP_CACHE)
 
 static ngx_keyval_t  ngx_http_fastcgi_cache_headers[] = {
-    { ngx_string("HTTP_IF_MODIFIED_SINCE"), ngx_string("") },
+    { ngx_string("HTTP_IF_MODIFIED_SINCE"),
+      ngx_string("$upstream_cache_last_modified") },
     { ngx_string("HTTP_IF_UNMODIFIED_SINCE"), ngx_string("") },
-    { ngx_string("HTTP_IF_NONE_MATCH"), ngx_string("") },
+    { ngx_string("HTTP_IF_NONE_MATCH"),
+      ngx_string("$upstream_cache_etag") },
     { ngx_string("HTTP_IF_MATCH"), ngx_string("") },
     { ngx_string("HTTP_RANGE"), ngx_string("") },
     { ngx_string("HTTP_IF_RANGE"), ngx_string("") },
@@ -1444,12 +1678,9 @@ ngx_http_fastcgi_process_header(ngx_http_request_t *r)
     ngx_http_upstream_header_t     *hh;
     ngx_http_fastcgi_loc_conf_t    *flcf;
     ngx_http_fastcgi_split_part_t  *part;
-    ngx_http_upstream_main_conf_t  *umcf;
 
     f = ngx_http_get_module_ctx(r, ngx_http_fastcgi_module);
 
-    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
-
     u = r->upstream;
 
     for ( ;; ) {
@@ -1746,7 +1977,7 @@ ngx_http_fastcgi_process_header(ngx_http_request_t *r)
                     ngx_strlow(h->lowcase_key, h->key.data, h->key.len);
                 }
 
-                hh = ngx_hash_find(&umcf->headers_in_hash, h->hash,
+                hh = ngx_hash_find(&u->conf->hide_headers_hash, h->hash,
                                    h->lowcase_key, h->key.len);
 
                 if (hh && hh->handler(r, h, hh->offset) != NGX_OK) {
@@ -2266,194 +2497,1671 @@ ngx_http_fastcgi_finalize_request(ngx_http_request_t *r, ngx_int_t rc)
 }
 
 
+static u_char  ngx_http_fastcgi_mux_get_values[] =
+    "\x01\x09\x00\x00\x00\x20\x00\x00"
+    "\x0f\x00" "FCGI_MPXS_CONNS"
+    "\x0d\x00" "FCGI_MAX_REQS";
+
+
+static u_char  ngx_http_fastcgi_mux_buffer[16384];
+
+
 static ngx_int_t
-ngx_http_fastcgi_add_variables(ngx_conf_t *cf)
+ngx_http_fastcgi_mux_init(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
 {
-   ngx_http_variable_t  *var, *v;
+    ngx_http_fastcgi_srv_conf_t  *fscf;
 
-    for (v = ngx_http_fastcgi_vars; v->name.len; v++) {
-        var = ngx_http_add_variable(cf, &v->name, v->flags);
-        if (var == NULL) {
-            return NGX_ERROR;
-        }
+    fscf = ngx_http_conf_upstream_srv_conf(us, ngx_http_fastcgi_module);
 
-        var->get_handler = v->get_handler;
-        var->data = v->data;
+    if (fscf->original_init_upstream(cf, us) != NGX_OK) {
+        return NGX_ERROR;
     }
 
+    fscf->original_init_peer = us->peer.init;
+
+    us->peer.init = ngx_http_fastcgi_mux_init_peer;
+
+    ngx_queue_init(&fscf->peers);
+
     return NGX_OK;
 }
 
 
-static void *
-ngx_http_fastcgi_create_loc_conf(ngx_conf_t *cf)
+static ngx_int_t
+ngx_http_fastcgi_mux_init_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
 {
-    ngx_http_fastcgi_loc_conf_t  *conf;
+    ngx_http_upstream_t               *u;
+    ngx_http_fastcgi_srv_conf_t       *fscf;
+    ngx_http_fastcgi_mux_peer_data_t  *mp;
 
-    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_fastcgi_loc_conf_t));
-    if (conf == NULL) {
-        return NULL;
+    fscf = ngx_http_conf_upstream_srv_conf(us, ngx_http_fastcgi_module);
+
+    if (fscf->original_init_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
     }
 
+    u = r->upstream;
+
     /*
-     * set by ngx_pcalloc():
-     *
-     *     conf->upstream.bufs.num = 0;
-     *     conf->upstream.ignore_headers = 0;
-     *     conf->upstream.next_upstream = 0;
-     *     conf->upstream.cache_use_stale = 0;
-     *     conf->upstream.cache_methods = 0;
-     *     conf->upstream.temp_path = NULL;
-     *     conf->upstream.hide_headers_hash = { NULL, 0 };
-     *     conf->upstream.uri = { 0, NULL };
-     *     conf->upstream.location = NULL;
-     *     conf->upstream.store_lengths = NULL;
-     *     conf->upstream.store_values = NULL;
-     *
-     *     conf->index.len = { 0, NULL };
+     * the virtual connections are never added to the event module,
+     * so the event methods without edge-triggered notifications are
+     * not supported
      */
 
-    conf->upstream.store = NGX_CONF_UNSET;
-    conf->upstream.store_access = NGX_CONF_UNSET_UINT;
-    conf->upstream.request_buffering = NGX_CONF_UNSET;
-    conf->upstream.buffering = NGX_CONF_UNSET;
-    conf->upstream.ignore_client_abort = NGX_CONF_UNSET;
+    if (u->output.tag != (ngx_buf_tag_t) &ngx_http_fastcgi_module
+        || !(ngx_event_flags & NGX_USE_CLEAR_EVENT))
+    {
+        return NGX_OK;
+    }
 
-    conf->upstream.local = NGX_CONF_UNSET_PTR;
+    mp = ngx_palloc(r->pool, sizeof(ngx_http_fastcgi_mux_peer_data_t));
+    if (mp == NULL) {
+        return NGX_ERROR;
+    }
 
-    conf->upstream.connect_timeout = NGX_CONF_UNSET_MSEC;
-    conf->upstream.send_timeout = NGX_CONF_UNSET_MSEC;
-    conf->upstream.read_timeout = NGX_CONF_UNSET_MSEC;
+    mp->conf = fscf;
+    mp->request = r;
+    mp->stream = NULL;
 
-    conf->upstream.send_lowat = NGX_CONF_UNSET_SIZE;
-    conf->upstream.buffer_size = NGX_CONF_UNSET_SIZE;
+    mp->data = u->peer.data;
+    mp->original_get_peer = u->peer.get;
+    mp->original_free_peer = u->peer.free;
 
-    conf->upstream.busy_buffers_size_conf = NGX_CONF_UNSET_SIZE;
-    conf->upstream.max_temp_file_size_conf = NGX_CONF_UNSET_SIZE;
-    conf->upstream.temp_file_write_size_conf = NGX_CONF_UNSET_SIZE;
+    u->peer.data = mp;
+    u->peer.get = ngx_http_fastcgi_mux_get_peer;
+    u->peer.free = ngx_http_fastcgi_mux_free_peer;
 
-    conf->upstream.upstream_tries = NGX_CONF_UNSET_UINT;
+    return NGX_OK;
+}
 
-    conf->upstream.pass_request_headers = NGX_CONF_UNSET;
-    conf->upstream.pass_request_body = NGX_CONF_UNSET;
 
-#if (NGX_HTTP_CACHE)
-    conf->upstream.cache = NGX_CONF_UNSET_PTR;
-    conf->upstream.cache_min_uses = NGX_CONF_UNSET_UINT;
-    conf->upstream.cache_bypass = NGX_CONF_UNSET_PTR;
-    conf->upstream.no_cache = NGX_CONF_UNSET_PTR;
-    conf->upstream.cache_valid = NGX_CONF_UNSET_PTR;
-    conf->upstream.cache_lock = NGX_CONF_UNSET;
-    conf->upstream.cache_lock_timeout = NGX_CONF_UNSET_MSEC;
-#endif
+static ngx_int_t
+ngx_http_fastcgi_mux_get_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_fastcgi_mux_peer_data_t  *mp = data;
 
-    conf->upstream.hide_headers = NGX_CONF_UNSET_PTR;
-    conf->upstream.pass_headers = NGX_CONF_UNSET_PTR;
+    ngx_int_t                       rc;
+    ngx_queue_t                    *q;
+    ngx_http_fastcgi_mux_t         *mux, *m;
+    ngx_http_fastcgi_mux_peer_t    *peer;
+    ngx_http_fastcgi_mux_stream_t  *s;
 
-    conf->upstream.intercept_errors = NGX_CONF_UNSET;
+    rc = mp->original_get_peer(pc, mp->data);
 
-    /* "fastcgi_cyclic_temp_file" is disabled */
-    conf->upstream.cyclic_temp_file = 0;
+    if (rc != NGX_OK) {
+        return rc;
+    }
 
-    conf->catch_stderr = NGX_CONF_UNSET_PTR;
+    peer = ngx_http_fastcgi_mux_find_peer(mp->conf, pc);
+    if (peer == NULL) {
+        return NGX_ERROR;
+    }
 
-    conf->keep_conn = NGX_CONF_UNSET;
+    mux = NULL;
 
-    ngx_str_set(&conf->upstream.module, "fastcgi");
+    for (q = ngx_queue_head(&peer->conns);
+         q != ngx_queue_sentinel(&peer->conns);
+         q = ngx_queue_next(q))
+    {
+        m = ngx_queue_data(q, ngx_http_fastcgi_mux_t, queue);
 
-    return conf;
-}
+        if (m->active < m->capacity) {
+            mux = m;
+            break;
+        }
+    }
 
+    if (mux == NULL) {
 
-static char *
-ngx_http_fastcgi_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
-{
-    ngx_http_fastcgi_loc_conf_t *prev = parent;
-    ngx_http_fastcgi_loc_conf_t *conf = child;
+        if (peer->nconns == mp->conf->connections) {
 
-    size_t                        size;
-    ngx_hash_init_t               hash;
-    ngx_http_core_loc_conf_t     *clcf;
+            /* all the connections are busy, a connection of its own is used */
 
-    if (conf->upstream.store != 0) {
-        ngx_conf_merge_value(conf->upstream.store,
-                              prev->upstream.store, 0);
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                           "fastcgi multiplex busy %V", &peer->name);
 
-        if (conf->upstream.store_lengths == NULL) {
-            conf->upstream.store_lengths = prev->upstream.store_lengths;
-            conf->upstream.store_values = prev->upstream.store_values;
+            return NGX_OK;
         }
-    }
-
-    ngx_conf_merge_uint_value(conf->upstream.store_access,
-                              prev->upstream.store_access, 0600);
 
-    ngx_conf_merge_value(conf->upstream.request_buffering,
-                         prev->upstream.request_buffering, 1);
+        mux = ngx_http_fastcgi_mux_connect(mp, peer, pc);
+        if (mux == NULL) {
+            return NGX_DECLINED;
+        }
+    }
 
-    ngx_conf_merge_value(conf->upstream.buffering,
-                              prev->upstream.buffering, 1);
+    s = ngx_http_fastcgi_mux_attach(mux, mp->request);
+    if (s == NULL) {
+        return NGX_ERROR;
+    }
 
-    ngx_conf_merge_value(conf->upstream.ignore_client_abort,
-                              prev->upstream.ignore_client_abort, 0);
+    mp->stream = s;
 
-    ngx_conf_merge_ptr_value(conf->upstream.local,
-                              prev->upstream.local, NULL);
+    pc->connection = &s->connection;
 
-    ngx_conf_merge_msec_value(conf->upstream.connect_timeout,
-                              prev->upstream.connect_timeout, 60000);
+    return NGX_DONE;
+}
 
-    ngx_conf_merge_msec_value(conf->upstream.send_timeout,
-                              prev->upstream.send_timeout, 60000);
 
-    ngx_conf_merge_msec_value(conf->upstream.read_timeout,
-                              prev->upstream.read_timeout, 60000);
+static void
+ngx_http_fastcgi_mux_free_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_fastcgi_mux_peer_data_t  *mp = data;
 
-    ngx_conf_merge_size_value(conf->upstream.send_lowat,
-                              prev->upstream.send_lowat, 0);
+    ngx_http_fastcgi_mux_stream_t  *s;
 
-    ngx_conf_merge_size_value(conf->upstream.buffer_size,
-                              prev->upstream.buffer_size,
-                              (size_t) ngx_pagesize);
+    s = mp->stream;
 
+    if (s) {
+        mp->stream = NULL;
 
-    ngx_conf_merge_bufs_value(conf->upstream.bufs, prev->upstream.bufs,
-                              8, ngx_pagesize);
+        if (pc->connection == &s->connection) {
+            pc->connection = NULL;
+        }
 
-    if (conf->upstream.bufs.num < 2) {
-        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                           "there must be at least 2 \"fastcgi_buffers\"");
-        return NGX_CONF_ERROR;
+        ngx_http_fastcgi_mux_detach(s);
     }
 
+    mp->original_free_peer(pc, mp->data, state);
+}
 
-    size = conf->upstream.buffer_size;
-    if (size < conf->upstream.bufs.size) {
-        size = conf->upstream.bufs.size;
-    }
 
+static ngx_http_fastcgi_mux_peer_t *
+ngx_http_fastcgi_mux_find_peer(ngx_http_fastcgi_srv_conf_t *fscf,
+    ngx_peer_connection_t *pc)
+{
+    ngx_queue_t                  *q;
+    ngx_http_fastcgi_mux_peer_t  *peer;
 
-    ngx_conf_merge_size_value(conf->upstream.busy_buffers_size_conf,
-                              prev->upstream.busy_buffers_size_conf,
-                              NGX_CONF_UNSET_SIZE);
+    for (q = ngx_queue_head(&fscf->peers);
+         q != ngx_queue_sentinel(&fscf->peers);
+         q = ngx_queue_next(q))
+    {
+        peer = ngx_queue_data(q, ngx_http_fastcgi_mux_peer_t, queue);
 
-    if (conf->upstream.busy_buffers_size_conf == NGX_CONF_UNSET_SIZE) {
-        conf->upstream.busy_buffers_size = 2 * size;
-    } else {
-        conf->upstream.busy_buffers_size =
-                                         conf->upstream.busy_buffers_size_conf;
+        if (ngx_memn2cmp((u_char *) peer->sockaddr, (u_char *) pc->sockaddr,
+                         peer->socklen, pc->socklen)
+            == 0)
+        {
+            return peer;
+        }
     }
 
-    if (conf->upstream.busy_buffers_size < size) {
-        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-             "\"fastcgi_busy_buffers_size\" must be equal to or greater than "
-             "the maximum of the value of \"fastcgi_buffer_size\" and "
-             "one of the \"fastcgi_buffers\"");
-
-        return NGX_CONF_ERROR;
+    peer = ngx_alloc(sizeof(ngx_http_fastcgi_mux_peer_t) + pc->socklen
+                     + pc->name->len, pc->log);
+    if (peer == NULL) {
+        return NULL;
     }
 
-    if (conf->upstream.busy_buffers_size
+    ngx_queue_init(&peer->conns);
+    peer->nconns = 0;
+
+    peer->sockaddr = (struct sockaddr *) &peer[1];
+    peer->socklen = pc->socklen;
+    ngx_memcpy(peer->sockaddr, pc->sockaddr, pc->socklen);
+
+    peer->name.len = pc->name->len;
+    peer->name.data = (u_char *) peer->sockaddr + pc->socklen;
+    ngx_memcpy(peer->name.data, pc->name->data, pc->name->len);
+
+    ngx_queue_insert_tail(&fscf->peers, &peer->queue);
+
+    return peer;
+}
+
+
+static ngx_http_fastcgi_mux_t *
+ngx_http_fastcgi_mux_connect(ngx_http_fastcgi_mux_peer_data_t *mp,
+    ngx_http_fastcgi_mux_peer_t *peer, ngx_peer_connection_t *pc)
+{
+    int                       tcp_nodelay;
+    ngx_int_t                 rc;
+    ngx_connection_t         *c;
+    ngx_http_upstream_t      *u;
+    ngx_http_fastcgi_mux_t   *mux;
+
+    u = mp->request->upstream;
+
+    mux = ngx_calloc(sizeof(ngx_http_fastcgi_mux_t)
+                     + mp->conf->requests
+                       * sizeof(ngx_http_fastcgi_mux_stream_t *),
+                     ngx_cycle->log);
+    if (mux == NULL) {
+        return NULL;
+    }
+
+    mux->conf = mp->conf;
+    mux->mux_peer = peer;
+
+    mux->streams = (ngx_http_fastcgi_mux_stream_t **) &mux[1];
+    mux->capacity = 1;
+
+    mux->connect_timeout = u->conf->connect_timeout;
+    mux->send_timeout = u->conf->send_timeout;
+    mux->read_timeout = u->conf->read_timeout;
+
+    ngx_queue_init(&mux->waiting);
+
+    mux->flush.handler = ngx_http_fastcgi_mux_flush_handler;
+    mux->flush.data = mux;
+    mux->flush.log = ngx_cycle->log;
+
+    mux->peer.sockaddr = peer->sockaddr;
+    mux->peer.socklen = peer->socklen;
+    mux->peer.name = &peer->name;
+    mux->peer.local = pc->local;
+
+    mux->peer.get = ngx_event_get_peer;
+    mux->peer.log = ngx_cycle->log;
+    mux->peer.log_error = NGX_ERROR_ERR;
+    mux->peer.tries = 1;
+
+    rc = ngx_event_connect_peer(&mux->peer);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "fastcgi multiplex connect to %V: %i", &peer->name, rc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+
+        if (mux->peer.connection) {
+            ngx_close_connection(mux->peer.connection);
+        }
+
+        ngx_free(mux);
+
+        return NULL;
+    }
+
+    c = mux->peer.connection;
+
+    c->data = mux;
+    c->read->handler = ngx_http_fastcgi_mux_read_handler;
+    c->write->handler = ngx_http_fastcgi_mux_write_handler;
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    if (peer->sockaddr->sa_family != AF_UNIX)
+#endif
+    {
+        tcp_nodelay = 1;
+
+        if (setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY,
+                       (const void *) &tcp_nodelay, sizeof(int))
+            == -1)
+        {
+            ngx_connection_error(c, ngx_socket_errno,
+                                 "setsockopt(TCP_NODELAY) failed");
+
+        } else {
+            c->tcp_nodelay = NGX_TCP_NODELAY_SET;
+        }
+    }
+
+    /* the application is asked whether it multiplexes requests */
+
+    if (ngx_http_fastcgi_mux_append(&mux->out, ngx_http_fastcgi_mux_get_values,
+                                    sizeof(ngx_http_fastcgi_mux_get_values)
+                                    - 1)
+        != NGX_OK)
+    {
+        ngx_close_connection(c);
+        ngx_free(mux);
+        return NULL;
+    }
+
+    ngx_queue_insert_tail(&peer->conns, &mux->queue);
+    peer->nconns++;
+
+    if (rc == NGX_AGAIN) {
+        ngx_add_timer(c->write, mux->connect_timeout);
+        return mux;
+    }
+
+    mux->connected = 1;
+
+    ngx_post_event((&mux->flush), &ngx_posted_events);
+
+    return mux;
+}
+
+
+static ngx_http_fastcgi_mux_stream_t *
+ngx_http_fastcgi_mux_attach(ngx_http_fastcgi_mux_t *mux,
+    ngx_http_request_t *r)
+{
+    ngx_uint_t                      i;
+    ngx_connection_t               *c, *vc;
+    ngx_http_fastcgi_mux_stream_t  *s;
+
+    for (i = 0; i < mux->capacity; i++) {
+        if (mux->streams[i] == NULL) {
+            break;
+        }
+    }
+
+    s = ngx_pcalloc(r->pool, sizeof(ngx_http_fastcgi_mux_stream_t));
+    if (s == NULL) {
+        return NULL;
+    }
+
+    c = mux->peer.connection;
+    vc = &s->connection;
+
+    /*
+     * the virtual connection refers to the shared descriptor, its events
+     * are never added to the event module and are posted instead
+     */
+
+    vc->fd = c->fd;
+    vc->shared = 1;
+
+    vc->read = &s->read;
+    vc->write = &s->write;
+
+    s->read.data = vc;
+    s->write.data = vc;
+    s->write.write = 1;
+
+    s->read.active = 1;
+    s->write.active = 1;
+    s->write.ready = 1;
+
+    s->read.log = r->connection->log;
+    s->write.log = r->connection->log;
+
+    vc->recv = ngx_http_fastcgi_mux_recv;
+    vc->send = ngx_http_fastcgi_mux_send_buf;
+    vc->recv_chain = ngx_http_fastcgi_mux_recv_chain;
+    vc->send_chain = ngx_http_fastcgi_mux_send_chain;
+
+    vc->log = r->connection->log;
+    vc->pool = r->pool;
+
+    vc->sockaddr = c->sockaddr;
+    vc->socklen = c->socklen;
+    vc->number = c->number;
+
+    vc->tcp_nodelay = NGX_TCP_NODELAY_SET;
+    vc->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+
+    s->mux = mux;
+    s->id = i + 1;
+
+    mux->streams[i] = s;
+    mux->active++;
+
+    if (c->idle) {
+        c->idle = 0;
+
+        if (c->read->timer_set) {
+            ngx_del_timer(c->read);
+        }
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "fastcgi multiplex attach: %d id:%ui active:%ui",
+                   c->fd, s->id, mux->active);
+
+    return s;
+}
+
+
+static void
+ngx_http_fastcgi_mux_detach(ngx_http_fastcgi_mux_stream_t *s)
+{
+    ngx_connection_t        *c;
+    ngx_http_fastcgi_mux_t  *mux;
+
+    mux = s->mux;
+
+    if (mux) {
+        c = mux->peer.connection;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, s->connection.log, 0,
+                       "fastcgi multiplex detach: %d id:%ui", c->fd, s->id);
+
+        s->mux = NULL;
+
+        if (s->waiting) {
+            ngx_queue_remove(&s->queue);
+            s->waiting = 0;
+        }
+
+        if (mux->stream == s) {
+            mux->stream = NULL;
+        }
+
+        if (s->id == 0) {
+            /* the request is complete */
+
+        } else if (!s->begun) {
+            mux->streams[s->id - 1] = NULL;
+            mux->active--;
+
+        } else if (!mux->multiplexed) {
+
+            /*
+             * an application which does not multiplex requests
+             * cannot be asked to abort a request
+             */
+
+            mux->streams[s->id - 1] = NULL;
+            mux->active--;
+
+            ngx_http_fastcgi_mux_close(mux);
+
+            goto done;
+
+        } else {
+            s->mux = mux;
+
+            if (ngx_http_fastcgi_mux_abort(s) != NGX_OK) {
+                s->mux = NULL;
+                ngx_http_fastcgi_mux_close(mux);
+                goto done;
+            }
+        }
+
+        if (mux->blocked) {
+            mux->blocked = 0;
+            ngx_post_event(c->read, &ngx_posted_events);
+        }
+
+        ngx_http_fastcgi_mux_idle(mux);
+    }
+
+done:
+
+    ngx_http_fastcgi_mux_free_chunks(&s->in, 1);
+
+    if (s->read.timer_set) {
+        ngx_del_timer(&s->read);
+    }
+
+    if (s->write.timer_set) {
+        ngx_del_timer(&s->write);
+    }
+
+    if (s->read.prev) {
+        ngx_delete_posted_event((&s->read));
+    }
+
+    if (s->write.prev) {
+        ngx_delete_posted_event((&s->write));
+    }
+}
+
+
+/*
+ * The record being sent by the request is completed, and the application
+ * is asked to abort the request.
+ */
+
+static ngx_int_t
+ngx_http_fastcgi_mux_abort(ngx_http_fastcgi_mux_stream_t *s)
+{
+    size_t                   n;
+    ngx_connection_t        *c;
+    ngx_http_fastcgi_mux_t  *mux;
+    u_char                   header[8];
+    static u_char            zero[256];
+
+    mux = s->mux;
+    c = mux->peer.connection;
+
+    while (s->hlen == 8 && s->rest) {
+        n = ngx_min(s->rest, sizeof(zero));
+
+        if (ngx_http_fastcgi_mux_write(s, zero, n) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    s->mux = NULL;
+
+    header[0] = 1;
+    header[1] = NGX_HTTP_FASTCGI_ABORT_REQUEST;
+    header[2] = (u_char) (s->id >> 8);
+    header[3] = (u_char) s->id;
+    header[4] = 0;
+    header[5] = 0;
+    header[6] = 0;
+    header[7] = 0;
+
+    if (ngx_http_fastcgi_mux_append(&mux->out, header, 8) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    /* the id is reused once the request end is received */
+
+    mux->streams[s->id - 1] = NGX_HTTP_FASTCGI_MUX_ABORTED;
+
+    ngx_post_event((&mux->flush), &ngx_posted_events);
+
+    if (!c->read->timer_set) {
+        ngx_add_timer(c->read, mux->read_timeout);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_fastcgi_mux_flush_handler(ngx_event_t *ev)
+{
+    ngx_http_fastcgi_mux_t  *mux = ev->data;
+
+    if (!mux->connected) {
+        return;
+    }
+
+    if (ngx_http_fastcgi_mux_send(mux) != NGX_OK) {
+        ngx_http_fastcgi_mux_close(mux);
+    }
+}
+
+
+static void
+ngx_http_fastcgi_mux_write_handler(ngx_event_t *wev)
+{
+    int                      err;
+    socklen_t                len;
+    ngx_connection_t        *c;
+    ngx_http_fastcgi_mux_t  *mux;
+
+    c = wev->data;
+    mux = c->data;
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "fastcgi %V timed out", mux->peer.name);
+        ngx_http_fastcgi_mux_close(mux);
+        return;
+    }
+
+    if (!mux->connected) {
+        err = 0;
+        len = sizeof(int);
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            == -1)
+        {
+            err = ngx_errno;
+        }
+
+        if (err) {
+            ngx_log_error(NGX_LOG_ERR, c->log, err,
+                          "connect() to fastcgi %V failed", mux->peer.name);
+            ngx_http_fastcgi_mux_close(mux);
+            return;
+        }
+
+        mux->connected = 1;
+
+        if (wev->timer_set) {
+            ngx_del_timer(wev);
+        }
+    }
+
+    if (ngx_http_fastcgi_mux_send(mux) != NGX_OK) {
+        ngx_http_fastcgi_mux_close(mux);
+    }
+}
+
+
+static void
+ngx_http_fastcgi_mux_read_handler(ngx_event_t *rev)
+{
+    size_t                   size;
+    ssize_t                  n;
+    ngx_uint_t               i;
+    ngx_connection_t        *c;
+    ngx_http_fastcgi_mux_t  *mux;
+
+    c = rev->data;
+    mux = c->data;
+
+    if (c->close) {
+        ngx_http_fastcgi_mux_close(mux);
+        return;
+    }
+
+    if (rev->timedout) {
+        rev->timedout = 0;
+
+        /* the requests in progress are limited by their own timeouts */
+
+        for (i = 0; i < mux->capacity; i++) {
+            if (mux->streams[i]
+                && mux->streams[i] != NGX_HTTP_FASTCGI_MUX_ABORTED)
+            {
+                break;
+            }
+        }
+
+        if (i == mux->capacity) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                           "fastcgi multiplex close idle %d", c->fd);
+            ngx_http_fastcgi_mux_close(mux);
+            return;
+        }
+    }
+
+    if (!mux->connected) {
+        return;
+    }
+
+    /*
+     * the connection is read in portions, and the read event is posted
+     * before the events of the requests the records are passed to,
+     * so the requests read their data before the next portion is read
+     */
+
+    ngx_post_event(rev, &ngx_posted_events);
+
+    for (size = 0; size < NGX_HTTP_FASTCGI_MUX_BUSY; size += n) {
+
+        if (mux->blocked) {
+            break;
+        }
+
+        n = c->recv(c, ngx_http_fastcgi_mux_buffer,
+                    sizeof(ngx_http_fastcgi_mux_buffer));
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+
+            if (mux->active) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "fastcgi %V prematurely closed connection",
+                              mux->peer.name);
+            }
+
+            ngx_http_fastcgi_mux_close(mux);
+            return;
+        }
+
+        if (ngx_http_fastcgi_mux_parse(mux, ngx_http_fastcgi_mux_buffer,
+                                       ngx_http_fastcgi_mux_buffer + n)
+            != NGX_OK)
+        {
+            ngx_http_fastcgi_mux_close(mux);
+            return;
+        }
+    }
+
+    if (!rev->ready || mux->blocked) {
+        ngx_delete_posted_event(rev);
+    }
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_http_fastcgi_mux_close(mux);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_fastcgi_mux_send(ngx_http_fastcgi_mux_t *mux)
+{
+    off_t                           sent;
+    ngx_chain_t                    *cl;
+    ngx_queue_t                    *q;
+    ngx_connection_t               *c;
+    ngx_http_fastcgi_mux_stream_t  *s;
+
+    c = mux->peer.connection;
+
+    while (mux->out.head) {
+        sent = c->sent;
+
+        cl = c->send_chain(c, mux->out.head, 0);
+
+        if (cl == NGX_CHAIN_ERROR) {
+            return NGX_ERROR;
+        }
+
+        mux->out.size -= (size_t) (c->sent - sent);
+
+        ngx_http_fastcgi_mux_free_chunks(&mux->out, 0);
+
+        if (cl && !c->write->ready) {
+            break;
+        }
+    }
+
+    if (mux->out.head) {
+        ngx_add_timer(c->write, mux->send_timeout);
+
+        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+    } else if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    /* the requests waiting for the output to drain are resumed */
+
+    while (mux->out.size < NGX_HTTP_FASTCGI_MUX_BUSY
+           && !ngx_queue_empty(&mux->waiting))
+    {
+        q = ngx_queue_head(&mux->waiting);
+        s = ngx_queue_data(q, ngx_http_fastcgi_mux_stream_t, queue);
+
+        ngx_queue_remove(q);
+        s->waiting = 0;
+
+        s->write.ready = 1;
+        ngx_post_event((&s->write), &ngx_posted_events);
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * The records received are passed to the requests by their ids,
+ * the management records with the id 0 are processed here.
+ */
+
+static ngx_int_t
+ngx_http_fastcgi_mux_parse(ngx_http_fastcgi_mux_t *mux, u_char *p,
+    u_char *last)
+{
+    size_t                          n;
+    ngx_uint_t                      id;
+    ngx_http_fastcgi_header_t      *h;
+    ngx_http_fastcgi_mux_stream_t  *s;
+
+    while (p < last) {
+
+        if (mux->hlen < 8) {
+            n = ngx_min((size_t) (last - p), 8 - mux->hlen);
+
+            ngx_memcpy(&mux->header[mux->hlen], p, n);
+
+            mux->hlen += n;
+            p += n;
+
+            if (mux->hlen < 8) {
+                break;
+            }
+
+            h = (ngx_http_fastcgi_header_t *) mux->header;
+
+            if (h->version != 1) {
+                ngx_log_error(NGX_LOG_ERR, mux->peer.connection->log, 0,
+                              "fastcgi %V sent unsupported FastCGI "
+                              "protocol version: %d",
+                              mux->peer.name, h->version);
+                return NGX_ERROR;
+            }
+
+            id = (h->request_id_hi << 8) + h->request_id_lo;
+
+            mux->type = h->type;
+            mux->id = id;
+            mux->rest = (h->content_length_hi << 8) + h->content_length_lo
+                        + h->padding_length;
+            mux->stream = NULL;
+            mux->nvalues = 0;
+
+            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, mux->peer.connection->log, 0,
+                           "fastcgi multiplex record: %d type:%ui id:%ui "
+                           "length:%uz", mux->peer.connection->fd,
+                           mux->type, id, mux->rest);
+
+            if (id) {
+                if (id > mux->conf->requests || mux->streams[id - 1] == NULL) {
+                    ngx_log_error(NGX_LOG_ERR, mux->peer.connection->log, 0,
+                                  "fastcgi %V sent unexpected FastCGI "
+                                  "request id %ui", mux->peer.name, id);
+                    return NGX_ERROR;
+                }
+
+                s = mux->streams[id - 1];
+
+                if (s != NGX_HTTP_FASTCGI_MUX_ABORTED) {
+                    mux->stream = s;
+
+                    h->request_id_hi = 0;
+                    h->request_id_lo = 1;
+
+                    if (ngx_http_fastcgi_mux_append(&s->in, mux->header, 8)
+                        != NGX_OK)
+                    {
+                        return NGX_ERROR;
+                    }
+                }
+            }
+
+        } else {
+            n = ngx_min((size_t) (last - p), mux->rest);
+
+            if (mux->stream) {
+                if (ngx_http_fastcgi_mux_append(&mux->stream->in, p, n)
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+
+            } else if (mux->id == 0
+                       && mux->nvalues + n <= sizeof(mux->values))
+            {
+                ngx_memcpy(&mux->values[mux->nvalues], p, n);
+                mux->nvalues += n;
+            }
+
+            mux->rest -= n;
+            p += n;
+        }
+
+        s = mux->stream;
+
+        if (s) {
+            s->read.ready = 1;
+            ngx_post_event((&s->read), &ngx_posted_events);
+
+            if (!mux->multiplexed) {
+
+                /* the connection is used by this request only */
+
+                if (s->in.size >= NGX_HTTP_FASTCGI_MUX_BUSY) {
+                    mux->blocked = 1;
+                }
+
+            } else if (s->in.size >= NGX_HTTP_FASTCGI_MUX_BUFFERED) {
+
+                /*
+                 * a request which does not read its response is aborted,
+                 * so the other requests on the connection are not delayed
+                 */
+
+                ngx_log_error(NGX_LOG_ERR, s->connection.log, 0,
+                              "fastcgi %V sent too large response to "
+                              "a request which does not read it",
+                              mux->peer.name);
+
+                mux->stream = NULL;
+
+                if (s->waiting) {
+                    ngx_queue_remove(&s->queue);
+                    s->waiting = 0;
+                }
+
+                ngx_http_fastcgi_mux_free_chunks(&s->in, 1);
+
+                s->error = 1;
+
+                if (ngx_http_fastcgi_mux_abort(s) != NGX_OK) {
+                    return NGX_ERROR;
+                }
+
+                s->write.ready = 1;
+                ngx_post_event((&s->write), &ngx_posted_events);
+            }
+        }
+
+        if (mux->rest == 0 && ngx_http_fastcgi_mux_end_record(mux) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_fastcgi_mux_end_record(ngx_http_fastcgi_mux_t *mux)
+{
+    ngx_http_fastcgi_mux_stream_t  *s;
+
+    mux->hlen = 0;
+
+    if (mux->id == 0) {
+
+        if (mux->type == NGX_HTTP_FASTCGI_GET_VALUES_RESULT) {
+            ngx_http_fastcgi_mux_values(mux);
+
+        } else if (mux->type != NGX_HTTP_FASTCGI_UNKNOWN_TYPE) {
+            ngx_log_error(NGX_LOG_ERR, mux->peer.connection->log, 0,
+                          "fastcgi %V sent unexpected FastCGI "
+                          "management record type: %ui",
+                          mux->peer.name, mux->type);
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+    }
+
+    if (mux->type != NGX_HTTP_FASTCGI_END_REQUEST) {
+        return NGX_OK;
+    }
+
+    s = mux->stream;
+
+    if (s) {
+        s->id = 0;
+        s->eof = 1;
+
+        s->read.ready = 1;
+        ngx_post_event((&s->read), &ngx_posted_events);
+
+        mux->stream = NULL;
+    }
+
+    mux->streams[mux->id - 1] = NULL;
+    mux->active--;
+
+    ngx_http_fastcgi_mux_idle(mux);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_fastcgi_mux_values(ngx_http_fastcgi_mux_t *mux)
+{
+    u_char      *p, *last, *name, *value;
+    size_t       len[2];
+    ngx_int_t    n, max;
+    ngx_uint_t   i, mpxs;
+
+    p = mux->values;
+    last = p + mux->nvalues;
+
+    mpxs = 0;
+    max = 0;
+
+    while (p < last) {
+
+        for (i = 0; i < 2; i++) {
+
+            if (p < last && *p < 0x80) {
+                len[i] = *p++;
+
+            } else if (last - p >= 4) {
+                len[i] = ((p[0] & 0x7f) << 24) + (p[1] << 16) + (p[2] << 8)
+                         + p[3];
+                p += 4;
+
+            } else {
+                goto done;
+            }
+        }
+
+        if ((size_t) (last - p) < len[0] + len[1]) {
+            break;
+        }
+
+        name = p;
+        value = p + len[0];
+        p = value + len[1];
+
+        n = ngx_atoi(value, len[1]);
+
+        if (len[0] == sizeof("FCGI_MPXS_CONNS") - 1
+            && ngx_strncmp(name, "FCGI_MPXS_CONNS", len[0]) == 0)
+        {
+            mpxs = (n > 0);
+
+        } else if (len[0] == sizeof("FCGI_MAX_REQS") - 1
+                   && ngx_strncmp(name, "FCGI_MAX_REQS", len[0]) == 0)
+        {
+            max = n;
+        }
+    }
+
+done:
+
+    if (mpxs) {
+        mux->multiplexed = 1;
+
+        mux->capacity = mux->conf->requests;
+
+        if (max > 0 && (ngx_uint_t) max < mux->capacity) {
+            mux->capacity = max;
+        }
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, mux->peer.connection->log, 0,
+                   "fastcgi multiplex %V: %ui requests max:%i",
+                   mux->peer.name, mux->capacity, max);
+}
+
+
+/*
+ * The records sent by a request are copied to the connection output
+ * with the request id of the request.  The FCGI_KEEP_CONN flag is always
+ * set, as the connection is closed by nginx only.
+ */
+
+static ngx_int_t
+ngx_http_fastcgi_mux_write(ngx_http_fastcgi_mux_stream_t *s, u_char *p,
+    size_t size)
+{
+    u_char                     *last, flags;
+    size_t                      n;
+    ngx_http_fastcgi_mux_t     *mux;
+    ngx_http_fastcgi_header_t  *h;
+
+    mux = s->mux;
+    last = p + size;
+
+    while (p < last) {
+
+        if (s->hlen < 8) {
+            n = ngx_min((size_t) (last - p), 8 - s->hlen);
+
+            ngx_memcpy(&s->header[s->hlen], p, n);
+
+            s->hlen += n;
+            p += n;
+
+            if (s->hlen < 8) {
+                break;
+            }
+
+            h = (ngx_http_fastcgi_header_t *) s->header;
+
+            h->request_id_hi = (u_char) (s->id >> 8);
+            h->request_id_lo = (u_char) s->id;
+
+            s->type = h->type;
+            s->rest = (h->content_length_hi << 8) + h->content_length_lo
+                      + h->padding_length;
+            s->offset = 0;
+
+            if (ngx_http_fastcgi_mux_append(&mux->out, s->header, 8)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            s->begun = 1;
+
+            if (s->rest == 0) {
+                s->hlen = 0;
+            }
+
+            continue;
+        }
+
+        n = ngx_min((size_t) (last - p), s->rest);
+
+        if (s->type == NGX_HTTP_FASTCGI_BEGIN_REQUEST
+            && s->offset <= offsetof(ngx_http_fastcgi_begin_request_t, flags)
+            && s->offset + n > offsetof(ngx_http_fastcgi_begin_request_t,
+                                        flags))
+        {
+            n = offsetof(ngx_http_fastcgi_begin_request_t, flags) - s->offset;
+
+            if (ngx_http_fastcgi_mux_append(&mux->out, p, n) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            flags = p[n] | NGX_HTTP_FASTCGI_KEEP_CONN;
+
+            if (ngx_http_fastcgi_mux_append(&mux->out, &flags, 1) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            n++;
+
+        } else if (ngx_http_fastcgi_mux_append(&mux->out, p, n) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        p += n;
+        s->offset += n;
+        s->rest -= n;
+
+        if (s->rest == 0) {
+            s->hlen = 0;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_fastcgi_mux_idle(ngx_http_fastcgi_mux_t *mux)
+{
+    ngx_connection_t  *c;
+
+    c = mux->peer.connection;
+
+    if (mux->active) {
+        return;
+    }
+
+    c->idle = 1;
+
+    ngx_add_timer(c->read, mux->conf->timeout);
+}
+
+
+static void
+ngx_http_fastcgi_mux_close(ngx_http_fastcgi_mux_t *mux)
+{
+    ngx_uint_t                      i;
+    ngx_http_fastcgi_mux_stream_t  *s;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "fastcgi multiplex close %V", mux->peer.name);
+
+    /* the requests in progress fail and try the next upstream */
+
+    for (i = 0; i < mux->conf->requests; i++) {
+        s = mux->streams[i];
+
+        if (s == NULL || s == NGX_HTTP_FASTCGI_MUX_ABORTED) {
+            continue;
+        }
+
+        s->mux = NULL;
+        s->waiting = 0;
+        s->error = 1;
+
+        s->read.ready = 1;
+        s->write.ready = 1;
+
+        ngx_post_event((&s->read), &ngx_posted_events);
+        ngx_post_event((&s->write), &ngx_posted_events);
+    }
+
+    ngx_close_connection(mux->peer.connection);
+
+    if (mux->flush.prev) {
+        ngx_delete_posted_event((&mux->flush));
+    }
+
+    ngx_http_fastcgi_mux_free_chunks(&mux->out, 1);
+
+    ngx_queue_remove(&mux->queue);
+    mux->mux_peer->nconns--;
+
+    ngx_free(mux);
+}
+
+
+static ngx_int_t
+ngx_http_fastcgi_mux_append(ngx_http_fastcgi_mux_queue_t *q, u_char *p,
+    size_t size)
+{
+    size_t        n;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    q->size += size;
+
+    while (size) {
+        cl = q->tail;
+
+        if (cl == NULL || cl->buf->last == cl->buf->end) {
+            cl = ngx_alloc(sizeof(ngx_chain_t) + sizeof(ngx_buf_t)
+                           + NGX_HTTP_FASTCGI_MUX_CHUNK, ngx_cycle->log);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            b = (ngx_buf_t *) &cl[1];
+            ngx_memzero(b, sizeof(ngx_buf_t));
+
+            b->start = (u_char *) &b[1];
+            b->pos = b->start;
+            b->last = b->start;
+            b->end = b->start + NGX_HTTP_FASTCGI_MUX_CHUNK;
+            b->temporary = 1;
+
+            cl->buf = b;
+            cl->next = NULL;
+
+            if (q->tail) {
+                q->tail->next = cl;
+
+            } else {
+                q->head = cl;
+            }
+
+            q->tail = cl;
+        }
+
+        n = ngx_min(size, (size_t) (cl->buf->end - cl->buf->last));
+
+        cl->buf->last = ngx_cpymem(cl->buf->last, p, n);
+
+        p += n;
+        size -= n;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_fastcgi_mux_free_chunks(ngx_http_fastcgi_mux_queue_t *q,
+    ngx_uint_t all)
+{
+    ngx_chain_t  *cl;
+
+    while (q->head) {
+        cl = q->head;
+
+        if (!all && cl->buf->pos < cl->buf->last) {
+            return;
+        }
+
+        q->head = cl->next;
+
+        if (q->head == NULL) {
+            q->tail = NULL;
+        }
+
+        ngx_free(cl);
+    }
+
+    q->size = 0;
+}
+
+
+static ssize_t
+ngx_http_fastcgi_mux_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    ngx_http_fastcgi_mux_stream_t *s = (ngx_http_fastcgi_mux_stream_t *) c;
+
+    size_t                   n, len;
+    ngx_buf_t               *b;
+    ngx_http_fastcgi_mux_t  *mux;
+
+    if (s->in.size == 0) {
+        c->read->ready = 0;
+
+        if (s->eof) {
+            c->read->eof = 1;
+            return 0;
+        }
+
+        if (s->mux == NULL) {
+            c->read->error = 1;
+            return NGX_ERROR;
+        }
+
+        return NGX_AGAIN;
+    }
+
+    n = 0;
+
+    while (n < size && s->in.head) {
+        b = s->in.head->buf;
+
+        len = ngx_min(size - n, (size_t) (b->last - b->pos));
+
+        buf = ngx_cpymem(buf, b->pos, len);
+        b->pos += len;
+        n += len;
+
+        s->in.size -= len;
+
+        ngx_http_fastcgi_mux_free_chunks(&s->in, 0);
+    }
+
+    mux = s->mux;
+
+    if (mux && mux->blocked && s->in.size < NGX_HTTP_FASTCGI_MUX_BUSY) {
+        mux->blocked = 0;
+        ngx_post_event(mux->peer.connection->read, &ngx_posted_events);
+    }
+
+    return n;
+}
+
+
+/*
+ * Like readv(), the buffers are filled in turn, and their last pointers
+ * are left to the caller.
+ */
+
+static ssize_t
+ngx_http_fastcgi_mux_recv_chain(ngx_connection_t *c, ngx_chain_t *in)
+{
+    size_t      size;
+    ssize_t     n, total;
+    ngx_buf_t  *b;
+
+    total = 0;
+
+    for ( /* void */ ; in; in = in->next) {
+        b = in->buf;
+
+        size = b->end - b->last;
+
+        if (size == 0) {
+            continue;
+        }
+
+        n = ngx_http_fastcgi_mux_recv(c, b->last, size);
+
+        if (n <= 0) {
+            return total ? total : n;
+        }
+
+        total += n;
+
+        if ((size_t) n < size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+
+static ssize_t
+ngx_http_fastcgi_mux_send_buf(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    ngx_http_fastcgi_mux_stream_t *s = (ngx_http_fastcgi_mux_stream_t *) c;
+
+    ngx_http_fastcgi_mux_t  *mux;
+
+    mux = s->mux;
+
+    if (mux == NULL) {
+        c->write->error = 1;
+        return NGX_ERROR;
+    }
+
+    if (mux->out.size >= NGX_HTTP_FASTCGI_MUX_BUSY) {
+        c->write->ready = 0;
+
+        if (!s->waiting) {
+            ngx_queue_insert_tail(&mux->waiting, &s->queue);
+            s->waiting = 1;
+        }
+
+        return NGX_AGAIN;
+    }
+
+    if (ngx_http_fastcgi_mux_write(s, buf, size) != NGX_OK) {
+        c->write->error = 1;
+        return NGX_ERROR;
+    }
+
+    c->sent += size;
+
+    ngx_post_event((&mux->flush), &ngx_posted_events);
+
+    return size;
+}
+
+
+static ngx_chain_t *
+ngx_http_fastcgi_mux_send_chain(ngx_connection_t *c, ngx_chain_t *in,
+    off_t limit)
+{
+    ssize_t      n;
+    ngx_buf_t   *b;
+
+    for ( /* void */ ; in; in = in->next) {
+        b = in->buf;
+
+        if (ngx_buf_special(b)) {
+            continue;
+        }
+
+        if (!ngx_buf_in_memory(b)) {
+            ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                          "fastcgi multiplex cannot send file buffers");
+            return NGX_CHAIN_ERROR;
+        }
+
+        if (b->pos == b->last) {
+            continue;
+        }
+
+        n = ngx_http_fastcgi_mux_send_buf(c, b->pos, b->last - b->pos);
+
+        if (n == NGX_ERROR) {
+            return NGX_CHAIN_ERROR;
+        }
+
+        if (n == NGX_AGAIN) {
+            return in;
+        }
+
+        b->pos = b->last;
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_fastcgi_add_variables(ngx_conf_t *cf)
+{
+   ngx_http_variable_t  *var, *v;
+
+    for (v = ngx_http_fastcgi_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_fastcgi_create_srv_conf(ngx_conf_t *cf)
+{
+    ngx_http_fastcgi_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_fastcgi_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->connections = 0;
+     *     conf->original_init_upstream = NULL;
+     *     conf->original_init_peer = NULL;
+     */
+
+    return conf;
+}
+
+
+static void *
+ngx_http_fastcgi_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_fastcgi_loc_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_fastcgi_loc_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->upstream.bufs.num = 0;
+     *     conf->upstream.ignore_headers = 0;
+     *     conf->upstream.next_upstream = 0;
+     *     conf->upstream.cache_use_stale = 0;
+     *     conf->upstream.cache_methods = 0;
+     *     conf->upstream.temp_path = NULL;
+     *     conf->upstream.hide_headers_hash = { NULL, 0 };
+     *     conf->upstream.uri = { 0, NULL };
+     *     conf->upstream.location = NULL;
+     *     conf->upstream.store_lengths = NULL;
+     *     conf->upstream.store_values = NULL;
+     *
+     *     conf->index.len = { 0, NULL };
+     */
+
+    conf->upstream.store = NGX_CONF_UNSET;
+    conf->upstream.store_access = NGX_CONF_UNSET_UINT;
+    conf->upstream.request_buffering = NGX_CONF_UNSET;
+    conf->upstream.buffering = NGX_CONF_UNSET;
+    conf->upstream.adaptive_buffers = NGX_CONF_UNSET;
+    conf->upstream.ignore_client_abort = NGX_CONF_UNSET;
+
+    conf->upstream.local = NGX_CONF_UNSET_PTR;
+    conf->upstream.hedge = NGX_CONF_UNSET_PTR;
+
+    conf->upstream.connect_timeout = NGX_CONF_UNSET_MSEC;
+    conf->upstream.send_timeout = NGX_CONF_UNSET_MSEC;
+    conf->upstream.read_timeout = NGX_CONF_UNSET_MSEC;
+
+    conf->upstream.send_lowat = NGX_CONF_UNSET_SIZE;
+    conf->upstream.buffer_size = NGX_CONF_UNSET_SIZE;
+
+    conf->upstream.busy_buffers_size_conf = NGX_CONF_UNSET_SIZE;
+    conf->upstream.max_temp_file_size_conf = NGX_CONF_UNSET_SIZE;
+    conf->upstream.temp_file_write_size_conf = NGX_CONF_UNSET_SIZE;
+
+    conf->upstream.upstream_tries = NGX_CONF_UNSET_UINT;
+
+    conf->upstream.pass_request_headers = NGX_CONF_UNSET;
+    conf->upstream.pass_request_body = NGX_CONF_UNSET;
+
+#if (NGX_HTTP_CACHE)
+    conf->upstream.cache = NGX_CONF_UNSET_PTR;
+    conf->upstream.cache_min_uses = NGX_CONF_UNSET_UINT;
+    conf->upstream.cache_bypass = NGX_CONF_UNSET_PTR;
+    conf->upstream.cache_purge = NGX_CONF_UNSET_PTR;
+    conf->upstream.no_cache = NGX_CONF_UNSET_PTR;
+    conf->upstream.cache_valid = NGX_CONF_UNSET_PTR;
+    conf->upstream.cache_lock = NGX_CONF_UNSET;
+    conf->upstream.cache_lock_timeout = NGX_CONF_UNSET_MSEC;
+    conf->upstream.cache_collapse = NGX_CONF_UNSET_UINT;
+    conf->upstream.cache_revalidate = NGX_CONF_UNSET;
+    conf->upstream.cache_background_update = NGX_CONF_UNSET;
+#endif
+
+    conf->upstream.hide_headers = NGX_CONF_UNSET_PTR;
+    conf->upstream.pass_headers = NGX_CONF_UNSET_PTR;
+
+    conf->upstream.intercept_errors = NGX_CONF_UNSET;
+
+    /* "fastcgi_cyclic_temp_file" is disabled */
+    conf->upstream.cyclic_temp_file = 0;
+
+    conf->catch_stderr = NGX_CONF_UNSET_PTR;
+
+    conf->keep_conn = NGX_CONF_UNSET;
+
+    ngx_str_set(&conf->upstream.module, "fastcgi");
+
+    return conf;
+}
+
+
+static char *
+ngx_http_fastcgi_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_fastcgi_loc_conf_t *prev = parent;
+    ngx_http_fastcgi_loc_conf_t *conf = child;
+
+    size_t                        size;
+    ngx_hash_init_t               hash;
+    ngx_http_core_loc_conf_t     *clcf;
+
+    if (conf->upstream.store != 0) {
+        ngx_conf_merge_value(conf->upstream.store,
+                              prev->upstream.store, 0);
+
+        if (conf->upstream.store_lengths == NULL) {
+            conf->upstream.store_lengths = prev->upstream.store_lengths;
+            conf->upstream.store_values = prev->upstream.store_values;
+        }
+    }
+
+    ngx_conf_merge_uint_value(conf->upstream.store_access,
+                              prev->upstream.store_access, 0600);
+
+    ngx_conf_merge_value(conf->upstream.request_buffering,
+                         prev->upstream.request_buffering, 1);
+
+    ngx_conf_merge_value(conf->upstream.buffering,
+                              prev->upstream.buffering, 1);
+
+    ngx_conf_merge_value(conf->upstream.adaptive_buffers,
+                              prev->upstream.adaptive_buffers, 0);
+
+    ngx_conf_merge_value(conf->upstream.ignore_client_abort,
+                              prev->upstream.ignore_client_abort, 0);
+
+    ngx_conf_merge_ptr_value(conf->upstream.local,
+                              prev->upstream.local, NULL);
+
+    ngx_conf_merge_ptr_value(conf->upstream.hedge,
+                              prev->upstream.hedge, NULL);
+
+    ngx_conf_merge_msec_value(conf->upstream.connect_timeout,
+                              prev->upstream.connect_timeout, 60000);
+
+    ngx_conf_merge_msec_value(conf->upstream.send_timeout,
+                              prev->upstream.send_timeout, 60000);
+
+    ngx_conf_merge_msec_value(conf->upstream.read_timeout,
+                              prev->upstream.read_timeout, 60000);
+
+    ngx_conf_merge_size_value(conf->upstream.send_lowat,
+                              prev->upstream.send_lowat, 0);
+
+    ngx_conf_merge_size_value(conf->upstream.buffer_size,
+                              prev->upstream.buffer_size,
+                              (size_t) ngx_pagesize);
+
+
+    ngx_conf_merge_bufs_value(conf->upstream.bufs, prev->upstream.bufs,
+                              8, ngx_pagesize);
+
+    if (conf->upstream.bufs.num < 2) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "there must be at least 2 \"fastcgi_buffers\"");
+        return NGX_CONF_ERROR;
+    }
+
+
+    size = conf->upstream.buffer_size;
+    if (size < conf->upstream.bufs.size) {
+        size = conf->upstream.bufs.size;
+    }
+
+
+    ngx_conf_merge_size_value(conf->upstream.busy_buffers_size_conf,
+                              prev->upstream.busy_buffers_size_conf,
+                              NGX_CONF_UNSET_SIZE);
+
+    if (conf->upstream.busy_buffers_size_conf == NGX_CONF_UNSET_SIZE) {
+        conf->upstream.busy_buffers_size = 2 * size;
+    } else {
+        conf->upstream.busy_buffers_size =
+                                         conf->upstream.busy_buffers_size_conf;
+    }
+
+    if (conf->upstream.busy_buffers_size < size) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+             "\"fastcgi_busy_buffers_size\" must be equal to or greater than "
+             "the maximum of the value of \"fastcgi_buffer_size\" and "
+             "one of the \"fastcgi_buffers\"");
+
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->upstream.busy_buffers_size
         > (conf->upstream.bufs.num - 1) * conf->upstream.bufs.size)
     {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
@@ -2580,6 +4288,13 @@ ngx_http_fastcgi_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_ptr_value(conf->upstream.cache_bypass,
                              prev->upstream.cache_bypass, NULL);
 
+    ngx_conf_merge_ptr_value(conf->upstream.cache_purge,
+                             prev->upstream.cache_purge, NULL);
+
+    if (conf->upstream.cache_tag == NULL) {
+        conf->upstream.cache_tag = prev->upstream.cache_tag;
+    }
+
     ngx_conf_merge_ptr_value(conf->upstream.no_cache,
                              prev->upstream.no_cache, NULL);
 
@@ -2602,6 +4317,16 @@ ngx_http_fastcgi_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_msec_value(conf->upstream.cache_lock_timeout,
                               prev->upstream.cache_lock_timeout, 5000);
 
+    ngx_conf_merge_uint_value(conf->upstream.cache_collapse,
+                              prev->upstream.cache_collapse,
+                              NGX_HTTP_UPSTREAM_COLLAPSE_OFF);
+
+    ngx_conf_merge_value(conf->upstream.cache_revalidate,
+                              prev->upstream.cache_revalidate, 0);
+
+    ngx_conf_merge_value(conf->upstream.cache_background_update,
+                              prev->upstream.cache_background_update, 0);
+
 #endif
 
     ngx_conf_merge_value(conf->upstream.pass_request_headers,
@@ -2777,7 +4502,7 @@ ngx_http_fastcgi_merge_params(ngx_conf_t *cf,
 
             s->key = h->key;
             s->value = h->value;
-            s->skip_empty = 0;
+            s->skip_empty = 1;
 
         next:
 
@@ -3261,6 +4986,92 @@ ngx_http_fastcgi_cache_key(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 #endif
 
 
+static char *
+ngx_http_fastcgi_multiplex(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_srv_conf_t  *uscf;
+    ngx_http_fastcgi_srv_conf_t   *fscf;
+
+    ngx_int_t    n;
+    ngx_str_t   *value, s;
+    ngx_uint_t   i;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    fscf = ngx_http_conf_upstream_srv_conf(uscf, ngx_http_fastcgi_module);
+
+    if (fscf->original_init_upstream) {
+        return "is duplicate";
+    }
+
+    fscf->original_init_upstream = uscf->peer.init_upstream
+                                   ? uscf->peer.init_upstream
+                                   : ngx_http_upstream_init_round_robin;
+
+    uscf->peer.init_upstream = ngx_http_fastcgi_mux_init;
+
+    /* read options */
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    fscf->connections = n;
+    fscf->requests = 16;
+    fscf->timeout = 60000;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "requests=", 9) == 0) {
+
+            n = ngx_atoi(&value[i].data[9], value[i].len - 9);
+
+            /* the request ids are 16-bit */
+
+            if (n == NGX_ERROR || n == 0 || n > 65535) {
+                goto invalid;
+            }
+
+            fscf->requests = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = &value[i].data[8];
+
+            fscf->timeout = ngx_parse_time(&s, 0);
+
+            if (fscf->timeout == (ngx_msec_t) NGX_ERROR) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
 static char *
 ngx_http_fastcgi_lowat_check(ngx_conf_t *cf, void *post, void *data)
 {
@@ -10,11 +10,38 @@
 #include <ngx_http.h>
 
 
+typedef struct ngx_http_memcached_conn_s      ngx_http_memcached_conn_t;
+typedef struct ngx_http_memcached_loc_conf_s  ngx_http_memcached_loc_conf_t;
+
+
+/*
+ * The connections to the peers of an upstream are shared by all locations
+ * which pass requests to it; the number of connections is the largest one
+ * of these locations, and the timeouts and the buffer size are taken from
+ * the first of them.
+ */
+
+typedef struct {
+    ngx_http_upstream_srv_conf_t   *upstream;
+    ngx_uint_t                      pipeline;
+    ngx_http_memcached_loc_conf_t  *conf;
+    ngx_http_memcached_conn_t      *conns;     /* local to a process */
+} ngx_http_memcached_pipeline_t;
+
+
 typedef struct {
-    ngx_http_upstream_conf_t   upstream;
-    ngx_int_t                  index;
-    ngx_uint_t                 gzip_flag;
-} ngx_http_memcached_loc_conf_t;
+    ngx_array_t                pipelines;    /* of pipeline pointers */
+} ngx_http_memcached_main_conf_t;
+
+
+struct ngx_http_memcached_loc_conf_s {
+    ngx_http_upstream_conf_t        upstream;
+    ngx_int_t                       index;
+    ngx_uint_t                      gzip_flag;
+
+    ngx_uint_t                      pipeline;
+    ngx_http_memcached_pipeline_t  *pipe;
+};
 
 
 typedef struct {
@@ -24,6 +51,75 @@ typedef struct {
 } ngx_http_memcached_ctx_t;
 
 
+/*
+ * In the pipelined mode the keys requested by concurrent client requests
+ * are collected during an event loop iteration and sent as multi-key "get"
+ * commands over a few persistent connections per peer.  A key requested
+ * by several clients is sent only once.
+ */
+
+#define NGX_HTTP_MEMCACHED_BATCH    32
+#define NGX_HTTP_MEMCACHED_KEY_MAX  250
+
+
+/*
+ * a value is read once into memory shared by all requests waiting for it,
+ * and is freed once the last of them is done with it
+ */
+
+typedef struct {
+    ngx_uint_t                 count;
+    u_char                    *last;
+} ngx_http_memcached_value_t;
+
+
+typedef struct {
+    ngx_queue_t                  queue;
+    ngx_queue_t                  waiters;
+    ngx_str_t                    key;
+    ngx_uint_t                   found;
+    ngx_uint_t                   flags;
+    size_t                       length;
+    ngx_http_memcached_value_t  *value;
+} ngx_http_memcached_entry_t;
+
+
+typedef struct {
+    ngx_queue_t                queue;
+    ngx_queue_t                entries;
+    ngx_uint_t                 nentries;
+    size_t                     len;
+    ngx_queue_t               *next;
+} ngx_http_memcached_batch_t;
+
+
+typedef struct {
+    ngx_queue_t                  queue;
+    ngx_http_request_t          *request;
+    ngx_http_memcached_entry_t  *entry;
+    ngx_http_memcached_value_t  *value;
+} ngx_http_memcached_waiter_t;
+
+
+struct ngx_http_memcached_conn_s {
+    ngx_peer_connection_t           peer;
+    ngx_http_memcached_loc_conf_t  *conf;
+
+    ngx_queue_t                     pending;
+    ngx_queue_t                     batches;
+
+    ngx_buf_t                       in;
+    ngx_buf_t                       out;
+
+    ngx_event_t                     flush;
+
+    ngx_http_memcached_entry_t     *value;
+    size_t                          rest;
+
+    unsigned                        connected:1;
+};
+
+
 static ngx_int_t ngx_http_memcached_create_request(ngx_http_request_t *r);
 static ngx_int_t ngx_http_memcached_reinit_request(ngx_http_request_t *r);
 static ngx_int_t ngx_http_memcached_process_header(ngx_http_request_t *r);
@@ -33,12 +129,42 @@ static void ngx_http_memcached_abort_request(ngx_http_request_t *r);
 static void ngx_http_memcached_finalize_request(ngx_http_request_t *r,
     ngx_int_t rc);
 
+static ngx_int_t ngx_http_memcached_pipeline(ngx_http_request_t *r,
+    ngx_http_memcached_loc_conf_t *mlcf);
+static ngx_http_memcached_conn_t *ngx_http_memcached_get_conn(
+    ngx_http_request_t *r, ngx_http_memcached_loc_conf_t *mlcf,
+    ngx_str_t *key);
+static ngx_int_t ngx_http_memcached_add_key(ngx_http_memcached_conn_t *mc,
+    ngx_http_memcached_waiter_t *w, ngx_str_t *key);
+static ngx_int_t ngx_http_memcached_connect(ngx_http_memcached_conn_t *mc);
+static void ngx_http_memcached_flush_handler(ngx_event_t *ev);
+static void ngx_http_memcached_write_handler(ngx_event_t *wev);
+static void ngx_http_memcached_read_handler(ngx_event_t *rev);
+static ngx_int_t ngx_http_memcached_send(ngx_http_memcached_conn_t *mc);
+static ngx_int_t ngx_http_memcached_parse(ngx_http_memcached_conn_t *mc);
+static ngx_int_t ngx_http_memcached_parse_value(ngx_http_memcached_conn_t *mc,
+    ngx_http_memcached_batch_t *batch, u_char *p, u_char *last);
+static void ngx_http_memcached_complete(ngx_http_memcached_batch_t *batch,
+    ngx_uint_t status);
+static void ngx_http_memcached_deliver(ngx_http_memcached_entry_t *e,
+    ngx_uint_t status);
+static void ngx_http_memcached_free_value(ngx_http_memcached_value_t *value);
+static void ngx_http_memcached_error(ngx_http_memcached_conn_t *mc,
+    ngx_uint_t status);
+static void ngx_http_memcached_close(ngx_http_memcached_conn_t *mc);
+static void ngx_http_memcached_cleanup(void *data);
+
+static void *ngx_http_memcached_create_main_conf(ngx_conf_t *cf);
 static void *ngx_http_memcached_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_memcached_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
+static ngx_http_memcached_pipeline_t *ngx_http_memcached_add_pipeline(
+    ngx_conf_t *cf, ngx_http_memcached_loc_conf_t *mlcf);
 
 static char *ngx_http_memcached_pass(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_memcached_set_pipeline(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
 
 
 static ngx_conf_bitmask_t  ngx_http_memcached_next_upstream_masks[] = {
@@ -116,6 +242,13 @@ static ngx_command_t  ngx_http_memcached_commands[] = {
       offsetof(ngx_http_memcached_loc_conf_t, upstream.upstream_tries),
       NULL },
 
+    { ngx_string("memcached_pipeline"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_memcached_set_pipeline,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_memcached_loc_conf_t, pipeline),
+      NULL },
+
       ngx_null_command
 };
 
@@ -124,7 +257,7 @@ static ngx_http_module_t  ngx_http_memcached_module_ctx = {
     NULL,                                  /* preconfiguration */
     NULL,                                  /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
+    ngx_http_memcached_create_main_conf,   /* create main configuration */
     NULL,                                  /* init main configuration */
 
     NULL,                                  /* create server configuration */
@@ -180,6 +313,12 @@ ngx_http_memcached_handler(ngx_http_request_t *r)
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
+    mlcf = ngx_http_get_module_loc_conf(r, ngx_http_memcached_module);
+
+    if (mlcf->pipeline) {
+        return ngx_http_memcached_pipeline(r, mlcf);
+    }
+
     if (ngx_http_upstream_create(r) != NGX_OK) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
@@ -189,8 +328,6 @@ ngx_http_memcached_handler(ngx_http_request_t *r)
     ngx_str_set(&u->schema, "memcached://");
     u->output.tag = (ngx_buf_tag_t) &ngx_http_memcached_module;
 
-    mlcf = ngx_http_get_module_loc_conf(r, ngx_http_memcached_module);
-
     u->conf = &mlcf->upstream;
 
     u->create_request = ngx_http_memcached_create_request;
@@ -561,148 +698,1298 @@ ngx_http_memcached_finalize_request(ngx_http_request_t *r, ngx_int_t rc)
 }
 
 
-static void *
-ngx_http_memcached_create_loc_conf(ngx_conf_t *cf)
+static ngx_int_t
+ngx_http_memcached_pipeline(ngx_http_request_t *r,
+    ngx_http_memcached_loc_conf_t *mlcf)
 {
-    ngx_http_memcached_loc_conf_t  *conf;
+    uintptr_t                     escape;
+    ngx_str_t                     key;
+    ngx_pool_cleanup_t           *cln;
+    ngx_http_variable_value_t    *vv;
+    ngx_http_memcached_conn_t    *mc;
+    ngx_http_memcached_waiter_t  *w;
 
-    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_memcached_loc_conf_t));
-    if (conf == NULL) {
-        return NULL;
+    vv = ngx_http_get_indexed_variable(r, mlcf->index);
+
+    if (vv == NULL || vv->not_found || vv->len == 0) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "the \"$memcached_key\" variable is not set");
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
+    escape = 2 * ngx_escape_uri(NULL, vv->data, vv->len, NGX_ESCAPE_MEMCACHED);
+
+    key.len = vv->len + escape;
+
     /*
-     * set by ngx_pcalloc():
-     *
-     *     conf->upstream.bufs.num = 0;
-     *     conf->upstream.next_upstream = 0;
-     *     conf->upstream.temp_path = NULL;
-     *     conf->upstream.uri = { 0, NULL };
-     *     conf->upstream.location = NULL;
+     * memcached rejects the whole command with a key this long,
+     * so the key is not sent along with the keys of other requests
      */
 
-    conf->upstream.local = NGX_CONF_UNSET_PTR;
-    conf->upstream.connect_timeout = NGX_CONF_UNSET_MSEC;
-    conf->upstream.send_timeout = NGX_CONF_UNSET_MSEC;
-    conf->upstream.read_timeout = NGX_CONF_UNSET_MSEC;
+    if (key.len > NGX_HTTP_MEMCACHED_KEY_MAX) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "the memcached key is too long: %uz", key.len);
+        return NGX_HTTP_BAD_REQUEST;
+    }
+    key.data = ngx_pnalloc(r->pool, key.len);
+    if (key.data == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
 
-    conf->upstream.buffer_size = NGX_CONF_UNSET_SIZE;
+    if (escape == 0) {
+        ngx_memcpy(key.data, vv->data, vv->len);
 
-    conf->upstream.upstream_tries = NGX_CONF_UNSET_UINT;
+    } else {
+        (void) ngx_escape_uri(key.data, vv->data, vv->len,
+                              NGX_ESCAPE_MEMCACHED);
+    }
 
-    /* the hardcoded values */
-    conf->upstream.cyclic_temp_file = 0;
-    conf->upstream.buffering = 0;
-    conf->upstream.ignore_client_abort = 0;
-    conf->upstream.send_lowat = 0;
-    conf->upstream.bufs.num = 0;
-    conf->upstream.busy_buffers_size = 0;
-    conf->upstream.max_temp_file_size = 0;
-    conf->upstream.temp_file_write_size = 0;
-    conf->upstream.intercept_errors = 1;
-    conf->upstream.intercept_404 = 1;
-    conf->upstream.pass_request_headers = 0;
-    conf->upstream.pass_request_body = 0;
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http memcached pipelined request: \"%V\"", &key);
 
-    conf->index = NGX_CONF_UNSET;
-    conf->gzip_flag = NGX_CONF_UNSET_UINT;
+    mc = ngx_http_memcached_get_conn(r, mlcf, &key);
+    if (mc == NULL) {
+        return NGX_HTTP_BAD_GATEWAY;
+    }
 
-    return conf;
+    w = ngx_pcalloc(r->pool, sizeof(ngx_http_memcached_waiter_t));
+    if (w == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    w->request = r;
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (mc->peer.connection == NULL
+        && ngx_http_memcached_connect(mc) != NGX_OK)
+    {
+        return NGX_HTTP_BAD_GATEWAY;
+    }
+
+    if (ngx_http_memcached_add_key(mc, w, &key) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    cln->handler = ngx_http_memcached_cleanup;
+    cln->data = w;
+
+    if (mc->flush.prev == NULL) {
+        ngx_post_event((&mc->flush), &ngx_posted_events);
+    }
+
+    r->main->count++;
+
+    return NGX_DONE;
 }
 
 
-static char *
-ngx_http_memcached_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
+/*
+ * A key is always sent to the same connection of the same peer,
+ * so that the same keys requested at once are coalesced.
+ */
+
+static ngx_http_memcached_conn_t *
+ngx_http_memcached_get_conn(ngx_http_request_t *r,
+    ngx_http_memcached_loc_conf_t *mlcf, ngx_str_t *key)
 {
-    ngx_http_memcached_loc_conf_t *prev = parent;
-    ngx_http_memcached_loc_conf_t *conf = child;
+    uint32_t                        hash;
+    ngx_uint_t                      i, n, p;
+    ngx_http_memcached_conn_t      *mc;
+    ngx_http_upstream_rr_peer_t    *peer;
+    ngx_http_upstream_rr_peers_t   *peers;
+    ngx_http_memcached_pipeline_t  *pipe;
+
+    pipe = mlcf->pipe;
+    peers = pipe->upstream->peer.data;
+
+    if (pipe->conns == NULL) {
+        n = peers->number * pipe->pipeline;
+
+        pipe->conns = ngx_pcalloc(ngx_cycle->pool,
+                                  n * sizeof(ngx_http_memcached_conn_t));
+        if (pipe->conns == NULL) {
+            return NULL;
+        }
 
-    ngx_conf_merge_ptr_value(conf->upstream.local,
-                              prev->upstream.local, NULL);
+        for (i = 0; i < n; i++) {
+            mc = &pipe->conns[i];
+            peer = &peers->peer[i / pipe->pipeline];
 
-    ngx_conf_merge_ptr_value(conf->upstream.local,
-                              prev->upstream.local, NULL);
+            mc->conf = pipe->conf;
 
-    ngx_conf_merge_msec_value(conf->upstream.connect_timeout,
-                              prev->upstream.connect_timeout, 60000);
+            mc->peer.sockaddr = peer->sockaddr;
+            mc->peer.socklen = peer->socklen;
+            mc->peer.name = &peer->name;
 
-    ngx_conf_merge_msec_value(conf->upstream.send_timeout,
-                              prev->upstream.send_timeout, 60000);
+            ngx_queue_init(&mc->pending);
+            ngx_queue_init(&mc->batches);
 
-    ngx_conf_merge_msec_value(conf->upstream.read_timeout,
-                              prev->upstream.read_timeout, 60000);
+            mc->flush.handler = ngx_http_memcached_flush_handler;
+            mc->flush.data = mc;
+            mc->flush.log = ngx_cycle->log;
+        }
+    }
 
-    ngx_conf_merge_size_value(conf->upstream.buffer_size,
-                              prev->upstream.buffer_size,
-                              (size_t) ngx_pagesize);
+    hash = ngx_crc32_short(key->data, key->len);
 
-    ngx_conf_merge_bitmask_value(conf->upstream.next_upstream,
-                              prev->upstream.next_upstream,
-                              (NGX_CONF_BITMASK_SET
-                               |NGX_HTTP_UPSTREAM_FT_ERROR
-                               |NGX_HTTP_UPSTREAM_FT_TIMEOUT));
+    p = hash % peers->number;
 
-    if (conf->upstream.next_upstream & NGX_HTTP_UPSTREAM_FT_OFF) {
-        conf->upstream.next_upstream = NGX_CONF_BITMASK_SET
-                                       |NGX_HTTP_UPSTREAM_FT_OFF;
+    for (i = 0; i < peers->number; i++, p = (p + 1) % peers->number) {
+        peer = &peers->peer[p];
+
+        if (peer->down) {
+            continue;
+        }
+
+#if (NGX_HTTP_UPSTREAM_CHECK)
+        if (ngx_http_upstream_check_peer_down(peer->check_index)) {
+            continue;
+        }
+#endif
+
+        n = (hash / peers->number) % pipe->pipeline;
+
+        return &pipe->conns[p * pipe->pipeline + n];
     }
 
-    ngx_conf_merge_uint_value(conf->upstream.upstream_tries,
-                              prev->upstream.upstream_tries,
-                              NGX_CONF_UNSET_UINT);
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                  "no live memcached servers in upstream \"%V\"",
+                  peers->name);
 
-    if (conf->upstream.upstream == NULL) {
-        conf->upstream.upstream = prev->upstream.upstream;
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_memcached_add_key(ngx_http_memcached_conn_t *mc,
+    ngx_http_memcached_waiter_t *w, ngx_str_t *key)
+{
+    ngx_queue_t                 *q;
+    ngx_http_memcached_batch_t  *batch;
+    ngx_http_memcached_entry_t  *e;
+
+    batch = NULL;
+
+    if (!ngx_queue_empty(&mc->pending)) {
+        q = ngx_queue_last(&mc->pending);
+        batch = ngx_queue_data(q, ngx_http_memcached_batch_t, queue);
+
+        for (q = ngx_queue_head(&batch->entries);
+             q != ngx_queue_sentinel(&batch->entries);
+             q = ngx_queue_next(q))
+        {
+            e = ngx_queue_data(q, ngx_http_memcached_entry_t, queue);
+
+            if (e->key.len == key->len
+                && ngx_strncmp(e->key.data, key->data, key->len) == 0)
+            {
+                goto found;
+            }
+        }
     }
 
-    if (conf->index == NGX_CONF_UNSET) {
-        conf->index = prev->index;
+    if (batch == NULL || batch->nentries == NGX_HTTP_MEMCACHED_BATCH) {
+        batch = ngx_alloc(sizeof(ngx_http_memcached_batch_t), ngx_cycle->log);
+        if (batch == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_queue_init(&batch->entries);
+        batch->nentries = 0;
+        batch->len = 0;
+        batch->next = NULL;
+
+        ngx_queue_insert_tail(&mc->pending, &batch->queue);
     }
 
-    ngx_conf_merge_uint_value(conf->gzip_flag, prev->gzip_flag, 0);
+    e = ngx_alloc(sizeof(ngx_http_memcached_entry_t) + key->len,
+                  ngx_cycle->log);
+    if (e == NULL) {
+        return NGX_ERROR;
+    }
 
-    return NGX_CONF_OK;
+    ngx_queue_init(&e->waiters);
+
+    e->key.len = key->len;
+    e->key.data = (u_char *) &e[1];
+    ngx_memcpy(e->key.data, key->data, key->len);
+
+    e->found = 0;
+    e->flags = 0;
+    e->length = 0;
+    e->value = NULL;
+
+    ngx_queue_insert_tail(&batch->entries, &e->queue);
+
+    batch->nentries++;
+    batch->len += key->len;
+
+found:
+
+    w->entry = e;
+    ngx_queue_insert_tail(&e->waiters, &w->queue);
+
+    return NGX_OK;
 }
 
 
-static char *
-ngx_http_memcached_pass(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+static ngx_int_t
+ngx_http_memcached_connect(ngx_http_memcached_conn_t *mc)
 {
-    ngx_http_memcached_loc_conf_t *mlcf = conf;
+    ngx_int_t                      rc;
+    ngx_connection_t              *c;
+    ngx_http_memcached_loc_conf_t  *mlcf;
 
-    ngx_str_t                 *value;
-    ngx_url_t                  u;
-    ngx_http_core_loc_conf_t  *clcf;
+    mlcf = mc->conf;
 
-    if (mlcf->upstream.upstream) {
-        return "is duplicate";
+    if (mc->in.start == NULL) {
+        mc->in.start = ngx_alloc(mlcf->upstream.buffer_size, ngx_cycle->log);
+        if (mc->in.start == NULL) {
+            return NGX_ERROR;
+        }
+
+        mc->in.pos = mc->in.start;
+        mc->in.last = mc->in.start;
+        mc->in.end = mc->in.start + mlcf->upstream.buffer_size;
     }
 
-    value = cf->args->elts;
+    mc->peer.get = ngx_event_get_peer;
+    mc->peer.log = ngx_cycle->log;
+    mc->peer.log_error = NGX_ERROR_ERR;
+    mc->peer.tries = 1;
 
-    ngx_memzero(&u, sizeof(ngx_url_t));
+    if (mlcf->upstream.local && mlcf->upstream.local->value == NULL) {
+        mc->peer.local = mlcf->upstream.local->addr;
+    }
 
-    u.url = value[1];
-    u.no_resolve = 1;
+    rc = ngx_event_connect_peer(&mc->peer);
 
-    mlcf->upstream.upstream = ngx_http_upstream_add(cf, &u, 0);
-    if (mlcf->upstream.upstream == NULL) {
-        return NGX_CONF_ERROR;
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "memcached pipeline connect to %V: %i",
+                   mc->peer.name, rc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "could not connect to memcached %V", mc->peer.name);
+
+        if (mc->peer.connection) {
+            ngx_close_connection(mc->peer.connection);
+            mc->peer.connection = NULL;
+        }
+
+        return NGX_ERROR;
     }
 
-    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    c = mc->peer.connection;
 
-    clcf->handler = ngx_http_memcached_handler;
+    c->data = mc;
+    c->read->handler = ngx_http_memcached_read_handler;
+    c->write->handler = ngx_http_memcached_write_handler;
 
-    if (clcf->name.data[clcf->name.len - 1] == '/') {
-        clcf->auto_redirect = 1;
+    if (rc == NGX_AGAIN) {
+        ngx_add_timer(c->write, mlcf->upstream.connect_timeout);
+        return NGX_OK;
     }
 
-    mlcf->index = ngx_http_get_variable_index(cf, &ngx_http_memcached_key);
+    mc->connected = 1;
 
-    if (mlcf->index == NGX_ERROR) {
-        return NGX_CONF_ERROR;
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_memcached_flush_handler(ngx_event_t *ev)
+{
+    ngx_http_memcached_conn_t  *mc = ev->data;
+
+    if (mc->peer.connection == NULL) {
+        if (ngx_http_memcached_connect(mc) != NGX_OK) {
+            ngx_http_memcached_error(mc, NGX_HTTP_BAD_GATEWAY);
+        }
+
+        return;
+    }
+
+    if (!mc->connected) {
+        return;
+    }
+
+    if (ngx_http_memcached_send(mc) != NGX_OK) {
+        ngx_http_memcached_error(mc, NGX_HTTP_BAD_GATEWAY);
+    }
+}
+
+
+static void
+ngx_http_memcached_write_handler(ngx_event_t *wev)
+{
+    int                         err;
+    socklen_t                   len;
+    ngx_connection_t           *c;
+    ngx_http_memcached_conn_t  *mc;
+
+    c = wev->data;
+    mc = c->data;
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "memcached %V timed out", mc->peer.name);
+        ngx_http_memcached_error(mc, NGX_HTTP_GATEWAY_TIME_OUT);
+        return;
     }
 
+    if (!mc->connected) {
+        err = 0;
+        len = sizeof(int);
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            == -1)
+        {
+            err = ngx_errno;
+        }
+
+        if (err) {
+            ngx_log_error(NGX_LOG_ERR, c->log, err,
+                          "connect() to memcached %V failed", mc->peer.name);
+            ngx_http_memcached_error(mc, NGX_HTTP_BAD_GATEWAY);
+            return;
+        }
+
+        mc->connected = 1;
+
+        if (wev->timer_set) {
+            ngx_del_timer(wev);
+        }
+    }
+
+    if (ngx_http_memcached_send(mc) != NGX_OK) {
+        ngx_http_memcached_error(mc, NGX_HTTP_BAD_GATEWAY);
+    }
+}
+
+
+/*
+ * The pending batches are written to the output buffer as "get" commands
+ * and are then waited for in the order they were sent.
+ */
+
+static ngx_int_t
+ngx_http_memcached_send(ngx_http_memcached_conn_t *mc)
+{
+    u_char                      *p;
+    size_t                       size, len;
+    ssize_t                      n;
+    ngx_queue_t                 *q, *eq;
+    ngx_connection_t            *c;
+    ngx_http_memcached_batch_t  *batch;
+    ngx_http_memcached_entry_t  *e;
+
+    c = mc->peer.connection;
+
+    size = 0;
+
+    for (q = ngx_queue_head(&mc->pending);
+         q != ngx_queue_sentinel(&mc->pending);
+         q = ngx_queue_next(q))
+    {
+        batch = ngx_queue_data(q, ngx_http_memcached_batch_t, queue);
+        size += sizeof("get") - 1 + batch->nentries + batch->len
+                + sizeof(CRLF) - 1;
+    }
+
+    if (size) {
+        len = mc->out.last - mc->out.pos;
+
+        if ((size_t) (mc->out.end - mc->out.last) < size) {
+
+            if (len + size <= (size_t) (mc->out.end - mc->out.start)) {
+                ngx_memmove(mc->out.start, mc->out.pos, len);
+
+            } else {
+                p = ngx_alloc(len + size, c->log);
+                if (p == NULL) {
+                    return NGX_ERROR;
+                }
+
+                ngx_memcpy(p, mc->out.pos, len);
+
+                if (mc->out.start) {
+                    ngx_free(mc->out.start);
+                }
+
+                mc->out.start = p;
+                mc->out.end = p + len + size;
+            }
+
+            mc->out.pos = mc->out.start;
+            mc->out.last = mc->out.start + len;
+        }
+
+        p = mc->out.last;
+
+        while (!ngx_queue_empty(&mc->pending)) {
+            q = ngx_queue_head(&mc->pending);
+            batch = ngx_queue_data(q, ngx_http_memcached_batch_t, queue);
+
+            p = ngx_cpymem(p, "get", sizeof("get") - 1);
+
+            for (eq = ngx_queue_head(&batch->entries);
+                 eq != ngx_queue_sentinel(&batch->entries);
+                 eq = ngx_queue_next(eq))
+            {
+                e = ngx_queue_data(eq, ngx_http_memcached_entry_t, queue);
+
+                *p++ = ' ';
+                p = ngx_cpymem(p, e->key.data, e->key.len);
+            }
+
+            *p++ = CR; *p++ = LF;
+
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                           "memcached pipeline get: %ui keys",
+                           batch->nentries);
+
+            batch->next = ngx_queue_head(&batch->entries);
+
+            ngx_queue_remove(q);
+            ngx_queue_insert_tail(&mc->batches, q);
+        }
+
+        mc->out.last = p;
+    }
+
+    while (mc->out.pos < mc->out.last) {
+        n = c->send(c, mc->out.pos, mc->out.last - mc->out.pos);
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (n == NGX_AGAIN) {
+            ngx_add_timer(c->write, mc->conf->upstream.send_timeout);
+
+            if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            return NGX_OK;
+        }
+
+        mc->out.pos += n;
+    }
+
+    mc->out.pos = mc->out.start;
+    mc->out.last = mc->out.start;
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    if (ngx_queue_empty(&mc->batches)) {
+        c->idle = 1;
+        return NGX_OK;
+    }
+
+    c->idle = 0;
+
+    if (!c->read->timer_set) {
+        ngx_add_timer(c->read, mc->conf->upstream.read_timeout);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_memcached_read_handler(ngx_event_t *rev)
+{
+    size_t                      len;
+    ssize_t                     n;
+    ngx_connection_t           *c;
+    ngx_http_memcached_conn_t  *mc;
+
+    c = rev->data;
+    mc = c->data;
+
+    if (c->close) {
+        ngx_http_memcached_error(mc, NGX_HTTP_BAD_GATEWAY);
+        return;
+    }
+
+    if (rev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "memcached %V timed out", mc->peer.name);
+        ngx_http_memcached_error(mc, NGX_HTTP_GATEWAY_TIME_OUT);
+        return;
+    }
+
+    if (!mc->connected) {
+        return;
+    }
+
+    for ( ;; ) {
+
+        if (mc->in.last == mc->in.end) {
+            len = mc->in.last - mc->in.pos;
+
+            if (len == (size_t) (mc->in.end - mc->in.start)) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "memcached %V sent too long response line",
+                              mc->peer.name);
+                ngx_http_memcached_error(mc, NGX_HTTP_BAD_GATEWAY);
+                return;
+            }
+
+            ngx_memmove(mc->in.start, mc->in.pos, len);
+
+            mc->in.pos = mc->in.start;
+            mc->in.last = mc->in.start + len;
+        }
+
+        n = c->recv(c, mc->in.last, mc->in.end - mc->in.last);
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+
+            if (ngx_queue_empty(&mc->batches)) {
+
+                /* the idle connection was closed by memcached */
+
+                ngx_http_memcached_close(mc);
+
+                if (!ngx_queue_empty(&mc->pending)
+                    && ngx_http_memcached_connect(mc) != NGX_OK)
+                {
+                    ngx_http_memcached_error(mc, NGX_HTTP_BAD_GATEWAY);
+                }
+
+                return;
+            }
+
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "memcached %V prematurely closed connection",
+                          mc->peer.name);
+            ngx_http_memcached_error(mc, NGX_HTTP_BAD_GATEWAY);
+            return;
+        }
+
+        mc->in.last += n;
+
+        if (ngx_http_memcached_parse(mc) != NGX_OK) {
+            ngx_http_memcached_error(mc, NGX_HTTP_BAD_GATEWAY);
+            return;
+        }
+
+        /* the connection might be closed while delivering responses */
+
+        if (mc->peer.connection != c) {
+            return;
+        }
+
+        if (!ngx_queue_empty(&mc->batches)) {
+            ngx_add_timer(rev, mc->conf->upstream.read_timeout);
+        }
+    }
+
+    if (ngx_queue_empty(&mc->batches)) {
+        c->idle = 1;
+
+        if (rev->timer_set) {
+            ngx_del_timer(rev);
+        }
+    }
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_http_memcached_error(mc, NGX_HTTP_BAD_GATEWAY);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_memcached_parse(ngx_http_memcached_conn_t *mc)
+{
+    u_char                       *p, *last;
+    size_t                        n;
+    ngx_queue_t                  *q;
+    ngx_http_memcached_batch_t   *batch;
+    ngx_http_memcached_entry_t   *e;
+    ngx_http_memcached_waiter_t  *w;
+
+    for ( ;; ) {
+
+        if (mc->in.pos == mc->in.last) {
+            mc->in.pos = mc->in.start;
+            mc->in.last = mc->in.start;
+            return NGX_OK;
+        }
+
+        e = mc->value;
+
+        if (e) {
+            n = mc->in.last - mc->in.pos;
+
+            if (mc->rest > 2) {
+
+                if (n > mc->rest - 2) {
+                    n = mc->rest - 2;
+                }
+
+                e->value->last = ngx_cpymem(e->value->last, mc->in.pos, n);
+
+                mc->in.pos += n;
+                mc->rest -= n;
+
+                continue;
+            }
+
+            if (n > mc->rest) {
+                n = mc->rest;
+            }
+
+            if (ngx_strncmp(mc->in.pos, &CRLF[2 - mc->rest], n) != 0) {
+                ngx_log_error(NGX_LOG_ERR, mc->peer.connection->log, 0,
+                              "memcached %V sent invalid trailer",
+                              mc->peer.name);
+                return NGX_ERROR;
+            }
+
+            mc->in.pos += n;
+            mc->rest -= n;
+
+            if (mc->rest == 0) {
+                mc->value = NULL;
+                ngx_http_memcached_deliver(e, NGX_HTTP_OK);
+            }
+
+            continue;
+        }
+
+        last = ngx_strlchr(mc->in.pos, mc->in.last, LF);
+
+        if (last == NULL) {
+            return NGX_OK;
+        }
+
+        p = mc->in.pos;
+        mc->in.pos = last + 1;
+
+        if (last > p && last[-1] == CR) {
+            last--;
+        }
+
+        if (ngx_queue_empty(&mc->batches)) {
+            goto invalid;
+        }
+
+        q = ngx_queue_head(&mc->batches);
+        batch = ngx_queue_data(q, ngx_http_memcached_batch_t, queue);
+
+        if (last - p >= (ssize_t) sizeof("VALUE ") - 1
+            && ngx_strncmp(p, "VALUE ", sizeof("VALUE ") - 1) == 0)
+        {
+            if (ngx_http_memcached_parse_value(mc, batch, p, last) != NGX_OK) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (last - p == sizeof("END") - 1
+            && ngx_strncmp(p, "END", sizeof("END") - 1) == 0)
+        {
+            ngx_queue_remove(q);
+            ngx_http_memcached_complete(batch, NGX_HTTP_NOT_FOUND);
+            continue;
+        }
+
+        /* an error ends the command, the connection is still usable */
+
+        if ((last - p == sizeof("ERROR") - 1
+             && ngx_strncmp(p, "ERROR", sizeof("ERROR") - 1) == 0)
+            || (last - p >= (ssize_t) sizeof("CLIENT_ERROR") - 1
+                && ngx_strncmp(p, "CLIENT_ERROR",
+                               sizeof("CLIENT_ERROR") - 1) == 0)
+            || (last - p >= (ssize_t) sizeof("SERVER_ERROR") - 1
+                && ngx_strncmp(p, "SERVER_ERROR",
+                               sizeof("SERVER_ERROR") - 1) == 0))
+        {
+            ngx_log_error(NGX_LOG_ERR, mc->peer.connection->log, 0,
+                          "memcached %V sent error: \"%*s\"",
+                          mc->peer.name, last - p, p);
+
+            ngx_queue_remove(q);
+            ngx_http_memcached_complete(batch, NGX_HTTP_BAD_GATEWAY);
+            continue;
+        }
+
+        goto invalid;
+    }
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, mc->peer.connection->log, 0,
+                  "memcached %V sent invalid response: \"%*s\"",
+                  mc->peer.name, last - p, p);
+
+    return NGX_ERROR;
+}
+
+
+/*
+ * "VALUE <key> <flags> <bytes> [<cas unique>]", the values are sent
+ * in the order of the keys, and missing keys are skipped
+ */
+
+static ngx_int_t
+ngx_http_memcached_parse_value(ngx_http_memcached_conn_t *mc,
+    ngx_http_memcached_batch_t *batch, u_char *p, u_char *last)
+{
+    u_char                      *start;
+    ngx_int_t                    flags;
+    ngx_str_t                    key;
+    ngx_queue_t                 *q;
+    ngx_http_memcached_entry_t  *e;
+
+    p += sizeof("VALUE ") - 1;
+
+    key.data = p;
+
+    while (p < last && *p != ' ') { p++; }
+
+    key.len = p - key.data;
+
+    for (q = batch->next;
+         q != ngx_queue_sentinel(&batch->entries);
+         q = ngx_queue_next(q))
+    {
+        e = ngx_queue_data(q, ngx_http_memcached_entry_t, queue);
+
+        if (e->key.len == key.len
+            && ngx_strncmp(e->key.data, key.data, key.len) == 0)
+        {
+            goto found;
+        }
+    }
+
+    return NGX_ERROR;
+
+found:
+
+    batch->next = ngx_queue_next(q);
+
+    if (p++ == last) {
+        return NGX_ERROR;
+    }
+
+    start = p;
+
+    while (p < last && *p != ' ') { p++; }
+
+    flags = ngx_atoi(start, p - start);
+
+    if (flags == NGX_ERROR || p++ == last) {
+        return NGX_ERROR;
+    }
+
+    start = p;
+
+    while (p < last && *p != ' ') { p++; }
+
+    e->length = ngx_atosz(start, p - start);
+
+    if (e->length == (size_t) NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    e->value = ngx_alloc(sizeof(ngx_http_memcached_value_t) + e->length,
+                         mc->peer.connection->log);
+    if (e->value == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* the reference of the entry itself */
+
+    e->value->count = 1;
+    e->value->last = (u_char *) &e->value[1];
+
+    e->found = 1;
+    e->flags = flags;
+
+    mc->value = e;
+    mc->rest = e->length + 2;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_memcached_complete(ngx_http_memcached_batch_t *batch,
+    ngx_uint_t status)
+{
+    ngx_queue_t                 *q;
+    ngx_http_memcached_entry_t  *e;
+
+    while (!ngx_queue_empty(&batch->entries)) {
+        q = ngx_queue_head(&batch->entries);
+        e = ngx_queue_data(q, ngx_http_memcached_entry_t, queue);
+
+        ngx_queue_remove(q);
+
+        /* a value cut short by an error is not delivered */
+
+        if (!ngx_queue_empty(&e->waiters)) {
+            ngx_http_memcached_deliver(e, status);
+        }
+
+        if (e->value) {
+            ngx_http_memcached_free_value(e->value);
+        }
+
+        ngx_free(e);
+    }
+
+    ngx_free(batch);
+}
+
+
+static void
+ngx_http_memcached_deliver(ngx_http_memcached_entry_t *e, ngx_uint_t status)
+{
+    ngx_int_t                       rc;
+    ngx_buf_t                      *b;
+    ngx_chain_t                     out;
+    ngx_queue_t                    *q;
+    ngx_table_elt_t                *h;
+    ngx_connection_t               *c;
+    ngx_http_request_t             *r;
+    ngx_http_memcached_waiter_t    *w;
+    ngx_http_memcached_loc_conf_t  *mlcf;
+
+    while (!ngx_queue_empty(&e->waiters)) {
+        q = ngx_queue_head(&e->waiters);
+        w = ngx_queue_data(q, ngx_http_memcached_waiter_t, queue);
+
+        ngx_queue_remove(q);
+        w->entry = NULL;
+
+        r = w->request;
+        c = r->connection;
+
+        if (status != NGX_HTTP_OK) {
+
+            if (status == NGX_HTTP_NOT_FOUND) {
+                ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                              "key: \"%V\" was not found by memcached",
+                              &e->key);
+            }
+
+            ngx_http_finalize_request(r, status);
+            ngx_http_run_posted_requests(c);
+            continue;
+        }
+
+        mlcf = ngx_http_get_module_loc_conf(r, ngx_http_memcached_module);
+
+        if (e->flags & mlcf->gzip_flag) {
+            h = ngx_list_push(&r->headers_out.headers);
+            if (h == NULL) {
+                ngx_http_finalize_request(r, NGX_ERROR);
+                ngx_http_run_posted_requests(c);
+                continue;
+            }
+
+            h->hash = 1;
+            ngx_str_set(&h->key, "Content-Encoding");
+            ngx_str_set(&h->value, "gzip");
+
+            r->headers_out.content_encoding = h;
+        }
+
+        r->headers_out.status = NGX_HTTP_OK;
+        r->headers_out.content_length_n = e->length;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            ngx_http_finalize_request(r, rc);
+            ngx_http_run_posted_requests(c);
+            continue;
+        }
+
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+            ngx_http_run_posted_requests(c);
+            continue;
+        }
+
+        if (e->length) {
+            b->pos = (u_char *) &e->value[1];
+            b->last = e->value->last;
+            b->memory = 1;
+
+            w->value = e->value;
+            w->value->count++;
+        }
+
+        b->last_buf = (r == r->main) ? 1 : 0;
+        b->last_in_chain = 1;
+
+        out.buf = b;
+        out.next = NULL;
+
+        ngx_http_finalize_request(r, ngx_http_output_filter(r, &out));
+        ngx_http_run_posted_requests(c);
+    }
+}
+
+
+/*
+ * The requests waiting on the connection are finalized with the status
+ * after the connection is closed, as they may start new requests to it.
+ */
+
+static void
+ngx_http_memcached_error(ngx_http_memcached_conn_t *mc, ngx_uint_t status)
+{
+    ngx_queue_t                  failed, *q;
+    ngx_http_memcached_batch_t  *batch;
+
+    ngx_http_memcached_close(mc);
+
+    ngx_queue_init(&failed);
+
+    if (!ngx_queue_empty(&mc->batches)) {
+        ngx_queue_add(&failed, &mc->batches);
+    }
+
+    if (!ngx_queue_empty(&mc->pending)) {
+        ngx_queue_add(&failed, &mc->pending);
+    }
+
+    ngx_queue_init(&mc->batches);
+    ngx_queue_init(&mc->pending);
+
+    while (!ngx_queue_empty(&failed)) {
+        q = ngx_queue_head(&failed);
+        batch = ngx_queue_data(q, ngx_http_memcached_batch_t, queue);
+
+        ngx_queue_remove(q);
+
+        ngx_http_memcached_complete(batch, status);
+    }
+}
+
+
+static void
+ngx_http_memcached_close(ngx_http_memcached_conn_t *mc)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "memcached pipeline close %V", mc->peer.name);
+
+    if (mc->peer.connection) {
+        ngx_close_connection(mc->peer.connection);
+        mc->peer.connection = NULL;
+    }
+
+    if (mc->flush.prev) {
+        ngx_delete_posted_event((&mc->flush));
+    }
+
+    mc->connected = 0;
+    mc->value = NULL;
+
+    mc->in.pos = mc->in.start;
+    mc->in.last = mc->in.start;
+    mc->out.pos = mc->out.start;
+    mc->out.last = mc->out.start;
+}
+
+
+static void
+ngx_http_memcached_free_value(ngx_http_memcached_value_t *value)
+{
+    if (--value->count == 0) {
+        ngx_free(value);
+    }
+}
+
+
+static void
+ngx_http_memcached_cleanup(void *data)
+{
+    ngx_http_memcached_waiter_t  *w = data;
+
+    if (w->entry) {
+        ngx_queue_remove(&w->queue);
+        w->entry = NULL;
+    }
+
+    if (w->value) {
+        ngx_http_memcached_free_value(w->value);
+        w->value = NULL;
+    }
+}
+
+static void *
+ngx_http_memcached_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_memcached_main_conf_t  *mmcf;
+
+    mmcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_memcached_main_conf_t));
+    if (mmcf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&mmcf->pipelines, cf->pool, 4,
+                       sizeof(ngx_http_memcached_pipeline_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return mmcf;
+}
+
+
+static void *
+ngx_http_memcached_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_memcached_loc_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_memcached_loc_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->upstream.bufs.num = 0;
+     *     conf->upstream.next_upstream = 0;
+     *     conf->upstream.temp_path = NULL;
+     *     conf->upstream.uri = { 0, NULL };
+     *     conf->upstream.location = NULL;
+     */
+
+    conf->upstream.local = NGX_CONF_UNSET_PTR;
+    conf->upstream.connect_timeout = NGX_CONF_UNSET_MSEC;
+    conf->upstream.send_timeout = NGX_CONF_UNSET_MSEC;
+    conf->upstream.read_timeout = NGX_CONF_UNSET_MSEC;
+
+    conf->upstream.buffer_size = NGX_CONF_UNSET_SIZE;
+
+    conf->upstream.upstream_tries = NGX_CONF_UNSET_UINT;
+
+    /* the hardcoded values */
+    conf->upstream.cyclic_temp_file = 0;
+    conf->upstream.buffering = 0;
+    conf->upstream.ignore_client_abort = 0;
+    conf->upstream.send_lowat = 0;
+    conf->upstream.bufs.num = 0;
+    conf->upstream.busy_buffers_size = 0;
+    conf->upstream.max_temp_file_size = 0;
+    conf->upstream.temp_file_write_size = 0;
+    conf->upstream.intercept_errors = 1;
+    conf->upstream.intercept_404 = 1;
+    conf->upstream.pass_request_headers = 0;
+    conf->upstream.pass_request_body = 0;
+
+    conf->index = NGX_CONF_UNSET;
+    conf->gzip_flag = NGX_CONF_UNSET_UINT;
+    conf->pipeline = NGX_CONF_UNSET_UINT;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_memcached_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_memcached_loc_conf_t *prev = parent;
+    ngx_http_memcached_loc_conf_t *conf = child;
+
+    ngx_conf_merge_ptr_value(conf->upstream.local,
+                              prev->upstream.local, NULL);
+
+    ngx_conf_merge_ptr_value(conf->upstream.local,
+                              prev->upstream.local, NULL);
+
+    ngx_conf_merge_msec_value(conf->upstream.connect_timeout,
+                              prev->upstream.connect_timeout, 60000);
+
+    ngx_conf_merge_msec_value(conf->upstream.send_timeout,
+                              prev->upstream.send_timeout, 60000);
+
+    ngx_conf_merge_msec_value(conf->upstream.read_timeout,
+                              prev->upstream.read_timeout, 60000);
+
+    ngx_conf_merge_size_value(conf->upstream.buffer_size,
+                              prev->upstream.buffer_size,
+                              (size_t) ngx_pagesize);
+
+    ngx_conf_merge_bitmask_value(conf->upstream.next_upstream,
+                              prev->upstream.next_upstream,
+                              (NGX_CONF_BITMASK_SET
+                               |NGX_HTTP_UPSTREAM_FT_ERROR
+                               |NGX_HTTP_UPSTREAM_FT_TIMEOUT));
+
+    if (conf->upstream.next_upstream & NGX_HTTP_UPSTREAM_FT_OFF) {
+        conf->upstream.next_upstream = NGX_CONF_BITMASK_SET
+                                       |NGX_HTTP_UPSTREAM_FT_OFF;
+    }
+
+    ngx_conf_merge_uint_value(conf->upstream.upstream_tries,
+                              prev->upstream.upstream_tries,
+                              NGX_CONF_UNSET_UINT);
+
+    if (conf->upstream.upstream == NULL) {
+        conf->upstream.upstream = prev->upstream.upstream;
+    }
+
+    if (conf->index == NGX_CONF_UNSET) {
+        conf->index = prev->index;
+    }
+
+    ngx_conf_merge_uint_value(conf->gzip_flag, prev->gzip_flag, 0);
+
+    ngx_conf_merge_uint_value(conf->pipeline, prev->pipeline, 0);
+
+    if (conf->pipeline && conf->upstream.upstream) {
+        conf->pipe = ngx_http_memcached_add_pipeline(cf, conf);
+        if (conf->pipe == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_http_memcached_pipeline_t *
+ngx_http_memcached_add_pipeline(ngx_conf_t *cf,
+    ngx_http_memcached_loc_conf_t *mlcf)
+{
+    ngx_uint_t                       i;
+    ngx_http_memcached_pipeline_t   *pipe, **pipep;
+    ngx_http_memcached_main_conf_t  *mmcf;
+
+    mmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_memcached_module);
+
+    pipep = mmcf->pipelines.elts;
+
+    for (i = 0; i < mmcf->pipelines.nelts; i++) {
+        pipe = pipep[i];
+
+        if (pipe->upstream == mlcf->upstream.upstream) {
+
+            if (pipe->pipeline < mlcf->pipeline) {
+                pipe->pipeline = mlcf->pipeline;
+            }
+
+            return pipe;
+        }
+    }
+
+    pipe = ngx_pcalloc(cf->pool, sizeof(ngx_http_memcached_pipeline_t));
+    if (pipe == NULL) {
+        return NULL;
+    }
+
+    pipe->upstream = mlcf->upstream.upstream;
+    pipe->pipeline = mlcf->pipeline;
+    pipe->conf = mlcf;
+
+    pipep = ngx_array_push(&mmcf->pipelines);
+    if (pipep == NULL) {
+        return NULL;
+    }
+
+    *pipep = pipe;
+
+    return pipe;
+}
+
+
+static char *
+ngx_http_memcached_pass(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_memcached_loc_conf_t *mlcf = conf;
+
+    ngx_str_t                 *value;
+    ngx_url_t                  u;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    if (mlcf->upstream.upstream) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    ngx_memzero(&u, sizeof(ngx_url_t));
+
+    u.url = value[1];
+    u.no_resolve = 1;
+
+    mlcf->upstream.upstream = ngx_http_upstream_add(cf, &u, 0);
+    if (mlcf->upstream.upstream == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+
+    clcf->handler = ngx_http_memcached_handler;
+
+    if (clcf->name.data[clcf->name.len - 1] == '/') {
+        clcf->auto_redirect = 1;
+    }
+
+    mlcf->index = ngx_http_get_variable_index(cf, &ngx_http_memcached_key);
+
+    if (mlcf->index == NGX_ERROR) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_memcached_set_pipeline(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_memcached_loc_conf_t *mlcf = conf;
+
+    ngx_int_t   n;
+    ngx_str_t  *value;
+
+    if (mlcf->pipeline != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        mlcf->pipeline = 0;
+        return NGX_CONF_OK;
+    }
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid number of connections \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    mlcf->pipeline = n;
+
     return NGX_CONF_OK;
 }
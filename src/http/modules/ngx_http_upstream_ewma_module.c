@@ -0,0 +1,672 @@
+
+/*
+ * Copyright (C) 2010-2013 Alibaba Group Holding Limited
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * The cost of a peer is the exponentially weighted moving average
+ * of its response time, in microseconds.  A response slower than the
+ * average replaces it ("peak"), so a degrading peer is avoided at once,
+ * while faster responses only bring the cost down gradually.
+ */
+
+typedef struct {
+    ngx_atomic_t                       cost;
+    ngx_atomic_t                       stamp;
+    ngx_atomic_t                       inflight;
+} ngx_http_upstream_ewma_peer_t;
+
+
+typedef struct {
+    ngx_shm_zone_t                    *shm_zone;
+    ngx_array_t                        upstreams;
+    ngx_uint_t                         npeers;
+} ngx_http_upstream_ewma_main_conf_t;
+
+
+typedef struct {
+    ngx_msec_t                         decay;
+    ngx_http_upstream_rr_peers_t      *rr_peers;
+    ngx_http_upstream_ewma_peer_t    **peers;
+} ngx_http_upstream_ewma_conf_t;
+
+
+typedef struct {
+    /* the round robin data must be first */
+    ngx_http_upstream_rr_peer_data_t   rrp;
+
+    ngx_http_upstream_ewma_conf_t     *conf;
+    ngx_http_upstream_ewma_peer_t    **peers;
+    ngx_msec_t                         start;
+
+    ngx_event_get_peer_pt              get_rr_peer;
+    ngx_event_free_peer_pt             free_rr_peer;
+} ngx_http_upstream_ewma_peer_data_t;
+
+
+static ngx_int_t ngx_http_upstream_init_ewma_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_ewma_peer(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_upstream_free_ewma_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static ngx_int_t ngx_http_upstream_ewma_next(
+    ngx_http_upstream_ewma_peer_data_t *ep, ngx_uint_t i, ngx_uint_t skip,
+    time_t now);
+static uint64_t ngx_http_upstream_ewma_cost(
+    ngx_http_upstream_ewma_peer_data_t *ep, ngx_uint_t i);
+static void ngx_http_upstream_ewma_update(ngx_http_upstream_ewma_peer_t *peer,
+    ngx_msec_t decay, ngx_msec_t time);
+
+static ngx_int_t ngx_http_upstream_ewma_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static void *ngx_http_upstream_ewma_create_main_conf(ngx_conf_t *cf);
+static void *ngx_http_upstream_ewma_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_ewma(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_ewma_commands[] = {
+
+    { ngx_string("ewma"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
+      ngx_http_upstream_ewma,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_ewma_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    ngx_http_upstream_ewma_create_main_conf, /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_ewma_create_conf,    /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_ewma_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_ewma_module_ctx,    /* module context */
+    ngx_http_upstream_ewma_commands,       /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_init_ewma(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_uint_t                           n;
+    ngx_http_upstream_rr_peers_t        *peers;
+    ngx_http_upstream_ewma_conf_t       *ecf;
+    ngx_http_upstream_ewma_main_conf_t  *emcf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "init ewma");
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    peers = us->peer.data;
+
+    n = peers->number;
+
+    if (peers->next) {
+        n += peers->next->number;
+    }
+
+    /* the statistics are allocated in the shared zone once it is created */
+
+    ecf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_ewma_module);
+
+    ecf->rr_peers = peers;
+
+    ecf->peers = ngx_pcalloc(cf->pool,
+                             n * sizeof(ngx_http_upstream_ewma_peer_t *));
+    if (ecf->peers == NULL) {
+        return NGX_ERROR;
+    }
+
+    emcf = ngx_http_conf_get_module_main_conf(cf,
+                                              ngx_http_upstream_ewma_module);
+
+    emcf->npeers += n;
+
+    emcf->shm_zone->shm.size = ngx_http_upstream_shared_size(emcf->npeers,
+                                      sizeof(ngx_http_upstream_ewma_peer_t));
+
+    us->peer.init = ngx_http_upstream_init_ewma_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_ewma_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_ewma_conf_t       *ecf;
+    ngx_http_upstream_ewma_peer_data_t  *ep;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init ewma peer");
+
+    ecf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_ewma_module);
+
+    ep = ngx_palloc(r->pool, sizeof(ngx_http_upstream_ewma_peer_data_t));
+    if (ep == NULL) {
+        return NGX_ERROR;
+    }
+
+    ep->conf = ecf;
+    ep->peers = ecf->peers;
+    ep->start = 0;
+
+    r->upstream->peer.data = &ep->rrp;
+
+    if (ngx_http_upstream_init_round_robin_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.get = ngx_http_upstream_get_ewma_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_ewma_peer;
+
+    ep->get_rr_peer = ngx_http_upstream_get_round_robin_peer;
+    ep->free_rr_peer = ngx_http_upstream_free_round_robin_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_ewma_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_ewma_peer_data_t  *ep = data;
+
+    time_t                         now;
+    uint64_t                       cost1, cost2;
+    uintptr_t                      m;
+    ngx_int_t                      rc, i, j, w1, w2;
+    ngx_uint_t                     k, n, p;
+    ngx_http_upstream_rr_peer_t   *best;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get ewma peer, try: %ui", pc->tries);
+
+    if (ep->rrp.peers->single) {
+        return ep->get_rr_peer(pc, &ep->rrp);
+    }
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    now = ngx_time();
+
+    peers = ep->rrp.peers;
+
+    /*
+     * power of two choices: two random live peers are compared,
+     * the one with the lower cost times the number of requests
+     * in flight, relative to its weight, is selected
+     */
+
+    i = ngx_http_upstream_ewma_next(ep, ngx_random() % peers->number,
+                                    peers->number, now);
+
+    if (i == NGX_ERROR) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get ewma peer, no peer found");
+
+        goto failed;
+    }
+
+    j = ngx_http_upstream_ewma_next(ep, ngx_random() % peers->number, i, now);
+
+    p = i;
+
+    if (j != NGX_ERROR) {
+        w1 = peers->peer[i].weight;
+        w2 = peers->peer[j].weight;
+
+        if (peers->breaker) {
+            w1 = ngx_http_upstream_breaker_weight(peers, i, w1);
+            w2 = ngx_http_upstream_breaker_weight(peers, j, w2);
+        }
+
+        cost1 = ngx_http_upstream_ewma_cost(ep, i) * w2;
+        cost2 = ngx_http_upstream_ewma_cost(ep, j) * w1;
+
+        ngx_log_debug4(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get ewma peer, %i:%uL %i:%uL", i, cost1, j, cost2);
+
+        if (cost2 < cost1) {
+            p = j;
+        }
+    }
+
+    best = &peers->peer[p];
+
+    if (now - best->checked > best->fail_timeout) {
+        best->checked = now;
+    }
+
+    pc->sockaddr = best->sockaddr;
+    pc->socklen = best->socklen;
+    pc->name = &best->name;
+
+    ep->rrp.current = p;
+
+    n = p / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+    ep->rrp.tried[n] |= m;
+
+    if (ngx_http_upstream_breaker_select(&ep->rrp) != NGX_OK) {
+
+        /* the peer is marked as tried, so another one is selected */
+
+        return ngx_http_upstream_get_ewma_peer(pc, ep);
+    }
+
+    (void) ngx_atomic_fetch_add(&ep->peers[p]->inflight, 1);
+    ep->start = ngx_current_msec;
+
+    if (pc->tries == 1 && peers->next) {
+        pc->tries += peers->next->number;
+    }
+
+    return NGX_OK;
+
+failed:
+
+    if (peers->next) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get ewma peer, backup servers");
+
+        ep->peers += peers->number;
+
+        ep->rrp.peers = peers->next;
+        pc->tries = ep->rrp.peers->number;
+
+        n = (ep->rrp.peers->number + (8 * sizeof(uintptr_t) - 1))
+                / (8 * sizeof(uintptr_t));
+
+        for (k = 0; k < n; k++) {
+             ep->rrp.tried[k] = 0;
+        }
+
+        rc = ngx_http_upstream_get_ewma_peer(pc, ep);
+
+        if (rc != NGX_BUSY) {
+            return rc;
+        }
+    }
+
+    /* all peers failed, mark them as live for quick recovery */
+
+    for (k = 0; k < peers->number; k++) {
+        peers->peer[k].fails = 0;
+    }
+
+    pc->name = peers->name;
+
+    return NGX_BUSY;
+}
+
+
+static void
+ngx_http_upstream_free_ewma_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_upstream_ewma_peer_data_t  *ep = data;
+
+    ngx_msec_t                      time;
+    ngx_http_upstream_ewma_peer_t  *peer;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free ewma peer %ui %ui", pc->tries, state);
+
+    if (ep->rrp.peers->single) {
+        ep->free_rr_peer(pc, &ep->rrp, state);
+        return;
+    }
+
+    peer = ep->peers[ep->rrp.current];
+
+    (void) ngx_atomic_fetch_add(&peer->inflight, (ngx_atomic_int_t) -1);
+
+    time = ngx_current_msec - ep->start;
+
+    /*
+     * a failed peer may respond fast with an error, so its
+     * response time is taken as no less than the decay time
+     */
+
+    if ((state & NGX_PEER_FAILED) && time < ep->conf->decay) {
+        time = ep->conf->decay;
+    }
+
+    ngx_http_upstream_ewma_update(peer, ep->conf->decay, time);
+
+    ep->free_rr_peer(pc, &ep->rrp, state);
+}
+
+
+/*
+ * Returns the first live peer not yet tried starting from the peer "i",
+ * other than the peer "skip".
+ */
+
+static ngx_int_t
+ngx_http_upstream_ewma_next(ngx_http_upstream_ewma_peer_data_t *ep,
+    ngx_uint_t i, ngx_uint_t skip, time_t now)
+{
+    uintptr_t                      m;
+    ngx_uint_t                     k, n;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    peers = ep->rrp.peers;
+
+    for (k = 0; k < peers->number; k++, i = (i + 1) % peers->number) {
+
+        if (i == skip) {
+            continue;
+        }
+
+        n = i / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+        if (ep->rrp.tried[n] & m) {
+            continue;
+        }
+
+        peer = &peers->peer[i];
+
+        if (peer->down) {
+            continue;
+        }
+
+        if (peers->breaker
+            && ngx_http_upstream_breaker_test(peers, i) != NGX_OK)
+        {
+            continue;
+        }
+
+#if (NGX_HTTP_UPSTREAM_CHECK)
+        if (ngx_http_upstream_check_peer_down(peer->check_index)) {
+            continue;
+        }
+#endif
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            continue;
+        }
+
+        return i;
+    }
+
+    return NGX_ERROR;
+}
+
+
+static uint64_t
+ngx_http_upstream_ewma_cost(ngx_http_upstream_ewma_peer_data_t *ep,
+    ngx_uint_t i)
+{
+    uint64_t                        cost;
+    ngx_msec_t                      elapsed;
+    ngx_atomic_int_t                inflight;
+    ngx_http_upstream_ewma_peer_t  *peer;
+
+    peer = ep->peers[i];
+
+    /* the cost decays while the peer is not used */
+
+    elapsed = ngx_current_msec - (ngx_msec_t) peer->stamp;
+
+    cost = (uint64_t) peer->cost * ep->conf->decay
+           / (ep->conf->decay + elapsed);
+
+    /* the counter may be below zero for a while after reload */
+
+    inflight = (ngx_atomic_int_t) peer->inflight;
+
+    if (inflight < 0) {
+        inflight = 0;
+    }
+
+    return (cost + 1) * (inflight + 1);
+}
+
+
+/*
+ * The weight of the previous average is decay / (decay + elapsed),
+ * a first order approximation of exp(-elapsed / decay).
+ */
+
+static void
+ngx_http_upstream_ewma_update(ngx_http_upstream_ewma_peer_t *peer,
+    ngx_msec_t decay, ngx_msec_t time)
+{
+    uint64_t           rtt;
+    ngx_msec_t         now, elapsed;
+    ngx_atomic_uint_t  old, cost;
+
+    now = ngx_current_msec;
+    rtt = (uint64_t) time * 1000;
+
+    do {
+        old = peer->cost;
+        elapsed = now - (ngx_msec_t) peer->stamp;
+
+        if (rtt >= old) {
+            cost = rtt;
+
+        } else {
+            cost = ((uint64_t) old * decay + rtt * elapsed)
+                   / (decay + elapsed);
+        }
+
+    } while (!ngx_atomic_cmp_set(&peer->cost, old, cost));
+
+    peer->stamp = now;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_ewma_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_upstream_ewma_main_conf_t  *emcf = shm_zone->data;
+
+    ngx_uint_t                       i, j, n;
+    ngx_http_upstream_rr_peers_t    *peers;
+    ngx_http_upstream_ewma_conf_t  **ecfp;
+
+    if (ngx_http_upstream_shared_init(shm_zone) != NGX_OK) {
+        goto failed;
+    }
+
+    ecfp = emcf->upstreams.elts;
+
+    for (i = 0; i < emcf->upstreams.nelts; i++) {
+        n = 0;
+
+        for (peers = ecfp[i]->rr_peers; peers; peers = peers->next) {
+            for (j = 0; j < peers->number; j++) {
+                ecfp[i]->peers[n] = ngx_http_upstream_shared_get(shm_zone,
+                                       peers->name, &peers->peer[j].name,
+                                       sizeof(ngx_http_upstream_ewma_peer_t));
+                if (ecfp[i]->peers[n] == NULL) {
+                    goto failed;
+                }
+
+                n++;
+            }
+        }
+    }
+
+    ngx_http_upstream_shared_release(shm_zone);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                  "could not allocate ewma statistics");
+
+    return NGX_ERROR;
+}
+
+
+static void *
+ngx_http_upstream_ewma_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_ewma_main_conf_t  *emcf;
+
+    emcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_ewma_main_conf_t));
+    if (emcf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&emcf->upstreams, cf->pool, 4,
+                       sizeof(ngx_http_upstream_ewma_conf_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return emcf;
+}
+
+
+static void *
+ngx_http_upstream_ewma_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_ewma_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_ewma_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->rr_peers = NULL;
+     *     conf->peers = NULL;
+     */
+
+    conf->decay = NGX_CONF_UNSET_MSEC;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_ewma(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_str_t                            *value, s, name;
+    ngx_http_upstream_srv_conf_t         *uscf;
+    ngx_http_upstream_ewma_conf_t        *ecf, **ecfp;
+    ngx_http_upstream_ewma_main_conf_t   *emcf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    ecf = ngx_http_conf_upstream_srv_conf(uscf, ngx_http_upstream_ewma_module);
+
+    if (ecf->decay != NGX_CONF_UNSET_MSEC) {
+        return "is duplicate";
+    }
+
+    ecf->decay = 10000;
+
+    value = cf->args->elts;
+
+    if (cf->args->nelts == 2) {
+
+        if (ngx_strncmp(value[1].data, "decay=", 6) != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+
+        s.len = value[1].len - 6;
+        s.data = &value[1].data[6];
+
+        ecf->decay = ngx_parse_time(&s, 0);
+
+        if (ecf->decay == (ngx_msec_t) NGX_ERROR || ecf->decay == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid decay \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    if (uscf->peer.init_upstream) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "load balancing method redefined");
+    }
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_ewma;
+
+    uscf->flags = NGX_HTTP_UPSTREAM_CREATE
+                  |NGX_HTTP_UPSTREAM_WEIGHT
+                  |NGX_HTTP_UPSTREAM_MAX_FAILS
+                  |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_HTTP_UPSTREAM_DOWN
+                  |NGX_HTTP_UPSTREAM_BACKUP;
+
+    emcf = ngx_http_conf_get_module_main_conf(cf,
+                                              ngx_http_upstream_ewma_module);
+
+    if (emcf->shm_zone == NULL) {
+        ngx_str_set(&name, "upstream_ewma");
+
+        emcf->shm_zone = ngx_shared_memory_add(cf, &name, 8 * ngx_pagesize,
+                                               &ngx_http_upstream_ewma_module);
+        if (emcf->shm_zone == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        emcf->shm_zone->init = ngx_http_upstream_ewma_init_zone;
+        emcf->shm_zone->data = emcf;
+    }
+
+    ecfp = ngx_array_push(&emcf->upstreams);
+    if (ecfp == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *ecfp = ecf;
+
+    return NGX_CONF_OK;
+}
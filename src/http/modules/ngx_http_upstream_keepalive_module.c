@@ -10,13 +10,38 @@
 #include <ngx_http.h>
 
 
+typedef struct {
+    ngx_atomic_t                       idle;
+    ngx_atomic_t                       hits;
+    ngx_atomic_t                       misses;
+    ngx_atomic_t                       evicted;
+    ngx_atomic_t                       expired;
+    ngx_atomic_t                       retired;
+} ngx_http_upstream_keepalive_stat_t;
+
+
+typedef struct {
+    ngx_shm_zone_t                    *shm_zone;
+    ngx_array_t                        upstreams;
+} ngx_http_upstream_keepalive_main_conf_t;
+
+
 typedef struct {
     ngx_uint_t                         max_cached;
+    ngx_uint_t                         max_per_peer;
+    ngx_uint_t                         min_per_peer;
+    ngx_uint_t                         max_requests;
     ngx_msec_t                         keepalive_timeout;
 
     ngx_queue_t                        cache;
     ngx_queue_t                        free;
 
+    ngx_queue_t                        pools;
+    ngx_queue_t                        free_pools;
+
+    ngx_str_t                          name;
+    ngx_http_upstream_keepalive_stat_t  *stat;
+
     ngx_http_upstream_init_pt          original_init_upstream;
     ngx_http_upstream_init_peer_pt     original_init_peer;
 
@@ -41,14 +66,28 @@ typedef struct {
 } ngx_http_upstream_keepalive_peer_data_t;
 
 
+/* the connections cached to a single peer */
+
+typedef struct {
+    ngx_queue_t                        queue;
+    ngx_queue_t                        cache;
+    ngx_uint_t                         cached;
+
+    socklen_t                          socklen;
+    u_char                             sockaddr[NGX_SOCKADDRLEN];
+
+} ngx_http_upstream_keepalive_pool_t;
+
+
 typedef struct {
     ngx_http_upstream_keepalive_srv_conf_t  *conf;
+    ngx_http_upstream_keepalive_pool_t      *pool;
 
     ngx_queue_t                        queue;
+    ngx_queue_t                        peer_queue;
     ngx_connection_t                  *connection;
 
-    socklen_t                          socklen;
-    u_char                             sockaddr[NGX_SOCKADDRLEN];
+    ngx_msec_t                         idle_start;
 
 } ngx_http_upstream_keepalive_cache_t;
 
@@ -60,6 +99,16 @@ static ngx_int_t ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc,
 static void ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t state);
 
+static ngx_http_upstream_keepalive_pool_t *ngx_http_upstream_keepalive_pool(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf, ngx_peer_connection_t *pc,
+    ngx_uint_t create);
+static void ngx_http_upstream_keepalive_remove(
+    ngx_http_upstream_keepalive_cache_t *item);
+static ngx_http_upstream_keepalive_cache_t *
+    ngx_http_upstream_keepalive_victim(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_http_upstream_keepalive_pool_t *pool);
+
 static void ngx_http_upstream_keepalive_dummy_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close(ngx_connection_t *c);
@@ -72,17 +121,30 @@ static void ngx_http_upstream_keepalive_save_session(ngx_peer_connection_t *pc,
     void *data);
 #endif
 
+static ngx_int_t ngx_http_upstream_keepalive_init_zone(
+    ngx_shm_zone_t *shm_zone, void *data);
+static ngx_int_t ngx_http_upstream_keepalive_status_handler(
+    ngx_http_request_t *r);
+static size_t ngx_http_upstream_keepalive_status_size(ngx_http_request_t *r);
+static u_char *ngx_http_upstream_keepalive_status_write(ngx_http_request_t *r,
+    u_char *p, u_char *last);
+
+static void *ngx_http_upstream_keepalive_create_main_conf(ngx_conf_t *cf);
 static void *ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf);
 static char *ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_upstream_keepalive_timeout(ngx_conf_t *cf,
     ngx_command_t *cmd, void *conf);
+static char *ngx_http_upstream_keepalive_requests(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_upstream_keepalive_status(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
 
 
 static ngx_command_t  ngx_http_upstream_keepalive_commands[] = {
 
     { ngx_string("keepalive"),
-      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1234,
       ngx_http_upstream_keepalive,
       0,
       0,
@@ -95,6 +157,20 @@ static ngx_command_t  ngx_http_upstream_keepalive_commands[] = {
       0,
       NULL },
 
+    { ngx_string("keepalive_requests"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_http_upstream_keepalive_requests,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("keepalive_status"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_upstream_keepalive_status,
+      0,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -103,7 +179,8 @@ static ngx_http_module_t  ngx_http_upstream_keepalive_module_ctx = {
     NULL,                                  /* preconfiguration */
     NULL,                                  /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
+    ngx_http_upstream_keepalive_create_main_conf,
+                                           /* create main configuration */
     NULL,                                  /* init main configuration */
 
     ngx_http_upstream_keepalive_create_conf, /* create server configuration */
@@ -135,6 +212,7 @@ ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us)
 {
     ngx_uint_t                               i;
+    ngx_http_upstream_keepalive_pool_t      *pools;
     ngx_http_upstream_keepalive_srv_conf_t  *kcf;
     ngx_http_upstream_keepalive_cache_t     *cached;
 
@@ -168,6 +246,26 @@ ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
         cached[i].conf = kcf;
     }
 
+    if (kcf->max_requests == NGX_CONF_UNSET_UINT) {
+        kcf->max_requests = 0;
+    }
+
+    /* there are no more peers with cached connections than cache items */
+
+    pools = ngx_pcalloc(cf->pool,
+                 sizeof(ngx_http_upstream_keepalive_pool_t) * kcf->max_cached);
+    if (pools == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_queue_init(&kcf->pools);
+    ngx_queue_init(&kcf->free_pools);
+
+    for (i = 0; i < kcf->max_cached; i++) {
+        ngx_queue_init(&pools[i].cache);
+        ngx_queue_insert_head(&kcf->free_pools, &pools[i].queue);
+    }
+
     return NGX_OK;
 }
 
@@ -219,10 +317,12 @@ static ngx_int_t
 ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
 {
     ngx_http_upstream_keepalive_peer_data_t  *kp = data;
+    ngx_http_upstream_keepalive_pool_t       *pool;
     ngx_http_upstream_keepalive_cache_t      *item;
+    ngx_http_upstream_keepalive_srv_conf_t   *kcf;
 
     ngx_int_t          rc;
-    ngx_queue_t       *q, *cache;
+    ngx_queue_t       *q;
     ngx_connection_t  *c;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
@@ -238,42 +338,67 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
 
     /* search cache for suitable connection */
 
-    cache = &kp->conf->cache;
+    kcf = kp->conf;
 
-    for (q = ngx_queue_head(cache);
-         q != ngx_queue_sentinel(cache);
-         q = ngx_queue_next(q))
-    {
-        item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
+    pool = ngx_http_upstream_keepalive_pool(kcf, pc, 0);
+
+    while (pool) {
+
+        /* the most recently used connection is the least likely to expire */
+
+        q = ngx_queue_head(&pool->cache);
+        item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t,
+                              peer_queue);
         c = item->connection;
 
-        if (ngx_memn2cmp((u_char *) &item->sockaddr, (u_char *) pc->sockaddr,
-                         item->socklen, pc->socklen)
-            == 0)
-        {
-            ngx_queue_remove(q);
-            ngx_queue_insert_head(&kp->conf->free, q);
+        if (pool->cached == 1) {
+            pool = NULL;
+        }
+
+        ngx_http_upstream_keepalive_remove(item);
 
+        /*
+         * a connection idle for keepalive_timeout may be already closed
+         * by the peer even if the timer has not yet expired
+         */
+
+        if (kcf->keepalive_timeout != NGX_CONF_UNSET_MSEC
+            && kcf->keepalive_timeout != 0
+            && (ngx_msec_int_t) (ngx_current_msec - item->idle_start)
+               >= (ngx_msec_int_t) kcf->keepalive_timeout)
+        {
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
-                           "get keepalive peer: using connection %p", c);
+                           "get keepalive peer: expired connection %p", c);
 
-            c->idle = 0;
-            c->log = pc->log;
-            c->read->log = pc->log;
-            c->write->log = pc->log;
-            c->pool->log = pc->log;
+            (void) ngx_atomic_fetch_add(&kcf->stat->expired, 1);
 
-            if (c->read->timer_set) {
-                ngx_del_timer(c->read);
-            }
+            ngx_http_upstream_keepalive_close(c);
+            continue;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get keepalive peer: using connection %p", c);
 
-            pc->connection = c;
-            pc->cached = 1;
+        (void) ngx_atomic_fetch_add(&kcf->stat->hits, 1);
 
-            return NGX_DONE;
+        c->idle = 0;
+        c->log = pc->log;
+        c->read->log = pc->log;
+        c->write->log = pc->log;
+        c->pool->log = pc->log;
+
+        if (c->read->timer_set) {
+            ngx_del_timer(c->read);
         }
+
+        pc->connection = c;
+        pc->cached = 1;
+
+        return NGX_DONE;
     }
 
+    (void) ngx_atomic_fetch_add(&kcf->stat->misses, 1);
+
     return NGX_OK;
 }
 
@@ -283,7 +408,9 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     ngx_uint_t state)
 {
     ngx_http_upstream_keepalive_peer_data_t  *kp = data;
+    ngx_http_upstream_keepalive_pool_t       *pool;
     ngx_http_upstream_keepalive_cache_t      *item;
+    ngx_http_upstream_keepalive_srv_conf_t   *kcf;
 
     ngx_queue_t          *q;
     ngx_connection_t     *c;
@@ -312,6 +439,19 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
         goto invalid;
     }
 
+    kcf = kp->conf;
+
+    c->requests++;
+
+    if (kcf->max_requests && c->requests >= kcf->max_requests) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "free keepalive peer: retiring connection %p", c);
+
+        (void) ngx_atomic_fetch_add(&kcf->stat->retired, 1);
+
+        goto invalid;
+    }
+
     if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
         goto invalid;
     }
@@ -319,24 +459,41 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "free keepalive peer: saving connection %p", c);
 
-    if (ngx_queue_empty(&kp->conf->free)) {
+    pool = ngx_http_upstream_keepalive_pool(kcf, pc, 0);
 
-        q = ngx_queue_last(&kp->conf->cache);
-        ngx_queue_remove(q);
+    if ((pool && kcf->max_per_peer && pool->cached >= kcf->max_per_peer)
+        || ngx_queue_empty(&kcf->free))
+    {
+        item = ngx_http_upstream_keepalive_victim(kcf, pool);
 
-        item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "free keepalive peer: evicting connection %p",
+                       item->connection);
+
+        (void) ngx_atomic_fetch_add(&kcf->stat->evicted, 1);
 
+        ngx_http_upstream_keepalive_remove(item);
         ngx_http_upstream_keepalive_close(item->connection);
+    }
 
-    } else {
-        q = ngx_queue_head(&kp->conf->free);
-        ngx_queue_remove(q);
+    /* the pool may be freed if its last connection was evicted */
 
-        item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
-    }
+    pool = ngx_http_upstream_keepalive_pool(kcf, pc, 1);
+
+    q = ngx_queue_head(&kcf->free);
+    ngx_queue_remove(q);
+
+    item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
 
     item->connection = c;
-    ngx_queue_insert_head(&kp->conf->cache, q);
+    item->pool = pool;
+    item->idle_start = ngx_current_msec;
+
+    ngx_queue_insert_head(&kcf->cache, q);
+    ngx_queue_insert_head(&pool->cache, &item->peer_queue);
+    pool->cached++;
+
+    (void) ngx_atomic_fetch_add(&kcf->stat->idle, 1);
 
     pc->connection = NULL;
 
@@ -347,10 +504,10 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
         ngx_del_timer(c->write);
     }
 
-    if (kp->conf->keepalive_timeout != NGX_CONF_UNSET_MSEC &&
-        kp->conf->keepalive_timeout != 0)
+    if (kcf->keepalive_timeout != NGX_CONF_UNSET_MSEC &&
+        kcf->keepalive_timeout != 0)
     {
-        ngx_add_timer(c->read, kp->conf->keepalive_timeout);
+        ngx_add_timer(c->read, kcf->keepalive_timeout);
     }
 
     c->write->handler = ngx_http_upstream_keepalive_dummy_handler;
@@ -363,9 +520,6 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     c->write->log = ngx_cycle->log;
     c->pool->log = ngx_cycle->log;
 
-    item->socklen = pc->socklen;
-    ngx_memcpy(&item->sockaddr, pc->sockaddr, pc->socklen);
-
     if (c->read->ready) {
         ngx_http_upstream_keepalive_close_handler(c->read);
     }
@@ -376,6 +530,104 @@ invalid:
 }
 
 
+static ngx_http_upstream_keepalive_pool_t *
+ngx_http_upstream_keepalive_pool(ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_peer_connection_t *pc, ngx_uint_t create)
+{
+    ngx_queue_t                         *q;
+    ngx_http_upstream_keepalive_pool_t  *pool;
+
+    for (q = ngx_queue_head(&kcf->pools);
+         q != ngx_queue_sentinel(&kcf->pools);
+         q = ngx_queue_next(q))
+    {
+        pool = ngx_queue_data(q, ngx_http_upstream_keepalive_pool_t, queue);
+
+        if (ngx_memn2cmp((u_char *) &pool->sockaddr, (u_char *) pc->sockaddr,
+                         pool->socklen, pc->socklen)
+            == 0)
+        {
+            return pool;
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    q = ngx_queue_head(&kcf->free_pools);
+    ngx_queue_remove(q);
+    ngx_queue_insert_head(&kcf->pools, q);
+
+    pool = ngx_queue_data(q, ngx_http_upstream_keepalive_pool_t, queue);
+
+    pool->socklen = pc->socklen;
+    ngx_memcpy(&pool->sockaddr, pc->sockaddr, pc->socklen);
+
+    return pool;
+}
+
+
+static void
+ngx_http_upstream_keepalive_remove(ngx_http_upstream_keepalive_cache_t *item)
+{
+    ngx_http_upstream_keepalive_pool_t      *pool;
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf;
+
+    kcf = item->conf;
+    pool = item->pool;
+
+    ngx_queue_remove(&item->queue);
+    ngx_queue_insert_head(&kcf->free, &item->queue);
+
+    ngx_queue_remove(&item->peer_queue);
+
+    if (--pool->cached == 0) {
+        ngx_queue_remove(&pool->queue);
+        ngx_queue_insert_head(&kcf->free_pools, &pool->queue);
+    }
+
+    (void) ngx_atomic_fetch_add(&kcf->stat->idle, (ngx_atomic_int_t) -1);
+}
+
+
+/*
+ * The connection to close for a new one: the least recently used one
+ * of the same peer if the peer already has max_per_peer connections,
+ * otherwise the least recently used one of a peer with more than
+ * min_per_peer connections, if any.
+ */
+
+static ngx_http_upstream_keepalive_cache_t *
+ngx_http_upstream_keepalive_victim(ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_http_upstream_keepalive_pool_t *pool)
+{
+    ngx_queue_t                          *q;
+    ngx_http_upstream_keepalive_cache_t  *item;
+
+    if (pool && kcf->max_per_peer && pool->cached >= kcf->max_per_peer) {
+        q = ngx_queue_last(&pool->cache);
+        return ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t,
+                              peer_queue);
+    }
+
+    for (q = ngx_queue_last(&kcf->cache);
+         q != ngx_queue_sentinel(&kcf->cache);
+         q = ngx_queue_prev(q))
+    {
+        item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
+
+        if (item->pool == pool || item->pool->cached > kcf->min_per_peer) {
+            return item;
+        }
+    }
+
+    q = ngx_queue_last(&kcf->cache);
+
+    return ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
+}
+
+
 static void
 ngx_http_upstream_keepalive_dummy_handler(ngx_event_t *ev)
 {
@@ -387,8 +639,7 @@ ngx_http_upstream_keepalive_dummy_handler(ngx_event_t *ev)
 static void
 ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev)
 {
-    ngx_http_upstream_keepalive_srv_conf_t  *conf;
-    ngx_http_upstream_keepalive_cache_t     *item;
+    ngx_http_upstream_keepalive_cache_t  *item;
 
     int                n;
     char               buf[1];
@@ -424,12 +675,13 @@ ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev)
 close:
 
     item = c->data;
-    conf = item->conf;
 
-    ngx_http_upstream_keepalive_close(c);
+    if (!c->close) {
+        (void) ngx_atomic_fetch_add(&item->conf->stat->expired, 1);
+    }
 
-    ngx_queue_remove(&item->queue);
-    ngx_queue_insert_head(&conf->free, &item->queue);
+    ngx_http_upstream_keepalive_remove(item);
+    ngx_http_upstream_keepalive_close(c);
 }
 
 
@@ -479,6 +731,134 @@ ngx_http_upstream_keepalive_save_session(ngx_peer_connection_t *pc, void *data)
 #endif
 
 
+static ngx_int_t
+ngx_http_upstream_keepalive_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_upstream_keepalive_main_conf_t  *kmcf = shm_zone->data;
+
+    ngx_uint_t                                i;
+    ngx_http_upstream_keepalive_srv_conf_t  **kcfp;
+
+    if (ngx_http_upstream_shared_init(shm_zone) != NGX_OK) {
+        goto failed;
+    }
+
+    kcfp = kmcf->upstreams.elts;
+
+    for (i = 0; i < kmcf->upstreams.nelts; i++) {
+        kcfp[i]->stat = ngx_http_upstream_shared_get(shm_zone,
+                                &kcfp[i]->name, NULL,
+                                sizeof(ngx_http_upstream_keepalive_stat_t));
+        if (kcfp[i]->stat == NULL) {
+            goto failed;
+        }
+    }
+
+    ngx_http_upstream_shared_release(shm_zone);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                  "could not allocate keepalive statistics");
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_keepalive_status_handler(ngx_http_request_t *r)
+{
+    return ngx_http_send_json(r, ngx_http_upstream_keepalive_status_size,
+                              ngx_http_upstream_keepalive_status_write);
+}
+
+
+static size_t
+ngx_http_upstream_keepalive_status_size(ngx_http_request_t *r)
+{
+    size_t                                     size;
+    ngx_uint_t                                 i;
+    ngx_http_upstream_keepalive_srv_conf_t   **kcfp;
+    ngx_http_upstream_keepalive_main_conf_t   *kmcf;
+
+    kmcf = ngx_http_get_module_main_conf(r,
+                                         ngx_http_upstream_keepalive_module);
+
+    kcfp = kmcf->upstreams.elts;
+
+    size = sizeof("{\"upstreams\": {\n}}\n");
+
+    for (i = 0; i < kmcf->upstreams.nelts; i++) {
+        size += kcfp[i]->name.len + 128 + 6 * NGX_ATOMIC_T_LEN;
+    }
+
+    return size;
+}
+
+
+static u_char *
+ngx_http_upstream_keepalive_status_write(ngx_http_request_t *r, u_char *p,
+    u_char *last)
+{
+    ngx_uint_t                                 i;
+    ngx_http_upstream_keepalive_stat_t        *stat;
+    ngx_http_upstream_keepalive_srv_conf_t   **kcfp;
+    ngx_http_upstream_keepalive_main_conf_t   *kmcf;
+
+    kmcf = ngx_http_get_module_main_conf(r,
+                                         ngx_http_upstream_keepalive_module);
+
+    kcfp = kmcf->upstreams.elts;
+
+    p = ngx_cpymem(p, "{\"upstreams\": {\n",
+                   sizeof("{\"upstreams\": {\n") - 1);
+
+    for (i = 0; i < kmcf->upstreams.nelts; i++) {
+        stat = kcfp[i]->stat;
+
+        p = ngx_slprintf(p, last,
+                         "  \"%V\": {\"idle\": %uA, \"hits\": %uA, "
+                         "\"misses\": %uA, \"evicted\": %uA, "
+                         "\"expired\": %uA, \"retired\": %uA}",
+                         &kcfp[i]->name, stat->idle, stat->hits,
+                         stat->misses, stat->evicted, stat->expired,
+                         stat->retired);
+
+        if (i != kmcf->upstreams.nelts - 1) {
+            *p++ = ',';
+        }
+
+        *p++ = '\n';
+    }
+
+    return ngx_cpymem(p, "}}\n", sizeof("}}\n") - 1);
+}
+
+
+static void *
+ngx_http_upstream_keepalive_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_keepalive_main_conf_t  *kmcf;
+
+    kmcf = ngx_pcalloc(cf->pool,
+                       sizeof(ngx_http_upstream_keepalive_main_conf_t));
+    if (kmcf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&kmcf->upstreams, cf->pool, 4,
+                       sizeof(ngx_http_upstream_keepalive_srv_conf_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return kmcf;
+}
+
+
 static void *
 ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
 {
@@ -493,11 +873,15 @@ ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
     /*
      * set by ngx_pcalloc():
      *
+     *     conf->max_per_peer = 0;
+     *     conf->min_per_peer = 0;
+     *     conf->stat = NULL;
      *     conf->original_init_upstream = NULL;
      *     conf->original_init_peer = NULL;
      */
 
     conf->max_cached = 1;
+    conf->max_requests = NGX_CONF_UNSET_UINT;
     conf->keepalive_timeout = NGX_CONF_UNSET_MSEC;
 
     return conf;
@@ -507,11 +891,12 @@ ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
 static char *
 ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
-    ngx_http_upstream_srv_conf_t            *uscf;
-    ngx_http_upstream_keepalive_srv_conf_t  *kcf;
+    ngx_http_upstream_srv_conf_t             *uscf;
+    ngx_http_upstream_keepalive_srv_conf_t   *kcf, **kcfp;
+    ngx_http_upstream_keepalive_main_conf_t  *kmcf;
 
     ngx_int_t    n;
-    ngx_str_t   *value;
+    ngx_str_t   *value, name;
     ngx_uint_t   i;
 
     uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
@@ -546,6 +931,32 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     for (i = 2; i < cf->args->nelts; i++) {
 
+        if (ngx_strncmp(value[i].data, "max_per_peer=", 13) == 0) {
+
+            n = ngx_atoi(&value[i].data[13], value[i].len - 13);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            kcf->max_per_peer = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "min_per_peer=", 13) == 0) {
+
+            n = ngx_atoi(&value[i].data[13], value[i].len - 13);
+
+            if (n == NGX_ERROR) {
+                goto invalid;
+            }
+
+            kcf->min_per_peer = n;
+
+            continue;
+        }
+
         if (ngx_strcmp(value[i].data, "single") == 0) {
             ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
                                "the \"single\" parameter is deprecated");
@@ -555,6 +966,42 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         goto invalid;
     }
 
+    if (kcf->max_per_peer && kcf->min_per_peer > kcf->max_per_peer) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"min_per_peer\" must not be greater "
+                           "than \"max_per_peer\"");
+        return NGX_CONF_ERROR;
+    }
+
+    kmcf = ngx_http_conf_get_module_main_conf(cf,
+                                          ngx_http_upstream_keepalive_module);
+
+    if (kmcf->shm_zone == NULL) {
+        ngx_str_set(&name, "upstream_keepalive");
+
+        kmcf->shm_zone = ngx_shared_memory_add(cf, &name, 8 * ngx_pagesize,
+                                           &ngx_http_upstream_keepalive_module);
+        if (kmcf->shm_zone == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        kmcf->shm_zone->init = ngx_http_upstream_keepalive_init_zone;
+        kmcf->shm_zone->data = kmcf;
+    }
+
+    kcfp = ngx_array_push(&kmcf->upstreams);
+    if (kcfp == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *kcfp = kcf;
+
+    kcf->name = uscf->host;
+
+    kmcf->shm_zone->shm.size = ngx_http_upstream_shared_size(
+                                   kmcf->upstreams.nelts,
+                                   sizeof(ngx_http_upstream_keepalive_stat_t));
+
     return NGX_CONF_OK;
 
 invalid:
@@ -597,3 +1044,47 @@ ngx_http_upstream_keepalive_timeout(ngx_conf_t *cf, ngx_command_t *cmd,
     return NGX_CONF_OK;
 }
 
+
+static char *
+ngx_http_upstream_keepalive_requests(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_upstream_srv_conf_t            *uscf;
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf;
+
+    ngx_int_t    n;
+    ngx_str_t   *value;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    kcf = ngx_http_conf_upstream_srv_conf(uscf,
+                                          ngx_http_upstream_keepalive_module);
+
+    if (kcf->max_requests != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+    if (n == NGX_ERROR || n == 0) {
+        return "invalid value";
+    }
+
+    kcf->max_requests = n;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_upstream_keepalive_status(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_upstream_keepalive_status_handler;
+
+    return NGX_CONF_OK;
+}
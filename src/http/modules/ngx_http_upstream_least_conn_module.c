@@ -161,7 +161,7 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
 
     time_t                         now;
     uintptr_t                      m;
-    ngx_int_t                      rc, total;
+    ngx_int_t                      rc, w, bw, total;
     ngx_uint_t                     i, n, p, many;
     ngx_http_upstream_rr_peer_t   *peer, *best;
     ngx_http_upstream_rr_peers_t  *peers;
@@ -186,6 +186,7 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
 #if (NGX_SUPPRESS_WARN)
     many = 0;
     p = 0;
+    bw = 0;
 #endif
 
     for (i = 0; i < peers->number; i++) {
@@ -203,6 +204,12 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
             continue;
         }
 
+        if (peers->breaker
+            && ngx_http_upstream_breaker_test(peers, i) != NGX_OK)
+        {
+            continue;
+        }
+
 #if (NGX_HTTP_UPSTREAM_CHECK)
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                        "get least_conn peer, check_index: %ui",
@@ -220,22 +227,25 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
             continue;
         }
 
+        w = peer->weight;
+
+        if (peers->breaker) {
+            w = ngx_http_upstream_breaker_weight(peers, i, w);
+        }
+
         /*
          * select peer with least number of connections; if there are
          * multiple peers with the same number of connections, select
          * based on round-robin
          */
 
-        if (best == NULL
-            || lcp->conns[i] * best->weight < lcp->conns[p] * peer->weight)
-        {
+        if (best == NULL || lcp->conns[i] * bw < lcp->conns[p] * w) {
             best = peer;
+            bw = w;
             many = 0;
             p = i;
 
-        } else if (lcp->conns[i] * best->weight
-                   == lcp->conns[p] * peer->weight)
-        {
+        } else if (lcp->conns[i] * bw == lcp->conns[p] * w) {
             many = 1;
         }
     }
@@ -266,6 +276,12 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
                 continue;
             }
 
+            if (peers->breaker
+                && ngx_http_upstream_breaker_test(peers, i) != NGX_OK)
+            {
+                continue;
+            }
+
 #if (NGX_HTTP_UPSTREAM_CHECK)
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                            "get least_conn peer, check_index: %ui",
@@ -276,7 +292,13 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
             }
 #endif
 
-            if (lcp->conns[i] * best->weight != lcp->conns[p] * peer->weight) {
+            w = peer->weight;
+
+            if (peers->breaker) {
+                w = ngx_http_upstream_breaker_weight(peers, i, w);
+            }
+
+            if (lcp->conns[i] * bw != lcp->conns[p] * w) {
                 continue;
             }
 
@@ -296,6 +318,7 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
 
             if (peer->current_weight > best->current_weight) {
                 best = peer;
+                bw = w;
                 p = i;
             }
         }
@@ -317,6 +340,14 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
     m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
 
     lcp->rrp.tried[n] |= m;
+
+    if (ngx_http_upstream_breaker_select(&lcp->rrp) != NGX_OK) {
+
+        /* the peer is marked as tried, so another one is selected */
+
+        return ngx_http_upstream_get_least_conn_peer(pc, lcp);
+    }
+
     lcp->conns[p]++;
 
     if (pc->tries == 1 && peers->next) {
@@ -21,8 +21,32 @@
 #define NGX_HTTP_CACHE_UPDATING      5
 #define NGX_HTTP_CACHE_HIT           6
 #define NGX_HTTP_CACHE_SCARCE        7
+#define NGX_HTTP_CACHE_REVALIDATED   8
+#define NGX_HTTP_CACHE_COLLAPSED     9
+
+#define NGX_HTTP_CACHE_NSTATUS       10
+#define NGX_HTTP_CACHE_READ_BUCKETS  6
 
 #define NGX_HTTP_CACHE_KEY_LEN       16
+#define NGX_HTTP_CACHE_ETAG_LEN      42
+
+#define NGX_HTTP_CACHE_VERSION       1
+
+#define NGX_HTTP_CACHE_MAX_SHARDS    64
+
+#define NGX_HTTP_CACHE_INDEX_MAGIC   "NGXCIDX"
+#define NGX_HTTP_CACHE_INDEX_VERSION 1
+
+#define NGX_HTTP_CACHE_MEM_EVICT     16
+
+#define NGX_HTTP_CACHE_EVICT_LRU     0
+#define NGX_HTTP_CACHE_EVICT_SLRU    1
+
+#define NGX_HTTP_CACHE_ADMIT_ALL     0
+#define NGX_HTTP_CACHE_ADMIT_TINYLFU 1
+
+#define NGX_HTTP_CACHE_SKETCH_ROWS   4
+#define NGX_HTTP_CACHE_SKETCH_MAX    15
 
 
 typedef struct {
@@ -31,6 +55,10 @@ typedef struct {
 } ngx_http_cache_valid_t;
 
 
+typedef struct ngx_http_file_cache_purge_node_s
+    ngx_http_file_cache_purge_node_t;
+
+
 typedef struct {
     ngx_rbtree_node_t                node;
     ngx_queue_t                      queue;
@@ -45,16 +73,93 @@ typedef struct {
     unsigned                         exists:1;
     unsigned                         updating:1;
     unsigned                         deleting:1;
-                                     /* 11 unused bits */
+    unsigned                         purged:1;
+    unsigned                         protected:1;
+    unsigned                         indexed:1;
+                                     /* 8 unused bits */
 
     ngx_file_uniq_t                  uniq;
     time_t                           expire;
     time_t                           valid_sec;
     size_t                           body_start;
     off_t                            fs_size;
+
+    ngx_http_file_cache_purge_node_t *purge;
 } ngx_http_file_cache_node_t;
 
 
+/* the cache key text or a tag of a node, ordered by the text */
+
+struct ngx_http_file_cache_purge_node_s {
+    ngx_rbtree_node_t                node;
+    ngx_http_file_cache_node_t      *fcn;
+    ngx_http_file_cache_purge_node_t *next;
+    u_short                          tag;
+    u_short                          len;
+    u_char                           data[1];
+};
+
+
+typedef struct {
+    ngx_shmtx_sh_t                   lock;
+    ngx_shmtx_t                      mutex;
+
+    ngx_rbtree_t                     rbtree;
+    ngx_rbtree_node_t                sentinel;
+
+    /* the probationary and protected segments of the inactive queue */
+
+    ngx_queue_t                      queue;
+    ngx_queue_t                      protected;
+    off_t                            protected_size;
+
+    /* lock statistics, updated while the lock is held */
+
+    ngx_atomic_t                     locks;
+    ngx_atomic_t                     contended;
+    ngx_atomic_t                     hold_usec;
+    ngx_atomic_t                     max_hold_usec;
+    uint64_t                         start;
+} ngx_http_file_cache_shard_t;
+
+
+typedef struct {
+    ngx_rbtree_node_t                node;
+    ngx_queue_t                      queue;
+
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN
+                                         - sizeof(ngx_rbtree_key_t)];
+
+    ngx_file_uniq_t                  uniq;
+    size_t                           len;
+    u_char                           data[1];
+} ngx_http_file_cache_mem_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                     rbtree;
+    ngx_rbtree_node_t                sentinel;
+    ngx_queue_t                      queue;
+    size_t                           size;
+
+    ngx_atomic_t                     hits;
+    ngx_atomic_t                     misses;
+    ngx_atomic_t                     stores;
+    ngx_atomic_t                     evictions;
+} ngx_http_file_cache_mem_sh_t;
+
+
+/* a response being received by the request holding the cache lock */
+
+typedef struct {
+    ngx_rbtree_node_t                node;
+    ngx_http_cache_t                *leader;
+    ngx_queue_t                      followers;
+    ngx_str_t                        name;
+    off_t                            length;
+} ngx_http_file_cache_stream_t;
+
+
 struct ngx_http_cache_s {
     ngx_file_t                       file;
     ngx_array_t                      keys;
@@ -66,36 +171,61 @@ struct ngx_http_cache_s {
     time_t                           last_modified;
     time_t                           date;
 
+    ngx_str_t                        etag;
+    ngx_str_t                        tags;
+
     size_t                           header_start;
     size_t                           body_start;
     off_t                            length;
     off_t                            fs_size;
 
     ngx_uint_t                       min_uses;
+    ngx_uint_t                       uses;
     ngx_uint_t                       error;
     ngx_uint_t                       valid_msec;
 
     ngx_buf_t                       *buf;
 
     ngx_http_file_cache_t           *file_cache;
+    ngx_http_file_cache_shard_t     *shard;
     ngx_http_file_cache_node_t      *node;
 
     ngx_msec_t                       lock_timeout;
     ngx_msec_t                       wait_time;
 
+    /* the start of a cache file read in usec, kept over an AIO read */
+    uint64_t                         read_start;
+
     ngx_event_t                      wait_event;
 
+    ngx_http_file_cache_stream_t    *stream;
+    ngx_queue_t                      stream_queue;
+    off_t                            stream_sent;
+    ngx_chain_t                     *stream_free;
+    ngx_chain_t                     *stream_busy;
+
     unsigned                         lock:1;
     unsigned                         waiting:1;
 
+    unsigned                         collapse:2;
+    unsigned                         streaming:1;
+    unsigned                         stream_sending:1;
+    unsigned                         stream_done:1;
+    unsigned                         stream_error:1;
+    unsigned                         stream_only:1;
+    unsigned                         complete:1;
+
     unsigned                         updated:1;
     unsigned                         updating:1;
     unsigned                         exists:1;
     unsigned                         temp_file:1;
+    unsigned                         background:1;
+    unsigned                         memory:1;
 };
 
 
 typedef struct {
+    ngx_uint_t                       version;
     time_t                           valid_sec;
     time_t                           last_modified;
     time_t                           date;
@@ -103,16 +233,71 @@ typedef struct {
     u_short                          valid_msec;
     u_short                          header_start;
     u_short                          body_start;
+    u_char                           etag_len;
+    u_char                           etag[NGX_HTTP_CACHE_ETAG_LEN];
 } ngx_http_file_cache_header_t;
 
 
 typedef struct {
-    ngx_rbtree_t                     rbtree;
-    ngx_rbtree_node_t                sentinel;
-    ngx_queue_t                      queue;
+    u_char                           magic[8];
+    ngx_uint_t                       version;
+    size_t                           bsize;
+    size_t                           entry_size;
+    ngx_uint_t                       entries;
+} ngx_http_file_cache_index_header_t;
+
+
+typedef struct {
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+    ngx_file_uniq_t                  uniq;
+    time_t                           valid_sec;
+    size_t                           body_start;
+    off_t                            fs_size;
+    ngx_uint_t                       valid_msec;
+} ngx_http_file_cache_index_entry_t;
+
+
+typedef struct {
     ngx_atomic_t                     cold;
     ngx_atomic_t                     loading;
-    off_t                            size;
+    ngx_atomic_t                     size;
+    ngx_atomic_t                     hits;
+    ngx_atomic_t                     misses;
+    ngx_atomic_t                     hit_bytes;
+    ngx_atomic_t                     miss_bytes;
+
+    /* requests and bytes sent by $upstream_cache_status */
+
+    ngx_atomic_t                     requests[NGX_HTTP_CACHE_NSTATUS];
+    ngx_atomic_t                     bytes[NGX_HTTP_CACHE_NSTATUS];
+
+    /* time spent reading cache file headers, see ngx_http_cache_read_usec */
+
+    ngx_atomic_t                     reads[NGX_HTTP_CACHE_READ_BUCKETS];
+
+    ngx_atomic_t                     expired;
+    ngx_atomic_t                     evicted;
+    ngx_atomic_t                     loaded;
+
+    /* set if nodes may lack their key text and tags in the trees below */
+
+    ngx_atomic_t                     unindexed;
+
+    ngx_uint_t                       nshards;
+    ngx_http_file_cache_shard_t     *shards;
+
+    /* protected by the slab pool mutex */
+
+    ngx_rbtree_t                     keys;
+    ngx_rbtree_node_t                keys_sentinel;
+    ngx_rbtree_t                     tags;
+    ngx_rbtree_node_t                tags_sentinel;
+
+    /* the TinyLFU frequency sketch of 4-bit counters, updated without locks */
+
+    u_char                          *sketch;
+    ngx_uint_t                       sketch_mask;
+    ngx_atomic_t                     sketch_ops;
 } ngx_http_file_cache_sh_t;
 
 
@@ -121,6 +306,7 @@ struct ngx_http_file_cache_s {
     ngx_slab_pool_t                 *shpool;
 
     ngx_path_t                      *path;
+    ngx_path_t                      *temp_path;
 
     off_t                            max_size;
     size_t                           bsize;
@@ -133,7 +319,32 @@ struct ngx_http_file_cache_s {
     ngx_msec_t                       loader_sleep;
     ngx_msec_t                       loader_threshold;
 
+    ngx_uint_t                       shards;
+    ngx_uint_t                       manager_files;
+    ngx_msec_t                       manager_sleep;
+    ngx_msec_t                       manager_threshold;
+
+    ngx_str_t                        index;
+    time_t                           index_interval;
+    time_t                           index_last;
+
+    ngx_flag_t                       purge;
+
+    ngx_uint_t                       eviction;
+    ngx_uint_t                       admission;
+
+    ngx_http_file_cache_mem_sh_t    *mem;
+    ngx_slab_pool_t                 *mem_pool;
+    size_t                           mem_max_object;
+    ngx_uint_t                       mem_min_uses;
+
     ngx_shm_zone_t                  *shm_zone;
+    ngx_shm_zone_t                  *mem_zone;
+
+    /* responses received by this worker process for lock holders */
+
+    ngx_rbtree_t                     streams;
+    ngx_rbtree_node_t                streams_sentinel;
 };
 
 
@@ -143,7 +354,13 @@ void ngx_http_file_cache_create_key(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_open(ngx_http_request_t *r);
 void ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf);
 void ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf);
+void ngx_http_file_cache_update_header(ngx_http_request_t *r);
+ngx_int_t ngx_http_file_cache_purge(ngx_http_request_t *r, ngx_str_t *tags);
+ngx_int_t ngx_http_file_cache_set_tags(ngx_http_request_t *r,
+    ngx_http_complex_value_t *cv);
 ngx_int_t ngx_http_cache_send(ngx_http_request_t *);
+void ngx_http_file_cache_stream_update(ngx_http_request_t *r,
+    ngx_temp_file_t *tf);
 void ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf);
 time_t ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status);
 
@@ -153,7 +370,8 @@ char *ngx_http_file_cache_valid_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 
 
-extern ngx_str_t  ngx_http_cache_status[];
+extern ngx_str_t   ngx_http_cache_status[];
+extern ngx_uint_t  ngx_http_cache_read_usec[];
 
 
 #endif /* _NGX_HTTP_CACHE_H_INCLUDED_ */
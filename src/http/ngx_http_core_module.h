@@ -134,6 +134,10 @@ typedef enum {
 
 typedef struct ngx_http_phase_handler_s  ngx_http_phase_handler_t;
 
+typedef size_t (*ngx_http_json_size_pt)(ngx_http_request_t *r);
+typedef u_char *(*ngx_http_json_write_pt)(ngx_http_request_t *r, u_char *p,
+    u_char *last);
+
 typedef ngx_int_t (*ngx_http_phase_handler_pt)(ngx_http_request_t *r,
     ngx_http_phase_handler_t *ph);
 
@@ -519,6 +523,8 @@ void ngx_http_set_exten(ngx_http_request_t *r);
 ngx_int_t ngx_http_set_etag(ngx_http_request_t *r);
 ngx_int_t ngx_http_send_response(ngx_http_request_t *r, ngx_uint_t status,
     ngx_str_t *ct, ngx_http_complex_value_t *cv);
+ngx_int_t ngx_http_send_json(ngx_http_request_t *r, ngx_http_json_size_pt size,
+    ngx_http_json_write_pt write);
 u_char *ngx_http_map_uri_to_path(ngx_http_request_t *r, ngx_str_t *name,
     size_t *root_length, size_t reserved);
 ngx_int_t ngx_http_auth_basic_user(ngx_http_request_t *r);
@@ -14,6 +14,17 @@
 static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_file_cache_stream_add(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_stream_follow(ngx_http_cache_t *c);
+static void ngx_http_file_cache_stream_notify(
+    ngx_http_file_cache_stream_t *st, ngx_http_cache_t *c);
+static void ngx_http_file_cache_stream_end(ngx_http_cache_t *c, ngx_uint_t ok,
+    off_t length);
+static ngx_int_t ngx_http_file_cache_stream_start(ngx_http_request_t *r);
+static void ngx_http_file_cache_stream_handler(ngx_event_t *ev);
+static void ngx_http_file_cache_stream_writer(ngx_http_request_t *r);
+static void ngx_http_file_cache_stream_send(ngx_http_request_t *r);
 static ngx_int_t ngx_http_file_cache_read(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static ssize_t ngx_http_file_cache_aio_read(ngx_http_request_t *r,
@@ -25,15 +36,73 @@ static ngx_int_t ngx_http_file_cache_exists(ngx_http_file_cache_t *cache,
     ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_name(ngx_http_request_t *r,
     ngx_path_t *path);
+static ngx_http_file_cache_shard_t *ngx_http_file_cache_shard(
+    ngx_http_file_cache_t *cache, u_char *key);
+static void ngx_http_file_cache_shard_lock(ngx_http_file_cache_shard_t *shard);
+static void ngx_http_file_cache_shard_unlock(
+    ngx_http_file_cache_shard_t *shard);
 static ngx_http_file_cache_node_t *
-    ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key);
+    ngx_http_file_cache_lookup(ngx_http_file_cache_shard_t *shard,
+    u_char *key);
+static void ngx_http_file_cache_demote(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard);
+static ngx_queue_t *ngx_http_file_cache_oldest(
+    ngx_http_file_cache_shard_t *shard);
+static ngx_queue_t *ngx_http_file_cache_victims(
+    ngx_http_file_cache_shard_t *shard);
+static ngx_int_t ngx_http_file_cache_sketch_init(ngx_http_file_cache_t *cache,
+    size_t size);
+static void ngx_http_file_cache_sketch_add(ngx_http_file_cache_t *cache,
+    u_char *key);
+static void ngx_http_file_cache_sketch_age(ngx_http_file_cache_t *cache);
+static ngx_uint_t ngx_http_file_cache_sketch_get(ngx_http_file_cache_t *cache,
+    u_char *key);
+static ngx_uint_t ngx_http_file_cache_admit(ngx_http_file_cache_t *cache,
+    ngx_http_cache_t *c);
 static void ngx_http_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_http_file_cache_mem_get(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_mem_set(ngx_http_file_cache_t *cache,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_mem_remove(ngx_http_file_cache_t *cache,
+    u_char *key);
+static void ngx_http_file_cache_free_node(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+static void ngx_http_file_cache_purge_index(ngx_http_file_cache_t *cache,
+    ngx_http_cache_t *c, ngx_uint_t replace);
+static ngx_http_file_cache_purge_node_t *ngx_http_file_cache_purge_add(
+    ngx_http_file_cache_t *cache, ngx_http_file_cache_node_t *fcn,
+    u_char *data, size_t len, ngx_uint_t tag);
+static void ngx_http_file_cache_purge_key(
+    ngx_http_file_cache_purge_node_t *pn);
+static ngx_int_t ngx_http_file_cache_purge_collect(ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel, u_char *data, size_t len, ngx_uint_t exact,
+    ngx_array_t *keys);
+static ngx_int_t ngx_http_file_cache_purge_unindexed(ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel, ngx_array_t *keys);
+static ngx_uint_t ngx_http_file_cache_purge_node(ngx_http_file_cache_t *cache,
+    u_char *key);
+static void ngx_http_file_cache_purge_rbtree_insert_value(
+    ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel);
+static ngx_http_file_cache_mem_node_t *
+    ngx_http_file_cache_mem_lookup(ngx_http_file_cache_mem_sh_t *mem,
+    u_char *key);
+static void ngx_http_file_cache_mem_rbtree_insert_value(
+    ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel);
 static void ngx_http_file_cache_cleanup(void *data);
 static time_t ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache);
 static time_t ngx_http_file_cache_expire(ngx_http_file_cache_t *cache);
+static time_t ngx_http_file_cache_expire_shard(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard, u_char *name, time_t now);
 static void ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
-    ngx_queue_t *q, u_char *name);
+    ngx_http_file_cache_shard_t *shard, ngx_queue_t *q, u_char *name);
+static time_t ngx_http_file_cache_write_index(ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_index_copy(ngx_array_t *a,
+    ngx_queue_t *queue);
+static ngx_int_t ngx_http_file_cache_load_index(ngx_http_file_cache_t *cache);
 static void ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache);
 static ngx_int_t ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
@@ -53,7 +122,17 @@ ngx_str_t  ngx_http_cache_status[] = {
     ngx_string("EXPIRED"),
     ngx_string("STALE"),
     ngx_string("UPDATING"),
-    ngx_string("HIT")
+    ngx_string("HIT"),
+    ngx_string("SCARCE"),
+    ngx_string("REVALIDATED"),
+    ngx_string("COLLAPSED")
+};
+
+
+/* upper bounds of the read time histogram buckets, the last is unbounded */
+
+ngx_uint_t  ngx_http_cache_read_usec[] = {
+    100, 1000, 10000, 100000, 1000000, 0
 };
 
 
@@ -65,9 +144,12 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
     ngx_http_file_cache_t  *ocache = data;
 
-    size_t                  len;
-    ngx_uint_t              n;
-    ngx_http_file_cache_t  *cache;
+    u_char                       *file;
+    size_t                        len;
+    ngx_int_t                     rc;
+    ngx_uint_t                    n;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_shard_t  *shard;
 
     cache = shm_zone->data;
 
@@ -91,6 +173,13 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
             }
         }
 
+        if (cache->shards != ocache->sh->nshards) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "cache \"%V\" had previously different shards",
+                          &shm_zone->shm.name);
+            return NGX_ERROR;
+        }
+
         cache->sh = ocache->sh;
 
         cache->shpool = ocache->shpool;
@@ -102,6 +191,18 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
             cache->path->loader = NULL;
         }
 
+        if (cache->admission == NGX_HTTP_CACHE_ADMIT_TINYLFU
+            && cache->sh->sketch == NULL)
+        {
+            ngx_shmtx_lock(&cache->shpool->mutex);
+            rc = ngx_http_file_cache_sketch_init(cache, shm_zone->shm.size);
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+
+            if (rc != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+
         return NGX_OK;
     }
 
@@ -121,14 +222,77 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
     cache->shpool->data = cache->sh;
 
-    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
-                    ngx_http_file_cache_rbtree_insert_value);
+    cache->sh->shards = ngx_slab_alloc(cache->shpool,
+                                    cache->shards
+                                    * sizeof(ngx_http_file_cache_shard_t));
+    if (cache->sh->shards == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (n = 0; n < cache->shards; n++) {
+        shard = &cache->sh->shards[n];
+
+        ngx_memzero(shard, sizeof(ngx_http_file_cache_shard_t));
+
+#if (NGX_HAVE_ATOMIC_OPS)
+
+        file = NULL;
+
+#else
+
+        len = ngx_strlen(cache->shpool->mutex.name) + NGX_INT_T_LEN + 2;
+
+        file = ngx_slab_alloc(cache->shpool, len);
+        if (file == NULL) {
+            return NGX_ERROR;
+        }
+
+        (void) ngx_sprintf(file, "%s.%ui%Z", cache->shpool->mutex.name, n);
 
-    ngx_queue_init(&cache->sh->queue);
+#endif
+
+        if (ngx_shmtx_create(&shard->mutex, &shard->lock, file) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ngx_rbtree_init(&shard->rbtree, &shard->sentinel,
+                        ngx_http_file_cache_rbtree_insert_value);
+
+        ngx_queue_init(&shard->queue);
+        ngx_queue_init(&shard->protected);
+    }
+
+    ngx_rbtree_init(&cache->sh->keys, &cache->sh->keys_sentinel,
+                    ngx_http_file_cache_purge_rbtree_insert_value);
+    ngx_rbtree_init(&cache->sh->tags, &cache->sh->tags_sentinel,
+                    ngx_http_file_cache_purge_rbtree_insert_value);
 
+    cache->sh->nshards = cache->shards;
     cache->sh->cold = 1;
     cache->sh->loading = 0;
     cache->sh->size = 0;
+    cache->sh->hits = 0;
+    cache->sh->misses = 0;
+    cache->sh->hit_bytes = 0;
+    cache->sh->miss_bytes = 0;
+
+    ngx_memzero((void *) cache->sh->requests, sizeof(cache->sh->requests));
+    ngx_memzero((void *) cache->sh->bytes, sizeof(cache->sh->bytes));
+    ngx_memzero((void *) cache->sh->reads, sizeof(cache->sh->reads));
+
+    cache->sh->expired = 0;
+    cache->sh->evicted = 0;
+    cache->sh->loaded = 0;
+    cache->sh->sketch = NULL;
+    cache->sh->sketch_mask = 0;
+    cache->sh->sketch_ops = 0;
+
+    if (cache->admission == NGX_HTTP_CACHE_ADMIT_TINYLFU) {
+        rc = ngx_http_file_cache_sketch_init(cache, shm_zone->shm.size);
+        if (rc != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
 
     cache->bsize = ngx_fs_bsize(cache->path->name.data);
 
@@ -148,6 +312,68 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 }
 
 
+static ngx_int_t
+ngx_http_file_cache_mem_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_file_cache_t  *ocache = data;
+
+    size_t                  len;
+    ngx_http_file_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->mem = ocache->mem;
+        cache->mem_pool = ocache->mem_pool;
+
+        return NGX_OK;
+    }
+
+    cache->mem_pool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->mem = cache->mem_pool->data;
+
+        return NGX_OK;
+    }
+
+    cache->mem = ngx_slab_alloc(cache->mem_pool,
+                                sizeof(ngx_http_file_cache_mem_sh_t));
+    if (cache->mem == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->mem_pool->data = cache->mem;
+
+    ngx_rbtree_init(&cache->mem->rbtree, &cache->mem->sentinel,
+                    ngx_http_file_cache_mem_rbtree_insert_value);
+
+    ngx_queue_init(&cache->mem->queue);
+
+    cache->mem->size = 0;
+    cache->mem->hits = 0;
+    cache->mem->misses = 0;
+    cache->mem->stores = 0;
+    cache->mem->evictions = 0;
+
+    len = sizeof(" in cache memory zone \"\"") + shm_zone->shm.name.len;
+
+    cache->mem_pool->log_ctx = ngx_slab_alloc(cache->mem_pool, len);
+    if (cache->mem_pool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->mem_pool->log_ctx, " in cache memory zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* allocation failures are expected, the least recently used are evicted */
+
+    cache->mem_pool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_http_file_cache_new(ngx_http_request_t *r)
 {
@@ -238,6 +464,7 @@ ngx_http_file_cache_create_key(ngx_http_request_t *r)
 ngx_int_t
 ngx_http_file_cache_open(ngx_http_request_t *r)
 {
+    size_t                     size;
     ngx_int_t                  rc, rv;
     ngx_uint_t                 cold, test;
     ngx_http_cache_t          *c;
@@ -256,6 +483,15 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         return ngx_http_file_cache_read(r, c);
     }
 
+    if (c->streaming) {
+        c->buf = ngx_create_temp_buf(r->pool, c->body_start);
+        if (c->buf == NULL) {
+            return NGX_ERROR;
+        }
+
+        return ngx_http_file_cache_read(r, c);
+    }
+
     cache = c->file_cache;
 
     if (c->node == NULL) {
@@ -311,10 +547,40 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         }
     }
 
+    /*
+     * once the cache is full, a new object is only stored if it is
+     * used more often than the entry it would displace
+     */
+
+    if (rv == NGX_DECLINED
+        && !c->exists
+        && cache->admission == NGX_HTTP_CACHE_ADMIT_TINYLFU
+        && !ngx_http_file_cache_admit(cache, c))
+    {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache not admitted");
+
+        c->temp_file = 0;
+        rv = NGX_HTTP_CACHE_SCARCE;
+    }
+
     if (ngx_http_file_cache_name(r, cache->path) != NGX_OK) {
         return NGX_ERROR;
     }
 
+    if (c->exists && cache->mem) {
+
+        rc = ngx_http_file_cache_mem_get(r, c);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (rc == NGX_OK) {
+            return ngx_http_file_cache_read(r, c);
+        }
+    }
+
     if (!test) {
         goto done;
     }
@@ -358,7 +624,21 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
     c->length = of.size;
     c->fs_size = (of.fs_size + cache->bsize - 1) / cache->bsize;
 
-    c->buf = ngx_create_temp_buf(r->pool, c->body_start);
+    (void) ngx_atomic_fetch_add(&cache->sh->hits, 1);
+
+    size = c->body_start;
+
+    /* small objects to be stored in the memory tier are read whole */
+
+    if (cache->mem
+        && c->uses >= cache->mem_min_uses
+        && c->length <= (off_t) cache->mem_max_object
+        && c->length > (off_t) size)
+    {
+        size = (size_t) c->length;
+    }
+
+    c->buf = ngx_create_temp_buf(r->pool, size);
     if (c->buf == NULL) {
         return NGX_ERROR;
     }
@@ -367,6 +647,8 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
 
 done:
 
+    (void) ngx_atomic_fetch_add(&cache->sh->misses, 1);
+
     if (rv == NGX_DECLINED) {
         return ngx_http_file_cache_lock(r, c);
     }
@@ -379,29 +661,26 @@ static ngx_int_t
 ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
     ngx_msec_t                 now, timer;
-    ngx_http_file_cache_t     *cache;
 
     if (!c->lock) {
         return NGX_DECLINED;
     }
 
-    cache = c->file_cache;
-
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_http_file_cache_shard_lock(c->shard);
 
     if (!c->node->updating) {
         c->node->updating = 1;
         c->updating = 1;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_http_file_cache_shard_unlock(c->shard);
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http file cache lock u:%d wt:%M",
                    c->updating, c->wait_time);
 
     if (c->updating) {
-        return NGX_DECLINED;
+        return ngx_http_file_cache_stream_add(r, c);
     }
 
     c->waiting = 1;
@@ -418,10 +697,21 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     timer = c->wait_time - now;
 
-    ngx_add_timer(&c->wait_event, (timer > 500) ? 500 : timer);
-
     r->main->blocked++;
 
+    /*
+     * a request waiting for a lock held in this worker process is woken up
+     * as soon as the lock is released, while a lock held elsewhere is polled
+     */
+
+    ngx_http_file_cache_stream_follow(c);
+
+    if (c->streaming) {
+        return NGX_AGAIN;
+    }
+
+    ngx_add_timer(&c->wait_event, (c->stream || timer < 500) ? timer : 500);
+
     return NGX_AGAIN;
 }
 
@@ -433,7 +723,6 @@ ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev)
     ngx_msec_t                 timer;
     ngx_http_cache_t          *c;
     ngx_http_request_t        *r;
-    ngx_http_file_cache_t     *cache;
 
     r = ev->data;
     c = r->cache;
@@ -442,28 +731,42 @@ ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev)
                    "http file cache wait handler wt:%M cur:%M",
                    c->wait_time, ngx_current_msec);
 
+    if (c->streaming) {
+        goto wakeup;
+    }
+
     timer = c->wait_time - ngx_current_msec;
 
     if ((ngx_msec_int_t) timer <= 0) {
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
                        "http file cache lock timeout");
         c->lock = 0;
+
+        if (c->stream) {
+            ngx_http_file_cache_stream_end(c, 0, 0);
+        }
+
         goto wakeup;
     }
 
-    cache = c->file_cache;
     wait = 0;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_http_file_cache_shard_lock(c->shard);
 
     if (c->node->updating) {
         wait = 1;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_http_file_cache_shard_unlock(c->shard);
 
     if (wait) {
-        ngx_add_timer(ev, (timer > 500) ? 500 : timer);
+        ngx_http_file_cache_stream_follow(c);
+
+        if (c->streaming) {
+            return;
+        }
+
+        ngx_add_timer(ev, (c->stream || timer < 500) ? timer : 500);
         return;
     }
 
@@ -476,837 +779,2744 @@ wakeup:
 
 
 static ngx_int_t
-ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
+ngx_http_file_cache_stream_add(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    time_t                         now;
-    ssize_t                        n;
-    ngx_int_t                      rc;
-    ngx_http_file_cache_t         *cache;
-    ngx_http_file_cache_header_t  *h;
+    ngx_http_file_cache_stream_t  *st;
 
-    n = ngx_http_file_cache_aio_read(r, c);
-
-    if (n < 0) {
-        return n;
+    if (c->stream) {
+        return NGX_DECLINED;
     }
 
-    if ((size_t) n < c->header_start) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                      "cache file \"%s\" is too small", c->file.name.data);
-        return NGX_DECLINED;
+    st = ngx_palloc(r->pool, sizeof(ngx_http_file_cache_stream_t));
+    if (st == NULL) {
+        return NGX_ERROR;
     }
 
-    h = (ngx_http_file_cache_header_t *) c->buf->pos;
+    st->node.key = (ngx_rbtree_key_t) (uintptr_t) c->node;
+    st->leader = c;
+    ngx_queue_init(&st->followers);
+    ngx_str_null(&st->name);
+    st->length = 0;
 
-    if (h->crc32 != c->crc32) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                      "cache file \"%s\" has md5 collision", c->file.name.data);
-        return NGX_DECLINED;
-    }
+    ngx_rbtree_insert(&c->file_cache->streams, &st->node);
 
-    if (h->body_start > c->body_start) {
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
-                      "cache file \"%s\" has too long header",
-                      c->file.name.data);
-        return NGX_DECLINED;
-    }
+    c->stream = st;
 
-    c->buf->last += n;
+    return NGX_DECLINED;
+}
 
-    c->valid_sec = h->valid_sec;
-    c->last_modified = h->last_modified;
-    c->date = h->date;
-    c->valid_msec = h->valid_msec;
-    c->header_start = h->header_start;
-    c->body_start = h->body_start;
 
-    r->cached = 1;
+static void
+ngx_http_file_cache_stream_follow(ngx_http_cache_t *c)
+{
+    ngx_rbtree_key_t               key;
+    ngx_rbtree_node_t             *node, *sentinel;
+    ngx_http_file_cache_stream_t  *st;
 
-    cache = c->file_cache;
+    if (c->stream) {
+        return;
+    }
 
-    if (cache->sh->cold) {
+    key = (ngx_rbtree_key_t) (uintptr_t) c->node;
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+    node = c->file_cache->streams.root;
+    sentinel = c->file_cache->streams.sentinel;
 
-        if (!c->node->exists) {
-            c->node->uses = 1;
-            c->node->body_start = c->body_start;
-            c->node->exists = 1;
-            c->node->uniq = c->uniq;
-            c->node->fs_size = c->fs_size;
+    while (node != sentinel) {
 
-            cache->sh->size += c->fs_size;
+        if (key < node->key) {
+            node = node->left;
+            continue;
         }
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
-    }
+        if (key > node->key) {
+            node = node->right;
+            continue;
+        }
 
-    now = ngx_time();
+        /* key == node->key */
 
-    if (c->valid_sec < now) {
+        st = (ngx_http_file_cache_stream_t *) node;
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                       "http file cache follow: %O", st->length);
 
-        if (c->node->updating) {
-            rc = NGX_HTTP_CACHE_UPDATING;
+        c->stream = st;
+        ngx_queue_insert_tail(&st->followers, &c->stream_queue);
 
-        } else {
-            c->node->updating = 1;
-            c->updating = 1;
-            rc = NGX_HTTP_CACHE_STALE;
+        if (st->length) {
+            ngx_http_file_cache_stream_notify(st, c);
         }
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return;
+    }
+}
 
-        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "http file cache expired: %i %T %T",
-                       rc, c->valid_sec, now);
 
-        return rc;
+void
+ngx_http_file_cache_stream_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
+{
+    ngx_queue_t                   *q;
+    ngx_http_cache_t              *c;
+    ngx_http_file_cache_stream_t  *st;
+
+    c = r->cache;
+    st = c->stream;
+
+    if (st == NULL
+        || st->leader != c
+        || tf->file.fd == NGX_INVALID_FILE
+        || tf->offset < (off_t) c->body_start
+        || tf->offset == st->length)
+    {
+        return;
     }
 
-    return NGX_OK;
+    /* the temporary file now starts with the complete cache header */
+
+    st->name = tf->file.name;
+    st->length = tf->offset;
+
+    for (q = ngx_queue_head(&st->followers);
+         q != ngx_queue_sentinel(&st->followers);
+         q = ngx_queue_next(q))
+    {
+        c = ngx_queue_data(q, ngx_http_cache_t, stream_queue);
+        ngx_http_file_cache_stream_notify(st, c);
+    }
 }
 
 
-static ssize_t
-ngx_http_file_cache_aio_read(ngx_http_request_t *r, ngx_http_cache_t *c)
+static void
+ngx_http_file_cache_stream_notify(ngx_http_file_cache_stream_t *st,
+    ngx_http_cache_t *c)
 {
-#if (NGX_HAVE_FILE_AIO)
-    ssize_t                    n;
-    ngx_http_core_loc_conf_t  *clcf;
+    ngx_fd_t                  fd;
+    ngx_event_t              *ev;
+    ngx_http_request_t       *r;
+    ngx_pool_cleanup_t       *cln;
+    ngx_pool_cleanup_file_t  *clnf;
 
-    if (!ngx_file_aio) {
-        goto noaio;
+    ev = &c->wait_event;
+    r = ev->data;
+
+    if (c->streaming) {
+        c->length = st->length;
+
+        if (c->stream_sending) {
+            ngx_post_event(ev, &ngx_posted_events);
+        }
+
+        return;
     }
 
-    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+    /* subrequests wait for the response to be cached */
 
-    if (!clcf->aio) {
-        goto noaio;
+    if (c->collapse == NGX_HTTP_UPSTREAM_COLLAPSE_OFF
+        || !c->waiting
+        || r != r->main)
+    {
+        return;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, sizeof(ngx_pool_cleanup_file_t));
+    if (cln == NULL) {
+        return;
     }
 
-    n = ngx_file_aio_read(&c->file, c->buf->pos, c->body_start, 0, r->pool);
+    fd = ngx_open_file(st->name.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
 
-    if (n != NGX_AGAIN) {
-        return n;
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", st->name.data);
+        return;
     }
 
-    c->file.aio->data = r;
-    c->file.aio->handler = ngx_http_cache_aio_event_handler;
+    cln->handler = ngx_pool_cleanup_file;
+    clnf = cln->data;
 
-    r->main->blocked++;
-    r->aio = 1;
+    clnf->fd = fd;
+    clnf->name = c->file.name.data;
+    clnf->log = r->pool->log;
 
-    return NGX_AGAIN;
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache stream: \"%s\" %O",
+                   st->name.data, st->length);
 
-noaio:
+    c->file.fd = fd;
+    c->length = st->length;
+    c->streaming = 1;
 
-#endif
+    if (ev->timer_set) {
+        ngx_del_timer(ev);
+    }
 
-    return ngx_read_file(&c->file, c->buf->pos, c->body_start, 0);
+    ngx_post_event(ev, &ngx_posted_events);
 }
 
 
-#if (NGX_HAVE_FILE_AIO)
-
 static void
-ngx_http_cache_aio_event_handler(ngx_event_t *ev)
+ngx_http_file_cache_stream_end(ngx_http_cache_t *c, ngx_uint_t ok,
+    off_t length)
 {
-    ngx_event_aio_t     *aio;
-    ngx_http_request_t  *r;
+    ngx_queue_t                   *q;
+    ngx_event_t                   *ev;
+    ngx_http_cache_t              *fc;
+    ngx_http_file_cache_stream_t  *st;
 
-    aio = ev->data;
-    r = aio->data;
-
-    r->main->blocked--;
-    r->aio = 0;
-
-    r->connection->write->handler(r->connection->write);
-}
-
-#endif
+    st = c->stream;
+    c->stream = NULL;
 
+    if (st->leader != c) {
+        ngx_queue_remove(&c->stream_queue);
+        return;
+    }
 
-static ngx_int_t
-ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
-{
-    ngx_int_t                    rc;
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                   "http file cache stream end: %ui %O", ok, length);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_rbtree_delete(&c->file_cache->streams, &st->node);
 
-    fcn = c->node;
+    while (!ngx_queue_empty(&st->followers)) {
+        q = ngx_queue_head(&st->followers);
+        ngx_queue_remove(q);
 
-    if (fcn == NULL) {
-        fcn = ngx_http_file_cache_lookup(cache, c->key);
-    }
+        fc = ngx_queue_data(q, ngx_http_cache_t, stream_queue);
+        fc->stream = NULL;
 
-    if (fcn) {
-        ngx_queue_remove(&fcn->queue);
+        ev = &fc->wait_event;
 
-        if (c->node == NULL) {
-            fcn->uses++;
-            fcn->count++;
-        }
+        if (fc->streaming) {
+            fc->stream_done = 1;
 
-        if (fcn->error) {
+            if (ok) {
+                fc->length = length;
 
-            if (fcn->valid_sec < ngx_time()) {
-                goto renew;
+            } else {
+                fc->stream_error = 1;
             }
 
-            rc = NGX_OK;
+            if (fc->stream_sending) {
+                ngx_post_event(ev, &ngx_posted_events);
+            }
 
-            goto done;
+            continue;
         }
 
-        if (fcn->exists || fcn->uses >= c->min_uses) {
+        /* the lock is released, waiting requests look up the cache again */
 
-            c->exists = fcn->exists;
-            if (fcn->body_start) {
-                c->body_start = fcn->body_start;
+        if (fc->waiting) {
+            if (ev->timer_set) {
+                ngx_del_timer(ev);
             }
 
-            rc = NGX_OK;
-
-            goto done;
+            ngx_post_event(ev, &ngx_posted_events);
         }
-
-        rc = NGX_AGAIN;
-
-        goto done;
     }
+}
 
-    fcn = ngx_slab_alloc_locked(cache->shpool,
-                                sizeof(ngx_http_file_cache_node_t));
-    if (fcn == NULL) {
-        ngx_shmtx_unlock(&cache->shpool->mutex);
 
-        (void) ngx_http_file_cache_forced_expire(cache);
+static ngx_int_t
+ngx_http_file_cache_stream_start(ngx_http_request_t *r)
+{
+    ngx_int_t          rc;
+    ngx_event_t       *ev;
+    ngx_http_cache_t  *c;
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+    c = r->cache;
 
-        fcn = ngx_slab_alloc_locked(cache->shpool,
-                                    sizeof(ngx_http_file_cache_node_t));
-        if (fcn == NULL) {
-            rc = NGX_ERROR;
-            goto failed;
-        }
+    if (c->stream_error) {
+        return NGX_HTTP_BAD_GATEWAY;
     }
 
-    ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+    /* the length of the response is not known yet */
 
-    ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
-               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+    r->allow_ranges = 0;
 
-    ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+    rc = ngx_http_send_header(r);
 
-    fcn->uses = 1;
-    fcn->count = 1;
-    fcn->updating = 0;
-    fcn->deleting = 0;
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
 
-renew:
+    c->stream_sent = c->body_start;
+    c->stream_sending = 1;
 
-    rc = NGX_DECLINED;
+    /*
+     * the body is sent from a posted event, as the caller still
+     * sets the request write event handler
+     */
 
-    fcn->valid_msec = 0;
-    fcn->error = 0;
-    fcn->exists = 0;
-    fcn->valid_sec = 0;
-    fcn->uniq = 0;
-    fcn->body_start = 0;
-    fcn->fs_size = 0;
+    ev = &c->wait_event;
+    ev->handler = ngx_http_file_cache_stream_handler;
 
-done:
+    ngx_post_event(ev, &ngx_posted_events);
 
-    fcn->expire = ngx_time() + cache->inactive;
+    return NGX_DONE;
+}
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
 
-    c->uniq = fcn->uniq;
-    c->error = fcn->error;
-    c->node = fcn;
+static void
+ngx_http_file_cache_stream_handler(ngx_event_t *ev)
+{
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
+    ngx_http_log_ctx_t  *ctx;
 
-failed:
+    r = ev->data;
+    c = r->connection;
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ctx = c->log->data;
+    ctx->current_request = r;
 
-    return rc;
+    r->write_event_handler = ngx_http_file_cache_stream_writer;
+
+    ngx_http_file_cache_stream_send(r);
+
+    ngx_http_run_posted_requests(c);
 }
 
 
-static ngx_int_t
-ngx_http_file_cache_name(ngx_http_request_t *r, ngx_path_t *path)
+static void
+ngx_http_file_cache_stream_writer(ngx_http_request_t *r)
 {
-    u_char            *p;
-    ngx_http_cache_t  *c;
+    ngx_event_t  *wev;
 
-    c = r->cache;
+    wev = r->connection->write;
 
-    if (c->file.name.len) {
-        return NGX_OK;
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, NGX_ETIMEDOUT,
+                      "client timed out");
+        r->connection->timedout = 1;
+        ngx_http_finalize_request(r, NGX_HTTP_REQUEST_TIME_OUT);
+        return;
     }
 
-    c->file.name.len = path->name.len + 1 + path->len
-                       + 2 * NGX_HTTP_CACHE_KEY_LEN;
+    ngx_http_file_cache_stream_send(r);
+}
 
-    c->file.name.data = ngx_pnalloc(r->pool, c->file.name.len + 1);
-    if (c->file.name.data == NULL) {
-        return NGX_ERROR;
-    }
 
-    ngx_memcpy(c->file.name.data, path->name.data, path->name.len);
+static void
+ngx_http_file_cache_stream_send(ngx_http_request_t *r)
+{
+    ngx_int_t                  rc;
+    ngx_buf_t                 *b;
+    ngx_chain_t               *cl;
+    ngx_event_t               *wev;
+    ngx_http_cache_t          *c;
+    ngx_http_core_loc_conf_t  *clcf;
 
-    p = c->file.name.data + path->name.len + 1 + path->len;
-    p = ngx_hex_dump(p, c->key, NGX_HTTP_CACHE_KEY_LEN);
-    *p = '\0';
+    c = r->cache;
+    wev = r->connection->write;
 
-    ngx_create_hashed_filename(path, c->file.name.data, c->file.name.len);
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache stream send: %O-%O d:%d",
+                   c->stream_sent, c->length, c->stream_done);
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "cache file: \"%s\"", c->file.name.data);
+    if (c->stream_error) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "cache lock holder failed to receive the response");
+        ngx_http_finalize_request(r, NGX_ERROR);
+        return;
+    }
 
-    return NGX_OK;
-}
+    if (c->stream_sent < c->length || c->stream_done) {
 
+        cl = ngx_chain_get_free_buf(r->pool, &c->stream_free);
+        if (cl == NULL) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
 
-static ngx_http_file_cache_node_t *
-ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key)
-{
-    ngx_int_t                    rc;
-    ngx_rbtree_key_t             node_key;
-    ngx_rbtree_node_t           *node, *sentinel;
-    ngx_http_file_cache_node_t  *fcn;
+        b = cl->buf;
 
-    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+        ngx_memzero(b, sizeof(ngx_buf_t));
 
-    node = cache->sh->rbtree.root;
-    sentinel = cache->sh->rbtree.sentinel;
+        b->tag = (ngx_buf_tag_t) &ngx_http_file_cache_stream_send;
+        b->file = &c->file;
+        b->file_pos = c->stream_sent;
+        b->file_last = c->length;
+        b->in_file = (b->file_last > b->file_pos) ? 1 : 0;
 
-    while (node != sentinel) {
+        if (c->stream_done) {
+            b->last_buf = 1;
+            b->last_in_chain = 1;
 
-        if (node_key < node->key) {
-            node = node->left;
-            continue;
+        } else {
+            b->flush = 1;
         }
 
-        if (node_key > node->key) {
-            node = node->right;
-            continue;
-        }
+        c->stream_sent = c->length;
 
-        /* node_key == node->key */
+        rc = ngx_http_output_filter(r, cl);
 
-        fcn = (ngx_http_file_cache_node_t *) node;
+        ngx_chain_update_chains(r->pool, &c->stream_free, &c->stream_busy, &cl,
+                                (ngx_buf_tag_t) &ngx_http_file_cache_stream_send);
 
-        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
-                        NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+    } else {
+        rc = ngx_http_output_filter(r, NULL);
+    }
 
-        if (rc == 0) {
-            return fcn;
-        }
+    if (rc == NGX_ERROR) {
+        ngx_http_finalize_request(r, NGX_ERROR);
+        return;
+    }
 
-        node = (rc < 0) ? node->left : node->right;
+    if (c->stream_done) {
+        ngx_http_finalize_request(r, rc);
+        return;
     }
 
-    /* not found */
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
-    return NULL;
+    if (!wev->delayed) {
+        if (wev->active && !wev->ready) {
+            ngx_add_timer(wev, clcf->send_timeout);
+
+        } else if (wev->timer_set) {
+            ngx_del_timer(wev);
+        }
+    }
+
+    if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+        ngx_http_finalize_request(r, NGX_ERROR);
+    }
 }
 
 
-static void
-ngx_http_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
-    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+static ngx_int_t
+ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_rbtree_node_t           **p;
-    ngx_http_file_cache_node_t   *cn, *cnt;
+    time_t                         now;
+    ssize_t                        n;
+    uint64_t                       usec;
+    ngx_int_t                      rc;
+    ngx_uint_t                     i;
+    struct timeval                 tv;
+    ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_header_t  *h;
 
-    for ( ;; ) {
+    if (c->memory) {
+        n = (ssize_t) c->length;
 
-        if (node->key < temp->key) {
+    } else {
+        /*
+         * the read is reentered when an AIO read completes, so the time
+         * is measured from the moment the read was first issued
+         */
 
-            p = &temp->left;
+        if (c->read_start == 0) {
+            ngx_gettimeofday(&tv);
+            c->read_start = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+        }
 
-        } else if (node->key > temp->key) {
+        n = ngx_http_file_cache_aio_read(r, c);
 
-            p = &temp->right;
+        if (n != NGX_AGAIN) {
+            ngx_gettimeofday(&tv);
+            usec = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+            usec = (usec > c->read_start) ? usec - c->read_start : 0;
 
-        } else { /* node->key == temp->key */
+            c->read_start = 0;
 
-            cn = (ngx_http_file_cache_node_t *) node;
-            cnt = (ngx_http_file_cache_node_t *) temp;
+            for (i = 0; i < NGX_HTTP_CACHE_READ_BUCKETS - 1; i++) {
+                if (usec < ngx_http_cache_read_usec[i]) {
+                    break;
+                }
+            }
 
-            p = (ngx_memcmp(cn->key, cnt->key,
-                            NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t))
-                 < 0)
-                    ? &temp->left : &temp->right;
+            (void) ngx_atomic_fetch_add(&c->file_cache->sh->reads[i], 1);
         }
 
-        if (*p == sentinel) {
-            break;
+        if (n < 0) {
+            return n;
         }
+    }
 
-        temp = *p;
+    if ((size_t) n < c->header_start) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache file \"%s\" is too small", c->file.name.data);
+        return NGX_DECLINED;
     }
 
-    *p = node;
-    node->parent = temp;
-    node->left = sentinel;
-    node->right = sentinel;
-    ngx_rbt_red(node);
-}
+    h = (ngx_http_file_cache_header_t *) c->buf->pos;
 
+    if (h->version != NGX_HTTP_CACHE_VERSION) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "cache file \"%s\" version mismatch", c->file.name.data);
+        return NGX_DECLINED;
+    }
 
-void
-ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
-{
-    ngx_http_file_cache_header_t  *h = (ngx_http_file_cache_header_t *) buf;
+    if (h->crc32 != c->crc32) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache file \"%s\" has md5 collision", c->file.name.data);
+        return NGX_DECLINED;
+    }
 
-    u_char            *p;
-    ngx_str_t         *key;
-    ngx_uint_t         i;
-    ngx_http_cache_t  *c;
+    if (h->body_start > c->body_start) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache file \"%s\" has too long header",
+                      c->file.name.data);
+        return NGX_DECLINED;
+    }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache set header");
+    c->buf->last += n;
 
-    c = r->cache;
+    c->valid_sec = h->valid_sec;
+    c->last_modified = h->last_modified;
+    c->date = h->date;
+    c->valid_msec = h->valid_msec;
+    c->header_start = h->header_start;
+    c->body_start = h->body_start;
+    c->etag.len = h->etag_len;
+    c->etag.data = h->etag;
 
-    h->valid_sec = c->valid_sec;
-    h->last_modified = c->last_modified;
-    h->date = c->date;
-    h->crc32 = c->crc32;
-    h->valid_msec = (u_short) c->valid_msec;
-    h->header_start = (u_short) c->header_start;
-    h->body_start = (u_short) c->body_start;
+    r->cached = 1;
 
-    p = buf + sizeof(ngx_http_file_cache_header_t);
+    if (c->streaming) {
+        return NGX_OK;
+    }
 
-    p = ngx_cpymem(p, ngx_http_file_cache_key, sizeof(ngx_http_file_cache_key));
+    cache = c->file_cache;
 
-    key = c->keys.elts;
-    for (i = 0; i < c->keys.nelts; i++) {
-        p = ngx_copy(p, key[i].data, key[i].len);
-    }
+    if (cache->mem
+        && !c->memory
+        && (off_t) n == c->length
+        && c->uses >= cache->mem_min_uses
+        && c->length <= (off_t) cache->mem_max_object)
+    {
+        /* nodes added by the cache loader do not know the file uniq */
+
+        if (c->node->uniq != c->uniq) {
+            ngx_http_file_cache_shard_lock(c->shard);
+
+            if (c->node->uniq == 0) {
+                c->node->uniq = c->uniq;
+            }
+
+            ngx_http_file_cache_shard_unlock(c->shard);
+        }
+
+        ngx_http_file_cache_mem_set(cache, c);
+
+        c->memory = 1;
+    }
+
+    if (cache->sh->cold) {
+
+        ngx_http_file_cache_shard_lock(c->shard);
+
+        if (!c->node->exists) {
+            c->node->uses = 1;
+            c->node->body_start = c->body_start;
+            c->node->exists = 1;
+            c->node->uniq = c->uniq;
+            c->node->fs_size = c->fs_size;
+
+            (void) ngx_atomic_fetch_add(&cache->sh->size, c->fs_size);
+        }
+
+        ngx_http_file_cache_shard_unlock(c->shard);
+    }
+
+    now = ngx_time();
+
+    if (c->valid_sec < now) {
+
+        ngx_http_file_cache_shard_lock(c->shard);
+
+        if (c->node->updating) {
+            rc = NGX_HTTP_CACHE_UPDATING;
+
+        } else {
+            c->node->updating = 1;
+            c->updating = 1;
+            rc = NGX_HTTP_CACHE_STALE;
+        }
+
+        ngx_http_file_cache_shard_unlock(c->shard);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache expired: %i %T %T",
+                       rc, c->valid_sec, now);
+
+        return rc;
+    }
+
+    return NGX_OK;
+}
+
+
+static ssize_t
+ngx_http_file_cache_aio_read(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+#if (NGX_HAVE_FILE_AIO)
+    ssize_t                    n;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    if (!ngx_file_aio) {
+        goto noaio;
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (!clcf->aio) {
+        goto noaio;
+    }
+
+    n = ngx_file_aio_read(&c->file, c->buf->pos, c->buf->end - c->buf->pos, 0,
+                          r->pool);
+
+    if (n != NGX_AGAIN) {
+        return n;
+    }
+
+    c->file.aio->data = r;
+    c->file.aio->handler = ngx_http_cache_aio_event_handler;
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    return NGX_AGAIN;
+
+noaio:
+
+#endif
+
+    return ngx_read_file(&c->file, c->buf->pos, c->buf->end - c->buf->pos, 0);
+}
+
+
+#if (NGX_HAVE_FILE_AIO)
+
+static void
+ngx_http_cache_aio_event_handler(ngx_event_t *ev)
+{
+    ngx_event_aio_t     *aio;
+    ngx_http_request_t  *r;
+
+    aio = ev->data;
+    r = aio->data;
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    r->connection->write->handler(r->connection->write);
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+{
+    ngx_int_t                     rc;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
+
+    if (c->node == NULL) {
+        c->shard = ngx_http_file_cache_shard(cache, c->key);
+    }
+
+    shard = c->shard;
+
+    ngx_http_file_cache_shard_lock(shard);
+
+    fcn = c->node;
+
+    if (fcn == NULL) {
+        fcn = ngx_http_file_cache_lookup(shard, c->key);
+
+        if (cache->sh->sketch) {
+            ngx_http_file_cache_sketch_add(cache, c->key);
+        }
+    }
+
+    if (fcn) {
+        ngx_queue_remove(&fcn->queue);
+
+        if (c->node == NULL) {
+            fcn->uses++;
+            fcn->count++;
+        }
+
+        if (fcn->error) {
+
+            if (fcn->valid_sec < ngx_time()) {
+                goto renew;
+            }
+
+            rc = NGX_OK;
+
+            goto done;
+        }
+
+        if (fcn->exists || fcn->uses >= c->min_uses) {
+
+            /* a purged entry is fetched again and replaced */
+
+            c->exists = fcn->exists && !fcn->purged;
+            if (fcn->body_start) {
+                c->body_start = fcn->body_start;
+            }
+
+            rc = NGX_OK;
+
+            goto done;
+        }
+
+        rc = NGX_AGAIN;
+
+        goto done;
+    }
+
+    /* the slab pool mutex is always taken after a shard lock */
+
+    fcn = ngx_slab_alloc(cache->shpool, sizeof(ngx_http_file_cache_node_t));
+    if (fcn == NULL) {
+        ngx_http_file_cache_shard_unlock(shard);
+
+        (void) ngx_http_file_cache_forced_expire(cache);
+
+        ngx_http_file_cache_shard_lock(shard);
+
+        fcn = ngx_slab_alloc(cache->shpool,
+                             sizeof(ngx_http_file_cache_node_t));
+        if (fcn == NULL) {
+            rc = NGX_ERROR;
+            goto failed;
+        }
+    }
+
+    ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+
+    ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    ngx_rbtree_insert(&shard->rbtree, &fcn->node);
+
+    fcn->uses = 1;
+    fcn->count = 1;
+    fcn->updating = 0;
+    fcn->deleting = 0;
+    fcn->purged = 0;
+    fcn->protected = 0;
+    fcn->indexed = 0;
+    fcn->purge = NULL;
+
+renew:
+
+    rc = NGX_DECLINED;
+
+    if (fcn->protected) {
+        shard->protected_size -= fcn->fs_size;
+        fcn->protected = 0;
+    }
+
+    fcn->valid_msec = 0;
+    fcn->error = 0;
+    fcn->exists = 0;
+    fcn->valid_sec = 0;
+    fcn->uniq = 0;
+    fcn->body_start = 0;
+    fcn->fs_size = 0;
+
+done:
+
+    fcn->expire = ngx_time() + cache->inactive;
+
+    /*
+     * with the segmented LRU an entry is protected when it is used again,
+     * so a scan of objects used once only displaces probationary entries
+     */
+
+    if (cache->eviction == NGX_HTTP_CACHE_EVICT_SLRU
+        && c->node == NULL
+        && !fcn->protected
+        && fcn->exists
+        && !fcn->purged)
+    {
+        fcn->protected = 1;
+        shard->protected_size += fcn->fs_size;
+    }
+
+    if (fcn->protected) {
+        ngx_queue_insert_head(&shard->protected, &fcn->queue);
+        ngx_http_file_cache_demote(cache, shard);
+
+    } else {
+        ngx_queue_insert_head(&shard->queue, &fcn->queue);
+    }
+
+    c->uniq = fcn->uniq;
+    c->uses = fcn->uses;
+    c->error = fcn->error;
+    c->node = fcn;
+
+failed:
+
+    ngx_http_file_cache_shard_unlock(shard);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_name(ngx_http_request_t *r, ngx_path_t *path)
+{
+    u_char            *p;
+    ngx_http_cache_t  *c;
+
+    c = r->cache;
+
+    if (c->file.name.len) {
+        return NGX_OK;
+    }
+
+    c->file.name.len = path->name.len + 1 + path->len
+                       + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    c->file.name.data = ngx_pnalloc(r->pool, c->file.name.len + 1);
+    if (c->file.name.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(c->file.name.data, path->name.data, path->name.len);
+
+    p = c->file.name.data + path->name.len + 1 + path->len;
+    p = ngx_hex_dump(p, c->key, NGX_HTTP_CACHE_KEY_LEN);
+    *p = '\0';
+
+    ngx_create_hashed_filename(path, c->file.name.data, c->file.name.len);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "cache file: \"%s\"", c->file.name.data);
+
+    return NGX_OK;
+}
+
+
+static ngx_http_file_cache_shard_t *
+ngx_http_file_cache_shard(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_uint_t  n;
+
+    /* the key is an md5 hash, so any of its bytes is uniformly distributed */
+
+    n = key[NGX_HTTP_CACHE_KEY_LEN - 1] % cache->sh->nshards;
+
+    return &cache->sh->shards[n];
+}
+
+
+static void
+ngx_http_file_cache_shard_lock(ngx_http_file_cache_shard_t *shard)
+{
+    struct timeval  tv;
+
+    if (!ngx_shmtx_trylock(&shard->mutex)) {
+        ngx_shmtx_lock(&shard->mutex);
+        shard->contended++;
+    }
+
+    shard->locks++;
+
+    ngx_gettimeofday(&tv);
+
+    shard->start = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+static void
+ngx_http_file_cache_shard_unlock(ngx_http_file_cache_shard_t *shard)
+{
+    uint64_t        now, hold;
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    now = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+
+    /* the system time might be adjusted while the lock is held */
+
+    hold = (now > shard->start) ? now - shard->start : 0;
+
+    shard->hold_usec += (ngx_atomic_uint_t) hold;
+
+    if (hold > shard->max_hold_usec) {
+        shard->max_hold_usec = (ngx_atomic_uint_t) hold;
+    }
+
+    ngx_shmtx_unlock(&shard->mutex);
+}
+
+
+static void
+ngx_http_file_cache_demote(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard)
+{
+    off_t                        max;
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_node_t  *fcn;
+
+    /* the protected segment is limited to 80% of the shard size */
+
+    max = (cache->max_size - cache->max_size / 5) / cache->sh->nshards;
+
+    while (shard->protected_size > max
+           && !ngx_queue_empty(&shard->protected))
+    {
+        q = ngx_queue_last(&shard->protected);
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        ngx_queue_remove(q);
+
+        shard->protected_size -= fcn->fs_size;
+        fcn->protected = 0;
+
+        ngx_queue_insert_head(&shard->queue, q);
+    }
+}
+
+
+static ngx_queue_t *
+ngx_http_file_cache_oldest(ngx_http_file_cache_shard_t *shard)
+{
+    ngx_queue_t                 *p, *q;
+    ngx_http_file_cache_node_t  *pn, *qn;
+
+    if (ngx_queue_empty(&shard->protected)) {
+        return ngx_queue_empty(&shard->queue) ? NULL
+                                              : ngx_queue_last(&shard->queue);
+    }
+
+    p = ngx_queue_last(&shard->protected);
+
+    if (ngx_queue_empty(&shard->queue)) {
+        return p;
+    }
+
+    q = ngx_queue_last(&shard->queue);
+
+    pn = ngx_queue_data(p, ngx_http_file_cache_node_t, queue);
+    qn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+    return (pn->expire < qn->expire) ? p : q;
+}
+
+
+static ngx_queue_t *
+ngx_http_file_cache_victims(ngx_http_file_cache_shard_t *shard)
+{
+    /* probationary entries are evicted before protected ones */
+
+    if (ngx_queue_empty(&shard->queue)) {
+        return &shard->protected;
+    }
+
+    return &shard->queue;
+}
+
+
+/*
+ * The sketch keeps 4-bit counters, two of them in a byte: the counter n
+ * of a row is the low half of the byte if n is even, and the high half
+ * otherwise.
+ */
+
+static ngx_int_t
+ngx_http_file_cache_sketch_init(ngx_http_file_cache_t *cache, size_t size)
+{
+    ngx_uint_t  width;
+
+    /* one counter in each row per 128 bytes of the keys zone */
+
+    for (width = 1024; width < size / 128; width <<= 1) { /* void */ }
+
+    cache->sh->sketch = ngx_slab_alloc_locked(cache->shpool,
+                                              NGX_HTTP_CACHE_SKETCH_ROWS
+                                              * width / 2);
+    if (cache->sh->sketch == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(cache->sh->sketch, NGX_HTTP_CACHE_SKETCH_ROWS * width / 2);
+
+    cache->sh->sketch_mask = width - 1;
+    cache->sh->sketch_ops = 0;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_sketch_add(ngx_http_file_cache_t *cache, u_char *key)
+{
+    u_char                    *p;
+    uint32_t                   h;
+    ngx_uint_t                 i, n, shift, width;
+    ngx_http_file_cache_sh_t  *sh;
+
+    sh = cache->sh;
+    width = sh->sketch_mask + 1;
+
+    /*
+     * counters are updated without locks: a lost update only makes
+     * the estimated frequency a bit lower
+     */
+
+    for (i = 0; i < NGX_HTTP_CACHE_SKETCH_ROWS; i++) {
+        ngx_memcpy(&h, &key[i * sizeof(uint32_t)], sizeof(uint32_t));
+
+        n = h & sh->sketch_mask;
+
+        p = &sh->sketch[(i * width + n) / 2];
+        shift = (n & 1) * 4;
+
+        if (((*p >> shift) & 0x0f) < NGX_HTTP_CACHE_SKETCH_MAX) {
+            *p += (u_char) (1 << shift);
+        }
+    }
+
+    (void) ngx_atomic_fetch_add(&sh->sketch_ops, 1);
+}
+
+
+/*
+ * Counters are halved by the cache manager every 10 * width updates,
+ * so the sketch follows recent use, and the workers do not walk
+ * the whole sketch while serving requests.
+ */
+
+static void
+ngx_http_file_cache_sketch_age(ngx_http_file_cache_t *cache)
+{
+    size_t                     i, size;
+    ngx_uint_t                 width;
+    ngx_http_file_cache_sh_t  *sh;
+
+    sh = cache->sh;
+
+    if (sh->sketch == NULL) {
+        return;
+    }
+
+    width = sh->sketch_mask + 1;
+
+    if (sh->sketch_ops < (ngx_atomic_uint_t) (10 * width)) {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache sketch age: %uA", sh->sketch_ops);
+
+    sh->sketch_ops = 0;
+
+    size = NGX_HTTP_CACHE_SKETCH_ROWS * width / 2;
+
+    for (i = 0; i < size; i++) {
+        sh->sketch[i] = (u_char) ((sh->sketch[i] >> 1) & 0x77);
+    }
+}
+
+
+static ngx_uint_t
+ngx_http_file_cache_sketch_get(ngx_http_file_cache_t *cache, u_char *key)
+{
+    uint32_t                   h;
+    ngx_uint_t                 i, n, v, width, min;
+    ngx_http_file_cache_sh_t  *sh;
+
+    sh = cache->sh;
+    width = sh->sketch_mask + 1;
+    min = NGX_HTTP_CACHE_SKETCH_MAX;
+
+    for (i = 0; i < NGX_HTTP_CACHE_SKETCH_ROWS; i++) {
+        ngx_memcpy(&h, &key[i * sizeof(uint32_t)], sizeof(uint32_t));
+
+        n = h & sh->sketch_mask;
+
+        v = (sh->sketch[(i * width + n) / 2] >> ((n & 1) * 4)) & 0x0f;
+
+        if (v < min) {
+            min = v;
+        }
+    }
+
+    return min;
+}
+
+
+static ngx_uint_t
+ngx_http_file_cache_admit(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+{
+    ngx_uint_t                   freq, victim;
+    ngx_queue_t                 *queue;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[NGX_HTTP_CACHE_KEY_LEN];
+
+    if (cache->sh->sketch == NULL
+        || (off_t) cache->sh->size < cache->max_size)
+    {
+        return 1;
+    }
+
+    ngx_http_file_cache_shard_lock(c->shard);
+
+    queue = ngx_http_file_cache_victims(c->shard);
+
+    if (ngx_queue_empty(queue)) {
+        ngx_http_file_cache_shard_unlock(c->shard);
+        return 1;
+    }
+
+    fcn = ngx_queue_data(ngx_queue_last(queue), ngx_http_file_cache_node_t,
+                         queue);
+
+    ngx_memcpy(key, (u_char *) &fcn->node.key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    ngx_http_file_cache_shard_unlock(c->shard);
+
+    freq = ngx_http_file_cache_sketch_get(cache, c->key);
+    victim = ngx_http_file_cache_sketch_get(cache, key);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache admission: %ui victim:%ui", freq, victim);
+
+    return freq > victim;
+}
+
+
+static ngx_http_file_cache_node_t *
+ngx_http_file_cache_lookup(ngx_http_file_cache_shard_t *shard, u_char *key)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_key_t             node_key;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_http_file_cache_node_t  *fcn;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = shard->rbtree.root;
+    sentinel = shard->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        fcn = (ngx_http_file_cache_node_t *) node;
+
+        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                        NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (rc == 0) {
+            return fcn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    /* not found */
+
+    return NULL;
+}
+
+
+static void
+ngx_http_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t           **p;
+    ngx_http_file_cache_node_t   *cn, *cnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            cn = (ngx_http_file_cache_node_t *) node;
+            cnt = (ngx_http_file_cache_node_t *) temp;
+
+            p = (ngx_memcmp(cn->key, cnt->key,
+                            NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t))
+                 < 0)
+                    ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_mem_get(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    size_t                           len;
+    ngx_buf_t                       *b;
+    ngx_http_file_cache_t           *cache;
+    ngx_http_file_cache_mem_node_t  *mn;
+
+    cache = c->file_cache;
+
+    ngx_shmtx_lock(&cache->mem_pool->mutex);
+
+    mn = ngx_http_file_cache_mem_lookup(cache->mem, c->key);
+
+    /* an object stored for another cache file is stale */
+
+    if (mn == NULL || mn->uniq != c->uniq) {
+        cache->mem->misses++;
+        ngx_shmtx_unlock(&cache->mem_pool->mutex);
+        return NGX_DECLINED;
+    }
+
+    len = mn->len;
+
+    ngx_shmtx_unlock(&cache->mem_pool->mutex);
+
+    /* the zone is not locked while the buffer is allocated */
+
+    b = ngx_create_temp_buf(r->pool, len);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_shmtx_lock(&cache->mem_pool->mutex);
+
+    /* the object may have been replaced or evicted meanwhile */
+
+    mn = ngx_http_file_cache_mem_lookup(cache->mem, c->key);
+
+    if (mn == NULL || mn->uniq != c->uniq || mn->len != len) {
+        cache->mem->misses++;
+        ngx_shmtx_unlock(&cache->mem_pool->mutex);
+        ngx_pfree(r->pool, b->start);
+        return NGX_DECLINED;
+    }
+
+    ngx_memcpy(b->pos, mn->data, len);
+
+    c->length = len;
+
+    ngx_queue_remove(&mn->queue);
+    ngx_queue_insert_head(&cache->mem->queue, &mn->queue);
+
+    cache->mem->hits++;
+
+    ngx_shmtx_unlock(&cache->mem_pool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache memory hit: %O", c->length);
+
+    c->buf = b;
+    c->memory = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_mem_set(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+{
+    size_t                           len;
+    ngx_uint_t                       n;
+    ngx_queue_t                     *q;
+    ngx_http_file_cache_mem_node_t  *mn;
+
+    len = c->buf->last - c->buf->pos;
+
+    ngx_shmtx_lock(&cache->mem_pool->mutex);
+
+    mn = ngx_http_file_cache_mem_lookup(cache->mem, c->key);
+
+    if (mn) {
+        if (mn->uniq == c->uniq) {
+            ngx_shmtx_unlock(&cache->mem_pool->mutex);
+            return;
+        }
+
+        ngx_queue_remove(&mn->queue);
+        ngx_rbtree_delete(&cache->mem->rbtree, &mn->node);
+        cache->mem->size -= mn->len;
+        ngx_slab_free_locked(cache->mem_pool, mn);
+    }
+
+    for (n = 0; /* void */ ; n++) {
+
+        mn = ngx_slab_alloc_locked(cache->mem_pool,
+                                   offsetof(ngx_http_file_cache_mem_node_t,
+                                            data)
+                                   + len);
+        if (mn) {
+            break;
+        }
+
+        /*
+         * free the least recently used objects, a limited number of them
+         * as the freed memory may be of another slab size
+         */
+
+        if (n == NGX_HTTP_CACHE_MEM_EVICT
+            || ngx_queue_empty(&cache->mem->queue))
+        {
+            ngx_shmtx_unlock(&cache->mem_pool->mutex);
+            return;
+        }
+
+        q = ngx_queue_last(&cache->mem->queue);
+        mn = ngx_queue_data(q, ngx_http_file_cache_mem_node_t, queue);
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&cache->mem->rbtree, &mn->node);
+        cache->mem->size -= mn->len;
+        ngx_slab_free_locked(cache->mem_pool, mn);
+
+        cache->mem->evictions++;
+    }
+
+    ngx_memcpy((u_char *) &mn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+
+    ngx_memcpy(mn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    mn->uniq = c->uniq;
+    mn->len = len;
+    ngx_memcpy(mn->data, c->buf->pos, len);
+
+    ngx_rbtree_insert(&cache->mem->rbtree, &mn->node);
+    ngx_queue_insert_head(&cache->mem->queue, &mn->queue);
+
+    cache->mem->size += len;
+    cache->mem->stores++;
+
+    ngx_shmtx_unlock(&cache->mem_pool->mutex);
+}
+
+
+static void
+ngx_http_file_cache_mem_remove(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_http_file_cache_mem_node_t  *mn;
+
+    ngx_shmtx_lock(&cache->mem_pool->mutex);
+
+    mn = ngx_http_file_cache_mem_lookup(cache->mem, key);
+
+    if (mn) {
+        ngx_queue_remove(&mn->queue);
+        ngx_rbtree_delete(&cache->mem->rbtree, &mn->node);
+        cache->mem->size -= mn->len;
+        ngx_slab_free_locked(cache->mem_pool, mn);
+    }
+
+    ngx_shmtx_unlock(&cache->mem_pool->mutex);
+}
+
+
+static ngx_http_file_cache_mem_node_t *
+ngx_http_file_cache_mem_lookup(ngx_http_file_cache_mem_sh_t *mem, u_char *key)
+{
+    ngx_int_t                        rc;
+    ngx_rbtree_key_t                 node_key;
+    ngx_rbtree_node_t               *node, *sentinel;
+    ngx_http_file_cache_mem_node_t  *mn;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = mem->rbtree.root;
+    sentinel = mem->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        mn = (ngx_http_file_cache_mem_node_t *) node;
+
+        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], mn->key,
+                        NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (rc == 0) {
+            return mn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    /* not found */
+
+    return NULL;
+}
+
+
+static void
+ngx_http_file_cache_mem_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t               **p;
+    ngx_http_file_cache_mem_node_t   *mn, *mnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            mn = (ngx_http_file_cache_mem_node_t *) node;
+            mnt = (ngx_http_file_cache_mem_node_t *) temp;
+
+            p = (ngx_memcmp(mn->key, mnt->key,
+                            NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t))
+                 < 0)
+                    ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+void
+ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
+{
+    ngx_http_file_cache_header_t  *h = (ngx_http_file_cache_header_t *) buf;
+
+    u_char            *p;
+    ngx_str_t         *key;
+    ngx_uint_t         i;
+    ngx_http_cache_t  *c;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache set header");
+
+    c = r->cache;
+
+    ngx_memzero(h, sizeof(ngx_http_file_cache_header_t));
+
+    h->version = NGX_HTTP_CACHE_VERSION;
+    h->valid_sec = c->valid_sec;
+    h->last_modified = c->last_modified;
+    h->date = c->date;
+    h->crc32 = c->crc32;
+    h->valid_msec = (u_short) c->valid_msec;
+    h->header_start = (u_short) c->header_start;
+    h->body_start = (u_short) c->body_start;
+
+    if (c->etag.len <= NGX_HTTP_CACHE_ETAG_LEN) {
+        h->etag_len = (u_char) c->etag.len;
+        ngx_memcpy(h->etag, c->etag.data, c->etag.len);
+    }
+
+    p = buf + sizeof(ngx_http_file_cache_header_t);
+
+    p = ngx_cpymem(p, ngx_http_file_cache_key, sizeof(ngx_http_file_cache_key));
+
+    key = c->keys.elts;
+    for (i = 0; i < c->keys.nelts; i++) {
+        p = ngx_copy(p, key[i].data, key[i].len);
+    }
+
+    *p = LF;
+}
+
+
+void
+ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
+{
+    off_t                   fs_size;
+    ngx_int_t               rc;
+    ngx_file_uniq_t         uniq;
+    ngx_file_info_t         fi;
+    ngx_http_cache_t        *c;
+    ngx_ext_rename_file_t   ext;
+    ngx_http_file_cache_t  *cache;
+
+    c = r->cache;
+
+    if (c->updated) {
+        return;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache update");
+
+    c->updated = 1;
+    c->updating = 0;
+
+    cache = c->file_cache;
+
+    if (cache->mem) {
+        ngx_http_file_cache_mem_remove(cache, c->key);
+    }
+
+    uniq = 0;
+    fs_size = 0;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache rename: \"%s\" to \"%s\"",
+                   tf->file.name.data, c->file.name.data);
+
+    ext.access = NGX_FILE_OWNER_ACCESS;
+    ext.path_access = NGX_FILE_OWNER_ACCESS;
+    ext.time = -1;
+    ext.create_path = 1;
+    ext.delete_file = 1;
+    ext.log = r->connection->log;
+
+    rc = ngx_ext_rename_file(&tf->file.name, &c->file.name, &ext);
+
+    if (rc == NGX_OK) {
+
+        if (ngx_fd_info(tf->file.fd, &fi) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                          ngx_fd_info_n " \"%s\" failed", tf->file.name.data);
+
+            rc = NGX_ERROR;
+
+        } else {
+            uniq = ngx_file_uniq(&fi);
+            fs_size = (ngx_file_fs_size(&fi) + cache->bsize - 1) / cache->bsize;
+        }
+    }
+
+    ngx_http_file_cache_shard_lock(c->shard);
+
+    c->node->count--;
+    c->node->uniq = uniq;
+    c->node->body_start = c->body_start;
+
+    (void) ngx_atomic_fetch_add(&cache->sh->size, fs_size - c->node->fs_size);
+
+    if (c->node->protected) {
+        c->shard->protected_size += fs_size - c->node->fs_size;
+    }
+
+    c->node->fs_size = fs_size;
+
+    if (rc == NGX_OK) {
+        c->node->exists = 1;
+        c->node->purged = 0;
+    }
+
+    c->node->updating = 0;
+
+    ngx_http_file_cache_shard_unlock(c->shard);
+
+    if (c->stream) {
+        ngx_http_file_cache_stream_end(c, 1, tf->offset);
+    }
+
+    if (rc == NGX_OK && cache->purge) {
+        ngx_http_file_cache_purge_index(cache, c, 1);
+    }
+}
+
+
+void
+ngx_http_file_cache_update_header(ngx_http_request_t *r)
+{
+    ssize_t                        n;
+    ngx_err_t                      err;
+    ngx_file_t                     file;
+    ngx_file_uniq_t                uniq;
+    ngx_file_info_t                fi;
+    ngx_http_cache_t              *c;
+    ngx_http_file_cache_header_t   h;
+
+    c = r->cache;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache update header");
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = c->file.name;
+    file.log = r->connection->log;
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDWR, NGX_FILE_OPEN, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
+
+        /* cache file may have been deleted */
+
+        if (err == NGX_ENOENT) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http file cache \"%s\" not found",
+                           file.name.data);
+            return;
+        }
+
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, err,
+                      ngx_open_file_n " \"%s\" failed", file.name.data);
+        return;
+    }
+
+    /*
+     * make sure cache file wasn't replaced;
+     * if it was, do nothing
+     */
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", file.name.data);
+        goto done;
+    }
+
+    uniq = ngx_file_uniq(&fi);
+
+    if (c->uniq != uniq) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache \"%s\" changed",
+                       file.name.data);
+        goto done;
+    }
+
+    n = ngx_read_file(&file, (u_char *) &h,
+                      sizeof(ngx_http_file_cache_header_t), 0);
+
+    if (n == NGX_ERROR) {
+        goto done;
+    }
+
+    if ((size_t) n != sizeof(ngx_http_file_cache_header_t)) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      ngx_read_file_n " read only %z of %z from \"%s\"",
+                      n, sizeof(ngx_http_file_cache_header_t), file.name.data);
+        goto done;
+    }
+
+    if (h.version != NGX_HTTP_CACHE_VERSION
+        || h.last_modified != c->last_modified
+        || h.crc32 != c->crc32
+        || h.header_start != c->header_start
+        || h.body_start != c->body_start)
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache \"%s\" content changed",
+                       file.name.data);
+        goto done;
+    }
+
+    /*
+     * only the validity and date fields change on revalidation,
+     * the stored response headers and body are kept as they are
+     */
+
+    h.valid_sec = c->valid_sec;
+    h.date = c->date;
+    h.valid_msec = (u_short) c->valid_msec;
+
+    if (c->file_cache->mem) {
+        ngx_http_file_cache_mem_remove(c->file_cache, c->key);
+    }
+
+    (void) ngx_write_file(&file, (u_char *) &h,
+                          sizeof(ngx_http_file_cache_header_t), 0);
+
+done:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+}
+
+
+ngx_int_t
+ngx_http_file_cache_purge(ngx_http_request_t *r, ngx_str_t *tags)
+{
+    u_char                 *p, *last, *start, *key;
+    size_t                  len;
+    ngx_int_t               rc;
+    ngx_str_t              *k;
+    ngx_uint_t              i, n;
+    ngx_array_t                  *keys;
+    ngx_http_cache_t             *c;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_shard_t  *shard;
+
+    c = r->cache;
+    cache = c->file_cache;
+
+    len = 0;
+
+    k = c->keys.elts;
+    for (i = 0; i < c->keys.nelts; i++) {
+        len += k[i].len;
+    }
+
+    if (tags->len == 0 && (len == 0 || k[c->keys.nelts - 1].len == 0
+        || k[c->keys.nelts - 1].data[k[c->keys.nelts - 1].len - 1] != '*'))
+    {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache purge key");
+
+        return ngx_http_file_cache_purge_node(cache, c->key) ? NGX_OK
+                                                              : NGX_DECLINED;
+    }
+
+    if (!cache->purge) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "purging by a key prefix or tags requires "
+                      "the \"purge\" parameter of the cache");
+        return NGX_DECLINED;
+    }
+
+    keys = ngx_array_create(r->pool, 16, NGX_HTTP_CACHE_KEY_LEN);
+    if (keys == NULL) {
+        return NGX_ERROR;
+    }
+
+    rc = NGX_OK;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (tags->len) {
+        p = tags->data;
+        last = p + tags->len;
+
+        while (p < last && rc == NGX_OK) {
+
+            while (p < last && (*p == ' ' || *p == ',')) {
+                p++;
+            }
+
+            start = p;
+
+            while (p < last && *p != ' ' && *p != ',') {
+                p++;
+            }
+
+            if (p == start) {
+                break;
+            }
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http file cache purge tag: \"%*s\"",
+                           p - start, start);
+
+            rc = ngx_http_file_cache_purge_collect(cache->sh->tags.root,
+                                                   cache->sh->tags.sentinel,
+                                                   start, p - start, 1, keys);
+        }
+
+    } else {
+
+        /* the key without the trailing "*" is a prefix */
+
+        key = ngx_pnalloc(r->pool, len);
+        if (key == NULL) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return NGX_ERROR;
+        }
+
+        for (p = key, i = 0; i < c->keys.nelts; i++) {
+            p = ngx_cpymem(p, k[i].data, k[i].len);
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache purge prefix: \"%*s\"",
+                       len - 1, key);
+
+        rc = ngx_http_file_cache_purge_collect(cache->sh->keys.root,
+                                               cache->sh->keys.sentinel,
+                                               key, len - 1, 0, keys);
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (rc != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * the key text and tags of nodes restored by the cache loader are
+     * not known until their first use, so all such nodes are purged too
+     */
+
+    if (cache->sh->unindexed) {
+        cache->sh->unindexed = 0;
+
+        for (i = 0; i < cache->sh->nshards && rc == NGX_OK; i++) {
+            shard = &cache->sh->shards[i];
+
+            ngx_http_file_cache_shard_lock(shard);
+
+            rc = ngx_http_file_cache_purge_unindexed(shard->rbtree.root,
+                                                     shard->rbtree.sentinel,
+                                                     keys);
+
+            ngx_http_file_cache_shard_unlock(shard);
+        }
+
+        if (rc != NGX_OK) {
+            cache->sh->unindexed = 1;
+            return NGX_ERROR;
+        }
+    }
+
+    /* the nodes are marked under the shard locks taken one at a time */
+
+    n = 0;
+    key = keys->elts;
+
+    for (i = 0; i < keys->nelts; i++) {
+        n += ngx_http_file_cache_purge_node(cache,
+                                            key + i * NGX_HTTP_CACHE_KEY_LEN);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache purge: %ui of %ui", n, keys->nelts);
+
+    return n ? NGX_OK : NGX_DECLINED;
+}
+
+
+ngx_int_t
+ngx_http_file_cache_set_tags(ngx_http_request_t *r,
+    ngx_http_complex_value_t *cv)
+{
+    ngx_http_cache_t       *c;
+    ngx_http_file_cache_t  *cache;
+
+    c = r->cache;
+    cache = c->file_cache;
+
+    /*
+     * nodes restored by the cache loader are indexed on their first use,
+     * an unlocked test is enough as the index is checked again
+     */
+
+    if (!cache->purge || c->node == NULL || c->node->indexed) {
+        return NGX_OK;
+    }
+
+    if (cv && ngx_http_complex_value(r, cv, &c->tags) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_file_cache_purge_index(cache, c, 0);
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_http_cache_send(ngx_http_request_t *r)
+{
+    ngx_int_t          rc;
+    ngx_buf_t         *b;
+    ngx_chain_t        out;
+    ngx_http_cache_t  *c;
+
+    c = r->cache;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache send: %s", c->file.name.data);
+
+    if (c->streaming) {
+        return ngx_http_file_cache_stream_start(r);
+    }
+
+    if (r != r->main && c->length - c->body_start == 0) {
+        return ngx_http_send_header(r);
+    }
+
+    /* we need to allocate all before the header would be sent */
+
+    b = ngx_pcalloc(r->pool, sizeof(ngx_buf_t));
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (!c->memory) {
+        b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+        if (b->file == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+    }
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    (void) ngx_atomic_fetch_add(&c->file_cache->sh->hit_bytes,
+                                c->length - c->body_start);
+
+    if (c->memory) {
+
+        /* the whole object is in the buffer read from the file or memory */
+
+        b->pos = c->buf->start + c->body_start;
+        b->last = c->buf->start + c->length;
+
+        b->memory = (c->length - c->body_start) ? 1: 0;
+
+    } else {
+        b->file_pos = c->body_start;
+        b->file_last = c->length;
+
+        b->in_file = (c->length - c->body_start) ? 1: 0;
+
+        b->file->fd = c->file.fd;
+        b->file->name = c->file.name;
+        b->file->log = r->connection->log;
+    }
+
+    b->last_buf = (r == r->main) ? 1: 0;
+    b->last_in_chain = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+void
+ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
+{
+    ngx_event_t                 *ev;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_node_t  *fcn;
+
+    if (c->updated || c->node == NULL) {
+        return;
+    }
+
+    cache = c->file_cache;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                   "http file cache free, fd: %d", c->file.fd);
+
+    ngx_http_file_cache_shard_lock(c->shard);
+
+    fcn = c->node;
+    fcn->count--;
+
+    if (c->updating) {
+        fcn->updating = 0;
+    }
+
+    if (c->error) {
+        fcn->error = c->error;
+
+        if (c->valid_sec) {
+            fcn->valid_sec = c->valid_sec;
+            fcn->valid_msec = c->valid_msec;
+        }
+
+    } else if (!fcn->exists && fcn->count == 0 && c->min_uses == 1) {
+        ngx_queue_remove(&fcn->queue);
+        ngx_rbtree_delete(&c->shard->rbtree, &fcn->node);
+        ngx_http_file_cache_free_node(cache, fcn);
+        c->node = NULL;
+    }
+
+    ngx_http_file_cache_shard_unlock(c->shard);
+
+    if (c->stream) {
+        ngx_http_file_cache_stream_end(c, c->complete, tf ? tf->offset : 0);
+    }
+
+    c->updated = 1;
+    c->updating = 0;
+
+    if (c->temp_file) {
+        if (tf && tf->file.fd != NGX_INVALID_FILE) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                           "http file cache incomplete: \"%s\"",
+                           tf->file.name.data);
+
+            if (ngx_delete_file(tf->file.name.data) == NGX_FILE_ERROR) {
+                ngx_log_error(NGX_LOG_CRIT, c->file.log, ngx_errno,
+                              ngx_delete_file_n " \"%s\" failed",
+                              tf->file.name.data);
+            }
+        }
+    }
+
+    if (c->wait_event.timer_set) {
+        ngx_del_timer(&c->wait_event);
+    }
+
+    if (c->wait_event.prev) {
+        ev = &c->wait_event;
+        ngx_delete_posted_event(ev);
+    }
+}
+
+
+static void
+ngx_http_file_cache_cleanup(void *data)
+{
+    ngx_http_cache_t  *c = data;
+
+    if (c->updated) {
+        return;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                   "http file cache cleanup");
+
+    if (c->updating) {
+        ngx_log_error(NGX_LOG_ALERT, c->file.log, 0,
+                      "stalled cache updating, error:%ui", c->error);
+    }
+
+    ngx_http_file_cache_free(c, NULL);
+}
+
+
+static time_t
+ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
+{
+    u_char                       *name;
+    size_t                        len;
+    time_t                        wait, expire;
+    ngx_uint_t                    n, tries;
+    ngx_path_t                   *path;
+    ngx_queue_t                  *q, *queue;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard, *sh;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache forced expire");
+
+    /*
+     * the least recently used entry of the zone is at the tail
+     * of one of the shard queues, the oldest tail is expired
+     */
+
+    shard = &cache->sh->shards[0];
+    expire = 0;
+
+    for (n = 0; cache->sh->nshards > 1 && n < cache->sh->nshards; n++) {
+        sh = &cache->sh->shards[n];
+
+        ngx_http_file_cache_shard_lock(sh);
+
+        queue = ngx_http_file_cache_victims(sh);
+
+        if (!ngx_queue_empty(queue)) {
+            q = ngx_queue_last(queue);
+            fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+            if (expire == 0 || fcn->expire < expire) {
+                expire = fcn->expire;
+                shard = sh;
+            }
+        }
+
+        ngx_http_file_cache_shard_unlock(sh);
+    }
+
+    path = cache->path;
+    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    name = ngx_alloc(len + 1, ngx_cycle->log);
+    if (name == NULL) {
+        return 10;
+    }
+
+    ngx_memcpy(name, path->name.data, path->name.len);
+
+    wait = 10;
+    tries = 20;
+
+    ngx_http_file_cache_shard_lock(shard);
+
+    queue = ngx_http_file_cache_victims(shard);
+
+    for (q = ngx_queue_last(queue);
+         q != ngx_queue_sentinel(queue);
+         q = ngx_queue_prev(q))
+    {
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                  "http file cache forced expire: #%d %d %02xd%02xd%02xd%02xd",
+                  fcn->count, fcn->exists,
+                  fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+
+        if (fcn->count == 0) {
+            ngx_http_file_cache_delete(cache, shard, q, name);
+            (void) ngx_atomic_fetch_add(&cache->sh->evicted, 1);
+            wait = 0;
+
+        } else {
+            if (--tries) {
+                continue;
+            }
+
+            wait = 1;
+        }
+
+        break;
+    }
+
+    ngx_http_file_cache_shard_unlock(shard);
+
+    ngx_free(name);
+
+    return wait;
+}
+
+
+static time_t
+ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
+{
+    u_char                       *name;
+    size_t                        len;
+    time_t                        now, wait, next;
+    ngx_uint_t                    n;
+    ngx_path_t                   *path;
+    ngx_http_file_cache_shard_t  *shard;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache expire");
+
+    path = cache->path;
+    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    name = ngx_alloc(len + 1, ngx_cycle->log);
+    if (name == NULL) {
+        return 10;
+    }
+
+    ngx_memcpy(name, path->name.data, path->name.len);
+
+    now = ngx_time();
+    next = 10;
+
+    cache->last = ngx_current_msec;
+
+    for (n = 0; n < cache->sh->nshards; n++) {
+        shard = &cache->sh->shards[n];
+
+        wait = ngx_http_file_cache_expire_shard(cache, shard, name, now);
+
+        if (wait < next) {
+            next = wait;
+        }
+
+        ngx_log_debug5(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache shard %ui locks:%uA contended:%uA "
+                       "hold:%uAus max:%uAus",
+                       n, shard->locks, shard->contended,
+                       shard->hold_usec, shard->max_hold_usec);
+
+        if (ngx_quit || ngx_terminate) {
+            break;
+        }
+    }
+
+    ngx_free(name);
+
+    return next;
+}
+
+
+static time_t
+ngx_http_file_cache_expire_shard(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard, u_char *name, time_t now)
+{
+    u_char                      *p;
+    size_t                       len;
+    time_t                       wait;
+    ngx_uint_t                   n;
+    ngx_msec_t                   elapsed;
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+
+    for ( ;; ) {
+
+        /*
+         * at most manager_files entries are looked at while the shard
+         * is locked, so workers wait for a bounded amount of work only
+         */
+
+        ngx_http_file_cache_shard_lock(shard);
+
+        wait = 0;
+
+        for (n = 0; n < cache->manager_files; n++) {
+
+            q = ngx_http_file_cache_oldest(shard);
+
+            if (q == NULL) {
+                wait = 10;
+                break;
+            }
+
+            fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+            wait = fcn->expire - now;
+
+            if (wait > 0) {
+                wait = wait > 10 ? 10 : wait;
+                break;
+            }
+
+            wait = 0;
+
+            ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache expire: #%d %d %02xd%02xd%02xd%02xd",
+                       fcn->count, fcn->exists,
+                       fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+
+            if (fcn->count == 0) {
+                ngx_http_file_cache_delete(cache, shard, q, name);
+                (void) ngx_atomic_fetch_add(&cache->sh->expired, 1);
+                continue;
+            }
+
+            if (fcn->deleting) {
+                wait = 1;
+                break;
+            }
+
+            p = ngx_hex_dump(key, (u_char *) &fcn->node.key,
+                             sizeof(ngx_rbtree_key_t));
+            len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
+            (void) ngx_hex_dump(p, fcn->key, len);
+
+            /*
+             * abnormally exited workers may leave locked cache entries,
+             * and although it may be safe to remove them completely,
+             * we prefer to just move them to the top of the inactive queue
+             */
+
+            ngx_queue_remove(q);
+            fcn->expire = ngx_time() + cache->inactive;
+            ngx_queue_insert_head(fcn->protected ? &shard->protected
+                                                 : &shard->queue,
+                                  &fcn->queue);
+
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                       "ignore long locked inactive cache entry %*s, count:%d",
+                       2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
+        }
+
+        ngx_http_file_cache_shard_unlock(shard);
+
+        if (wait) {
+            return wait;
+        }
+
+        if (ngx_quit || ngx_terminate) {
+            return 1;
+        }
+
+        ngx_time_update();
+
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
 
-    *p = LF;
+        if (elapsed >= cache->manager_threshold) {
+            ngx_msleep(cache->manager_sleep);
+
+            ngx_time_update();
+
+            cache->last = ngx_current_msec;
+        }
+    }
 }
 
 
-void
-ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
+static void
+ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard, ngx_queue_t *q, u_char *name)
 {
-    off_t                   fs_size;
-    ngx_int_t               rc;
-    ngx_file_uniq_t         uniq;
-    ngx_file_info_t         fi;
-    ngx_http_cache_t        *c;
-    ngx_ext_rename_file_t   ext;
-    ngx_http_file_cache_t  *cache;
+    u_char                      *p;
+    size_t                       len;
+    ngx_path_t                  *path;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[NGX_HTTP_CACHE_KEY_LEN];
 
-    c = r->cache;
+    fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
-    if (c->updated) {
-        return;
+    if (fcn->protected) {
+        shard->protected_size -= fcn->fs_size;
+        fcn->protected = 0;
+
+        ngx_queue_remove(q);
+        ngx_queue_insert_tail(&shard->queue, q);
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache update");
+    if (fcn->exists) {
+        (void) ngx_atomic_fetch_add(&cache->sh->size, -fcn->fs_size);
 
-    c->updated = 1;
-    c->updating = 0;
+        path = cache->path;
+        p = name + path->name.len + 1 + path->len;
+        p = ngx_hex_dump(p, (u_char *) &fcn->node.key,
+                         sizeof(ngx_rbtree_key_t));
+        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
+        p = ngx_hex_dump(p, fcn->key, len);
+        *p = '\0';
 
-    cache = c->file_cache;
+        fcn->count++;
+        fcn->deleting = 1;
+        ngx_http_file_cache_shard_unlock(shard);
 
-    uniq = 0;
-    fs_size = 0;
+        if (cache->mem) {
+            ngx_memcpy(key, (u_char *) &fcn->node.key,
+                       sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache rename: \"%s\" to \"%s\"",
-                   tf->file.name.data, c->file.name.data);
+            ngx_http_file_cache_mem_remove(cache, key);
+        }
 
-    ext.access = NGX_FILE_OWNER_ACCESS;
-    ext.path_access = NGX_FILE_OWNER_ACCESS;
-    ext.time = -1;
-    ext.create_path = 1;
-    ext.delete_file = 1;
-    ext.log = r->connection->log;
+        len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+        ngx_create_hashed_filename(path, name, len);
 
-    rc = ngx_ext_rename_file(&tf->file.name, &c->file.name, &ext);
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache expire: \"%s\"", name);
 
-    if (rc == NGX_OK) {
+        /* entries restored from an index may refer to removed files */
 
-        if (ngx_fd_info(tf->file.fd, &fi) == NGX_FILE_ERROR) {
-            ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
-                          ngx_fd_info_n " \"%s\" failed", tf->file.name.data);
+        if (ngx_delete_file(name) == NGX_FILE_ERROR
+            && ngx_errno != NGX_ENOENT)
+        {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", name);
+        }
 
-            rc = NGX_ERROR;
+        ngx_http_file_cache_shard_lock(shard);
+        fcn->count--;
+        fcn->deleting = 0;
+    }
 
-        } else {
-            uniq = ngx_file_uniq(&fi);
-            fs_size = (ngx_file_fs_size(&fi) + cache->bsize - 1) / cache->bsize;
-        }
+    if (fcn->count == 0) {
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&shard->rbtree, &fcn->node);
+        ngx_http_file_cache_free_node(cache, fcn);
     }
+}
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
 
-    c->node->count--;
-    c->node->uniq = uniq;
-    c->node->body_start = c->body_start;
+static void
+ngx_http_file_cache_free_node(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    ngx_http_file_cache_purge_node_t  *pn, *next;
 
-    cache->sh->size += fs_size - c->node->fs_size;
-    c->node->fs_size = fs_size;
+    ngx_shmtx_lock(&cache->shpool->mutex);
 
-    if (rc == NGX_OK) {
-        c->node->exists = 1;
+    for (pn = fcn->purge; pn; pn = next) {
+        next = pn->next;
+
+        ngx_rbtree_delete(pn->tag ? &cache->sh->tags : &cache->sh->keys,
+                          &pn->node);
+        ngx_slab_free_locked(cache->shpool, pn);
     }
 
-    c->node->updating = 0;
+    ngx_slab_free_locked(cache->shpool, fcn);
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
 }
 
 
-ngx_int_t
-ngx_http_cache_send(ngx_http_request_t *r)
+static void
+ngx_http_file_cache_purge_index(ngx_http_file_cache_t *cache,
+    ngx_http_cache_t *c, ngx_uint_t replace)
 {
-    ngx_int_t          rc;
-    ngx_buf_t         *b;
-    ngx_chain_t        out;
-    ngx_http_cache_t  *c;
+    u_char                            *p, *last, *start, *key;
+    size_t                             len;
+    ngx_str_t                         *k;
+    ngx_uint_t                         i;
+    ngx_http_file_cache_node_t        *fcn;
+    ngx_http_file_cache_purge_node_t  *pn, *next, **link;
 
-    c = r->cache;
+    len = 0;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache send: %s", c->file.name.data);
+    k = c->keys.elts;
+    for (i = 0; i < c->keys.nelts; i++) {
+        len += k[i].len;
+    }
 
-    if (r != r->main && c->length - c->body_start == 0) {
-        return ngx_http_send_header(r);
+    if (len > 0xffff) {
+        cache->sh->unindexed = 1;
+        return;
     }
 
-    /* we need to allocate all before the header would be sent */
+    ngx_http_file_cache_shard_lock(c->shard);
 
-    b = ngx_pcalloc(r->pool, sizeof(ngx_buf_t));
-    if (b == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
-    }
+    fcn = c->node;
 
-    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
-    if (b->file == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    if (fcn->indexed && !replace) {
+        ngx_http_file_cache_shard_unlock(c->shard);
+        return;
     }
 
-    rc = ngx_http_send_header(r);
+    ngx_shmtx_lock(&cache->shpool->mutex);
 
-    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
-        return rc;
+    for (pn = fcn->purge; pn; pn = next) {
+        next = pn->next;
+
+        ngx_rbtree_delete(pn->tag ? &cache->sh->tags : &cache->sh->keys,
+                          &pn->node);
+        ngx_slab_free_locked(cache->shpool, pn);
     }
 
-    b->file_pos = c->body_start;
-    b->file_last = c->length;
+    fcn->purge = NULL;
+    fcn->indexed = 0;
 
-    b->in_file = (c->length - c->body_start) ? 1: 0;
-    b->last_buf = (r == r->main) ? 1: 0;
-    b->last_in_chain = 1;
+    pn = ngx_http_file_cache_purge_add(cache, fcn, NULL, len, 0);
+    if (pn == NULL) {
+        goto failed;
+    }
 
-    b->file->fd = c->file.fd;
-    b->file->name = c->file.name;
-    b->file->log = r->connection->log;
+    for (key = pn->data, i = 0; i < c->keys.nelts; i++) {
+        key = ngx_cpymem(key, k[i].data, k[i].len);
+    }
 
-    out.buf = b;
-    out.next = NULL;
+    ngx_http_file_cache_purge_key(pn);
 
-    return ngx_http_output_filter(r, &out);
-}
+    ngx_rbtree_insert(&cache->sh->keys, &pn->node);
 
+    fcn->purge = pn;
+    link = &pn->next;
 
-void
-ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
-{
-    ngx_http_file_cache_t       *cache;
-    ngx_http_file_cache_node_t  *fcn;
+    /* tags are separated by spaces or commas */
 
-    if (c->updated || c->node == NULL) {
-        return;
-    }
+    p = c->tags.data;
+    last = p + c->tags.len;
 
-    cache = c->file_cache;
+    for ( ;; ) {
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
-                   "http file cache free, fd: %d", c->file.fd);
+        while (p < last && (*p == ' ' || *p == ',')) {
+            p++;
+        }
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+        start = p;
 
-    fcn = c->node;
-    fcn->count--;
+        while (p < last && *p != ' ' && *p != ',') {
+            p++;
+        }
 
-    if (c->updating) {
-        fcn->updating = 0;
-    }
+        if (p == start) {
+            break;
+        }
 
-    if (c->error) {
-        fcn->error = c->error;
+        if (p - start > 0xffff) {
+            goto failed;
+        }
 
-        if (c->valid_sec) {
-            fcn->valid_sec = c->valid_sec;
-            fcn->valid_msec = c->valid_msec;
+        pn = ngx_http_file_cache_purge_add(cache, fcn, start, p - start, 1);
+        if (pn == NULL) {
+            goto failed;
         }
 
-    } else if (!fcn->exists && fcn->count == 0 && c->min_uses == 1) {
-        ngx_queue_remove(&fcn->queue);
-        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
-        ngx_slab_free_locked(cache->shpool, fcn);
-        c->node = NULL;
+        ngx_rbtree_insert(&cache->sh->tags, &pn->node);
+
+        *link = pn;
+        link = &pn->next;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    fcn->indexed = 1;
 
-    c->updated = 1;
-    c->updating = 0;
+    goto done;
 
-    if (c->temp_file) {
-        if (tf && tf->file.fd != NGX_INVALID_FILE) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
-                           "http file cache incomplete: \"%s\"",
-                           tf->file.name.data);
+failed:
 
-            if (ngx_delete_file(tf->file.name.data) == NGX_FILE_ERROR) {
-                ngx_log_error(NGX_LOG_CRIT, c->file.log, ngx_errno,
-                              ngx_delete_file_n " \"%s\" failed",
-                              tf->file.name.data);
-            }
-        }
-    }
+    /* the node is purged by any prefix or tag purge */
 
-    if (c->wait_event.timer_set) {
-        ngx_del_timer(&c->wait_event);
-    }
+    cache->sh->unindexed = 1;
+
+done:
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_http_file_cache_shard_unlock(c->shard);
 }
 
 
-static void
-ngx_http_file_cache_cleanup(void *data)
+static ngx_http_file_cache_purge_node_t *
+ngx_http_file_cache_purge_add(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, u_char *data, size_t len, ngx_uint_t tag)
 {
-    ngx_http_cache_t  *c = data;
+    ngx_http_file_cache_purge_node_t  *pn;
 
-    if (c->updated) {
-        return;
+    pn = ngx_slab_alloc_locked(cache->shpool,
+                               offsetof(ngx_http_file_cache_purge_node_t, data)
+                               + len);
+    if (pn == NULL) {
+        return NULL;
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
-                   "http file cache cleanup");
+    pn->fcn = fcn;
+    pn->next = NULL;
+    pn->tag = (u_short) tag;
+    pn->len = (u_short) len;
 
-    if (c->updating) {
-        ngx_log_error(NGX_LOG_ALERT, c->file.log, 0,
-                      "stalled cache updating, error:%ui", c->error);
+    if (data) {
+        ngx_memcpy(pn->data, data, len);
+        ngx_http_file_cache_purge_key(pn);
     }
 
-    ngx_http_file_cache_free(c, NULL);
+    return pn;
 }
 
 
-static time_t
-ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
+static void
+ngx_http_file_cache_purge_key(ngx_http_file_cache_purge_node_t *pn)
 {
-    u_char                      *name;
-    size_t                       len;
-    time_t                       wait;
-    ngx_uint_t                   tries;
-    ngx_path_t                  *path;
-    ngx_queue_t                 *q;
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_uint_t  i;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache forced expire");
+    /* the first bytes in network order keep the tree in text order */
 
-    path = cache->path;
-    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+    pn->node.key = 0;
 
-    name = ngx_alloc(len + 1, ngx_cycle->log);
-    if (name == NULL) {
-        return 10;
+    for (i = 0; i < sizeof(ngx_rbtree_key_t); i++) {
+        pn->node.key = (pn->node.key << 8) | (i < pn->len ? pn->data[i] : 0);
     }
+}
 
-    ngx_memcpy(name, path->name.data, path->name.len);
 
-    wait = 10;
-    tries = 20;
+static ngx_int_t
+ngx_http_file_cache_purge_collect(ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel, u_char *data, size_t len, ngx_uint_t exact,
+    ngx_array_t *keys)
+{
+    u_char                            *key;
+    ngx_int_t                          rc;
+    ngx_http_file_cache_purge_node_t  *pn;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    /* matching nodes are adjacent in order, so only they are visited */
 
-    for (q = ngx_queue_last(&cache->sh->queue);
-         q != ngx_queue_sentinel(&cache->sh->queue);
-         q = ngx_queue_prev(q))
-    {
-        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+    while (node != sentinel) {
 
-        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                  "http file cache forced expire: #%d %d %02xd%02xd%02xd%02xd",
-                  fcn->count, fcn->exists,
-                  fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+        pn = (ngx_http_file_cache_purge_node_t *) node;
 
-        if (fcn->count == 0) {
-            ngx_http_file_cache_delete(cache, q, name);
-            wait = 0;
+        rc = ngx_memcmp(pn->data, data, ngx_min((size_t) pn->len, len));
 
-        } else {
-            if (--tries) {
-                continue;
-            }
+        if (rc == 0 && pn->len < len) {
+            rc = -1;
+        }
 
-            wait = 1;
+        if (rc < 0) {
+            node = node->right;
+            continue;
         }
 
-        break;
-    }
+        if (rc > 0) {
+            node = node->left;
+            continue;
+        }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+        if (ngx_http_file_cache_purge_collect(node->left, sentinel, data, len,
+                                              exact, keys)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
 
-    ngx_free(name);
+        if (!exact || pn->len == len) {
+            key = ngx_array_push(keys);
+            if (key == NULL) {
+                return NGX_ERROR;
+            }
 
-    return wait;
+            ngx_memcpy(key, (u_char *) &pn->fcn->node.key,
+                       sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], pn->fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+        }
+
+        node = node->right;
+    }
+
+    return NGX_OK;
 }
 
 
-static time_t
-ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
-{
-    u_char                      *name, *p;
-    size_t                       len;
-    time_t                       now, wait;
-    ngx_path_t                  *path;
-    ngx_queue_t                 *q;
+static ngx_int_t
+ngx_http_file_cache_purge_unindexed(ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel, ngx_array_t *keys)
+{
+    u_char                      *key;
     ngx_http_file_cache_node_t  *fcn;
-    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache expire");
+    while (node != sentinel) {
 
-    path = cache->path;
-    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+        if (ngx_http_file_cache_purge_unindexed(node->left, sentinel, keys)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
 
-    name = ngx_alloc(len + 1, ngx_cycle->log);
-    if (name == NULL) {
-        return 10;
-    }
+        fcn = (ngx_http_file_cache_node_t *) node;
 
-    ngx_memcpy(name, path->name.data, path->name.len);
+        if (fcn->exists && !fcn->indexed && !fcn->purged) {
+            key = ngx_array_push(keys);
+            if (key == NULL) {
+                return NGX_ERROR;
+            }
 
-    now = ngx_time();
+            ngx_memcpy(key, (u_char *) &fcn->node.key,
+                       sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+        }
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+        node = node->right;
+    }
 
-    for ( ;; ) {
+    return NGX_OK;
+}
 
-        if (ngx_queue_empty(&cache->sh->queue)) {
-            wait = 10;
-            break;
-        }
 
-        q = ngx_queue_last(&cache->sh->queue);
+static ngx_uint_t
+ngx_http_file_cache_purge_node(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
 
-        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+    shard = ngx_http_file_cache_shard(cache, key);
 
-        wait = fcn->expire - now;
+    ngx_http_file_cache_shard_lock(shard);
 
-        if (wait > 0) {
-            wait = wait > 10 ? 10 : wait;
-            break;
-        }
+    fcn = ngx_http_file_cache_lookup(shard, key);
 
-        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache expire: #%d %d %02xd%02xd%02xd%02xd",
-                       fcn->count, fcn->exists,
-                       fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+    if (fcn == NULL || !fcn->exists || fcn->purged) {
+        ngx_http_file_cache_shard_unlock(shard);
+        return 0;
+    }
 
-        if (fcn->count == 0) {
-            ngx_http_file_cache_delete(cache, q, name);
-            continue;
-        }
+    fcn->purged = 1;
 
-        if (fcn->deleting) {
-            wait = 1;
-            break;
-        }
+    if (fcn->protected) {
+        shard->protected_size -= fcn->fs_size;
+        fcn->protected = 0;
 
-        p = ngx_hex_dump(key, (u_char *) &fcn->node.key,
-                         sizeof(ngx_rbtree_key_t));
-        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
-        (void) ngx_hex_dump(p, fcn->key, len);
+        ngx_queue_remove(&fcn->queue);
+        ngx_queue_insert_tail(&shard->queue, &fcn->queue);
+    }
 
-        /*
-         * abnormally exited workers may leave locked cache entries,
-         * and although it may be safe to remove them completely,
-         * we prefer to just move them to the top of the inactive queue
-         */
+    /*
+     * an unused entry is moved to the end of the inactive queue,
+     * so the cache manager removes its file on the next run
+     */
 
-        ngx_queue_remove(q);
-        fcn->expire = ngx_time() + cache->inactive;
-        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+    if (fcn->count == 0) {
+        fcn->expire = ngx_time();
 
-        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                      "ignore long locked inactive cache entry %*s, count:%d",
-                      2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
+        ngx_queue_remove(&fcn->queue);
+        ngx_queue_insert_tail(&shard->queue, &fcn->queue);
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_http_file_cache_shard_unlock(shard);
 
-    ngx_free(name);
+    if (cache->mem) {
+        ngx_http_file_cache_mem_remove(cache, key);
+    }
 
-    return wait;
+    return 1;
 }
 
 
 static void
-ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
-    u_char *name)
+ngx_http_file_cache_purge_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
 {
-    u_char                      *p;
-    size_t                       len;
-    ngx_path_t                  *path;
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_int_t                          rc;
+    ngx_rbtree_node_t                **p;
+    ngx_http_file_cache_purge_node_t  *pn, *pnt;
 
-    fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+    for ( ;; ) {
 
-    if (fcn->exists) {
-        cache->sh->size -= fcn->fs_size;
+        if (node->key < temp->key) {
 
-        path = cache->path;
-        p = name + path->name.len + 1 + path->len;
-        p = ngx_hex_dump(p, (u_char *) &fcn->node.key,
-                         sizeof(ngx_rbtree_key_t));
-        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
-        p = ngx_hex_dump(p, fcn->key, len);
-        *p = '\0';
+            p = &temp->left;
 
-        fcn->count++;
-        fcn->deleting = 1;
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        } else if (node->key > temp->key) {
 
-        len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
-        ngx_create_hashed_filename(path, name, len);
+            p = &temp->right;
 
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache expire: \"%s\"", name);
+        } else { /* node->key == temp->key */
 
-        if (ngx_delete_file(name) == NGX_FILE_ERROR) {
-            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
-                          ngx_delete_file_n " \"%s\" failed", name);
+            pn = (ngx_http_file_cache_purge_node_t *) node;
+            pnt = (ngx_http_file_cache_purge_node_t *) temp;
+
+            rc = ngx_memcmp(pn->data, pnt->data, ngx_min(pn->len, pnt->len));
+
+            if (rc == 0) {
+                rc = (ngx_int_t) pn->len - (ngx_int_t) pnt->len;
+            }
+
+            p = (rc < 0) ? &temp->left : &temp->right;
         }
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
-        fcn->count--;
-        fcn->deleting = 0;
-    }
+        if (*p == sentinel) {
+            break;
+        }
 
-    if (fcn->count == 0) {
-        ngx_queue_remove(q);
-        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
-        ngx_slab_free_locked(cache->shpool, fcn);
+        temp = *p;
     }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
 }
 
 
@@ -1320,18 +3530,27 @@ ngx_http_file_cache_manager(void *data)
 
     next = ngx_http_file_cache_expire(cache);
 
+    ngx_http_file_cache_sketch_age(cache);
+
+    if (cache->index.len) {
+        wait = ngx_http_file_cache_write_index(cache);
+
+        if (wait < next) {
+            next = wait;
+        }
+    }
+
     cache->last = ngx_current_msec;
     cache->files = 0;
 
     for ( ;; ) {
-        ngx_shmtx_lock(&cache->shpool->mutex);
-
         size = cache->sh->size;
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
-
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache size: %O", size);
+        ngx_log_debug5(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache size: %O hits:%uA misses:%uA "
+                       "hit bytes:%uA miss bytes:%uA",
+                       size, cache->sh->hits, cache->sh->misses,
+                       cache->sh->hit_bytes, cache->sh->miss_bytes);
 
         if (size < cache->max_size) {
             return next;
@@ -1355,6 +3574,7 @@ ngx_http_file_cache_loader(void *data)
 {
     ngx_http_file_cache_t  *cache = data;
 
+    ngx_int_t       rc;
     ngx_tree_ctx_t  tree;
 
     if (!cache->sh->cold || cache->sh->loading) {
@@ -1380,70 +3600,420 @@ ngx_http_file_cache_loader(void *data)
     cache->last = ngx_current_msec;
     cache->files = 0;
 
+    if (cache->index.len) {
+        rc = ngx_http_file_cache_load_index(cache);
+
+        if (rc == NGX_ABORT) {
+            cache->sh->loading = 0;
+            return;
+        }
+
+        /*
+         * the keys zone is usable as soon as the index is loaded,
+         * the tree walk only picks up files cached after the index
+         * was written
+         */
+
+        if (rc == NGX_OK) {
+            cache->sh->cold = 0;
+        }
+    }
+
     if (ngx_walk_tree(&tree, &cache->path->name) == NGX_ABORT) {
         cache->sh->loading = 0;
         return;
     }
 
-    cache->sh->cold = 0;
-    cache->sh->loading = 0;
+    cache->sh->cold = 0;
+    cache->sh->loading = 0;
+
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "http file cache: %V %.3fM, bsize: %uz",
+                  &cache->path->name,
+                  ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
+                  cache->bsize);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_msec_t              elapsed;
+    ngx_http_file_cache_t  *cache;
+
+    cache = ctx->data;
+
+    /* responses being received */
+
+    if (cache->temp_path
+        && path->len > cache->temp_path->name.len
+        && ngx_strncmp(path->data, cache->temp_path->name.data,
+                       cache->temp_path->name.len) == 0
+        && path->data[cache->temp_path->name.len] == '/')
+    {
+        return NGX_OK;
+    }
+
+    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
+        (void) ngx_http_file_cache_delete_file(ctx, path);
+    }
+
+    if (++cache->files >= cache->loader_files) {
+        ngx_http_file_cache_loader_sleep(cache);
+
+    } else {
+        ngx_time_update();
+
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache loader time elapsed: %M", elapsed);
+
+        if (elapsed >= cache->loader_threshold) {
+            ngx_http_file_cache_loader_sleep(cache);
+        }
+    }
+
+    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache)
+{
+    ngx_msleep(cache->loader_sleep);
+
+    ngx_time_update();
+
+    cache->last = ngx_current_msec;
+    cache->files = 0;
+}
+
+
+static time_t
+ngx_http_file_cache_write_index(ngx_http_file_cache_t *cache)
+{
+    time_t                               now;
+    u_char                              *name;
+    ssize_t                              n;
+    off_t                                offset;
+    ngx_int_t                            rc;
+    ngx_uint_t                           i, entries;
+    ngx_pool_t                          *pool;
+    ngx_file_t                           file;
+    ngx_array_t                          a;
+    ngx_http_file_cache_shard_t         *shard;
+    ngx_http_file_cache_index_header_t   h;
+
+    /* an index is not written until the keys zone is fully loaded */
+
+    if (cache->sh->cold) {
+        return cache->index_interval;
+    }
+
+    now = ngx_time();
+
+    if (now - cache->index_last < cache->index_interval) {
+        return cache->index_interval - (now - cache->index_last);
+    }
+
+    cache->index_last = now;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+    if (pool == NULL) {
+        return cache->index_interval;
+    }
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.fd = NGX_INVALID_FILE;
+    file.log = ngx_cycle->log;
+
+    name = ngx_pnalloc(pool, cache->index.len + sizeof(".tmp"));
+    if (name == NULL) {
+        goto failed;
+    }
+
+    (void) ngx_sprintf(name, "%V.tmp%Z", &cache->index);
+
+    if (ngx_array_init(&a, pool, 1024,
+                       sizeof(ngx_http_file_cache_index_entry_t))
+        != NGX_OK)
+    {
+        goto failed;
+    }
+
+    file.name.len = cache->index.len + sizeof(".tmp") - 1;
+    file.name.data = name;
+
+    file.fd = ngx_open_file(name, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                            NGX_FILE_DEFAULT_ACCESS);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", name);
+        goto failed;
+    }
+
+    offset = sizeof(ngx_http_file_cache_index_header_t);
+    entries = 0;
+
+    for (i = 0; i < cache->sh->nshards; i++) {
+        shard = &cache->sh->shards[i];
+
+        a.nelts = 0;
+
+        /*
+         * entries are copied from the least recently used one,
+         * so the loader restores the inactive queue order;
+         * protected entries follow the probationary ones
+         */
+
+        ngx_http_file_cache_shard_lock(shard);
+
+        rc = ngx_http_file_cache_index_copy(&a, &shard->queue);
+
+        if (rc == NGX_OK) {
+            rc = ngx_http_file_cache_index_copy(&a, &shard->protected);
+        }
+
+        ngx_http_file_cache_shard_unlock(shard);
+
+        if (rc != NGX_OK) {
+            goto failed;
+        }
+
+        if (a.nelts == 0) {
+            continue;
+        }
+
+        n = ngx_write_file(&file, a.elts, a.nelts * a.size, offset);
+
+        if (n == NGX_ERROR) {
+            goto failed;
+        }
+
+        offset += n;
+        entries += a.nelts;
+    }
+
+    ngx_memzero(&h, sizeof(ngx_http_file_cache_index_header_t));
+
+    ngx_memcpy(h.magic, NGX_HTTP_CACHE_INDEX_MAGIC,
+               sizeof(NGX_HTTP_CACHE_INDEX_MAGIC));
+    h.version = NGX_HTTP_CACHE_INDEX_VERSION;
+    h.bsize = cache->bsize;
+    h.entry_size = sizeof(ngx_http_file_cache_index_entry_t);
+    h.entries = entries;
+
+    if (ngx_write_file(&file, (u_char *) &h, sizeof(h), 0) == NGX_ERROR) {
+        goto failed;
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+
+    file.fd = NGX_INVALID_FILE;
+
+    if (ngx_rename_file(name, cache->index.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%V\" failed",
+                      name, &cache->index);
+        goto failed;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache index \"%V\": %ui entries",
+                   &cache->index, entries);
+
+    ngx_destroy_pool(pool);
+
+    return cache->index_interval;
+
+failed:
+
+    if (file.fd != NGX_INVALID_FILE) {
+        if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", name);
+        }
+
+        (void) ngx_delete_file(name);
+    }
+
+    ngx_destroy_pool(pool);
 
-    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
-                  "http file cache: %V %.3fM, bsize: %uz",
-                  &cache->path->name,
-                  ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
-                  cache->bsize);
+    return cache->index_interval;
 }
 
 
 static ngx_int_t
-ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+ngx_http_file_cache_index_copy(ngx_array_t *a, ngx_queue_t *queue)
 {
+    ngx_queue_t                        *q;
+    ngx_http_file_cache_node_t         *fcn;
+    ngx_http_file_cache_index_entry_t  *e;
+
+    for (q = ngx_queue_last(queue);
+         q != ngx_queue_sentinel(queue);
+         q = ngx_queue_prev(q))
+    {
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        if (!fcn->exists || fcn->deleting || fcn->purged) {
+            continue;
+        }
+
+        e = ngx_array_push(a);
+        if (e == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(e->key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+        ngx_memcpy(&e->key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        e->uniq = fcn->uniq;
+        e->valid_sec = fcn->valid_sec;
+        e->body_start = fcn->body_start;
+        e->fs_size = fcn->fs_size;
+        e->valid_msec = fcn->valid_msec;
+    }
+
     return NGX_OK;
 }
 
 
 static ngx_int_t
-ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+ngx_http_file_cache_load_index(ngx_http_file_cache_t *cache)
 {
-    ngx_msec_t              elapsed;
-    ngx_http_file_cache_t  *cache;
+    off_t                                offset;
+    size_t                               size;
+    ssize_t                              n;
+    ngx_int_t                            rc;
+    ngx_uint_t                           i, k, entries;
+    ngx_file_t                           file;
+    ngx_http_cache_t                     c;
+    ngx_http_file_cache_index_entry_t   *buf, *e;
+    ngx_http_file_cache_index_header_t   h;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = cache->index;
+    file.log = ngx_cycle->log;
+
+    file.fd = ngx_open_file(cache->index.data, NGX_FILE_RDONLY,
+                            NGX_FILE_OPEN, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        if (ngx_errno != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                          ngx_open_file_n " \"%V\" failed", &cache->index);
+        }
 
-    cache = ctx->data;
+        return NGX_DECLINED;
+    }
 
-    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
-        (void) ngx_http_file_cache_delete_file(ctx, path);
+    rc = NGX_DECLINED;
+    buf = NULL;
+
+    n = ngx_read_file(&file, (u_char *) &h, sizeof(h), 0);
+
+    if (n != sizeof(h)
+        || ngx_memcmp(h.magic, NGX_HTTP_CACHE_INDEX_MAGIC,
+                      sizeof(NGX_HTTP_CACHE_INDEX_MAGIC)) != 0
+        || h.version != NGX_HTTP_CACHE_INDEX_VERSION
+        || h.bsize != cache->bsize
+        || h.entry_size != sizeof(ngx_http_file_cache_index_entry_t))
+    {
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                      "cache index \"%V\" is invalid, ignored",
+                      &cache->index);
+        goto done;
     }
 
-    if (++cache->files >= cache->loader_files) {
-        ngx_http_file_cache_loader_sleep(cache);
+    size = 1024 * sizeof(ngx_http_file_cache_index_entry_t);
 
-    } else {
-        ngx_time_update();
+    buf = ngx_alloc(size, ngx_cycle->log);
+    if (buf == NULL) {
+        goto done;
+    }
 
-        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+    offset = sizeof(h);
+    entries = 0;
 
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache loader time elapsed: %M", elapsed);
+    /* cache files are not checked here, stale entries are found on open */
 
-        if (elapsed >= cache->loader_threshold) {
-            ngx_http_file_cache_loader_sleep(cache);
+    for (i = 0; i < h.entries; i += k) {
+
+        k = ngx_min(h.entries - i, 1024);
+
+        n = ngx_read_file(&file, (u_char *) buf,
+                          k * sizeof(ngx_http_file_cache_index_entry_t),
+                          offset);
+
+        if (n != (ssize_t) (k * sizeof(ngx_http_file_cache_index_entry_t))) {
+            ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                          "cache index \"%V\" is truncated", &cache->index);
+            goto done;
+        }
+
+        offset += n;
+
+        for (e = buf; e < buf + k; e++) {
+            ngx_memzero(&c, sizeof(ngx_http_cache_t));
+
+            ngx_memcpy(c.key, e->key, NGX_HTTP_CACHE_KEY_LEN);
+            c.uniq = e->uniq;
+            c.valid_sec = e->valid_sec;
+            c.body_start = e->body_start;
+            c.fs_size = e->fs_size;
+            c.valid_msec = e->valid_msec;
+
+            if (ngx_http_file_cache_add(cache, &c) != NGX_OK) {
+                ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                              "cache \"%V\" keys zone is full, "
+                              "%ui index entries loaded",
+                              &cache->shm_zone->shm.name, entries);
+                goto done;
+            }
+
+            entries++;
+        }
+
+        if (ngx_quit || ngx_terminate) {
+            rc = NGX_ABORT;
+            goto done;
         }
     }
 
-    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
-}
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "http file cache: %V %ui entries loaded from \"%V\"",
+                  &cache->path->name, entries, &cache->index);
 
+    rc = NGX_OK;
 
-static void
-ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache)
-{
-    ngx_msleep(cache->loader_sleep);
+done:
 
-    ngx_time_update();
+    if (buf) {
+        ngx_free(buf);
+    }
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%V\" failed", &cache->index);
+    }
+
+    return rc;
 }
 
 
@@ -1493,51 +4063,69 @@ ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
 static ngx_int_t
 ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 {
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    shard = ngx_http_file_cache_shard(cache, c->key);
 
-    fcn = ngx_http_file_cache_lookup(cache, c->key);
+    ngx_http_file_cache_shard_lock(shard);
 
-    if (fcn == NULL) {
+    fcn = ngx_http_file_cache_lookup(shard, c->key);
 
-        fcn = ngx_slab_alloc_locked(cache->shpool,
-                                    sizeof(ngx_http_file_cache_node_t));
-        if (fcn == NULL) {
-            ngx_shmtx_unlock(&cache->shpool->mutex);
-            return NGX_ERROR;
-        }
+    if (fcn) {
 
-        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+        /*
+         * the node is already known from the index or from a request,
+         * its position in the queue is kept
+         */
 
-        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
-                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+        ngx_http_file_cache_shard_unlock(shard);
+        return NGX_OK;
+    }
+
+    fcn = ngx_slab_alloc(cache->shpool, sizeof(ngx_http_file_cache_node_t));
+    if (fcn == NULL) {
+        ngx_http_file_cache_shard_unlock(shard);
+        return NGX_ERROR;
+    }
 
-        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+    ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
 
-        fcn->uses = 1;
-        fcn->count = 0;
-        fcn->valid_msec = 0;
-        fcn->error = 0;
-        fcn->exists = 1;
-        fcn->updating = 0;
-        fcn->deleting = 0;
-        fcn->uniq = 0;
-        fcn->valid_sec = 0;
-        fcn->body_start = 0;
-        fcn->fs_size = c->fs_size;
+    ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-        cache->sh->size += c->fs_size;
+    ngx_rbtree_insert(&shard->rbtree, &fcn->node);
 
-    } else {
-        ngx_queue_remove(&fcn->queue);
+    fcn->uses = 1;
+    fcn->count = 0;
+    fcn->error = 0;
+    fcn->exists = 1;
+    fcn->updating = 0;
+    fcn->deleting = 0;
+    fcn->purged = 0;
+    fcn->protected = 0;
+    fcn->indexed = 0;
+    fcn->purge = NULL;
+    fcn->valid_msec = c->valid_msec;
+    fcn->uniq = c->uniq;
+    fcn->valid_sec = c->valid_sec;
+    fcn->body_start = c->body_start;
+    fcn->fs_size = c->fs_size;
+
+    (void) ngx_atomic_fetch_add(&cache->sh->size, c->fs_size);
+    (void) ngx_atomic_fetch_add(&cache->sh->loaded, 1);
+
+    /* the key text and tags are not known until the first use */
+
+    if (cache->purge) {
+        cache->sh->unindexed = 1;
     }
 
     fcn->expire = ngx_time() + cache->inactive;
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+    ngx_queue_insert_head(&shard->queue, &fcn->queue);
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_http_file_cache_shard_unlock(shard);
 
     return NGX_OK;
 }
@@ -1587,15 +4175,23 @@ ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status)
 char *
 ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
-    off_t                   max_size;
-    u_char                 *last, *p;
-    time_t                  inactive;
-    ssize_t                 size;
-    ngx_str_t               s, name, *value;
-    ngx_int_t               loader_files;
-    ngx_msec_t              loader_sleep, loader_threshold;
-    ngx_uint_t              i, n;
-    ngx_http_file_cache_t  *cache;
+    off_t                           max_size;
+    u_char                         *last, *p;
+    time_t                          inactive;
+    ssize_t                         size;
+    ngx_str_t                       s, name, *value;
+    ngx_int_t                       loader_files, manager_files, shards;
+    ngx_msec_t                      loader_sleep, loader_threshold;
+    ngx_msec_t                      manager_sleep, manager_threshold;
+    ngx_uint_t                      i, n;
+    ngx_str_t                       index;
+    time_t                          index_interval;
+    ssize_t                         mem_size, mem_max_object;
+    ngx_int_t                       mem_min_uses;
+    ngx_flag_t                      purge, use_temp_path;
+    ngx_uint_t                      eviction, admission;
+    ngx_http_file_cache_t          *cache, **cachep;
+    ngx_http_upstream_main_conf_t  *umcf;
 
     cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_file_cache_t));
     if (cache == NULL) {
@@ -1612,6 +4208,24 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     loader_sleep = 50;
     loader_threshold = 200;
 
+    shards = 1;
+    manager_files = 100;
+    manager_sleep = 50;
+    manager_threshold = 200;
+
+    ngx_str_null(&index);
+    index_interval = 60;
+
+    mem_size = 0;
+    mem_max_object = 64 * 1024;
+    mem_min_uses = 2;
+
+    purge = 0;
+    use_temp_path = 0;
+
+    eviction = NGX_HTTP_CACHE_EVICT_LRU;
+    admission = NGX_HTTP_CACHE_ADMIT_ALL;
+
     name.len = 0;
     size = 0;
     max_size = NGX_MAX_OFF_T_VALUE;
@@ -1764,6 +4378,180 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (shards < 1 || shards > NGX_HTTP_CACHE_MAX_SHARDS) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid shards value \"%V\", "
+                           "it must be between 1 and %d",
+                           &value[i], NGX_HTTP_CACHE_MAX_SHARDS);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "index=", 6) == 0) {
+
+            index.len = value[i].len - 6;
+            index.data = value[i].data + 6;
+
+            if (index.len == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid index value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (ngx_conf_full_name(cf->cycle, &index, 0) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "index_interval=", 15) == 0) {
+
+            s.len = value[i].len - 15;
+            s.data = value[i].data + 15;
+
+            index_interval = ngx_parse_time(&s, 1);
+            if (index_interval == (time_t) NGX_ERROR || index_interval == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid index_interval value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "purge=on") == 0) {
+            purge = 1;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "purge=off") == 0) {
+            purge = 0;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "use_temp_path=on") == 0) {
+            use_temp_path = 1;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "use_temp_path=off") == 0) {
+            use_temp_path = 0;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "eviction=lru") == 0) {
+            eviction = NGX_HTTP_CACHE_EVICT_LRU;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "eviction=slru") == 0) {
+            eviction = NGX_HTTP_CACHE_EVICT_SLRU;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "admission=all") == 0) {
+            admission = NGX_HTTP_CACHE_ADMIT_ALL;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "admission=tinylfu") == 0) {
+            admission = NGX_HTTP_CACHE_ADMIT_TINYLFU;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "memory=", 7) == 0) {
+
+            s.len = value[i].len - 7;
+            s.data = value[i].data + 7;
+
+            mem_size = ngx_parse_size(&s);
+            if (mem_size < 8192) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid memory size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "memory_max_object=", 18) == 0) {
+
+            s.len = value[i].len - 18;
+            s.data = value[i].data + 18;
+
+            mem_max_object = ngx_parse_size(&s);
+            if (mem_max_object == NGX_ERROR || mem_max_object == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid memory_max_object value \"%V\"",
+                           &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "memory_min_uses=", 16) == 0) {
+
+            mem_min_uses = ngx_atoi(value[i].data + 16, value[i].len - 16);
+            if (mem_min_uses == NGX_ERROR || mem_min_uses == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid memory_min_uses value \"%V\"",
+                           &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "manager_files=", 14) == 0) {
+
+            manager_files = ngx_atoi(value[i].data + 14, value[i].len - 14);
+            if (manager_files == NGX_ERROR || manager_files == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid manager_files value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "manager_sleep=", 14) == 0) {
+
+            s.len = value[i].len - 14;
+            s.data = value[i].data + 14;
+
+            manager_sleep = ngx_parse_time(&s, 0);
+            if (manager_sleep == (ngx_msec_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid manager_sleep value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "manager_threshold=", 18) == 0) {
+
+            s.len = value[i].len - 18;
+            s.data = value[i].data + 18;
+
+            manager_threshold = ngx_parse_time(&s, 0);
+            if (manager_threshold == (ngx_msec_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid manager_threshold value \"%V\"",
+                           &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -1778,17 +4566,77 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     cache->path->manager = ngx_http_file_cache_manager;
     cache->path->loader = ngx_http_file_cache_loader;
+    cache->path->loader_delay = index.len ? 0 : 60000;
     cache->path->data = cache;
     cache->path->conf_file = cf->conf_file->file.name.data;
     cache->path->line = cf->conf_file->line;
     cache->loader_files = loader_files;
     cache->loader_sleep = loader_sleep;
     cache->loader_threshold = loader_threshold;
+    cache->shards = shards;
+    cache->manager_files = manager_files;
+    cache->manager_sleep = manager_sleep;
+    cache->manager_threshold = manager_threshold;
+    cache->index = index;
+    cache->index_interval = index_interval;
+    cache->mem_max_object = mem_max_object;
+    cache->mem_min_uses = mem_min_uses;
+    cache->purge = purge;
+    cache->eviction = eviction;
+    cache->admission = admission;
+
+    ngx_rbtree_init(&cache->streams, &cache->streams_sentinel,
+                    ngx_rbtree_insert_value);
+
+    /* the loader removes unknown files found in the cache directory */
+
+    if (index.len > cache->path->name.len
+        && ngx_strncmp(index.data, cache->path->name.data,
+                       cache->path->name.len) == 0
+        && index.data[cache->path->name.len] == '/')
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "cache index \"%V\" must be outside of "
+                           "the cache directory", &index);
+        return NGX_CONF_ERROR;
+    }
 
     if (ngx_add_path(cf, &cache->path) != NGX_OK) {
         return NGX_CONF_ERROR;
     }
 
+    /*
+     * responses are written to temporary files inside the cache directory,
+     * so that a complete response is renamed into place on the same
+     * file system instead of being copied from the proxy_temp_path
+     */
+
+    if (!use_temp_path) {
+        cache->temp_path = ngx_pcalloc(cf->pool, sizeof(ngx_path_t));
+        if (cache->temp_path == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        s.len = cache->path->name.len + sizeof("/temp") - 1;
+        s.data = ngx_pnalloc(cf->pool, s.len + 1);
+        if (s.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_sprintf(s.data, "%V/temp%Z", &cache->path->name);
+
+        cache->temp_path->name = s;
+        ngx_memcpy(cache->temp_path->level, cache->path->level,
+                   sizeof(cache->path->level));
+        cache->temp_path->len = cache->path->len;
+        cache->temp_path->conf_file = cf->conf_file->file.name.data;
+        cache->temp_path->line = cf->conf_file->line;
+
+        if (ngx_add_path(cf, &cache->temp_path) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
     cache->shm_zone = ngx_shared_memory_add(cf, &name, size, cmd->post);
     if (cache->shm_zone == NULL) {
         return NGX_CONF_ERROR;
@@ -1804,6 +4652,39 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->shm_zone->init = ngx_http_file_cache_init;
     cache->shm_zone->data = cache;
 
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+
+    cachep = ngx_array_push(&umcf->caches);
+    if (cachep == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *cachep = cache;
+
+    if (mem_size) {
+        s.len = name.len + sizeof(":memory") - 1;
+        s.data = ngx_pnalloc(cf->pool, s.len);
+        if (s.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_sprintf(s.data, "%V:memory", &name);
+
+        cache->mem_zone = ngx_shared_memory_add(cf, &s, mem_size, cmd->post);
+        if (cache->mem_zone == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        if (cache->mem_zone->data) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "duplicate zone \"%V\"", &s);
+            return NGX_CONF_ERROR;
+        }
+
+        cache->mem_zone->init = ngx_http_file_cache_mem_init;
+        cache->mem_zone->data = cache;
+    }
+
     cache->inactive = inactive;
     cache->max_size = max_size;
 
@@ -2437,6 +2437,30 @@ ngx_http_finalize_request(ngx_http_request_t *r, ngx_int_t rc)
             return;
         }
 
+        if (r->background) {
+
+            if (!r->logged) {
+
+                clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+                if (clcf->log_subrequest) {
+                    ngx_http_log_request(r);
+                }
+
+                r->logged = 1;
+
+            } else {
+                ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                              "subrequest: \"%V?%V\" logged again",
+                              &r->uri, &r->args);
+            }
+
+            r->done = 1;
+
+            ngx_http_finalize_connection(r);
+            return;
+        }
+
         pr = r->parent;
 
         if (r == c->data) {
@@ -2629,6 +2653,11 @@ ngx_http_finalize_connection(ngx_http_request_t *r)
         return;
     }
 
+    /* the last background subrequest finishes the main request */
+
+    r = r->main;
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
     if (!ngx_terminate
          && !ngx_exiting
          && r->keepalive
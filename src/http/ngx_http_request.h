@@ -62,6 +62,7 @@
 #define NGX_HTTP_SUBREQUEST_IN_MEMORY      2
 #define NGX_HTTP_SUBREQUEST_WAITED         4
 #define NGX_HTTP_LOG_UNSAFE                8
+#define NGX_HTTP_SUBREQUEST_BACKGROUND     16
 
 
 #define NGX_HTTP_CONTINUE                  100
@@ -270,6 +271,7 @@ typedef struct {
     ngx_array_t                       cache_control;
 
     off_t                             content_length_n;
+    off_t                             content_offset;
     time_t                            date_time;
     time_t                            last_modified_time;
 } ngx_http_headers_out_t;
@@ -489,6 +491,7 @@ struct ngx_http_request_s {
 
     unsigned                          subrequest_in_memory:1;
     unsigned                          waited:1;
+    unsigned                          background:1;
 
 #if (NGX_HTTP_CACHE)
     unsigned                          cached:1;
@@ -542,6 +545,8 @@ struct ngx_http_request_s {
     unsigned                          filter_need_in_memory:1;
     unsigned                          filter_need_temporary:1;
     unsigned                          allow_ranges:1;
+    unsigned                          subrequest_ranges:1;
+    unsigned                          single_range:1;
 
 #if (NGX_STAT_STUB)
     unsigned                          stat_reading:1;
@@ -13,10 +13,20 @@
 #if (NGX_HTTP_CACHE)
 static ngx_int_t ngx_http_upstream_cache(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_cache_purge(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
 static ngx_int_t ngx_http_upstream_cache_send(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
+static void ngx_http_upstream_cache_stat(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, off_t bytes);
+static ngx_int_t ngx_http_upstream_cache_background_update(
+    ngx_http_request_t *r, ngx_http_upstream_t *u);
 static ngx_int_t ngx_http_upstream_cache_status(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_upstream_cache_last_modified(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_upstream_cache_etag(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
 #endif
 
 static void ngx_http_upstream_init_request(ngx_http_request_t *r);
@@ -52,6 +62,8 @@ static void ngx_http_upstream_process_body_in_memory(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static void ngx_http_upstream_send_response(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_keep_header(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
 static void ngx_http_upstream_upgrade(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static void ngx_http_upstream_upgraded_read_downstream(ngx_http_request_t *r);
@@ -62,6 +74,10 @@ static void ngx_http_upstream_upgraded_write_upstream(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static void ngx_http_upstream_process_upgraded(ngx_http_request_t *r,
     ngx_uint_t from_upstream, ngx_uint_t do_write);
+#if (NGX_HAVE_SPLICE)
+static ngx_int_t ngx_http_upstream_splice_upgraded(ngx_connection_t *src,
+    ngx_connection_t *dst, ngx_linux_pipe_t *p);
+#endif
 static void
     ngx_http_upstream_process_non_buffered_downstream(ngx_http_request_t *r);
 static void
@@ -83,6 +99,21 @@ static void ngx_http_upstream_dummy_handler(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static void ngx_http_upstream_next(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_uint_t ft_type);
+static void ngx_http_upstream_hedge_init(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_hedge_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_upstream_hedge_get_peer(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_upstream_hedge_read_handler(ngx_event_t *ev);
+static void ngx_http_upstream_hedge_resume(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_hedge_close(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_hedge_free(ngx_http_upstream_t *u,
+    ngx_uint_t state);
+static void ngx_http_upstream_hedge_close_connection(ngx_connection_t *c);
+static void ngx_http_upstream_hedge_sample(ngx_http_upstream_hedge_t *hedge,
+    ngx_msec_t time);
 static void ngx_http_upstream_cleanup(void *data);
 static void ngx_http_upstream_finalize_request(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_int_t rc);
@@ -149,6 +180,8 @@ static ngx_int_t ngx_http_upstream_response_length_variable(
 static char *ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy);
 static char *ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_upstream_breaker(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 static ngx_addr_t *ngx_http_upstream_get_local(ngx_http_request_t *r,
     ngx_http_upstream_local_t *local);
@@ -238,6 +271,11 @@ ngx_http_upstream_header_t  ngx_http_upstream_headers_in[] = {
                  ngx_http_upstream_copy_header_line,
                  offsetof(ngx_http_headers_out_t, expires), 1 },
 
+    { ngx_string("Content-Range"),
+                 ngx_http_upstream_ignore_header_line, 0,
+                 ngx_http_upstream_copy_header_line,
+                 offsetof(ngx_http_headers_out_t, content_range), 0 },
+
     { ngx_string("Accept-Ranges"),
                  ngx_http_upstream_process_header_line,
                  offsetof(ngx_http_upstream_headers_in_t, accept_ranges),
@@ -292,6 +330,13 @@ ngx_http_upstream_header_t  ngx_http_upstream_headers_in[] = {
 };
 
 
+static ngx_http_upstream_header_t  ngx_http_upstream_hidden_header = {
+    ngx_null_string,
+    ngx_http_upstream_ignore_header_line, 0,
+    ngx_http_upstream_ignore_header_line, 0, 0
+};
+
+
 static ngx_command_t  ngx_http_upstream_commands[] = {
 
     { ngx_string("upstream"),
@@ -308,6 +353,13 @@ static ngx_command_t  ngx_http_upstream_commands[] = {
       0,
       NULL },
 
+    { ngx_string("circuit_breaker"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_ANY,
+      ngx_http_upstream_breaker,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -367,6 +419,14 @@ static ngx_http_variable_t  ngx_http_upstream_vars[] = {
       ngx_http_upstream_cache_status, 0,
       NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    { ngx_string("upstream_cache_last_modified"), NULL,
+      ngx_http_upstream_cache_last_modified, 0,
+      NGX_HTTP_VAR_NOCACHEABLE|NGX_HTTP_VAR_NOHASH, 0 },
+
+    { ngx_string("upstream_cache_etag"), NULL,
+      ngx_http_upstream_cache_etag, 0,
+      NGX_HTTP_VAR_NOCACHEABLE|NGX_HTTP_VAR_NOHASH, 0 },
+
 #endif
 
     { ngx_null_string, NULL, NULL, 0, 0, 0 }
@@ -391,6 +451,14 @@ ngx_conf_bitmask_t  ngx_http_upstream_cache_method_mask[] = {
 };
 
 
+ngx_conf_enum_t  ngx_http_upstream_cache_collapse[] = {
+    { ngx_string("off"), NGX_HTTP_UPSTREAM_COLLAPSE_OFF },
+    { ngx_string("cacheable"), NGX_HTTP_UPSTREAM_COLLAPSE_CACHEABLE },
+    { ngx_string("all"), NGX_HTTP_UPSTREAM_COLLAPSE_ALL },
+    { ngx_null_string, 0 }
+};
+
+
 ngx_conf_bitmask_t  ngx_http_upstream_ignore_headers_masks[] = {
     { ngx_string("X-Accel-Redirect"), NGX_HTTP_UPSTREAM_IGN_XA_REDIRECT },
     { ngx_string("X-Accel-Expires"), NGX_HTTP_UPSTREAM_IGN_XA_EXPIRES },
@@ -685,6 +753,8 @@ found:
         return;
     }
 
+    u->upstream = uscf;
+
     if (uscf->peer.init(r, uscf) != NGX_OK) {
         ngx_http_upstream_finalize_request(r, u,
                                            NGX_HTTP_INTERNAL_SERVER_ERROR);
@@ -701,12 +771,24 @@ static ngx_int_t
 ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
     ngx_int_t          rc;
-    ngx_http_cache_t  *c;
+    ngx_http_cache_t  *c, *pc;
 
     c = r->cache;
 
     if (c == NULL) {
 
+        switch (ngx_http_test_predicates(r, u->conf->cache_purge)) {
+
+        case NGX_ERROR:
+            return NGX_ERROR;
+
+        case NGX_DECLINED:
+            return ngx_http_upstream_cache_purge(r, u);
+
+        default: /* NGX_OK */
+            break;
+        }
+
         if (!(r->method & u->conf->cache_methods)) {
             return NGX_DECLINED;
         }
@@ -759,8 +841,9 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
         c->body_start = u->conf->buffer_size;
         c->file_cache = u->conf->cache->data;
 
-        c->lock = u->conf->cache_lock;
+        c->lock = (u->conf->cache_lock || u->conf->cache_collapse) ? 1 : 0;
         c->lock_timeout = u->conf->cache_lock_timeout;
+        c->collapse = u->conf->cache_collapse;
 
         u->cache_status = NGX_HTTP_CACHE_MISS;
     }
@@ -774,6 +857,25 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     case NGX_HTTP_CACHE_UPDATING:
 
+        if (r->background) {
+
+            /* take over the update from the request that served stale */
+
+            pc = r->parent->cache;
+
+            if (pc && pc->background && pc->updating && pc->node == c->node) {
+                pc->updating = 0;
+                c->updating = 1;
+                rc = NGX_HTTP_CACHE_STALE;
+
+            } else {
+                u->cache_status = rc;
+                rc = NGX_OK;
+            }
+
+            break;
+        }
+
         if (u->conf->cache_use_stale & NGX_HTTP_UPSTREAM_FT_UPDATING) {
             u->cache_status = rc;
             rc = NGX_OK;
@@ -784,8 +886,22 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
         break;
 
+    case NGX_HTTP_CACHE_STALE:
+
+        if ((u->conf->cache_use_stale & NGX_HTTP_UPSTREAM_FT_UPDATING)
+            && u->conf->cache_background_update
+            && !r->background)
+        {
+            c->background = 1;
+            u->cache_status = rc;
+            rc = NGX_OK;
+        }
+
+        break;
+
     case NGX_OK:
-        u->cache_status = NGX_HTTP_CACHE_HIT;
+        u->cache_status = c->streaming ? NGX_HTTP_CACHE_COLLAPSED
+                                       : NGX_HTTP_CACHE_HIT;
     }
 
     switch (rc) {
@@ -795,9 +911,23 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
         rc = ngx_http_upstream_cache_send(r, u);
 
         if (rc != NGX_HTTP_UPSTREAM_INVALID_HEADER) {
+
+            if (c->background && rc != NGX_ERROR && rc != NGX_DONE
+                && ngx_http_upstream_cache_background_update(r, u) != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
             return rc;
         }
 
+        if (c->background) {
+            c->background = 0;
+            c->valid_sec = 0;
+            u->buffer.start = NULL;
+            u->cache_status = NGX_HTTP_CACHE_EXPIRED;
+        }
+
         break;
 
     case NGX_HTTP_CACHE_STALE:
@@ -849,6 +979,53 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 }
 
 
+static ngx_int_t
+ngx_http_upstream_cache_purge(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_int_t  rc;
+    ngx_str_t  tags;
+
+    if (ngx_http_file_cache_new(r) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (u->create_key(r) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_file_cache_create_key(r);
+
+    r->cache->file_cache = u->conf->cache->data;
+
+    /* tags are taken from the purge request itself */
+
+    ngx_str_null(&tags);
+
+    if (u->conf->cache_tag
+        && ngx_http_complex_value(r, u->conf->cache_tag, &tags) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    rc = ngx_http_file_cache_purge(r, &tags);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream cache purge: %i", rc);
+
+    switch (rc) {
+
+    case NGX_OK:
+        return NGX_HTTP_NO_CONTENT;
+
+    case NGX_DECLINED:
+        return NGX_HTTP_NOT_FOUND;
+
+    default:
+        return NGX_ERROR;
+    }
+}
+
+
 static ngx_int_t
 ngx_http_upstream_cache_send(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
@@ -860,6 +1037,7 @@ ngx_http_upstream_cache_send(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     if (c->header_start == c->body_start) {
         r->http_version = NGX_HTTP_VERSION_9;
+        ngx_http_upstream_cache_stat(r, u, c->length - c->body_start);
         return ngx_http_cache_send(r);
     }
 
@@ -886,6 +1064,12 @@ ngx_http_upstream_cache_send(ngx_http_request_t *r, ngx_http_upstream_t *u)
             return NGX_DONE;
         }
 
+        if (ngx_http_file_cache_set_tags(r, u->conf->cache_tag) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ngx_http_upstream_cache_stat(r, u, c->length - c->body_start);
+
         return ngx_http_cache_send(r);
     }
 
@@ -900,6 +1084,44 @@ ngx_http_upstream_cache_send(ngx_http_request_t *r, ngx_http_upstream_t *u)
     return rc;
 }
 
+
+static void
+ngx_http_upstream_cache_stat(ngx_http_request_t *r, ngx_http_upstream_t *u,
+    off_t bytes)
+{
+    ngx_http_file_cache_sh_t  *sh;
+
+    if (u->cache_status == 0 || u->conf->cache == NULL) {
+        return;
+    }
+
+    sh = ((ngx_http_file_cache_t *) u->conf->cache->data)->sh;
+
+    (void) ngx_atomic_fetch_add(&sh->requests[u->cache_status], 1);
+    (void) ngx_atomic_fetch_add(&sh->bytes[u->cache_status], bytes);
+}
+
+static ngx_int_t
+ngx_http_upstream_cache_background_update(ngx_http_request_t *r,
+    ngx_http_upstream_t *u)
+{
+    ngx_http_request_t  *sr;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream cache background update");
+
+    if (ngx_http_subrequest(r, &r->uri, &r->args, &sr, NULL,
+                            NGX_HTTP_SUBREQUEST_BACKGROUND)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    sr->header_only = 1;
+
+    return NGX_OK;
+}
+
 #endif
 
 
@@ -1513,6 +1735,10 @@ ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     ngx_add_timer(c->read, u->conf->read_timeout);
 
+    if (u->conf->hedge) {
+        ngx_http_upstream_hedge_init(r, u);
+    }
+
 #if 1
     if (c->read->ready) {
 
@@ -1951,6 +2177,10 @@ ngx_http_upstream_process_header(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
         u->buffer.last += n;
 
+        if (u->hedge_event) {
+            ngx_http_upstream_hedge_close(r, u);
+        }
+
 #if 0
         u->valid_header_in = 0;
 
@@ -1989,6 +2219,12 @@ ngx_http_upstream_process_header(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     /* rc == NGX_OK */
 
+    if (u->hedge_start) {
+        ngx_http_upstream_hedge_sample(u->conf->hedge,
+                                       ngx_current_msec - u->hedge_start);
+        u->hedge_start = 0;
+    }
+
     if (u->headers_in.status_n >= NGX_HTTP_SPECIAL_RESPONSE) {
 
         if (r->subrequest_in_memory) {
@@ -2059,6 +2295,49 @@ ngx_http_upstream_test_next(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     status = u->headers_in.status_n;
 
+#if (NGX_HTTP_CACHE)
+
+    if (status == NGX_HTTP_NOT_MODIFIED
+        && u->cache_status == NGX_HTTP_CACHE_EXPIRED
+        && u->conf->cache_revalidate)
+    {
+        time_t     now, valid;
+        ngx_int_t  rc;
+
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http upstream not modified");
+
+        now = ngx_time();
+        valid = r->cache->valid_sec;
+
+        rc = u->reinit_request(r);
+
+        if (rc == NGX_OK) {
+            u->cache_status = NGX_HTTP_CACHE_REVALIDATED;
+            rc = ngx_http_upstream_cache_send(r, u);
+        }
+
+        if (valid == 0) {
+            valid = ngx_http_file_cache_valid(u->conf->cache_valid,
+                                              u->headers_in.status_n);
+            if (valid) {
+                valid = now + valid;
+            }
+        }
+
+        if (valid) {
+            r->cache->valid_sec = valid;
+            r->cache->date = now;
+
+            ngx_http_file_cache_update_header(r);
+        }
+
+        ngx_http_upstream_finalize_request(r, u, rc);
+        return NGX_OK;
+    }
+
+#endif
+
     for (un = ngx_http_upstream_next_errors; un->status; un++) {
 
         if (status != un->status) {
@@ -2174,6 +2453,12 @@ ngx_http_upstream_test_connect(ngx_connection_t *c)
     int        err;
     socklen_t  len;
 
+    /* a shared descriptor is tested by the connection which owns it */
+
+    if (c->shared) {
+        return NGX_OK;
+    }
+
 #if (NGX_HAVE_KQUEUE)
 
     if (ngx_event_flags & NGX_USE_KQUEUE_EVENT)  {
@@ -2296,13 +2581,7 @@ ngx_http_upstream_process_headers(ngx_http_request_t *r, ngx_http_upstream_t *u)
             i = 0;
         }
 
-        if (ngx_hash_find(&u->conf->hide_headers_hash, h[i].hash,
-                          h[i].lowcase_key, h[i].key.len))
-        {
-            continue;
-        }
-
-        hh = ngx_hash_find(&umcf->headers_in_hash, h[i].hash,
+        hh = ngx_hash_find(&u->conf->hide_headers_hash, h[i].hash,
                            h[i].lowcase_key, h[i].key.len);
 
         if (hh) {
@@ -2449,7 +2728,26 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     if (r->header_only) {
 
-        if (u->cacheable || u->store) {
+        if (!u->cacheable && !u->store) {
+            ngx_http_upstream_finalize_request(r, u, rc);
+            return;
+        }
+
+        if (r->background) {
+
+            /*
+             * the client connection is still used by the main request,
+             * so the response is only read into the cache
+             */
+
+            if (!u->buffering) {
+                ngx_http_upstream_finalize_request(r, u, rc);
+                return;
+            }
+
+            u->pipe->downstream_error = 1;
+
+        } else {
 
             if (ngx_shutdown_socket(c->fd, NGX_WRITE_SHUTDOWN) == -1) {
                 ngx_connection_error(c, ngx_socket_errno,
@@ -2459,10 +2757,6 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
             r->read_event_handler = ngx_http_request_empty_handler;
             r->write_event_handler = ngx_http_request_empty_handler;
             c->error = 1;
-
-        } else {
-            ngx_http_upstream_finalize_request(r, u, rc);
-            return;
         }
     }
 
@@ -2511,6 +2805,11 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
             c->tcp_nodelay = NGX_TCP_NODELAY_SET;
         }
 
+        if (ngx_http_upstream_keep_header(r, u) != NGX_OK) {
+            ngx_http_upstream_finalize_request(r, u, 0);
+            return;
+        }
+
         n = u->buffer.last - u->buffer.pos;
 
         if (n) {
@@ -2598,6 +2897,25 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
             r->cache->date = now;
             r->cache->body_start = (u_short) (u->buffer.pos - u->buffer.start);
 
+            if (u->headers_in.etag
+                && (u->headers_in.status_n == NGX_HTTP_OK
+                    || u->headers_in.status_n == NGX_HTTP_PARTIAL_CONTENT))
+            {
+                r->cache->etag = u->headers_in.etag->value;
+
+            } else {
+                ngx_str_null(&r->cache->etag);
+            }
+
+            if (u->conf->cache_tag
+                && ngx_http_complex_value(r, u->conf->cache_tag,
+                                          &r->cache->tags)
+                   != NGX_OK)
+            {
+                ngx_http_upstream_finalize_request(r, u, 0);
+                return;
+            }
+
             ngx_http_file_cache_set_header(r, u->buffer.start);
 
         } else {
@@ -2610,7 +2928,29 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
                    "http cacheable: %d", u->cacheable);
 
     if (u->cacheable == 0 && r->cache) {
-        ngx_http_file_cache_free(r->cache, u->pipe->temp_file);
+
+        /*
+         * an uncacheable response is still written to a temporary file
+         * if requests waiting for the cache lock are to receive it
+         */
+
+        if (u->conf->cache_collapse == NGX_HTTP_UPSTREAM_COLLAPSE_ALL
+            && u->buffering
+            && u->conf->max_temp_file_size
+            && r->cache->stream
+            && !ngx_queue_empty(&r->cache->stream->followers))
+        {
+            r->cache->stream_only = 1;
+            r->cache->valid_sec = 0;
+            r->cache->date = ngx_time();
+            r->cache->body_start = (u_short) (u->buffer.pos - u->buffer.start);
+            ngx_str_null(&r->cache->etag);
+
+            ngx_http_file_cache_set_header(r, u->buffer.start);
+
+        } else {
+            ngx_http_file_cache_free(r->cache, u->pipe->temp_file);
+        }
     }
 
 #endif
@@ -2621,6 +2961,8 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
     p->output_ctx = r;
     p->tag = u->output.tag;
     p->bufs = u->conf->bufs;
+    p->adaptive = u->conf->adaptive_buffers;
+    p->content_length = u->headers_in.content_length_n;
     p->busy_size = u->conf->busy_buffers_size;
     p->upstream = u->peer.connection;
     p->downstream = c;
@@ -2629,6 +2971,13 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     p->cacheable = u->cacheable || u->store;
 
+#if (NGX_HTTP_CACHE)
+    if (r->cache && r->cache->stream_only) {
+        p->cacheable = 1;
+        p->cacheable_limit = 1;
+    }
+#endif
+
     p->temp_file = ngx_pcalloc(r->pool, sizeof(ngx_temp_file_t));
     if (p->temp_file == NULL) {
         ngx_http_upstream_finalize_request(r, u, 0);
@@ -2643,6 +2992,22 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
     if (p->cacheable) {
         p->temp_file->persistent = 1;
 
+#if (NGX_HTTP_CACHE)
+
+        if (r->cache && (u->cacheable || r->cache->stream_only)) {
+
+            if (r->cache->file_cache->temp_path) {
+                p->temp_file->path = r->cache->file_cache->temp_path;
+            }
+
+            if (u->headers_in.content_length_n > 0) {
+                p->temp_file->preallocate = r->cache->body_start
+                                          + u->headers_in.content_length_n;
+            }
+        }
+
+#endif
+
     } else {
         p->temp_file->log_level = NGX_LOG_WARN;
         p->temp_file->warn = "an upstream response is buffered "
@@ -2664,8 +3029,12 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     p->preread_size = u->buffer.last - u->buffer.pos;
 
-    if (u->cacheable) {
-
+    if (u->cacheable
+#if (NGX_HTTP_CACHE)
+        || (r->cache && r->cache->stream_only)
+#endif
+       )
+    {
         p->buf_to_file = ngx_calloc_buf(r->pool);
         if (p->buf_to_file == NULL) {
             ngx_http_upstream_finalize_request(r, u, 0);
@@ -2678,6 +3047,11 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
         p->buf_to_file->temporary = 1;
     }
 
+    if (ngx_http_upstream_keep_header(r, u) != NGX_OK) {
+        ngx_http_upstream_finalize_request(r, u, 0);
+        return;
+    }
+
     if (ngx_event_flags & NGX_USE_AIO_EVENT) {
         /* the posted aio operation may corrupt a shadow buffer */
         p->single_buf = 1;
@@ -2727,22 +3101,69 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
 }
 
 
-static void
-ngx_http_upstream_upgrade(ngx_http_request_t *r, ngx_http_upstream_t *u)
+static ngx_int_t
+ngx_http_upstream_keep_header(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
-    int                        tcp_nodelay;
-    ngx_connection_t          *c;
-    ngx_http_core_loc_conf_t  *clcf;
+    size_t   size;
+    u_char  *p;
 
-    c = r->connection;
-    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+    /*
+     * the header lines reference the buffer memory, so only the rest
+     * of the buffer is used for the response body; if too little is left,
+     * the body is read into a new buffer
+     */
 
-    /* TODO: prevent upgrade if not requested or not possible */
+    if (!u->header_in_buffer) {
+        return NGX_OK;
+    }
 
-    r->keepalive = 0;
-    c->log->action = "proxying upgraded connection";
+    u->header_in_buffer = 0;
 
-    u->read_event_handler = ngx_http_upstream_upgraded_read_upstream;
+    if ((size_t) (u->buffer.end - u->buffer.pos) >= u->conf->buffer_size / 2)
+    {
+        u->buffer.start = u->buffer.pos;
+        return NGX_OK;
+    }
+
+    p = ngx_palloc(r->pool, u->conf->buffer_size);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    size = u->buffer.last - u->buffer.pos;
+
+    ngx_memcpy(p, u->buffer.pos, size);
+
+    u->buffer.start = p;
+    u->buffer.pos = p;
+    u->buffer.last = p + size;
+    u->buffer.end = p + u->conf->buffer_size;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_upgrade(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    int                        tcp_nodelay;
+    ngx_connection_t          *c;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    c = r->connection;
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    /* TODO: prevent upgrade if not requested or not possible */
+
+    r->keepalive = 0;
+    c->log->action = "proxying upgraded connection";
+
+    if (ngx_http_upstream_keep_header(r, u) != NGX_OK) {
+        ngx_http_upstream_finalize_request(r, u, 0);
+        return;
+    }
+
+    u->read_event_handler = ngx_http_upstream_upgraded_read_upstream;
     u->write_event_handler = ngx_http_upstream_upgraded_write_upstream;
     r->read_event_handler = ngx_http_upstream_upgraded_read_downstream;
     r->write_event_handler = ngx_http_upstream_upgraded_write_downstream;
@@ -2782,6 +3203,38 @@ ngx_http_upstream_upgrade(ngx_http_request_t *r, ngx_http_upstream_t *u)
         }
     }
 
+#if (NGX_HAVE_SPLICE)
+
+    /*
+     * the bytes are passed between sockets through pipes in the kernel,
+     * this is impossible with SSL; if pipes cannot be allocated,
+     * the connection is proxied through the buffers;
+     *
+     * a response body is not spliced even if it is not buffered: it passes
+     * the body filters, and whether a filter changes the bytes is only
+     * known to the filter itself, e.g. charset recoding keeps the length
+     */
+
+    if (u->conf->splice
+#if (NGX_HTTP_SSL)
+        && c->ssl == NULL && u->peer.connection->ssl == NULL
+#endif
+       )
+    {
+        u->splice_in = ngx_linux_pipe_get(c->log);
+
+        if (u->splice_in) {
+            u->splice_out = ngx_linux_pipe_get(c->log);
+
+            if (u->splice_out == NULL) {
+                ngx_linux_pipe_free(u->splice_in, c->log);
+                u->splice_in = NULL;
+            }
+        }
+    }
+
+#endif
+
     if (ngx_http_send_special(r, NGX_HTTP_FLUSH) == NGX_ERROR) {
         ngx_http_upstream_finalize_request(r, u, 0);
         return;
@@ -2831,6 +3284,13 @@ ngx_http_upstream_upgraded_write_upstream(ngx_http_request_t *r,
 }
 
 
+#if (NGX_HAVE_SPLICE)
+#define ngx_http_upstream_splice_empty(p)  ((p) == NULL || (p)->size == 0)
+#else
+#define ngx_http_upstream_splice_empty(p)  1
+#endif
+
+
 static void
 ngx_http_upstream_process_upgraded(ngx_http_request_t *r,
     ngx_uint_t from_upstream, ngx_uint_t do_write)
@@ -2841,6 +3301,9 @@ ngx_http_upstream_process_upgraded(ngx_http_request_t *r,
     ngx_connection_t          *c, *downstream, *upstream, *dst, *src;
     ngx_http_upstream_t       *u;
     ngx_http_core_loc_conf_t  *clcf;
+#if (NGX_HAVE_SPLICE)
+    ngx_linux_pipe_t          *p;
+#endif
 
     c = r->connection;
     u = r->upstream;
@@ -2868,11 +3331,17 @@ ngx_http_upstream_process_upgraded(ngx_http_request_t *r,
         src = upstream;
         dst = downstream;
         b = &u->buffer;
+#if (NGX_HAVE_SPLICE)
+        p = u->splice_in;
+#endif
 
     } else {
         src = downstream;
         dst = upstream;
         b = &u->from_client;
+#if (NGX_HAVE_SPLICE)
+        p = u->splice_out;
+#endif
 
         if (r->header_in->last > r->header_in->pos) {
             b = r->header_in;
@@ -2921,6 +3390,22 @@ ngx_http_upstream_process_upgraded(ngx_http_request_t *r,
             }
         }
 
+#if (NGX_HAVE_SPLICE)
+
+        /* the data already read into the buffer are sent first */
+
+        if (p && b->pos == b->last) {
+
+            if (ngx_http_upstream_splice_upgraded(src, dst, p) != NGX_OK) {
+                ngx_http_upstream_finalize_request(r, u, 0);
+                return;
+            }
+
+            break;
+        }
+
+#endif
+
         size = b->end - b->last;
 
         if (size && src->read->ready) {
@@ -2946,8 +3431,10 @@ ngx_http_upstream_process_upgraded(ngx_http_request_t *r,
         break;
     }
 
-    if ((upstream->read->eof && u->buffer.pos == u->buffer.last)
-        || (downstream->read->eof && u->from_client.pos == u->from_client.last)
+    if ((upstream->read->eof && u->buffer.pos == u->buffer.last
+         && ngx_http_upstream_splice_empty(u->splice_in))
+        || (downstream->read->eof && u->from_client.pos == u->from_client.last
+            && ngx_http_upstream_splice_empty(u->splice_out))
         || (downstream->read->eof && upstream->read->eof))
     {
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
@@ -3005,6 +3492,48 @@ ngx_http_upstream_process_upgraded(ngx_http_request_t *r,
 }
 
 
+#if (NGX_HAVE_SPLICE)
+
+static ngx_int_t
+ngx_http_upstream_splice_upgraded(ngx_connection_t *src,
+    ngx_connection_t *dst, ngx_linux_pipe_t *p)
+{
+    ssize_t  n;
+
+    for ( ;; ) {
+
+        if (p->size && dst->write->ready) {
+
+            if (ngx_linux_splice_send(dst, p) == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+        }
+
+        if (p->size || !src->read->ready) {
+            return NGX_OK;
+        }
+
+        n = ngx_linux_splice_recv(src, p, NGX_LINUX_PIPE_SIZE);
+
+        if (n == NGX_AGAIN || n == 0) {
+            return NGX_OK;
+        }
+
+        if (n == NGX_ERROR) {
+
+            /* the error is logged by ngx_linux_splice_recv() */
+
+            src->read->eof = 1;
+            src->read->error = 1;
+
+            return NGX_ERROR;
+        }
+    }
+}
+
+#endif
+
+
 static void
 ngx_http_upstream_process_non_buffered_downstream(ngx_http_request_t *r)
 {
@@ -3342,6 +3871,32 @@ ngx_http_upstream_process_request(ngx_http_request_t *r)
 
 #if (NGX_HTTP_CACHE)
 
+        if (r->cache && r->cache->stream_only && !p->cacheable) {
+
+            /* the response is too large to be passed to waiting requests */
+
+            r->cache->stream_only = 0;
+            ngx_http_file_cache_free(r->cache, p->temp_file);
+        }
+
+        if (r->cache) {
+            ngx_http_file_cache_stream_update(r, u->pipe->temp_file);
+        }
+
+        if (r->cache && r->cache->stream_only) {
+
+            tf = u->pipe->temp_file;
+
+            if (p->upstream_done
+                || (p->upstream_eof
+                    && (u->headers_in.content_length_n == -1
+                        || u->headers_in.content_length_n
+                           == tf->offset - (off_t) r->cache->body_start)))
+            {
+                r->cache->complete = 1;
+            }
+        }
+
         if (u->cacheable) {
 
             if (p->upstream_done) {
@@ -3383,7 +3938,12 @@ ngx_http_upstream_process_request(ngx_http_request_t *r)
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "http upstream downstream error");
 
-        if (!u->cacheable && !u->store && u->peer.connection) {
+        if (!u->cacheable && !u->store && u->peer.connection
+#if (NGX_HTTP_CACHE)
+            && !(r->cache && r->cache->stream_only)
+#endif
+           )
+        {
             ngx_http_upstream_finalize_request(r, u, 0);
         }
     }
@@ -3506,6 +4066,18 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
                       "upstream timed out");
     }
 
+    if (u->hedge) {
+
+        /* the hedged attempt failed, the original one is still waited for */
+
+        ngx_http_upstream_hedge_resume(r, u);
+        return;
+    }
+
+    if (u->hedge_event) {
+        ngx_http_upstream_hedge_close(r, u);
+    }
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     if (clcf->retry_cached_connection
@@ -3617,153 +4189,574 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
 }
 
 
-static void
-ngx_http_upstream_cleanup(void *data)
-{
-    ngx_http_request_t *r = data;
-
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "cleanup http upstream request: \"%V\"", &r->uri);
-
-    ngx_http_upstream_finalize_request(r, r->upstream, NGX_DONE);
-}
-
+/*
+ * Hedging: if a GET or HEAD request has not got the response header within
+ * the delay, the request is sent to another peer as well, the connection
+ * to the first peer is kept in u->hedge, and the first peer to respond wins.
+ * The hedged attempt gets its own balancer state, so the first peer is
+ * released to the balancer with its own result once its attempt ends.
+ */
 
 static void
-ngx_http_upstream_finalize_request(ngx_http_request_t *r,
-    ngx_http_upstream_t *u, ngx_int_t rc)
+ngx_http_upstream_hedge_init(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
-    ngx_time_t  *tp;
-
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "finalize http upstream request: %i", rc);
+    ngx_uint_t                  i, n;
+    ngx_msec_t                  delay;
+    ngx_event_t                *ev;
+    ngx_http_upstream_hedge_t  *hedge;
 
-    if (u->cleanup) {
-        *u->cleanup = NULL;
-        u->cleanup = NULL;
-    }
+    /*
+     * a request is hedged once, and only if there is a peer to try;
+     * a shared connection cannot be handed over to the hedge handlers,
+     * and the balancer of a resolved name cannot be initialized again
+     */
 
-    if (u->resolved && u->resolved->ctx) {
-        ngx_resolve_name_done(u->resolved->ctx);
-        u->resolved->ctx = NULL;
+    if (u->hedge_event
+        || u->upstream == NULL
+        || u->peer.tries < 2
+        || u->peer.connection->shared
+        || !(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))
+        || !r->request_buffering)
+    {
+        return;
     }
 
-    if (u->state && u->state->response_sec) {
-        tp = ngx_timeofday();
-        u->state->response_sec = tp->sec - u->state->response_sec;
-        u->state->response_msec = tp->msec - u->state->response_msec;
-
-        if (u->pipe && u->pipe->read_length) {
-            u->state->response_length = u->pipe->read_length;
-        }
-    }
+    hedge = u->conf->hedge;
 
-    u->finalize_request(r, rc);
+    u->hedge_start = ngx_current_msec;
 
-    if (u->peer.free && u->peer.sockaddr) {
-        u->peer.free(&u->peer, u->peer.data, 0);
-        u->peer.sockaddr = NULL;
+    if (hedge->requests >= 1024) {
+        hedge->requests /= 2;
+        hedge->hedged /= 2;
     }
 
-    if (u->peer.connection) {
+    hedge->requests++;
 
-#if (NGX_HTTP_SSL)
+    if (hedge->percentile) {
 
-        /* TODO: do not shutdown persistent connection */
+        /* the percentile of response times is not known yet */
 
-        if (u->peer.connection->ssl) {
+        if (hedge->samples < 100) {
+            return;
+        }
 
-            /*
-             * We send the "close notify" shutdown alert to the upstream only
-             * and do not wait its "close notify" shutdown alert.
-             * It is acceptable according to the TLS standard.
-             */
+        n = 0;
 
-            u->peer.connection->ssl->no_wait_shutdown = 1;
+        for (i = 0; i < NGX_HTTP_UPSTREAM_HEDGE_BUCKETS - 1; i++) {
+            n += hedge->times[i];
 
-            (void) ngx_ssl_shutdown(u->peer.connection);
+            if (n * 100 >= hedge->samples * hedge->percentile) {
+                break;
+            }
         }
-#endif
-
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "close http upstream connection: %d",
-                       u->peer.connection->fd);
 
-        if (u->peer.connection->pool) {
-            ngx_destroy_pool(u->peer.connection->pool);
-        }
+        delay = (ngx_msec_t) 1 << i;
 
-        ngx_close_connection(u->peer.connection);
+    } else {
+        delay = hedge->delay;
     }
 
-    u->peer.connection = NULL;
-
-    if (u->pipe && u->pipe->temp_file) {
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "http upstream temp fd: %d",
-                       u->pipe->temp_file->file.fd);
+    ev = ngx_pcalloc(r->pool, sizeof(ngx_event_t));
+    if (ev == NULL) {
+        return;
     }
 
-    if (u->store && u->pipe && u->pipe->temp_file
-        && u->pipe->temp_file->file.fd != NGX_INVALID_FILE)
-    {
-        if (ngx_delete_file(u->pipe->temp_file->file.name.data)
-            == NGX_FILE_ERROR)
-        {
-            ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
-                          ngx_delete_file_n " \"%s\" failed",
-                          u->pipe->temp_file->file.name.data);
-        }
-    }
+    ev->handler = ngx_http_upstream_hedge_handler;
+    ev->data = r;
+    ev->log = r->connection->log;
 
-#if (NGX_HTTP_CACHE)
+    u->hedge_event = ev;
 
-    if (r->cache) {
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream hedge delay: %M", delay);
 
-        if (u->cacheable) {
+    ngx_add_timer(ev, delay);
+}
 
-            if (rc == NGX_HTTP_BAD_GATEWAY || rc == NGX_HTTP_GATEWAY_TIME_OUT) {
-                time_t  valid;
 
-                valid = ngx_http_file_cache_valid(u->conf->cache_valid, rc);
+static void
+ngx_http_upstream_hedge_handler(ngx_event_t *ev)
+{
+    ngx_connection_t           *c;
+    ngx_http_request_t         *r;
+    ngx_http_log_ctx_t         *ctx;
+    ngx_http_upstream_t        *u;
+    ngx_peer_connection_t      *pc;
+    ngx_http_upstream_hedge_t  *hedge;
+
+    r = ev->data;
+    c = r->connection;
+    u = r->upstream;
 
-                if (valid) {
-                    r->cache->valid_sec = ngx_time() + valid;
-                    r->cache->error = rc;
-                }
-            }
-        }
+    ctx = c->log->data;
+    ctx->current_request = r;
 
-        ngx_http_file_cache_free(r->cache, u->pipe->temp_file);
+    hedge = u->conf->hedge;
+
+    if (u->peer.connection == NULL || u->peer.tries < 2) {
+        return;
     }
 
-#endif
+    /* the budget limits the share of requests sent twice */
 
-    if (u->header_sent
-        && rc != NGX_HTTP_REQUEST_TIME_OUT
-        && (rc == NGX_ERROR || rc >= NGX_HTTP_SPECIAL_RESPONSE))
-    {
-        rc = 0;
+    if (hedge->hedged * 100 >= hedge->requests * hedge->budget) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http upstream hedge budget exceeded");
+        return;
     }
 
-    if (rc == NGX_DECLINED) {
+    pc = ngx_palloc(r->pool, sizeof(ngx_peer_connection_t));
+    if (pc == NULL) {
         return;
     }
 
-    r->connection->log->action = "sending to client";
+    *pc = u->peer;
 
-    if (rc == 0
-        && !r->header_only
-#if (NGX_HTTP_CACHE)
-        && !r->cached
-#endif
-       )
-    {
-        rc = ngx_http_send_special(r, NGX_HTTP_LAST);
+    /* the round robin balancer reuses the data it is given */
+
+    u->peer.data = NULL;
+
+    if (u->upstream->peer.init(r, u->upstream) != NGX_OK) {
+        u->peer = *pc;
+        return;
     }
 
-    ngx_http_finalize_request(r, rc);
-}
+    hedge->hedged++;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream hedge: %d", pc->connection->fd);
+
+    pc->connection->read->handler = ngx_http_upstream_hedge_read_handler;
+    pc->connection->write->handler = ngx_http_upstream_hedge_read_handler;
+
+    u->hedge = pc;
+
+    /* the hedged attempt may try the peers left to the original one */
+
+    u->peer.tries = pc->tries - 1;
+    u->peer.get = ngx_http_upstream_hedge_get_peer;
+    u->peer.connection = NULL;
+    u->peer.sockaddr = NULL;
+
+    ngx_http_upstream_connect(r, u);
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hedge_get_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_int_t               rc;
+    ngx_uint_t              i;
+    ngx_http_upstream_t    *u;
+    ngx_peer_connection_t  *hedge;
+
+    u = (ngx_http_upstream_t *)
+            ((u_char *) pc - offsetof(ngx_http_upstream_t, peer));
+
+    hedge = u->hedge;
+
+    /*
+     * the peer of the original attempt is skipped once, the balancers
+     * do not select a peer which was already tried in the same state
+     */
+
+    for (i = 0; /* void */ ; i++) {
+
+        rc = hedge->get(pc, data);
+
+        if ((rc != NGX_OK && rc != NGX_DONE)
+            || pc->socklen != hedge->socklen
+            || ngx_memcmp(pc->sockaddr, hedge->sockaddr, pc->socklen) != 0)
+        {
+            return rc;
+        }
+
+        if (rc == NGX_DONE) {
+            ngx_http_upstream_hedge_close_connection(pc->connection);
+            pc->connection = NULL;
+        }
+
+        pc->free(pc, data, NGX_PEER_NEXT);
+        pc->sockaddr = NULL;
+
+        if (i == 1) {
+            return NGX_BUSY;
+        }
+    }
+}
+
+
+static void
+ngx_http_upstream_hedge_read_handler(ngx_event_t *ev)
+{
+    int                   n;
+    char                  buf[1];
+    ngx_err_t             err;
+    ngx_connection_t     *c;
+    ngx_http_request_t   *r;
+    ngx_http_log_ctx_t   *ctx;
+    ngx_http_upstream_t  *u;
+
+    if (ev->write) {
+        return;
+    }
+
+    c = ev->data;
+    r = c->data;
+    u = r->upstream;
+
+    ctx = r->connection->log->data;
+    ctx->current_request = r;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream hedge read handler");
+
+    if (ev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, NGX_ETIMEDOUT,
+                      "upstream timed out while hedged");
+        goto close;
+    }
+
+    n = recv(c->fd, buf, 1, MSG_PEEK);
+
+    err = ngx_socket_errno;
+
+    if (n == -1 && err == NGX_EAGAIN) {
+        /* stale event */
+
+        if (ngx_handle_read_event(ev, 0) != NGX_OK) {
+            goto close;
+        }
+
+        return;
+    }
+
+    if (n <= 0) {
+
+        /* the original attempt failed, the hedged one is still alive */
+
+        goto close;
+    }
+
+    ngx_http_upstream_hedge_resume(r, u);
+
+    ngx_http_run_posted_requests(r->connection);
+
+    return;
+
+close:
+
+    ngx_http_upstream_hedge_free(u, NGX_PEER_FAILED);
+}
+
+
+static void
+ngx_http_upstream_hedge_resume(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_connection_t       *c;
+    ngx_peer_connection_t  *pc;
+
+    pc = u->hedge;
+    u->hedge = NULL;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream hedge resume: %d", pc->connection->fd);
+
+    if (u->peer.connection) {
+        ngx_http_upstream_hedge_close_connection(u->peer.connection);
+        u->peer.connection = NULL;
+    }
+
+    if (u->peer.sockaddr) {
+        u->peer.free(&u->peer, u->peer.data, NGX_PEER_NEXT);
+    }
+
+    /* the original attempt goes on with its own balancer state */
+
+    u->peer = *pc;
+
+    c = u->peer.connection;
+
+    c->read->handler = ngx_http_upstream_handler;
+    c->write->handler = ngx_http_upstream_handler;
+
+    u->writer.connection = c;
+    u->request_sent = 1;
+
+    u->write_event_handler = ngx_http_upstream_dummy_handler;
+    u->read_event_handler = ngx_http_upstream_process_header;
+
+    ngx_http_upstream_process_header(r, u);
+}
+
+
+static void
+ngx_http_upstream_hedge_close(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    if (u->hedge_event->timer_set) {
+        ngx_del_timer(u->hedge_event);
+    }
+
+    if (u->hedge) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "close hedged upstream connection: %d",
+                       u->hedge->connection->fd);
+
+        /* the original attempt lost, its time so far is still reported */
+
+        ngx_http_upstream_hedge_free(u, NGX_PEER_NEXT);
+    }
+}
+
+
+static void
+ngx_http_upstream_hedge_free(ngx_http_upstream_t *u, ngx_uint_t state)
+{
+    ngx_peer_connection_t  *pc;
+
+    pc = u->hedge;
+    u->hedge = NULL;
+
+    ngx_http_upstream_hedge_close_connection(pc->connection);
+    pc->connection = NULL;
+
+    pc->free(pc, pc->data, state);
+
+    u->peer.get = pc->get;
+}
+
+
+static void
+ngx_http_upstream_hedge_close_connection(ngx_connection_t *c)
+{
+#if (NGX_HTTP_SSL)
+
+    if (c->ssl) {
+        c->ssl->no_wait_shutdown = 1;
+        c->ssl->no_send_shutdown = 1;
+
+        (void) ngx_ssl_shutdown(c);
+    }
+#endif
+
+    if (c->pool) {
+        ngx_destroy_pool(c->pool);
+    }
+
+    ngx_close_connection(c);
+}
+
+
+/*
+ * The response times are counted in buckets of powers of two milliseconds,
+ * old samples are halved to follow the recent response times.
+ */
+
+static void
+ngx_http_upstream_hedge_sample(ngx_http_upstream_hedge_t *hedge,
+    ngx_msec_t time)
+{
+    ngx_uint_t  i;
+
+    if (hedge->samples >= 1024) {
+        hedge->samples = 0;
+
+        for (i = 0; i < NGX_HTTP_UPSTREAM_HEDGE_BUCKETS; i++) {
+            hedge->times[i] /= 2;
+            hedge->samples += hedge->times[i];
+        }
+    }
+
+    for (i = 0; i < NGX_HTTP_UPSTREAM_HEDGE_BUCKETS - 1; i++) {
+        if (time <= (ngx_msec_t) 1 << i) {
+            break;
+        }
+    }
+
+    hedge->times[i]++;
+    hedge->samples++;
+}
+
+
+static void
+ngx_http_upstream_cleanup(void *data)
+{
+    ngx_http_request_t *r = data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "cleanup http upstream request: \"%V\"", &r->uri);
+
+    ngx_http_upstream_finalize_request(r, r->upstream, NGX_DONE);
+}
+
+
+static void
+ngx_http_upstream_finalize_request(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, ngx_int_t rc)
+{
+    ngx_time_t  *tp;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "finalize http upstream request: %i", rc);
+
+    if (u->cleanup) {
+        *u->cleanup = NULL;
+        u->cleanup = NULL;
+    }
+
+    if (u->resolved && u->resolved->ctx) {
+        ngx_resolve_name_done(u->resolved->ctx);
+        u->resolved->ctx = NULL;
+    }
+
+    if (u->state && u->state->response_sec) {
+        tp = ngx_timeofday();
+        u->state->response_sec = tp->sec - u->state->response_sec;
+        u->state->response_msec = tp->msec - u->state->response_msec;
+
+        if (u->pipe && u->pipe->read_length) {
+            u->state->response_length = u->pipe->read_length;
+        }
+    }
+
+    u->finalize_request(r, rc);
+
+    if (u->peer.free && u->peer.sockaddr) {
+        u->peer.free(&u->peer, u->peer.data, 0);
+        u->peer.sockaddr = NULL;
+    }
+
+    if (u->peer.connection) {
+
+#if (NGX_HTTP_SSL)
+
+        /* TODO: do not shutdown persistent connection */
+
+        if (u->peer.connection->ssl) {
+
+            /*
+             * We send the "close notify" shutdown alert to the upstream only
+             * and do not wait its "close notify" shutdown alert.
+             * It is acceptable according to the TLS standard.
+             */
+
+            u->peer.connection->ssl->no_wait_shutdown = 1;
+
+            (void) ngx_ssl_shutdown(u->peer.connection);
+        }
+#endif
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "close http upstream connection: %d",
+                       u->peer.connection->fd);
+
+        if (u->peer.connection->pool) {
+            ngx_destroy_pool(u->peer.connection->pool);
+        }
+
+        ngx_close_connection(u->peer.connection);
+    }
+
+    u->peer.connection = NULL;
+
+    if (u->hedge_event) {
+        ngx_http_upstream_hedge_close(r, u);
+    }
+
+#if (NGX_HAVE_SPLICE)
+
+    if (u->splice_in) {
+        ngx_linux_pipe_free(u->splice_in, r->connection->log);
+        u->splice_in = NULL;
+    }
+
+    if (u->splice_out) {
+        ngx_linux_pipe_free(u->splice_out, r->connection->log);
+        u->splice_out = NULL;
+    }
+
+#endif
+
+    if (u->pipe && u->pipe->temp_file) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http upstream temp fd: %d",
+                       u->pipe->temp_file->file.fd);
+    }
+
+    if (u->store && u->pipe && u->pipe->temp_file
+        && u->pipe->temp_file->file.fd != NGX_INVALID_FILE)
+    {
+        if (ngx_delete_file(u->pipe->temp_file->file.name.data)
+            == NGX_FILE_ERROR)
+        {
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed",
+                          u->pipe->temp_file->file.name.data);
+        }
+    }
+
+#if (NGX_HTTP_CACHE)
+
+    if (r->cache) {
+
+        if (u->cacheable) {
+
+            if (rc == NGX_HTTP_BAD_GATEWAY || rc == NGX_HTTP_GATEWAY_TIME_OUT) {
+                time_t  valid;
+
+                valid = ngx_http_file_cache_valid(u->conf->cache_valid, rc);
+
+                if (valid) {
+                    r->cache->valid_sec = ngx_time() + valid;
+                    r->cache->error = rc;
+                }
+            }
+        }
+
+        if (!r->cached && u->pipe && r->cache->file_cache) {
+            (void) ngx_atomic_fetch_add(&r->cache->file_cache->sh->miss_bytes,
+                                        u->pipe->read_length);
+        }
+
+        /* responses sent from the cache are accounted for when sent */
+
+        if (!r->cached) {
+            ngx_http_upstream_cache_stat(r, u, u->pipe ? u->pipe->read_length
+                                                       : 0);
+        }
+
+        ngx_http_file_cache_free(r->cache, u->pipe->temp_file);
+    }
+
+#endif
+
+    if (u->header_sent
+        && rc != NGX_HTTP_REQUEST_TIME_OUT
+        && (rc == NGX_ERROR || rc >= NGX_HTTP_SPECIAL_RESPONSE))
+    {
+        rc = 0;
+    }
+
+    if (rc == NGX_DECLINED) {
+        return;
+    }
+
+    r->connection->log->action = "sending to client";
+
+    if (rc == 0
+        && !r->header_only
+#if (NGX_HTTP_CACHE)
+        && !r->cached
+#endif
+       )
+    {
+        rc = ngx_http_send_special(r, NGX_HTTP_LAST);
+    }
+
+    ngx_http_finalize_request(r, rc);
+}
 
 
 static ngx_int_t
@@ -4715,41 +5708,94 @@ ngx_http_upstream_response_length_variable(ngx_http_request_t *r,
 }
 
 
-ngx_int_t
-ngx_http_upstream_header_variable(ngx_http_request_t *r,
+ngx_int_t
+ngx_http_upstream_header_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    if (r->upstream == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    return ngx_http_variable_unknown_header(v, (ngx_str_t *) data,
+                                         &r->upstream->headers_in.headers.part,
+                                         sizeof("upstream_http_") - 1);
+}
+
+
+#if (NGX_HTTP_CACHE)
+
+ngx_int_t
+ngx_http_upstream_cache_status(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_uint_t  n;
+
+    if (r->upstream == NULL || r->upstream->cache_status == 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    n = r->upstream->cache_status - 1;
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->len = ngx_http_cache_status[n].len;
+    v->data = ngx_http_cache_status[n].data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_cache_last_modified(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
-    if (r->upstream == NULL) {
+    u_char  *p;
+
+    if (r->upstream == NULL
+        || !r->upstream->conf->cache_revalidate
+        || r->upstream->cache_status != NGX_HTTP_CACHE_EXPIRED
+        || r->cache->last_modified == -1)
+    {
         v->not_found = 1;
         return NGX_OK;
     }
 
-    return ngx_http_variable_unknown_header(v, (ngx_str_t *) data,
-                                         &r->upstream->headers_in.headers.part,
-                                         sizeof("upstream_http_") - 1);
-}
+    p = ngx_pnalloc(r->pool, sizeof("Mon, 28 Sep 1970 06:00:00 GMT") - 1);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
 
+    v->len = ngx_http_time(p, r->cache->last_modified) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
 
-#if (NGX_HTTP_CACHE)
+    return NGX_OK;
+}
 
-ngx_int_t
-ngx_http_upstream_cache_status(ngx_http_request_t *r,
+
+static ngx_int_t
+ngx_http_upstream_cache_etag(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
-    ngx_uint_t  n;
-
-    if (r->upstream == NULL || r->upstream->cache_status == 0) {
+    if (r->upstream == NULL
+        || !r->upstream->conf->cache_revalidate
+        || r->upstream->cache_status != NGX_HTTP_CACHE_EXPIRED
+        || r->cache->etag.len == 0)
+    {
         v->not_found = 1;
         return NGX_OK;
     }
 
-    n = r->upstream->cache_status - 1;
-
     v->valid = 1;
     v->no_cacheable = 0;
     v->not_found = 0;
-    v->len = ngx_http_cache_status[n].len;
-    v->data = ngx_http_cache_status[n].data;
+    v->len = r->cache->etag.len;
+    v->data = r->cache->etag.data;
 
     return NGX_OK;
 }
@@ -5015,6 +6061,163 @@ invalid:
 }
 
 
+static char *
+ngx_http_upstream_breaker(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_srv_conf_t  *uscf = conf;
+
+    ngx_int_t                     n;
+    ngx_str_t                    *value, s;
+    ngx_msec_t                    ms;
+    ngx_uint_t                    i;
+    ngx_http_upstream_breaker_t  *b;
+
+    if (uscf->breaker) {
+        return "is duplicate";
+    }
+
+    b = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_breaker_t));
+    if (b == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    b->window = 10000;
+    b->error_rate = 50;
+    b->latency = 0;
+    b->min_requests = 20;
+    b->open_time = 30000;
+    b->probes = 3;
+    b->slow_start = 0;
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "error_rate=", 11) == 0) {
+
+            if (value[i].data[value[i].len - 1] != '%') {
+                goto invalid;
+            }
+
+            n = ngx_atoi(&value[i].data[11], value[i].len - 12);
+
+            if (n == NGX_ERROR || n == 0 || n > 100) {
+                goto invalid;
+            }
+
+            b->error_rate = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "min_requests=", 13) == 0) {
+
+            n = ngx_atoi(&value[i].data[13], value[i].len - 13);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            b->min_requests = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "probes=", 7) == 0) {
+
+            n = ngx_atoi(&value[i].data[7], value[i].len - 7);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            b->probes = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "window=", 7) == 0) {
+
+            s.len = value[i].len - 7;
+            s.data = &value[i].data[7];
+
+            ms = ngx_parse_time(&s, 0);
+
+            if (ms == (ngx_msec_t) NGX_ERROR
+                || ms < NGX_HTTP_UPSTREAM_BREAKER_BUCKETS)
+            {
+                goto invalid;
+            }
+
+            b->window = ms;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "latency=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = &value[i].data[8];
+
+            ms = ngx_parse_time(&s, 0);
+
+            if (ms == (ngx_msec_t) NGX_ERROR) {
+                goto invalid;
+            }
+
+            b->latency = ms;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "open_time=", 10) == 0) {
+
+            s.len = value[i].len - 10;
+            s.data = &value[i].data[10];
+
+            ms = ngx_parse_time(&s, 0);
+
+            if (ms == (ngx_msec_t) NGX_ERROR) {
+                goto invalid;
+            }
+
+            b->open_time = ms;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "slow_start=", 11) == 0) {
+
+            s.len = value[i].len - 11;
+            s.data = &value[i].data[11];
+
+            ms = ngx_parse_time(&s, 0);
+
+            if (ms == (ngx_msec_t) NGX_ERROR) {
+                goto invalid;
+            }
+
+            b->slow_start = ms;
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    uscf->breaker = b;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
 ngx_http_upstream_srv_conf_t *
 ngx_http_upstream_add(ngx_conf_t *cf, ngx_url_t *u, ngx_uint_t flags)
 {
@@ -5299,15 +6502,116 @@ ngx_http_upstream_param_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
 }
 
 
+char *
+ngx_http_upstream_hedge_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    char  *p = conf;
+
+    ngx_int_t                    n;
+    ngx_str_t                   *value, s;
+    ngx_uint_t                   i;
+    ngx_http_upstream_hedge_t  **phedge, *hedge;
+
+    phedge = (ngx_http_upstream_hedge_t **) (p + cmd->offset);
+
+    if (*phedge != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts != 2) {
+            return "invalid number of arguments";
+        }
+
+        *phedge = NULL;
+        return NGX_CONF_OK;
+    }
+
+    hedge = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_hedge_t));
+    if (hedge == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    /* the delay is either fixed or a percentile of response times */
+
+    if (value[1].data[0] == 'p') {
+        n = ngx_atoi(value[1].data + 1, value[1].len - 1);
+
+        if (n == NGX_ERROR || n == 0 || n > 99) {
+            goto invalid;
+        }
+
+        hedge->percentile = n;
+
+    } else {
+        hedge->delay = ngx_parse_time(&value[1], 0);
+
+        if (hedge->delay == (ngx_msec_t) NGX_ERROR) {
+            goto invalid;
+        }
+    }
+
+    hedge->budget = 10;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "budget=", 7) == 0) {
+
+            s.len = value[i].len - 7;
+            s.data = value[i].data + 7;
+
+            if (s.len && s.data[s.len - 1] == '%') {
+                s.len--;
+            }
+
+            n = ngx_atoi(s.data, s.len);
+
+            if (n == NGX_ERROR || n > 100) {
+                goto invalid_budget;
+            }
+
+            hedge->budget = n;
+
+            continue;
+        }
+
+        goto invalid_budget;
+    }
+
+    *phedge = hedge;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid delay \"%V\"", &value[1]);
+
+    return NGX_CONF_ERROR;
+
+invalid_budget:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
 ngx_int_t
 ngx_http_upstream_hide_headers_hash(ngx_conf_t *cf,
     ngx_http_upstream_conf_t *conf, ngx_http_upstream_conf_t *prev,
     ngx_str_t *default_hide_headers, ngx_hash_init_t *hash)
 {
-    ngx_str_t       *h;
-    ngx_uint_t       i, j;
-    ngx_array_t      hide_headers;
-    ngx_hash_key_t  *hk;
+    ngx_str_t                   *h;
+    ngx_uint_t                   i, j;
+    ngx_array_t                  hide_headers;
+    ngx_hash_key_t              *hk;
+    ngx_http_upstream_header_t  *header, *hh;
 
     if (conf->hide_headers == NGX_CONF_UNSET_PTR
         && conf->pass_headers == NGX_CONF_UNSET_PTR)
@@ -5350,7 +6654,7 @@ ngx_http_upstream_hide_headers_hash(ngx_conf_t *cf,
 
         hk->key = *h;
         hk->key_hash = ngx_hash_key_lc(h->data, h->len);
-        hk->value = (void *) 1;
+        hk->value = &ngx_http_upstream_hidden_header;
     }
 
     if (conf->hide_headers != NGX_CONF_UNSET_PTR) {
@@ -5374,7 +6678,7 @@ ngx_http_upstream_hide_headers_hash(ngx_conf_t *cf,
 
             hk->key = h[i];
             hk->key_hash = ngx_hash_key_lc(h[i].data, h[i].len);
-            hk->value = (void *) 1;
+            hk->value = &ngx_http_upstream_hidden_header;
 
         exist:
 
@@ -5402,6 +6706,51 @@ ngx_http_upstream_hide_headers_hash(ngx_conf_t *cf,
         }
     }
 
+    /*
+     * the known headers are added to the same hash, so both the handlers
+     * and the decision to hide a header are found with a single lookup;
+     * a hidden header is not copied by its copy handler
+     */
+
+    for (header = ngx_http_upstream_headers_in; header->name.len; header++) {
+
+        hk = hide_headers.elts;
+
+        for (j = 0; j < hide_headers.nelts; j++) {
+
+            if (hk[j].key.data == NULL) {
+                continue;
+            }
+
+            if (ngx_strcasecmp(header->name.data, hk[j].key.data) == 0) {
+                hh = ngx_palloc(cf->pool, sizeof(ngx_http_upstream_header_t));
+                if (hh == NULL) {
+                    return NGX_ERROR;
+                }
+
+                *hh = *header;
+                hh->copy_handler = ngx_http_upstream_ignore_header_line;
+
+                hk[j].value = hh;
+
+                goto hidden;
+            }
+        }
+
+        hk = ngx_array_push(&hide_headers);
+        if (hk == NULL) {
+            return NGX_ERROR;
+        }
+
+        hk->key = header->name;
+        hk->key_hash = ngx_hash_key_lc(header->name.data, header->name.len);
+        hk->value = header;
+
+    hidden:
+
+        continue;
+    }
+
     hash->hash = &conf->hide_headers_hash;
     hash->key = ngx_hash_key_lc;
     hash->pool = cf->pool;
@@ -5428,6 +6777,15 @@ ngx_http_upstream_create_main_conf(ngx_conf_t *cf)
         return NULL;
     }
 
+#if (NGX_HTTP_CACHE)
+    if (ngx_array_init(&umcf->caches, cf->pool, 4,
+                       sizeof(ngx_http_file_cache_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+#endif
+
     return umcf;
 }
 
@@ -5437,16 +6795,21 @@ ngx_http_upstream_init_main_conf(ngx_conf_t *cf, void *conf)
 {
     ngx_http_upstream_main_conf_t  *umcf = conf;
 
-    ngx_uint_t                      i;
+    ngx_str_t                       name;
+    ngx_uint_t                      i, n;
     ngx_array_t                     headers_in;
     ngx_hash_key_t                 *hk;
+    ngx_shm_zone_t                 *shm_zone;
     ngx_hash_init_t                 hash;
     ngx_http_upstream_init_pt       init;
     ngx_http_upstream_header_t     *header;
+    ngx_http_upstream_breaker_t    *b;
     ngx_http_upstream_srv_conf_t  **uscfp;
 
     uscfp = umcf->upstreams.elts;
 
+    n = 0;
+
     for (i = 0; i < umcf->upstreams.nelts; i++) {
 
         init = uscfp[i]->peer.init_upstream ? uscfp[i]->peer.init_upstream:
@@ -5455,6 +6818,35 @@ ngx_http_upstream_init_main_conf(ngx_conf_t *cf, void *conf)
         if (init(cf, uscfp[i]) != NGX_OK) {
             return NGX_CONF_ERROR;
         }
+
+        b = uscfp[i]->breaker;
+
+        if (b && b->npeers) {
+            b->peers = ngx_pcalloc(cf->pool, b->npeers
+                                   * sizeof(ngx_http_upstream_breaker_peer_t *));
+            if (b->peers == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            n += b->npeers;
+        }
+    }
+
+    /* the circuit breaker state of all upstreams is kept in one zone */
+
+    if (n) {
+        ngx_str_set(&name, "upstream_breaker");
+
+        shm_zone = ngx_shared_memory_add(cf, &name,
+                          ngx_http_upstream_shared_size(n,
+                                   sizeof(ngx_http_upstream_breaker_peer_t)),
+                          &ngx_http_upstream_module);
+        if (shm_zone == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        shm_zone->init = ngx_http_upstream_breaker_init_zone;
+        shm_zone->data = umcf;
     }
 
 
@@ -50,6 +50,11 @@
 #define NGX_HTTP_UPSTREAM_IGN_XA_CHARSET     0x00000100
 
 
+#define NGX_HTTP_UPSTREAM_COLLAPSE_OFF        0
+#define NGX_HTTP_UPSTREAM_COLLAPSE_CACHEABLE  1
+#define NGX_HTTP_UPSTREAM_COLLAPSE_ALL        2
+
+
 typedef struct {
     ngx_msec_t                       bl_time;
     ngx_uint_t                       bl_state;
@@ -67,6 +72,10 @@ typedef struct {
     ngx_hash_t                       headers_in_hash;
     ngx_array_t                      upstreams;
                                              /* ngx_http_upstream_srv_conf_t */
+#if (NGX_HTTP_CACHE)
+    ngx_array_t                      caches;
+                                             /* ngx_http_file_cache_t * */
+#endif
 } ngx_http_upstream_main_conf_t;
 
 typedef struct ngx_http_upstream_srv_conf_s  ngx_http_upstream_srv_conf_t;
@@ -106,11 +115,56 @@ typedef struct {
 #define NGX_HTTP_UPSTREAM_ID            0x0040
 
 
+#define NGX_HTTP_UPSTREAM_BREAKER_CLOSED     0
+#define NGX_HTTP_UPSTREAM_BREAKER_OPEN       1
+#define NGX_HTTP_UPSTREAM_BREAKER_HALF_OPEN  2
+
+#define NGX_HTTP_UPSTREAM_BREAKER_BUCKETS    10
+
+
+typedef struct {
+    ngx_msec_t                       epoch;
+    ngx_uint_t                       requests;
+    ngx_uint_t                       failures;
+} ngx_http_upstream_breaker_bucket_t;
+
+
+/* the state of a peer is shared by all worker processes */
+
+typedef struct {
+    ngx_uint_t                       state;
+    ngx_msec_t                       changed;
+    ngx_uint_t                       probes;
+    ngx_uint_t                       passed;
+    ngx_uint_t                       check_down;
+
+    ngx_http_upstream_breaker_bucket_t
+                                  buckets[NGX_HTTP_UPSTREAM_BREAKER_BUCKETS];
+} ngx_http_upstream_breaker_peer_t;
+
+
+typedef struct {
+    ngx_msec_t                       window;
+    ngx_uint_t                       error_rate;
+    ngx_msec_t                       latency;
+    ngx_uint_t                       min_requests;
+    ngx_msec_t                       open_time;
+    ngx_uint_t                       probes;
+    ngx_msec_t                       slow_start;
+
+    ngx_uint_t                       npeers;
+    struct ngx_http_upstream_rr_peers_s  *rr_peers;
+    ngx_slab_pool_t                 *shpool;
+    ngx_http_upstream_breaker_peer_t  **peers;
+} ngx_http_upstream_breaker_t;
+
+
 struct ngx_http_upstream_srv_conf_s {
     ngx_http_upstream_peer_t         peer;
     void                           **srv_conf;
 
     ngx_array_t                     *servers;  /* ngx_http_upstream_server_t */
+    ngx_http_upstream_breaker_t     *breaker;
 
 #if (NGX_HTTP_UPSTREAM_HASH)
     ngx_array_t                     *values;
@@ -134,6 +188,24 @@ typedef struct {
 } ngx_http_upstream_local_t;
 
 
+#define NGX_HTTP_UPSTREAM_HEDGE_BUCKETS  16
+
+
+typedef struct {
+    ngx_msec_t                       delay;
+    ngx_uint_t                       percentile;
+    ngx_uint_t                       budget;
+
+    /* the statistics are kept per worker process */
+
+    ngx_uint_t                       requests;
+    ngx_uint_t                       hedged;
+
+    ngx_uint_t                       samples;
+    ngx_uint_t                       times[NGX_HTTP_UPSTREAM_HEDGE_BUCKETS];
+} ngx_http_upstream_hedge_t;
+
+
 typedef struct {
     ngx_http_upstream_srv_conf_t    *upstream;
 
@@ -161,12 +233,14 @@ typedef struct {
     ngx_uint_t                       store_access;
     ngx_flag_t                       request_buffering;
     ngx_flag_t                       buffering;
+    ngx_flag_t                       adaptive_buffers;
     ngx_flag_t                       pass_request_headers;
     ngx_flag_t                       pass_request_body;
 
     ngx_flag_t                       ignore_client_abort;
     ngx_flag_t                       intercept_errors;
     ngx_flag_t                       cyclic_temp_file;
+    ngx_flag_t                       splice;
 
     ngx_path_t                      *temp_path;
 
@@ -175,6 +249,7 @@ typedef struct {
     ngx_array_t                     *pass_headers;
 
     ngx_http_upstream_local_t       *local;
+    ngx_http_upstream_hedge_t       *hedge;
 
 #if (NGX_HTTP_CACHE)
     ngx_shm_zone_t                  *cache;
@@ -185,9 +260,15 @@ typedef struct {
 
     ngx_flag_t                       cache_lock;
     ngx_msec_t                       cache_lock_timeout;
+    ngx_uint_t                       cache_collapse;
+
+    ngx_flag_t                       cache_revalidate;
+    ngx_flag_t                       cache_background_update;
 
     ngx_array_t                     *cache_valid;
     ngx_array_t                     *cache_bypass;
+    ngx_array_t                     *cache_purge;
+    ngx_http_complex_value_t        *cache_tag;
     ngx_array_t                     *no_cache;
 #endif
 
@@ -289,6 +370,7 @@ struct ngx_http_upstream_s {
     ngx_chain_writer_ctx_t           writer;
 
     ngx_http_upstream_conf_t        *conf;
+    ngx_http_upstream_srv_conf_t    *upstream;
 
     ngx_http_upstream_headers_in_t   headers_in;
 
@@ -299,6 +381,16 @@ struct ngx_http_upstream_s {
     ngx_buf_t                        buffer;
     off_t                            length;
 
+    /* the original attempt racing with the hedged one, and its balancer */
+    ngx_peer_connection_t           *hedge;
+    ngx_event_t                     *hedge_event;
+    ngx_msec_t                       hedge_start;
+
+#if (NGX_HAVE_SPLICE)
+    ngx_linux_pipe_t                *splice_in;
+    ngx_linux_pipe_t                *splice_out;
+#endif
+
     ngx_chain_t                     *out_bufs;
     ngx_chain_t                     *busy_bufs;
     ngx_chain_t                     *free_bufs;
@@ -343,12 +435,13 @@ struct ngx_http_upstream_s {
     unsigned                         accel:1;
     unsigned                         ssl:1;
 #if (NGX_HTTP_CACHE)
-    unsigned                         cache_status:3;
+    unsigned                         cache_status:4;
 #endif
 
     unsigned                         buffering:1;
     unsigned                         keepalive:1;
     unsigned                         upgrade:1;
+    unsigned                         header_in_buffer:1;
 
     unsigned                         request_sent:1;
     unsigned                         header_sent:1;
@@ -379,6 +472,8 @@ char *ngx_http_upstream_bind_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 char *ngx_http_upstream_param_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+char *ngx_http_upstream_hedge_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 ngx_int_t ngx_http_upstream_hide_headers_hash(ngx_conf_t *cf,
     ngx_http_upstream_conf_t *conf, ngx_http_upstream_conf_t *prev,
     ngx_str_t *default_hide_headers, ngx_hash_init_t *hash);
@@ -403,6 +498,7 @@ void ngx_http_upstream_check_free_peer(ngx_uint_t index);
 
 extern ngx_module_t        ngx_http_upstream_module;
 extern ngx_conf_bitmask_t  ngx_http_upstream_cache_method_mask[];
+extern ngx_conf_enum_t     ngx_http_upstream_cache_collapse[];
 extern ngx_conf_bitmask_t  ngx_http_upstream_ignore_headers_masks[];
 
 
@@ -12,6 +12,35 @@
 
 static ngx_http_upstream_rr_peer_t *ngx_http_upstream_get_peer(
     ngx_http_upstream_rr_peer_data_t *rrp);
+static void ngx_http_upstream_breaker_open(ngx_http_upstream_breaker_peer_t *bp,
+    ngx_msec_t now);
+static void ngx_http_upstream_breaker_close(
+    ngx_http_upstream_breaker_peer_t *bp, ngx_msec_t now);
+
+
+typedef struct {
+    ngx_str_node_t                     sn;
+    ngx_queue_t                        queue;
+    ngx_uint_t                         generation;
+    size_t                             size;
+} ngx_http_upstream_shared_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                       rbtree;
+    ngx_rbtree_node_t                  sentinel;
+    ngx_queue_t                        used;
+    ngx_queue_t                        free;
+    ngx_uint_t                         generation;
+} ngx_http_upstream_shared_sh_t;
+
+
+/*
+ * the weights are scaled during slow start to let a peer
+ * with the weight of 1 get a part of its share
+ */
+
+#define NGX_HTTP_UPSTREAM_BREAKER_SCALE  16
 
 #if (NGX_HTTP_SSL)
 
@@ -103,6 +132,13 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 
         us->peer.data = peers;
 
+        if (us->breaker) {
+            peers->breaker = us->breaker;
+            peers->breaker_base = 0;
+            us->breaker->rr_peers = peers;
+            us->breaker->npeers = n;
+        }
+
         /* backup servers */
 
         n = 0;
@@ -169,6 +205,12 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 
         peers->next = backup;
 
+        if (us->breaker) {
+            backup->breaker = us->breaker;
+            backup->breaker_base = peers->number;
+            us->breaker->npeers += n;
+        }
+
         return NGX_OK;
     }
 
@@ -255,6 +297,7 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
 
     rrp->peers = us->peer.data;
     rrp->current = 0;
+    rrp->start = ngx_current_msec;
 
     n = rrp->peers->number;
 
@@ -436,19 +479,39 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
         }
 #endif
 
+        if (rrp->peers->breaker
+            && ngx_http_upstream_breaker_test(rrp->peers, 0) != NGX_OK)
+        {
+            goto failed;
+        }
+
+        rrp->current = 0;
+
+        if (ngx_http_upstream_breaker_select(rrp) != NGX_OK) {
+            goto failed;
+        }
+
     } else {
 
         /* there are several peers */
 
-        peer = ngx_http_upstream_get_peer(rrp);
+        for ( ;; ) {
+            peer = ngx_http_upstream_get_peer(rrp);
 
-        if (peer == NULL) {
-            goto failed;
-        }
+            if (peer == NULL) {
+                goto failed;
+            }
 
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
-                       "get rr peer, current: %ui %i",
-                       rrp->current, peer->current_weight);
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                           "get rr peer, current: %ui %i",
+                           rrp->current, peer->current_weight);
+
+            /* the peer is marked as tried, so another one is selected */
+
+            if (ngx_http_upstream_breaker_select(rrp) == NGX_OK) {
+                break;
+            }
+        }
     }
 
     pc->sockaddr = peer->sockaddr;
@@ -511,7 +574,7 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
 {
     time_t                        now;
     uintptr_t                     m;
-    ngx_int_t                     total;
+    ngx_int_t                     w, total;
     ngx_uint_t                    i, n;
     ngx_http_upstream_rr_peer_t  *peer, *best;
 
@@ -535,6 +598,12 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
             continue;
         }
 
+        if (rrp->peers->breaker
+            && ngx_http_upstream_breaker_test(rrp->peers, i) != NGX_OK)
+        {
+            continue;
+        }
+
 #if (NGX_HTTP_UPSTREAM_CHECK)
         if (ngx_http_upstream_check_peer_down(peer->check_index)) {
             continue;
@@ -548,8 +617,14 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
             continue;
         }
 
-        peer->current_weight += peer->effective_weight;
-        total += peer->effective_weight;
+        w = peer->effective_weight;
+
+        if (rrp->peers->breaker) {
+            w = ngx_http_upstream_breaker_weight(rrp->peers, i, w);
+        }
+
+        peer->current_weight += w;
+        total += w;
 
         if (peer->effective_weight < peer->weight) {
             peer->effective_weight++;
@@ -597,6 +672,11 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 
     /* TODO: NGX_PEER_KEEPALIVE */
 
+    if (rrp->peers->breaker) {
+        ngx_http_upstream_breaker_update(rrp, state & NGX_PEER_FAILED,
+                                         pc->log);
+    }
+
     if (rrp->peers->single) {
         pc->tries = 0;
         return;
@@ -644,6 +724,533 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 }
 
 
+/*
+ * The state shared by worker processes, such as statistics of peers,
+ * is kept in blocks keyed by the names of an upstream and a peer, so
+ * a peer finds its own state on reload whatever the order of servers.
+ * A block no longer used is only reused on the next reload, as the old
+ * worker processes may still update it until they exit.
+ */
+
+ngx_int_t
+ngx_http_upstream_shared_init(ngx_shm_zone_t *shm_zone)
+{
+    ngx_slab_pool_t                *shpool;
+    ngx_http_upstream_shared_sh_t  *sh;
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    sh = shpool->data;
+
+    if (sh == NULL) {
+        sh = ngx_slab_alloc(shpool, sizeof(ngx_http_upstream_shared_sh_t));
+        if (sh == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_rbtree_init(&sh->rbtree, &sh->sentinel,
+                        ngx_str_rbtree_insert_value);
+
+        ngx_queue_init(&sh->used);
+        ngx_queue_init(&sh->free);
+
+        sh->generation = 0;
+
+        shpool->data = sh;
+    }
+
+    sh->generation++;
+
+    return NGX_OK;
+}
+
+
+void *
+ngx_http_upstream_shared_get(ngx_shm_zone_t *shm_zone, ngx_str_t *upstream,
+    ngx_str_t *peer, size_t size)
+{
+    u_char                           *p;
+    uint32_t                          hash;
+    ngx_str_t                         key;
+    ngx_queue_t                      *q;
+    ngx_slab_pool_t                  *shpool;
+    ngx_http_upstream_shared_sh_t    *sh;
+    ngx_http_upstream_shared_node_t  *node;
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    sh = shpool->data;
+
+    /* the state of a whole upstream is keyed by its name only */
+
+    key.len = upstream->len + (peer ? 1 + peer->len : 0);
+
+    key.data = ngx_slab_alloc(shpool, key.len);
+    if (key.data == NULL) {
+        return NULL;
+    }
+
+    p = ngx_cpymem(key.data, upstream->data, upstream->len);
+
+    if (peer) {
+        *p++ = ' ';
+        ngx_memcpy(p, peer->data, peer->len);
+    }
+
+    hash = ngx_crc32_short(key.data, key.len);
+
+    node = (ngx_http_upstream_shared_node_t *)
+               ngx_str_rbtree_lookup(&sh->rbtree, &key, hash);
+
+    if (node) {
+
+        /* servers with the same address share the state */
+
+        ngx_slab_free(shpool, key.data);
+
+        node->generation = sh->generation;
+
+        return (u_char *) node + sizeof(ngx_http_upstream_shared_node_t);
+    }
+
+    for (q = ngx_queue_head(&sh->free);
+         q != ngx_queue_sentinel(&sh->free);
+         q = ngx_queue_next(q))
+    {
+        node = ngx_queue_data(q, ngx_http_upstream_shared_node_t, queue);
+
+        if (node->size == size) {
+            ngx_queue_remove(q);
+            goto found;
+        }
+    }
+
+    node = ngx_slab_alloc(shpool,
+                          sizeof(ngx_http_upstream_shared_node_t) + size);
+    if (node == NULL) {
+        ngx_slab_free(shpool, key.data);
+        return NULL;
+    }
+
+    node->size = size;
+
+found:
+
+    node->sn.node.key = hash;
+    node->sn.str = key;
+    node->generation = sh->generation;
+
+    ngx_rbtree_insert(&sh->rbtree, &node->sn.node);
+    ngx_queue_insert_tail(&sh->used, &node->queue);
+
+    p = (u_char *) node + sizeof(ngx_http_upstream_shared_node_t);
+
+    ngx_memzero(p, size);
+
+    return p;
+}
+
+
+void
+ngx_http_upstream_shared_release(ngx_shm_zone_t *shm_zone)
+{
+    ngx_queue_t                      *q, *next;
+    ngx_slab_pool_t                  *shpool;
+    ngx_http_upstream_shared_sh_t    *sh;
+    ngx_http_upstream_shared_node_t  *node;
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    sh = shpool->data;
+
+    for (q = ngx_queue_head(&sh->used);
+         q != ngx_queue_sentinel(&sh->used);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+
+        node = ngx_queue_data(q, ngx_http_upstream_shared_node_t, queue);
+
+        if (node->generation == sh->generation) {
+            continue;
+        }
+
+        ngx_rbtree_delete(&sh->rbtree, &node->sn.node);
+        ngx_slab_free(shpool, node->sn.str.data);
+
+        ngx_queue_remove(q);
+        ngx_queue_insert_tail(&sh->free, q);
+    }
+}
+
+
+size_t
+ngx_http_upstream_shared_size(ngx_uint_t n, size_t size)
+{
+    /*
+     * a block takes up to twice its size in the slab pool, and the blocks
+     * of removed peers are kept until the next reload; the size is rounded
+     * up so that adding a few servers does not recreate the zone
+     */
+
+    size = 4 * n * (sizeof(ngx_http_upstream_shared_node_t) + size + 64);
+
+    return 8 * ngx_pagesize + ngx_align(size, 64 * ngx_pagesize);
+}
+
+
+ngx_int_t
+ngx_http_upstream_breaker_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_upstream_main_conf_t  *umcf = shm_zone->data;
+
+    ngx_uint_t                      i, j, n;
+    ngx_http_upstream_breaker_t    *b;
+    ngx_http_upstream_rr_peers_t   *peers;
+    ngx_http_upstream_srv_conf_t  **uscfp;
+
+    if (ngx_http_upstream_shared_init(shm_zone) != NGX_OK) {
+        goto failed;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        b = uscfp[i]->breaker;
+
+        if (b == NULL || b->npeers == 0) {
+            continue;
+        }
+
+        b->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+        n = 0;
+
+        for (peers = b->rr_peers; peers; peers = peers->next) {
+            for (j = 0; j < peers->number; j++) {
+                b->peers[n] = ngx_http_upstream_shared_get(shm_zone,
+                                 peers->name, &peers->peer[j].name,
+                                 sizeof(ngx_http_upstream_breaker_peer_t));
+                if (b->peers[n] == NULL) {
+                    goto failed;
+                }
+
+                n++;
+            }
+        }
+    }
+
+    ngx_http_upstream_shared_release(shm_zone);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                  "could not allocate circuit breaker state");
+
+    return NGX_ERROR;
+}
+
+
+/*
+ * Returns NGX_OK if the peer may be selected, and NGX_BUSY if its circuit
+ * is open or all probes of the half-open circuit are in flight.  A peer
+ * brought back by the health check starts from the closed state.
+ */
+
+ngx_int_t
+ngx_http_upstream_breaker_test(ngx_http_upstream_rr_peers_t *peers,
+    ngx_uint_t i)
+{
+    ngx_int_t                          rc;
+    ngx_msec_t                         now;
+    ngx_http_upstream_breaker_t       *b;
+    ngx_http_upstream_breaker_peer_t  *bp;
+
+    b = peers->breaker;
+    bp = b->peers[peers->breaker_base + i];
+
+#if (NGX_HTTP_UPSTREAM_CHECK)
+    if (ngx_http_upstream_check_peer_down(peers->peer[i].check_index)) {
+
+        if (!bp->check_down) {
+            ngx_shmtx_lock(&b->shpool->mutex);
+            bp->check_down = 1;
+            ngx_shmtx_unlock(&b->shpool->mutex);
+        }
+
+        return NGX_BUSY;
+    }
+#endif
+
+    if (bp->state == NGX_HTTP_UPSTREAM_BREAKER_CLOSED && !bp->check_down) {
+        return NGX_OK;
+    }
+
+    now = ngx_current_msec;
+    rc = NGX_OK;
+
+    ngx_shmtx_lock(&b->shpool->mutex);
+
+    if (bp->check_down) {
+        bp->check_down = 0;
+        ngx_http_upstream_breaker_close(bp, now);
+    }
+
+    if (bp->state == NGX_HTTP_UPSTREAM_BREAKER_OPEN) {
+
+        if (now - bp->changed < b->open_time) {
+            rc = NGX_BUSY;
+
+        } else {
+            bp->state = NGX_HTTP_UPSTREAM_BREAKER_HALF_OPEN;
+            bp->changed = now;
+            bp->probes = 0;
+            bp->passed = 0;
+        }
+    }
+
+    if (bp->state == NGX_HTTP_UPSTREAM_BREAKER_HALF_OPEN) {
+
+        /* probes which have not completed in time are not waited for */
+
+        if (now - bp->changed >= b->open_time) {
+            bp->changed = now;
+            bp->probes = 0;
+        }
+
+        if (bp->probes >= b->probes) {
+            rc = NGX_BUSY;
+        }
+    }
+
+    ngx_shmtx_unlock(&b->shpool->mutex);
+
+    return rc;
+}
+
+
+ngx_int_t
+ngx_http_upstream_breaker_weight(ngx_http_upstream_rr_peers_t *peers,
+    ngx_uint_t i, ngx_int_t weight)
+{
+    ngx_msec_t                         elapsed;
+    ngx_http_upstream_breaker_t       *b;
+    ngx_http_upstream_breaker_peer_t  *bp;
+
+    b = peers->breaker;
+
+    if (b->slow_start == 0) {
+        return weight;
+    }
+
+    bp = b->peers[peers->breaker_base + i];
+
+    weight *= NGX_HTTP_UPSTREAM_BREAKER_SCALE;
+
+    if (bp->state != NGX_HTTP_UPSTREAM_BREAKER_CLOSED || bp->changed == 0) {
+        return weight;
+    }
+
+    elapsed = ngx_current_msec - bp->changed;
+
+    if (elapsed >= b->slow_start) {
+        return weight;
+    }
+
+    weight = weight * elapsed / b->slow_start;
+
+    return weight ? weight : 1;
+}
+
+
+/*
+ * The probe of a half-open circuit is taken under the same lock as the
+ * limit is checked, as other workers may have taken the remaining probes
+ * since the peer was tested.  Returns NGX_BUSY if the peer may not be used.
+ */
+
+ngx_int_t
+ngx_http_upstream_breaker_select(ngx_http_upstream_rr_peer_data_t *rrp)
+{
+    ngx_int_t                          rc;
+    ngx_http_upstream_breaker_t       *b;
+    ngx_http_upstream_breaker_peer_t  *bp;
+
+    rrp->start = ngx_current_msec;
+
+    b = rrp->peers->breaker;
+
+    if (b == NULL) {
+        return NGX_OK;
+    }
+
+    bp = b->peers[rrp->peers->breaker_base + rrp->current];
+
+    if (bp->state == NGX_HTTP_UPSTREAM_BREAKER_CLOSED) {
+        return NGX_OK;
+    }
+
+    rc = NGX_OK;
+
+    ngx_shmtx_lock(&b->shpool->mutex);
+
+    switch (bp->state) {
+
+    case NGX_HTTP_UPSTREAM_BREAKER_HALF_OPEN:
+
+        if (bp->probes >= b->probes) {
+            rc = NGX_BUSY;
+            break;
+        }
+
+        bp->probes++;
+        break;
+
+    case NGX_HTTP_UPSTREAM_BREAKER_OPEN:
+        rc = NGX_BUSY;
+        break;
+
+    default: /* NGX_HTTP_UPSTREAM_BREAKER_CLOSED */
+        break;
+    }
+
+    ngx_shmtx_unlock(&b->shpool->mutex);
+
+    return rc;
+}
+
+
+/*
+ * The requests are counted in buckets of a sliding window,
+ * a response slower than the latency threshold is a failure.
+ */
+
+void
+ngx_http_upstream_breaker_update(ngx_http_upstream_rr_peer_data_t *rrp,
+    ngx_uint_t failed, ngx_log_t *log)
+{
+    ngx_uint_t                           k, requests, failures;
+    ngx_msec_t                           now, epoch;
+    ngx_http_upstream_rr_peer_t         *peer;
+    ngx_http_upstream_breaker_t         *b;
+    ngx_http_upstream_breaker_peer_t    *bp;
+    ngx_http_upstream_breaker_bucket_t  *bucket;
+
+    b = rrp->peers->breaker;
+    bp = b->peers[rrp->peers->breaker_base + rrp->current];
+    peer = &rrp->peers->peer[rrp->current];
+
+    now = ngx_current_msec;
+
+    if (b->latency && now - rrp->start >= b->latency) {
+        failed = 1;
+    }
+
+    epoch = now / (b->window / NGX_HTTP_UPSTREAM_BREAKER_BUCKETS);
+
+    ngx_shmtx_lock(&b->shpool->mutex);
+
+    bucket = &bp->buckets[epoch % NGX_HTTP_UPSTREAM_BREAKER_BUCKETS];
+
+    if (bucket->epoch != epoch) {
+        bucket->epoch = epoch;
+        bucket->requests = 0;
+        bucket->failures = 0;
+    }
+
+    bucket->requests++;
+
+    if (failed) {
+        bucket->failures++;
+    }
+
+    switch (bp->state) {
+
+    case NGX_HTTP_UPSTREAM_BREAKER_CLOSED:
+
+        requests = 0;
+        failures = 0;
+
+        for (k = 0; k < NGX_HTTP_UPSTREAM_BREAKER_BUCKETS; k++) {
+            bucket = &bp->buckets[k];
+
+            if (epoch - bucket->epoch < NGX_HTTP_UPSTREAM_BREAKER_BUCKETS) {
+                requests += bucket->requests;
+                failures += bucket->failures;
+            }
+        }
+
+        if (requests >= b->min_requests
+            && failures * 100 >= requests * b->error_rate)
+        {
+            ngx_http_upstream_breaker_open(bp, now);
+
+            ngx_log_error(NGX_LOG_WARN, log, 0,
+                          "circuit breaker opened for upstream server %V "
+                          "in upstream \"%V\", %ui of %ui requests failed",
+                          &peer->name, rrp->peers->name, failures, requests);
+        }
+
+        break;
+
+    case NGX_HTTP_UPSTREAM_BREAKER_HALF_OPEN:
+
+        if (bp->probes) {
+            bp->probes--;
+        }
+
+        if (failed) {
+            ngx_http_upstream_breaker_open(bp, now);
+
+            ngx_log_error(NGX_LOG_WARN, log, 0,
+                          "circuit breaker opened again for upstream server "
+                          "%V in upstream \"%V\"",
+                          &peer->name, rrp->peers->name);
+
+        } else if (++bp->passed >= b->probes) {
+            ngx_http_upstream_breaker_close(bp, now);
+
+            ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                          "circuit breaker closed for upstream server %V "
+                          "in upstream \"%V\"",
+                          &peer->name, rrp->peers->name);
+        }
+
+        break;
+
+    default: /* NGX_HTTP_UPSTREAM_BREAKER_OPEN */
+        break;
+    }
+
+    ngx_shmtx_unlock(&b->shpool->mutex);
+}
+
+
+static void
+ngx_http_upstream_breaker_open(ngx_http_upstream_breaker_peer_t *bp,
+    ngx_msec_t now)
+{
+    bp->state = NGX_HTTP_UPSTREAM_BREAKER_OPEN;
+    bp->changed = now;
+    bp->probes = 0;
+    bp->passed = 0;
+}
+
+
+static void
+ngx_http_upstream_breaker_close(ngx_http_upstream_breaker_peer_t *bp,
+    ngx_msec_t now)
+{
+    bp->state = NGX_HTTP_UPSTREAM_BREAKER_CLOSED;
+    bp->changed = now;
+    bp->probes = 0;
+    bp->passed = 0;
+
+    /* the failures before recovery are not counted */
+
+    ngx_memzero(bp->buckets, sizeof(bp->buckets));
+}
+
 #if (NGX_HTTP_SSL)
 
 ngx_int_t
@@ -730,3 +1337,4 @@ ngx_http_upstream_empty_save_session(ngx_peer_connection_t *pc, void *data)
 }
 
 #endif
+
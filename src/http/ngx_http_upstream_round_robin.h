@@ -57,6 +57,9 @@ struct ngx_http_upstream_rr_peers_s {
 
     ngx_str_t                      *name;
 
+    ngx_http_upstream_breaker_t    *breaker;
+    ngx_uint_t                      breaker_base;
+
     ngx_http_upstream_rr_peers_t   *next;
 
     ngx_http_upstream_rr_peer_t     peer[1];
@@ -68,6 +71,7 @@ typedef struct {
     ngx_uint_t                      current;
     uintptr_t                      *tried;
     uintptr_t                       data;
+    ngx_msec_t                      start;
 } ngx_http_upstream_rr_peer_data_t;
 
 
@@ -82,6 +86,23 @@ ngx_int_t ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc,
 void ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t state);
 
+ngx_int_t ngx_http_upstream_shared_init(ngx_shm_zone_t *shm_zone);
+void *ngx_http_upstream_shared_get(ngx_shm_zone_t *shm_zone,
+    ngx_str_t *upstream, ngx_str_t *peer, size_t size);
+void ngx_http_upstream_shared_release(ngx_shm_zone_t *shm_zone);
+size_t ngx_http_upstream_shared_size(ngx_uint_t n, size_t size);
+
+ngx_int_t ngx_http_upstream_breaker_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+ngx_int_t ngx_http_upstream_breaker_test(ngx_http_upstream_rr_peers_t *peers,
+    ngx_uint_t i);
+ngx_int_t ngx_http_upstream_breaker_weight(ngx_http_upstream_rr_peers_t *peers,
+    ngx_uint_t i, ngx_int_t weight);
+ngx_int_t ngx_http_upstream_breaker_select(
+    ngx_http_upstream_rr_peer_data_t *rrp);
+void ngx_http_upstream_breaker_update(ngx_http_upstream_rr_peer_data_t *rrp,
+    ngx_uint_t failed, ngx_log_t *log);
+
 #if (NGX_HTTP_SSL)
 ngx_int_t
     ngx_http_upstream_set_round_robin_peer_session(ngx_peer_connection_t *pc,
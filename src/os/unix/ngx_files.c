@@ -273,6 +273,23 @@ ngx_set_file_time(u_char *name, ngx_fd_t fd, time_t s)
 }
 
 
+#if (NGX_HAVE_FALLOCATE)
+
+ngx_int_t
+ngx_preallocate_file(ngx_file_t *file, off_t size)
+{
+    /* the file size is not changed, only disk blocks are reserved */
+
+    if (fallocate(file->fd, FALLOC_FL_KEEP_SIZE, 0, size) != -1) {
+        return NGX_OK;
+    }
+
+    return NGX_ERROR;
+}
+
+#endif
+
+
 ngx_int_t
 ngx_create_file_mapping(ngx_file_mapping_t *fm)
 {
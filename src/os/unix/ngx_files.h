@@ -165,6 +165,14 @@ ngx_int_t ngx_set_file_time(u_char *name, ngx_fd_t fd, time_t s);
 #define ngx_set_file_time_n      "utimes()"
 
 
+#if (NGX_HAVE_FALLOCATE)
+
+ngx_int_t ngx_preallocate_file(ngx_file_t *file, off_t size);
+#define ngx_preallocate_file_n   "fallocate()"
+
+#endif
+
+
 #define ngx_file_info(file, sb)  stat((const char *) file, sb)
 #define ngx_file_info_n          "stat()"
 
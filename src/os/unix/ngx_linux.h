@@ -12,6 +12,29 @@
 ngx_chain_t *ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in,
     off_t limit);
 
+
+#if (NGX_HAVE_SPLICE)
+
+#define NGX_LINUX_PIPE_SIZE  65536
+
+typedef struct ngx_linux_pipe_s  ngx_linux_pipe_t;
+
+struct ngx_linux_pipe_s {
+    ngx_fd_t            fd[2];
+    size_t              size;
+    ngx_linux_pipe_t   *next;
+};
+
+
+ngx_linux_pipe_t *ngx_linux_pipe_get(ngx_log_t *log);
+void ngx_linux_pipe_free(ngx_linux_pipe_t *p, ngx_log_t *log);
+ssize_t ngx_linux_splice_recv(ngx_connection_t *c, ngx_linux_pipe_t *p,
+    size_t size);
+ssize_t ngx_linux_splice_send(ngx_connection_t *c, ngx_linux_pipe_t *p);
+
+#endif
+
+
 extern int ngx_linux_rtsig_max;
 
 
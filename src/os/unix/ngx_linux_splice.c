@@ -0,0 +1,220 @@
+
+/*
+ * Copyright (C) 2010-2013 Alibaba Group Holding Limited
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * Pipes are kept per worker process: creating a pipe costs two system
+ * calls and two descriptors, so pipes are reused instead of being created
+ * for every proxied connection.  A pipe that still holds data is closed,
+ * it cannot be reused.
+ */
+
+#define NGX_LINUX_PIPE_FREE_MAX  64
+
+
+static ngx_linux_pipe_t  *ngx_linux_pipe_free_list;
+static ngx_uint_t         ngx_linux_pipe_nfree;
+
+
+ngx_linux_pipe_t *
+ngx_linux_pipe_get(ngx_log_t *log)
+{
+    ngx_linux_pipe_t  *p;
+
+    p = ngx_linux_pipe_free_list;
+
+    if (p) {
+        ngx_linux_pipe_free_list = p->next;
+        ngx_linux_pipe_nfree--;
+
+        p->next = NULL;
+
+        return p;
+    }
+
+    p = ngx_alloc(sizeof(ngx_linux_pipe_t), log);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    if (pipe(p->fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno, "pipe() failed");
+        ngx_free(p);
+        return NULL;
+    }
+
+    if (ngx_nonblocking(p->fd[0]) == -1
+        || ngx_nonblocking(p->fd[1]) == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_nonblocking_n " failed");
+        goto failed;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "splice pipe: %d:%d", p->fd[0], p->fd[1]);
+
+    p->size = 0;
+    p->next = NULL;
+
+    return p;
+
+failed:
+
+    (void) close(p->fd[0]);
+    (void) close(p->fd[1]);
+    ngx_free(p);
+
+    return NULL;
+}
+
+
+void
+ngx_linux_pipe_free(ngx_linux_pipe_t *p, ngx_log_t *log)
+{
+    if (p->size == 0 && ngx_linux_pipe_nfree < NGX_LINUX_PIPE_FREE_MAX) {
+        p->next = ngx_linux_pipe_free_list;
+        ngx_linux_pipe_free_list = p;
+        ngx_linux_pipe_nfree++;
+
+        return;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "splice pipe close: %d:%d", p->fd[0], p->fd[1]);
+
+    if (close(p->fd[0]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno, "close() pipe failed");
+    }
+
+    if (close(p->fd[1]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno, "close() pipe failed");
+    }
+
+    ngx_free(p);
+}
+
+
+/*
+ * The socket to pipe part is called with an empty pipe only, so EAGAIN
+ * means that there is no data in the socket rather than a full pipe.
+ */
+
+ssize_t
+ngx_linux_splice_recv(ngx_connection_t *c, ngx_linux_pipe_t *p, size_t size)
+{
+    ssize_t       n;
+    ngx_err_t     err;
+    ngx_event_t  *rev;
+
+    rev = c->read;
+
+    do {
+        n = splice(c->fd, NULL, p->fd[1], NULL, size,
+                   SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "splice recv: fd:%d %z of %uz", c->fd, n, size);
+
+        if (n == 0) {
+            rev->ready = 0;
+            rev->eof = 1;
+            return n;
+
+        } else if (n > 0) {
+
+            if ((size_t) n < size
+                && !(ngx_event_flags & NGX_USE_GREEDY_EVENT))
+            {
+                rev->ready = 0;
+            }
+
+            p->size += n;
+
+            return n;
+        }
+
+        err = ngx_socket_errno;
+
+        if (err == NGX_EAGAIN || err == NGX_EINTR) {
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "splice() not ready");
+            n = NGX_AGAIN;
+
+        } else {
+            n = ngx_connection_error(c, err, "splice() failed");
+            break;
+        }
+
+    } while (err == NGX_EINTR);
+
+    rev->ready = 0;
+
+    if (n == NGX_ERROR) {
+        rev->error = 1;
+    }
+
+    return n;
+}
+
+
+ssize_t
+ngx_linux_splice_send(ngx_connection_t *c, ngx_linux_pipe_t *p)
+{
+    ssize_t       n;
+    ngx_err_t     err;
+    ngx_event_t  *wev;
+
+    wev = c->write;
+
+    for ( ;; ) {
+        n = splice(p->fd[0], NULL, c->fd, NULL, p->size,
+                   SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "splice send: fd:%d %z of %uz", c->fd, n, p->size);
+
+        if (n > 0) {
+            if ((size_t) n < p->size) {
+                wev->ready = 0;
+            }
+
+            p->size -= n;
+            c->sent += n;
+
+            return n;
+        }
+
+        err = ngx_socket_errno;
+
+        if (n == 0) {
+            ngx_log_error(NGX_LOG_ALERT, c->log, err,
+                          "splice() returned zero");
+            wev->ready = 0;
+            return n;
+        }
+
+        if (err == NGX_EAGAIN || err == NGX_EINTR) {
+            wev->ready = 0;
+
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "splice() not ready");
+
+            if (err == NGX_EAGAIN) {
+                return NGX_AGAIN;
+            }
+
+        } else {
+            wev->error = 1;
+            (void) ngx_connection_error(c, err, "splice() failed");
+            return NGX_ERROR;
+        }
+    }
+}
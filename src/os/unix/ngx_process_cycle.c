@@ -76,6 +76,8 @@ static ngx_cache_manager_ctx_t  ngx_cache_loader_ctx = {
     ngx_cache_loader_process_handler, "cache loader process", 60000
 };
 
+static ngx_msec_t  ngx_cache_loader_start;
+
 
 static ngx_cycle_t        ngx_exit_cycle;
 static ngx_log_t          ngx_exit_log;
@@ -1373,6 +1375,9 @@ ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data)
     ngx_cache_manager_ctx_t *ctx = data;
 
     void                    *ident[4];
+    ngx_msec_t               delay;
+    ngx_uint_t               i;
+    ngx_path_t             **path;
     ngx_event_t              ev;
 
     /*
@@ -1398,7 +1403,23 @@ ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data)
 
     ngx_setproctitle(ctx->name);
 
-    ngx_add_timer(&ev, ctx->delay);
+    delay = ctx->delay;
+
+    if (ctx == &ngx_cache_loader_ctx) {
+
+        /* each path is loaded after its own delay, e.g. at once from an index */
+
+        ngx_cache_loader_start = ngx_current_msec;
+
+        path = cycle->paths.elts;
+        for (i = 0; i < cycle->paths.nelts; i++) {
+            if (path[i]->loader && path[i]->loader_delay < delay) {
+                delay = path[i]->loader_delay;
+            }
+        }
+    }
+
+    ngx_add_timer(&ev, delay);
 
     for ( ;; ) {
 
@@ -1450,24 +1471,42 @@ ngx_cache_manager_process_handler(ngx_event_t *ev)
 static void
 ngx_cache_loader_process_handler(ngx_event_t *ev)
 {
+    ngx_msec_t     elapsed, delay;
     ngx_uint_t     i;
     ngx_path_t   **path;
     ngx_cycle_t   *cycle;
 
     cycle = (ngx_cycle_t *) ngx_cycle;
 
+    delay = NGX_TIMER_INFINITE;
+
     path = cycle->paths.elts;
     for (i = 0; i < cycle->paths.nelts; i++) {
 
         if (ngx_terminate || ngx_quit) {
-            break;
+            exit(0);
         }
 
-        if (path[i]->loader) {
-            path[i]->loader(path[i]->data);
-            ngx_time_update();
+        if (path[i]->loader == NULL) {
+            continue;
+        }
+
+        elapsed = ngx_current_msec - ngx_cache_loader_start;
+
+        if (path[i]->loader_delay > elapsed) {
+            delay = ngx_min(delay, path[i]->loader_delay - elapsed);
+            continue;
         }
+
+        path[i]->loader(path[i]->data);
+        path[i]->loader = NULL;
+
+        ngx_time_update();
     }
 
-    exit(0);
+    if (delay == NGX_TIMER_INFINITE) {
+        exit(0);
+    }
+
+    ngx_add_timer(ev, delay);
 }
@@ -0,0 +1,106 @@
+#!/usr/bin/perl
+
+# Tests for cache status module.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy cache/)->plan(10)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    proxy_cache_path   %%TESTDIR%%/cache  levels=1:2
+                       keys_zone=NAME:1m shards=2 memory=1m;
+
+    proxy_cache_path   %%TESTDIR%%/cache2  keys_zone=OTHER:1m max_size=1m;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   NAME;
+
+            proxy_cache_valid   200 1m;
+        }
+
+        location /nocache {
+            proxy_pass    http://127.0.0.1:8081/t.html;
+            proxy_cache   NAME;
+
+            proxy_cache_bypass  1;
+            proxy_no_cache      1;
+        }
+
+        location /status {
+            cache_status;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+    }
+}
+
+EOF
+
+$t->write_file('t.html', 'SEE-THIS');
+
+$t->run();
+
+###############################################################################
+
+http_get('/t.html');
+http_get('/t.html');
+http_get('/nocache');
+
+my $s = http_get('/status');
+
+like($s, qr!Content-Type: application/json!, 'content type');
+like($s, qr/"NAME": \{.*"OTHER": \{/s, 'zones');
+
+like($s, qr/"MISS": \{"requests": 1, "bytes": 8\}/, 'miss');
+like($s, qr/"HIT": \{"requests": 1, "bytes": 8\}/, 'hit');
+like($s, qr/"BYPASS": \{"requests": 1, "bytes": 8\}/, 'bypass');
+like($s, qr/"lookups": \{"hits": 1, "misses": 1\}/, 'lookups');
+like($s, qr/"read_usec": \{("\d+": (\d+), )*"inf": \d+\}/, 'read time');
+is(read_count($s), 1, 'read time count');
+like($s, qr/"shards": \[\{"locks": \d+.*?\}, \{"locks"/, 'shards');
+like($s, qr/"memory": \{"size": \d+, "hits": 0/, 'memory');
+
+###############################################################################
+
+sub read_count {
+	my ($s) = @_;
+	my ($h) = $s =~ /"NAME": .*?"read_usec": \{(.*?)\}/s;
+	my $n = 0;
+	$n += $_ for $h =~ /: (\d+)/g;
+	return $n;
+}
+
+###############################################################################
@@ -0,0 +1,407 @@
+#!/usr/bin/perl
+
+# Tests for fastcgi requests multiplexed over shared connections.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+use IO::Select;
+use IO::Socket::INET;
+use Socket qw/ CRLF SOL_SOCKET SO_RCVBUF /;
+use Time::HiRes qw/ time /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http fastcgi/)->plan(19)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    upstream multiplex {
+        server 127.0.0.1:8081;
+        fastcgi_multiplex 1 requests=4;
+    }
+
+    upstream serial {
+        server 127.0.0.1:8082;
+        fastcgi_multiplex 1;
+    }
+
+    upstream unknown {
+        server 127.0.0.1:8083;
+        fastcgi_multiplex 1;
+    }
+
+    upstream down {
+        server 127.0.0.1:8084;
+        fastcgi_multiplex 1;
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        fastcgi_param  REQUEST_URI  $request_uri;
+
+        location / {
+            fastcgi_pass  multiplex;
+        }
+
+        location /nb {
+            fastcgi_pass  multiplex;
+            fastcgi_request_buffering  off;
+        }
+
+        location /serial {
+            fastcgi_pass  serial;
+        }
+
+        location /unknown {
+            fastcgi_pass  unknown;
+        }
+
+        location /down {
+            fastcgi_pass  down;
+        }
+    }
+
+    # slow clients
+
+    server {
+        listen       127.0.0.1:8085 sndbuf=8k;
+        server_name  localhost;
+
+        fastcgi_param  REQUEST_URI  $request_uri;
+
+        location / {
+            fastcgi_pass                multiplex;
+            fastcgi_buffers             4 4k;
+            fastcgi_max_temp_file_size  0;
+        }
+    }
+}
+
+EOF
+
+$t->run_daemon(\&fastcgi_daemon, 8081, 'multiplex', $t->testdir());
+$t->run_daemon(\&fastcgi_daemon, 8082, 'serial', $t->testdir());
+$t->run_daemon(\&fastcgi_daemon, 8083, 'unknown', $t->testdir());
+$t->run();
+
+$t->waitforsocket("127.0.0.1:$_") or die "Can't start fastcgi daemon"
+	for 8081 .. 8083;
+
+###############################################################################
+
+like(http_get('/first'), qr/id=1 uri=\/first body=$/, 'request');
+
+# the responses are held by the application until all the requests
+# are received, and are then sent in the reverse order
+
+my @r = http_concurrent('/t1', '/t2', '/t3');
+
+like($r[0], qr/id=\d uri=\/t1 body=$/, 'concurrent 1');
+like($r[1], qr/id=\d uri=\/t2 body=$/, 'concurrent 2');
+like($r[2], qr/id=\d uri=\/t3 body=$/, 'concurrent 3');
+
+like(http_post('/body', 'foobar'), qr/uri=\/body body=foobar$/, 'body');
+like(http_post('/large', 'x' x 300000), qr/uri=\/large body=(x{30000}){10}$/,
+	'large body');
+like(http_post('/nb', 'x' x 300000), qr/uri=\/nb body=(x{30000}){10}$/,
+	'large body unbuffered');
+
+# the request is aborted once the client closes the connection
+
+http_get('/hold', aborted => 1, sleep => 0.3);
+select undef, undef, undef, 0.5;
+
+like(http_get('/after'), qr/uri=\/after body=$/, 'after abort');
+
+# a request which does not read its response does not hold up the others
+
+my $s = IO::Socket::INET->new(
+	Proto => 'tcp',
+	PeerAddr => '127.0.0.1:8085'
+)
+	or die "Can't connect to nginx: $!\n";
+
+setsockopt($s, SOL_SOCKET, SO_RCVBUF, 4096);
+$s->syswrite('GET /huge HTTP/1.0' . CRLF . 'Host: localhost' . CRLF . CRLF);
+
+select undef, undef, undef, 1;
+
+like(http_get('/stalled'), qr/uri=\/stalled body=$/, 'not stalled');
+
+close $s;
+
+like(http_get('/serial/1'), qr/id=1 uri=\/serial\/1 body=$/, 'serial');
+like(http_get('/serial/2'), qr/id=1 uri=\/serial\/2 body=$/, 'serial again');
+
+like(http_get('/unknown'), qr/id=1 uri=\/unknown body=$/, 'unknown type');
+
+like(http_get('/down'), qr/502 Bad Gateway/, 'connect error');
+
+$t->stop();
+
+like(read_file($t, 'error.log'), qr/too large response/, 'stalled aborted');
+
+my $log = read_file($t, '8081.log');
+
+is(join(' ', $log =~ /^begin \d+ keep \d+ conn (\d+)$/mg),
+	'1 1 1 1 1 1 1 1 1 1 1', 'single connection');
+like($log, qr/^begin 3 /m, 'multiplexed');
+like($log, qr/^abort \d+$/m, 'abort');
+
+$log = read_file($t, '8082.log');
+
+is(join(' ', $log =~ /^begin \d+ keep (\d+) conn (\d+)$/mg), '1 1 1 1',
+	'serial keepalive');
+
+$log = read_file($t, '8083.log');
+
+like($log, qr/^begin 1 keep 1 conn 1$/m, 'unknown type keepalive');
+
+###############################################################################
+
+sub http_post {
+	my ($uri, $body) = @_;
+
+	return http('POST ' . $uri . ' HTTP/1.0' . CRLF
+		. 'Host: localhost' . CRLF
+		. 'Content-Length: ' . length($body) . CRLF . CRLF
+		. $body);
+}
+
+sub http_concurrent {
+	my (@uris) = @_;
+
+	my @s = map {
+		IO::Socket::INET->new(
+			Proto => 'tcp',
+			PeerAddr => '127.0.0.1:8080'
+		)
+			or die "Can't connect to nginx: $!\n";
+	} @uris;
+
+	for my $i (0 .. $#uris) {
+		$s[$i]->syswrite("GET $uris[$i] HTTP/1.0" . CRLF
+			. 'Host: localhost' . CRLF . CRLF);
+	}
+
+	return map { local $/; my $s = $_; <$s> } @s;
+}
+
+sub read_file {
+	my ($t, $name) = @_;
+
+	open my $fh, '<', $t->testdir() . '/' . $name
+		or die "Can't open $name: $!";
+	local $/;
+	return <$fh>;
+}
+
+###############################################################################
+
+# FastCGI application which answers FCGI_GET_VALUES and, in the multiplex
+# mode, holds the responses until three requests are received.
+
+sub fastcgi_daemon {
+	my ($port, $mode, $dir) = @_;
+
+	my $server = IO::Socket::INET->new(
+		Proto => 'tcp',
+		LocalAddr => "127.0.0.1:$port",
+		Listen => 5,
+		Reuse => 1
+	)
+		or die "Can't create listening socket: $!\n";
+
+	local $SIG{PIPE} = 'IGNORE';
+
+	my $log = "$dir/$port.log";
+	my $batch = $mode eq 'multiplex' ? 3 : 1;
+
+	my $select = IO::Select->new($server);
+	my (%clients, %in, %requests, %conn);
+	my $nconns = 0;
+
+	for ( ;; ) {
+		for my $c ($select->can_read(0.1)) {
+
+			if ($c == $server) {
+				my $client = $server->accept() or next;
+				$select->add($client);
+				$clients{$client} = $client;
+				$in{$client} = '';
+				$requests{$client} = {};
+				next;
+			}
+
+			my $buf;
+
+			if (!$c->sysread($buf, 65536)) {
+				$select->remove($c);
+				delete $clients{$c};
+				close $c;
+				next;
+			}
+
+			$in{$c} .= $buf;
+
+			while (length $in{$c} >= 8) {
+				my ($type, $id, $clen, $plen) = unpack('xCnnC', $in{$c});
+				last if length $in{$c} < 8 + $clen + $plen;
+
+				my $content = substr($in{$c}, 8, $clen);
+				substr($in{$c}, 0, 8 + $clen + $plen, '');
+
+				my $r = $requests{$c};
+
+				if ($type == 9) {
+					$c->syswrite(fastcgi_values($mode));
+
+				} elsif ($type == 1) {
+					$conn{$c} ||= ++$nconns;
+					$r->{$id} = { id => $id, params => '', stdin => '',
+						keep => unpack('x2C', $content) & 1 };
+					log_line($log,
+						"begin $id keep $r->{$id}{keep} conn $conn{$c}");
+
+				} elsif ($type == 2 && $r->{$id}) {
+					log_line($log, "abort $id");
+					$c->syswrite(fastcgi_record(3, $id, pack('NCx3', 0, 0)));
+					delete $r->{$id};
+
+				} elsif ($type == 4 && $r->{$id}) {
+					$r->{$id}{params} .= $content;
+
+				} elsif ($type == 5 && $r->{$id}) {
+					$r->{$id}{stdin} .= $content;
+					$r->{$id}{done} = time() unless length $content;
+				}
+			}
+		}
+
+		for my $c (values %clients) {
+			my $r = $requests{$c};
+
+			my @done = grep {
+				defined $_->{done}
+					&& fastcgi_param($_->{params}, 'REQUEST_URI') ne '/hold'
+			} values %$r;
+
+			next unless @done;
+			next if @done < $batch
+				&& time() - (sort map { $_->{done} } @done)[0] < 0.5;
+
+			@done = sort { $b->{id} <=> $a->{id} } @done;
+
+			my $out = '';
+
+			$out .= fastcgi_record(6, $_->{id},
+				'Content-Type: text/plain' . CRLF . CRLF) for @done;
+
+			for my $req (@done) {
+				my $uri = fastcgi_param($req->{params}, 'REQUEST_URI');
+
+				my $body = "id=$req->{id} uri=$uri body=$req->{stdin}";
+				$body = 'x' x 3000000 if $uri eq '/huge';
+
+				$out .= fastcgi_record(6, $req->{id}, $1)
+					while $body =~ /\G(.{1,32768})/gs;
+
+				$out .= fastcgi_record(6, $req->{id}, '')
+					. fastcgi_record(3, $req->{id}, pack('NCx3', 0, 0));
+
+				delete $r->{$req->{id}};
+			}
+
+			$c->syswrite($out);
+
+			if (grep { !$_->{keep} } @done) {
+				$select->remove($c);
+				delete $clients{$c};
+				close $c;
+			}
+		}
+	}
+}
+
+sub fastcgi_values {
+	my ($mode) = @_;
+
+	return fastcgi_record(11, 0, pack('Cx7', 9)) if $mode eq 'unknown';
+
+	my %values = (FCGI_MPXS_CONNS => $mode eq 'multiplex' ? 1 : 0,
+		FCGI_MAX_REQS => 8);
+
+	return fastcgi_record(10, 0, join('', map {
+		pack('CC', length($_), length($values{$_})) . $_ . $values{$_}
+	} sort keys %values));
+}
+
+sub fastcgi_record {
+	my ($type, $id, $content) = @_;
+
+	my $padding = (8 - length($content) % 8) % 8;
+
+	return pack('CCnnCx', 1, $type, $id, length($content), $padding)
+		. $content . "\0" x $padding;
+}
+
+sub fastcgi_param {
+	my ($params, $name) = @_;
+
+	while (length $params) {
+		my @len;
+
+		for (0 .. 1) {
+			if (unpack('C', $params) < 0x80) {
+				push @len, unpack('C', $params);
+				substr($params, 0, 1, '');
+
+			} else {
+				push @len, unpack('N', $params) & 0x7fffffff;
+				substr($params, 0, 4, '');
+			}
+		}
+
+		my $n = substr($params, 0, $len[0]);
+		my $v = substr($params, $len[0], $len[1]);
+		substr($params, 0, $len[0] + $len[1], '');
+
+		return $v if $n eq $name;
+	}
+
+	return '';
+}
+
+sub log_line {
+	my ($log, $line) = @_;
+
+	open my $fh, '>>', $log or die "Can't open $log: $!";
+	print $fh $line . "\n";
+	close $fh;
+}
+
+###############################################################################
@@ -0,0 +1,250 @@
+#!/usr/bin/perl
+
+# Tests for pipelined requests to memcached.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+use IO::Socket::INET;
+use Socket qw/ CRLF /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+plan(skip_all => 'win32') if $^O eq 'MSWin32';
+
+my $t = Test::Nginx->new()->has(qw/http memcached map/)->plan(17)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    map $uri $memcached_key {
+        default  $uri;
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            memcached_pass      127.0.0.1:8081;
+            memcached_pipeline  1;
+            memcached_gzip_flag 2;
+        }
+
+        location /other/ {
+            memcached_pass      127.0.0.1:8081;
+            memcached_pipeline  1;
+        }
+
+        location /down {
+            memcached_pass      127.0.0.1:8082;
+            memcached_pipeline  1;
+        }
+    }
+}
+
+EOF
+
+$t->run_daemon(\&memcached_fake_daemon, $t->testdir());
+$t->run()->waitforsocket('127.0.0.1:8081')
+	or die "Can't start fake memcached";
+
+###############################################################################
+
+like(http_get('/foo'), qr/200 OK.*Content-Length: 8.*SEE-THIS$/s, 'value');
+like(http_get('/none'), qr/404 Not Found/, 'not found');
+like(http_head('/foo'), qr/200 OK.*Content-Length: 8.*\x0d\x0a\x0d\x0a$/s,
+	'head');
+like(http_get('/gz'), qr/Content-Encoding: gzip/, 'gzip flag');
+like(http_get('/split'), qr/SPLIT-VALUE$/, 'split value');
+like(http_get('/down'), qr/502 Bad Gateway/, 'no memcached');
+
+# the connection is shared with another location, the gzip flag is not
+
+like(http_get('/other/gz'), qr/200 OK.*OTHER-VALUE$/s, 'other location');
+unlike(http_get('/other/gz'), qr/Content-Encoding/, 'other location flag');
+
+# keys requested at once are sent in one command, each key only once
+
+my @uris = qw{ /foo /bar /none /foo /bar /foo };
+my @r = http_concurrent(worker_pid($t), @uris);
+
+is(join(' ', map { /^HTTP\/1.1 (\d+)/ ? $1 : 'none' } @r),
+	'200 200 404 200 200 200', 'concurrent');
+is(scalar(grep { /BAR-VALUE$/ } @r), 2, 'concurrent values');
+
+# a key memcached rejects does not fail the keys of other requests
+
+@r = http_concurrent(worker_pid($t), '/' . 'x' x 300, '/foo');
+
+like($r[0], qr/400 Bad Request/, 'long key');
+like($r[1], qr/SEE-THIS$/, 'long key concurrent');
+
+like(http_get('/error'), qr/502 Bad Gateway/, 'server error');
+like(http_get('/foo'), qr/SEE-THIS$/, 'after server error');
+
+$t->stop();
+
+my $commands = read_file($t, 'commands');
+
+like($commands, qr!^/foo /bar /none$!m, 'batched');
+is(scalar(grep { my %k; grep { $k{$_}++ } split / /; }
+	split /\n/, $commands), 0, 'coalesced');
+
+is(read_file($t, 'connections'), 1, 'persistent');
+
+###############################################################################
+
+sub http_concurrent {
+	my ($worker, @uris) = @_;
+
+	my @s = map {
+		IO::Socket::INET->new(
+			Proto => 'tcp',
+			PeerAddr => '127.0.0.1:8080'
+		)
+			or die "Can't connect to nginx: $!\n";
+	} @uris;
+
+	# the worker process is stopped while the requests are sent,
+	# so it reads all of them in one event loop iteration
+
+	select undef, undef, undef, 0.2;
+
+	kill 'STOP', $worker;
+
+	for my $i (0 .. $#uris) {
+		$s[$i]->syswrite("GET $uris[$i] HTTP/1.0" . CRLF
+			. 'Host: localhost' . CRLF . CRLF);
+	}
+
+	select undef, undef, undef, 0.1;
+
+	kill 'CONT', $worker;
+
+	return map { local $/; my $s = $_; <$s> } @s;
+}
+
+sub worker_pid {
+	my ($t) = @_;
+
+	my ($pid) = read_file($t, 'error.log')
+		=~ /start worker process (\d+)/;
+
+	return $pid;
+}
+
+sub read_file {
+	my ($t, $name) = @_;
+
+	open my $fh, '<', $t->testdir() . '/' . $name
+		or die "Can't open $name: $!";
+	local $/;
+	return <$fh>;
+}
+
+###############################################################################
+
+sub memcached_fake_daemon {
+	my ($dir) = @_;
+
+	my %values = (
+		'/foo' => [ 0, 'SEE-THIS' ],
+		'/bar' => [ 0, 'BAR-VALUE' ],
+		'/gz' => [ 2, 'GZIPPED' ],
+		'/split' => [ 0, 'SPLIT-VALUE' ],
+		'/other/gz' => [ 2, 'OTHER-VALUE' ],
+	);
+
+	my $server = IO::Socket::INET->new(
+		Proto => 'tcp',
+		LocalAddr => '127.0.0.1:8081',
+		Listen => 5,
+		Reuse => 1
+	)
+		or die "Can't create listening socket: $!\n";
+
+	local $SIG{PIPE} = 'IGNORE';
+
+	my $connections = 0;
+
+	while (my $client = $server->accept()) {
+		$client->autoflush(1);
+
+		my $commands = 0;
+
+		while (<$client>) {
+			s/\x0d?\x0a$//;
+			next unless s/^get //;
+
+			if ($commands++ == 0) {
+				$connections++;
+				write_daemon_file("$dir/connections", $connections, '>');
+			}
+
+			write_daemon_file("$dir/commands", "$_\n", '>>');
+
+			# responses are slow to let more requests queue up
+
+			select undef, undef, undef, 0.1;
+
+			if (grep { $_ eq '/error' } split / /) {
+				print $client 'SERVER_ERROR out of memory' . CRLF;
+				next;
+			}
+
+			for my $key (split / /) {
+				next unless $values{$key};
+
+				my ($flags, $value) = @{$values{$key}};
+
+				print $client "VALUE $key $flags " . length($value)
+					. CRLF;
+
+				if ($key eq '/split') {
+					print $client substr($value, 0, 5);
+					select undef, undef, undef, 0.1;
+					print $client substr($value, 5) . "\x0d";
+					select undef, undef, undef, 0.1;
+					print $client "\x0a";
+					next;
+				}
+
+				print $client $value . CRLF;
+			}
+
+			print $client 'END' . CRLF;
+		}
+
+		close $client;
+	}
+}
+
+sub write_daemon_file {
+	my ($name, $data, $mode) = @_;
+
+	open my $fh, $mode, $name or die "Can't open $name: $!";
+	print $fh $data;
+	close $fh;
+}
+
+###############################################################################
@@ -0,0 +1,168 @@
+#!/usr/bin/perl
+
+# Tests for http proxy with adaptive buffers.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+use IO::Socket::INET;
+use Socket qw/ CRLF SOL_SOCKET SO_RCVBUF /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy gzip/)->plan(10)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        proxy_buffers           4 8k;
+        proxy_adaptive_buffers  on;
+
+        location / {
+            proxy_pass  http://127.0.0.1:8081;
+        }
+
+        location /chunked/ {
+            proxy_pass          http://127.0.0.1:8081/;
+            proxy_http_version  1.1;
+            proxy_set_header    Accept-Encoding  gzip;
+        }
+
+        location /odd/ {
+            proxy_pass     http://127.0.0.1:8081/;
+            proxy_buffers  3 12k;
+        }
+
+        location /fixed/ {
+            proxy_pass              http://127.0.0.1:8081/;
+            proxy_adaptive_buffers  off;
+        }
+    }
+
+    # slow clients
+
+    server {
+        listen       127.0.0.1:8082 sndbuf=8k;
+        server_name  localhost;
+
+        proxy_buffers           4 8k;
+        proxy_adaptive_buffers  on;
+
+        location / {
+            proxy_pass  http://127.0.0.1:8081;
+        }
+
+        location /nofile/ {
+            proxy_pass                http://127.0.0.1:8081/;
+            proxy_max_temp_file_size  0;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        gzip             on;
+        gzip_min_length  0;
+        gzip_types       text/plain;
+
+        default_type  text/plain;
+    }
+}
+
+EOF
+
+my $small = 'small';
+my $large = join('', map { sprintf("%08d\n", $_) } 1 .. 100000);
+
+$t->write_file('small', $small);
+$t->write_file('large', $large);
+$t->run();
+
+###############################################################################
+
+is(http_content(http_get('/small')), $small, 'small');
+is(http_content(http_get('/large')), $large, 'large');
+
+# the bufs freed by the previous requests are reused
+
+is(http_content(http_get('/large')), $large, 'large again');
+is(http_content(http_get('/small')), $small, 'small again');
+
+like(http_content(http_get('/chunked/large')), qr/^\x1f\x8b/,
+	'unknown length');
+is(http_content(http_get('/odd/large')), $large, 'odd buffer size');
+is(http_content(http_get('/fixed/large')), $large, 'fixed buffers');
+
+is(http_content(http_get_slow('/large')), $large, 'slow client');
+is(http_content(http_get_slow('/nofile/large')), $large,
+	'slow client without temp file');
+
+$t->stop();
+
+unlike(read_file($t, 'error.log'), qr/\[(alert|crit|emerg)\]/, 'no alerts');
+
+###############################################################################
+
+sub http_content {
+	my ($r) = @_;
+	return $r =~ /\x0d\x0a\x0d\x0a(.*)/s ? $1 : undef;
+}
+
+sub http_get_slow {
+	my ($uri) = @_;
+
+	my $s = IO::Socket::INET->new(
+		Proto => 'tcp',
+		PeerAddr => '127.0.0.1:8082'
+	)
+		or die "Can't connect to nginx: $!\n";
+
+	setsockopt($s, SOL_SOCKET, SO_RCVBUF, 4096);
+
+	$s->syswrite("GET $uri HTTP/1.0" . CRLF . 'Host: localhost' . CRLF . CRLF);
+
+	my $r = '';
+
+	while ($s->sysread(my $buf, 4096)) {
+		$r .= $buf;
+		select undef, undef, undef, 0.002 if length($r) < 200000;
+	}
+
+	return $r;
+}
+
+sub read_file {
+	my ($t, $name) = @_;
+
+	open my $fh, '<', $t->testdir() . '/' . $name
+		or die "Can't open $name: $!";
+	local $/;
+	return <$fh>;
+}
+
+###############################################################################
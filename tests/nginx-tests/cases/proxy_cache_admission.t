@@ -0,0 +1,88 @@
+#!/usr/bin/perl
+
+# Tests for http proxy cache admission and eviction policies.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy cache/)->plan(8)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    proxy_cache_path   %%TESTDIR%%/cache  levels=1:2
+                       keys_zone=NAME:1m max_size=8k
+                       admission=tinylfu eviction=slru;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   NAME;
+
+            proxy_cache_valid   200 1m;
+
+            add_header X-Cache-Status $upstream_cache_status;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+    }
+}
+
+EOF
+
+$t->write_file($_, 'SEE-THIS') for qw/hot.html t1.html scan.html/;
+
+$t->run();
+
+###############################################################################
+
+# the cache is not full, so objects are stored on the first use
+
+like(http_get('/hot.html'), qr/X-Cache-Status: MISS/, 'hot miss');
+like(http_get('/hot.html'), qr/X-Cache-Status: HIT/, 'hot hit');
+like(http_get('/hot.html'), qr/X-Cache-Status: HIT/, 'hot hit again');
+
+like(http_get('/t1.html'), qr/X-Cache-Status: MISS/, 't1 miss');
+
+# with the cache full, a new object is stored only when it is used
+# more often than the entry it would displace
+
+like(http_get('/scan.html'), qr/X-Cache-Status: MISS/, 'scan miss');
+
+$t->write_file('scan.html', 'NEW');
+
+like(http_get('/scan.html'), qr/X-Cache-Status: MISS.*NEW/s,
+	'scan not admitted');
+like(http_get('/scan.html'), qr/X-Cache-Status: HIT.*NEW/s, 'scan admitted');
+
+like(http_get('/hot.html'), qr/X-Cache-Status: HIT/, 'hot kept');
+
+###############################################################################
@@ -0,0 +1,243 @@
+#!/usr/bin/perl
+
+# Tests for http proxy cache request collapsing.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+use Socket qw/ CRLF /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+plan(skip_all => 'win32') if $^O eq 'MSWin32';
+
+my $t = Test::Nginx->new()->has(qw/http proxy cache/)->plan(13)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    proxy_cache_path   %%TESTDIR%%/cache  levels=1:2
+                       keys_zone=NAME:10m;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   NAME;
+
+            proxy_cache_collapse cacheable;
+
+            add_header X-Cache-Status $upstream_cache_status;
+        }
+
+        location /all/ {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   NAME;
+
+            proxy_cache_collapse all;
+
+            add_header X-Cache-Status $upstream_cache_status;
+        }
+
+        location /all/large/ {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   NAME;
+
+            proxy_cache_collapse all;
+
+            proxy_buffer_size         1k;
+            proxy_buffers             4 1k;
+            proxy_max_temp_file_size  4k;
+        }
+    }
+}
+
+EOF
+
+$t->run_daemon(\&http_fake_daemon);
+$t->run()->waitforsocket('127.0.0.1:8081');
+
+###############################################################################
+
+# waiting requests receive the response while it is being cached
+
+my @sockets;
+
+for my $i (1 .. 3) {
+	$sockets[$i] = http_start('/t');
+}
+
+like(http_end($sockets[1]), qr/MISS.*request 1.*end/s, 'leader');
+
+for my $i (2 .. 3) {
+	like(http_end($sockets[$i]), qr/COLLAPSED.*request 1.*end/s,
+		'follower ' . $i);
+}
+
+like(http_get('/t'), qr/HIT.*request 1/s, 'cached');
+
+# uncacheable responses are not shared by default
+
+for my $i (1 .. 2) {
+	$sockets[$i] = http_start('/nostore');
+}
+
+like(http_end($sockets[1]), qr/request 1.*end/s, 'nostore');
+like(http_end($sockets[2]), qr/request 2.*end/s, 'nostore not shared');
+
+# ...but are shared with "all"
+
+for my $i (1 .. 3) {
+	$sockets[$i] = http_start('/all/nostore');
+}
+
+like(http_end($sockets[1]), qr/MISS.*request 1.*end/s, 'all leader');
+
+for my $i (2 .. 3) {
+	like(http_end($sockets[$i]), qr/COLLAPSED.*request 1.*end/s,
+		'all follower ' . $i);
+}
+
+like(http_get('/all/nostore'), qr/MISS.*request 2/s, 'all not cached');
+
+# the temporary file of a shared response is limited by its maximum size
+
+for my $i (1 .. 2) {
+	$sockets[$i] = http_start('/all/large/nostore');
+}
+
+like(http_end($sockets[1]), qr/request 1\x0a(x{99}\x0a){100}end/s,
+	'all large leader');
+http_end($sockets[2]);
+
+# an incomplete response is not passed to waiting requests as complete
+
+for my $i (1 .. 2) {
+	$sockets[$i] = http_start('/all/short');
+}
+
+unlike(http_end($sockets[1]), qr/end/, 'short leader');
+unlike(http_end($sockets[2]) || '', qr/end/, 'short follower');
+
+###############################################################################
+
+sub http_start {
+	my ($uri) = @_;
+
+	my $s;
+	my $request = "GET $uri HTTP/1.0" . CRLF . CRLF;
+
+	eval {
+		local $SIG{ALRM} = sub { die "timeout\n" };
+		local $SIG{PIPE} = sub { die "sigpipe\n" };
+		alarm(3);
+		$s = IO::Socket::INET->new(
+			Proto => 'tcp',
+			PeerAddr => '127.0.0.1:8080'
+		);
+		log_out($request);
+		$s->print($request);
+		alarm(0);
+	};
+	alarm(0);
+	if ($@) {
+		log_in("died: $@");
+		return undef;
+	}
+	return $s;
+}
+
+sub http_end {
+	my ($s) = @_;
+	my $reply;
+
+	eval {
+		local $SIG{ALRM} = sub { die "timeout\n" };
+		local $SIG{PIPE} = sub { die "sigpipe\n" };
+		alarm(3);
+		local $/;
+		$reply = $s->getline();
+		log_in($reply);
+		alarm(0);
+	};
+	alarm(0);
+	if ($@) {
+		log_in("died: $@");
+		return undef;
+	}
+	return $reply;
+}
+
+###############################################################################
+
+sub http_fake_daemon {
+	my $server = IO::Socket::INET->new(
+		Proto => 'tcp',
+		LocalAddr => '127.0.0.1:8081',
+		Listen => 5,
+		Reuse => 1
+	)
+		or die "Can't create listening socket: $!\n";
+
+	my %num;
+
+	while (my $client = $server->accept()) {
+		$client->autoflush(1);
+
+		my $uri = '';
+
+		while (<$client>) {
+			$uri = $1 if /GET (.*) HTTP/;
+			last if /^\x0d?\x0a?$/;
+		}
+
+		next unless $uri;
+
+		my $num = ++$num{$uri};
+		my $cc = $uri =~ /nostore/ ? 'no-store' : 'max-age=300';
+		my $len = $uri =~ /short/ ? 'Content-Length: 100' . CRLF : '';
+
+		# the header is sent once all the requests wait for the cache lock
+
+		select(undef, undef, undef, 0.2) if $uri =~ /nostore/;
+
+		print $client <<"EOF";
+HTTP/1.1 200 OK
+Cache-Control: $cc
+${len}Connection: close
+
+request $num
+EOF
+
+		select(undef, undef, undef, 0.5);
+
+		next if $uri =~ /short/;
+
+		print $client ('x' x 99 . "\n") x 100 if $uri =~ /large/;
+
+		print $client 'end' . CRLF;
+	}
+}
+
+###############################################################################
@@ -0,0 +1,137 @@
+#!/usr/bin/perl
+
+# Tests for http proxy cache index snapshot.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy cache/)->plan(10)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    proxy_cache_path   %%TESTDIR%%/cache  levels=1:2
+                       keys_zone=NAME:10m shards=2
+                       index=%%TESTDIR%%/cache.index index_interval=1s;
+
+    proxy_cache_path   %%TESTDIR%%/cache2  levels=1:2
+                       keys_zone=NAME2:1m;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   NAME;
+
+            proxy_cache_valid   200 1m;
+
+            add_header X-Cache-Status $upstream_cache_status;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+    }
+}
+
+EOF
+
+$t->write_file("t$_.html", "SEE-THIS-$_") for 1 .. 3;
+
+$t->run();
+
+###############################################################################
+
+like(http_get('/t1.html'), qr/X-Cache-Status: MISS.*SEE-THIS-1/s, 'miss 1');
+like(http_get('/t2.html'), qr/X-Cache-Status: MISS.*SEE-THIS-2/s, 'miss 2');
+like(http_get('/t3.html'), qr/X-Cache-Status: MISS.*SEE-THIS-3/s, 'miss 3');
+
+sleep 3;
+
+ok(-s $t->testdir() . '/cache.index', 'index written');
+
+$t->stop();
+
+# a cache file removed after the index was written is noticed on open
+
+$t->write_file("t$_.html", "NEW-$_") for 1 .. 3;
+
+unlink cache_file($t, '/t3.html');
+
+$t->run();
+
+select undef, undef, undef, 0.5;
+
+like(read_file($t, 'error.log'), qr/3 entries loaded from/, 'index loaded');
+
+# a path without an index is loaded on its own schedule
+
+unlike(read_file($t, 'error.log'), qr/cache2 /, 'path without index delayed');
+
+like(http_get('/t1.html'), qr/X-Cache-Status: HIT.*SEE-THIS-1/s, 'hit 1');
+like(http_get('/t2.html'), qr/X-Cache-Status: HIT.*SEE-THIS-2/s, 'hit 2');
+like(http_get('/t3.html'), qr/X-Cache-Status: MISS.*NEW-3/s, 'removed file');
+like(http_get('/t3.html'), qr/X-Cache-Status: HIT.*NEW-3/s, 'removed cached');
+
+###############################################################################
+
+sub cache_file {
+	my ($t, $uri) = @_;
+
+	my @dirs = ($t->testdir() . '/cache');
+
+	while (my $dir = shift @dirs) {
+		opendir my $dh, $dir or next;
+
+		for my $e (grep { !/^\./ } readdir $dh) {
+			my $path = "$dir/$e";
+
+			if (-d $path) {
+				push @dirs, $path;
+				next;
+			}
+
+			return $path if read_file($t, $path, 1) =~ /KEY: .*\Q$uri\E/;
+		}
+
+		closedir $dh;
+	}
+
+	return '';
+}
+
+sub read_file {
+	my ($t, $name, $abs) = @_;
+
+	open my $fh, '<', $abs ? $name : $t->testdir() . '/' . $name
+		or die "Can't open $name: $!";
+	local $/;
+	return <$fh>;
+}
+
+###############################################################################
@@ -0,0 +1,158 @@
+#!/usr/bin/perl
+
+# Tests for http proxy cache memory tier.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy cache/)->plan(13)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    proxy_cache_path   %%TESTDIR%%/cache  levels=1:2
+                       keys_zone=NAME:10m memory=1m
+                       memory_max_object=4k memory_min_uses=2;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   NAME;
+
+            proxy_cache_valid   200 1m;
+
+            add_header X-Cache-Status $upstream_cache_status;
+        }
+
+        location /short/ {
+            proxy_pass    http://127.0.0.1:8081/;
+            proxy_cache   NAME;
+
+            proxy_cache_valid   200 1s;
+
+            add_header X-Cache-Status $upstream_cache_status;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+    }
+}
+
+EOF
+
+$t->write_file('t.html', 'SEE-THIS');
+$t->write_file('once.html', 'SEE-THIS');
+$t->write_file('big.html', 'X' x 8192);
+$t->write_file('short.html', 'SEE-THIS');
+
+$t->run();
+
+###############################################################################
+
+# the second use reads the whole file and stores it in memory
+
+like(http_get('/t.html'), qr/X-Cache-Status: MISS.*SEE-THIS/s, 'miss');
+like(http_get('/t.html'), qr/X-Cache-Status: HIT.*SEE-THIS/s, 'disk hit');
+
+unlink cache_file($t, '/t.html');
+
+like(http_get('/t.html'), qr/X-Cache-Status: HIT.*SEE-THIS$/s, 'memory hit');
+like(http_get('/t.html'), qr/Content-Length: 8\x0d/, 'memory hit length');
+
+# objects used less than memory_min_uses times are not stored
+
+like(http_get('/once.html'), qr/X-Cache-Status: MISS/, 'once miss');
+
+unlink cache_file($t, '/once.html');
+$t->write_file('once.html', 'NEW');
+
+like(http_get('/once.html'), qr/X-Cache-Status: MISS.*NEW/s, 'once not stored');
+
+# objects larger than memory_max_object are not stored
+
+like(http_get('/big.html'), qr/X-Cache-Status: MISS/, 'big miss');
+like(http_get('/big.html'), qr/X-Cache-Status: HIT.*X{8192}$/s, 'big disk hit');
+
+unlink cache_file($t, '/big.html');
+$t->write_file('big.html', 'NEW');
+
+like(http_get('/big.html'), qr/X-Cache-Status: MISS.*NEW/s, 'big not stored');
+
+# an updated cache file replaces the stored object
+
+like(http_get('/short/short.html'), qr/X-Cache-Status: MISS/, 'short miss');
+like(http_get('/short/short.html'), qr/X-Cache-Status: HIT.*SEE-THIS/s,
+	'short hit');
+
+$t->write_file('short.html', 'NEW');
+
+sleep 2;
+
+like(http_get('/short/short.html'), qr/X-Cache-Status: EXPIRED.*NEW/s,
+	'short expired');
+like(http_get('/short/short.html'), qr/X-Cache-Status: HIT.*NEW/s,
+	'short updated');
+
+###############################################################################
+
+sub cache_file {
+	my ($t, $uri) = @_;
+
+	my @dirs = ($t->testdir() . '/cache');
+
+	while (my $dir = shift @dirs) {
+		opendir my $dh, $dir or next;
+
+		for my $e (grep { !/^\./ } readdir $dh) {
+			my $path = "$dir/$e";
+
+			if (-d $path) {
+				push @dirs, $path;
+				next;
+			}
+
+			return $path if read_file($path) =~ /KEY: .*\Q$uri\E/;
+		}
+
+		closedir $dh;
+	}
+
+	return '';
+}
+
+sub read_file {
+	my ($name) = @_;
+
+	open my $fh, '<', $name or die "Can't open $name: $!";
+	local $/;
+	return <$fh>;
+}
+
+###############################################################################
@@ -0,0 +1,202 @@
+#!/usr/bin/perl
+
+# Tests for http proxy cache purge by key, key prefix and tags.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy cache map/)->plan(21)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    proxy_cache_path   %%TESTDIR%%/cache  levels=1:2
+                       keys_zone=NAME:10m purge=on
+                       index=%%TESTDIR%%/cache.index index_interval=1s;
+
+    map $request_method $purge {
+        PURGE    1;
+        default  0;
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   NAME;
+
+            proxy_cache_key     $uri;
+            proxy_cache_valid   200 1m;
+
+            proxy_cache_purge   $purge;
+            proxy_cache_tag     $upstream_http_x_tag;
+
+            add_header X-Cache-Status $upstream_cache_status;
+        }
+
+        location /purge-tag {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   NAME;
+
+            proxy_cache_key     $uri;
+            proxy_cache_purge   1;
+            proxy_cache_tag     $http_x_purge_tag;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location /a/ {
+            add_header X-Tag "red, blue";
+        }
+
+        location /b/ {
+            add_header X-Tag "blue";
+        }
+    }
+}
+
+EOF
+
+mkdir($t->testdir() . '/' . $_) for qw/a b/;
+
+$t->write_file($_, 'SEE-THIS') for qw!a/1.html a/2.html b/1.html!;
+
+$t->run();
+
+###############################################################################
+
+http_get($_) for qw!/a/1.html /a/2.html /b/1.html!;
+
+like(http_get('/a/1.html'), qr/X-Cache-Status: HIT/, 'cached');
+
+$t->write_file($_, 'NEW') for qw!a/1.html a/2.html b/1.html!;
+
+# exact key
+
+like(purge('/a/1.html'), qr/^HTTP\/1.1 204 /, 'purge key');
+like(purge('/a/1.html'), qr/^HTTP\/1.1 404 /, 'purge key again');
+like(purge('/a/3.html'), qr/^HTTP\/1.1 404 /, 'purge unknown key');
+
+like(http_get('/a/1.html'), qr/X-Cache-Status: MISS.*NEW/s, 'key purged');
+like(http_get('/a/2.html'), qr/X-Cache-Status: HIT.*SEE-THIS/s,
+	'other key kept');
+
+# key prefix
+
+like(purge('/a/*'), qr/^HTTP\/1.1 204 /, 'purge prefix');
+
+like(http_get('/a/1.html'), qr/X-Cache-Status: MISS.*NEW/s, 'prefix purged');
+like(http_get('/a/2.html'), qr/X-Cache-Status: MISS.*NEW/s, 'prefix purged 2');
+like(http_get('/b/1.html'), qr/X-Cache-Status: HIT.*SEE-THIS/s,
+	'prefix other kept');
+
+like(purge('/c/*'), qr/^HTTP\/1.1 404 /, 'purge unknown prefix');
+
+# tags
+
+like(purge_tag('red'), qr/^HTTP\/1.1 204 /, 'purge tag');
+
+like(http_get('/a/1.html'), qr/X-Cache-Status: MISS/, 'tag purged');
+like(http_get('/b/1.html'), qr/X-Cache-Status: HIT/, 'tag other kept');
+
+like(purge_tag('blue'), qr/^HTTP\/1.1 204 /, 'purge shared tag');
+like(http_get('/b/1.html'), qr/X-Cache-Status: MISS.*NEW/s, 'shared tag purged');
+
+# purged files are removed by the cache manager, which wakes up
+# at most every 10 seconds
+
+purge('/b/1.html');
+
+sleep 11;
+
+is(cached_files($t), 0, 'purged files removed');
+
+# entries restored on startup are purged by any prefix or tag purge,
+# as their keys and tags are not known until they are used
+
+http_get($_) for qw!/a/1.html /b/1.html!;
+
+sleep 2;
+
+$t->stop();
+$t->run();
+
+select undef, undef, undef, 0.5;
+
+like(purge_tag('green'), qr/^HTTP\/1.1 204 /, 'purge tag after restart');
+like(http_get('/b/1.html'), qr/X-Cache-Status: MISS/, 'restored purged');
+
+http_get('/a/1.html');
+
+like(purge('/c/*'), qr/^HTTP\/1.1 404 /, 'purge prefix after restart');
+like(http_get('/a/1.html'), qr/X-Cache-Status: HIT/, 'indexed kept');
+
+###############################################################################
+
+sub purge {
+	my ($uri) = @_;
+	return http(<<EOF);
+PURGE $uri HTTP/1.0
+Host: localhost
+
+EOF
+}
+
+sub purge_tag {
+	my ($tag) = @_;
+	return http(<<EOF);
+PURGE /purge-tag HTTP/1.0
+Host: localhost
+X-Purge-Tag: $tag
+
+EOF
+}
+
+sub cached_files {
+	my ($t) = @_;
+	my $n = 0;
+
+	my @dirs = ($t->testdir() . '/cache');
+
+	while (my $dir = shift @dirs) {
+		opendir my $dh, $dir or return $n;
+
+		for my $e (grep { !/^\./ } readdir $dh) {
+			my $path = "$dir/$e";
+			if (-d $path) { push @dirs, $path; } else { $n++; }
+		}
+
+		closedir $dh;
+	}
+
+	return $n;
+}
+
+###############################################################################
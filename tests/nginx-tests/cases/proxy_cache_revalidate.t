@@ -0,0 +1,135 @@
+#!/usr/bin/perl
+
+# Tests for http proxy cache revalidation and background update.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy cache/)->plan(12)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    proxy_cache_path   %%TESTDIR%%/cache  levels=1:2
+                       keys_zone=NAME:10m;
+
+    log_format status  '$uri $status $http_if_none_match';
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   NAME;
+
+            proxy_cache_valid   200 1s;
+            proxy_cache_revalidate on;
+
+            add_header X-Cache-Status $upstream_cache_status;
+        }
+
+        location /bg/ {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   NAME;
+
+            proxy_cache_valid   200 1s;
+            proxy_cache_use_stale updating;
+            proxy_cache_background_update on;
+
+            add_header X-Cache-Status $upstream_cache_status;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        access_log   %%TESTDIR%%/backend.log status;
+    }
+}
+
+EOF
+
+$t->write_file('t.html', 'SEE-THIS');
+mkdir($t->testdir() . '/bg');
+$t->write_file('bg/t.html', 'OLD');
+
+$t->run();
+
+###############################################################################
+
+like(http_get('/t.html'), qr/X-Cache-Status: MISS.*SEE-THIS/s, 'miss');
+like(http_get('/t.html'), qr/X-Cache-Status: HIT.*SEE-THIS/s, 'hit');
+
+sleep 2;
+
+like(http_get('/t.html'), qr/X-Cache-Status: REVALIDATED.*SEE-THIS/s,
+	'revalidated');
+like(http_get('/t.html'), qr/X-Cache-Status: HIT.*SEE-THIS/s,
+	'revalidated header updated');
+
+$t->write_file('t.html', 'NEW');
+utime(time() + 10, time() + 10, $t->testdir() . '/t.html');
+
+like(http_get('/t.html'), qr/X-Cache-Status: HIT.*SEE-THIS/s, 'changed hit');
+
+sleep 2;
+
+like(http_get('/t.html'), qr/X-Cache-Status: EXPIRED.*NEW/s, 'changed');
+
+my $log = read_file($t, 'backend.log');
+like($log, qr!^/t.html 304 \S*[0-9a-f]+-[0-9a-f]+\S*$!m, 'conditional request');
+is(() = $log =~ m!^/t.html 200 !mg, 2, 'full responses');
+
+# background update: stale response first, updated response later
+
+like(http_get('/bg/t.html'), qr/X-Cache-Status: MISS.*OLD/s, 'bg miss');
+
+sleep 2;
+
+$t->write_file('bg/t.html', 'NEW');
+
+like(http_get('/bg/t.html'), qr/X-Cache-Status: STALE.*OLD/s, 'bg stale');
+
+select undef, undef, undef, 0.2;
+
+like(http_get('/bg/t.html'), qr/X-Cache-Status: HIT.*NEW/s, 'bg updated');
+
+like(read_file($t, 'backend.log'), qr!^/bg/t.html 200 -\n/bg/t.html 200 -$!m,
+	'bg requests');
+
+###############################################################################
+
+sub read_file {
+	my ($t, $name) = @_;
+
+	open my $fh, '<', $t->testdir() . '/' . $name
+		or die "Can't open $name: $!";
+	local $/;
+	return <$fh>;
+}
+
+###############################################################################
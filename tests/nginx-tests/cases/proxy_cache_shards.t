@@ -0,0 +1,121 @@
+#!/usr/bin/perl
+
+# Tests for http proxy cache with a sharded keys zone.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy cache/)->plan(8)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    proxy_cache_path   %%TESTDIR%%/cache  levels=1:2
+                       keys_zone=NAME:10m inactive=3s shards=4
+                       manager_files=2 manager_sleep=10ms;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   NAME;
+
+            proxy_cache_valid   200 1m;
+
+            add_header X-Cache-Status $upstream_cache_status;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+    }
+}
+
+EOF
+
+$t->write_file("t$_.html", "SEE-THIS-$_") for 1 .. 8;
+
+$t->run();
+
+###############################################################################
+
+my ($miss, $hit) = (0, 0);
+
+for my $n (1 .. 8) {
+	$miss++ if http_get("/t$n.html") =~ /X-Cache-Status: MISS.*SEE-THIS-$n/s;
+}
+
+for my $n (1 .. 8) {
+	$hit++ if http_get("/t$n.html") =~ /X-Cache-Status: HIT.*SEE-THIS-$n/s;
+}
+
+is($miss, 8, 'misses');
+is($hit, 8, 'hits');
+
+is(cached_files($t), 8, 'files cached');
+
+$t->write_file('t1.html', 'NEW');
+
+like(http_get('/t1.html'), qr/X-Cache-Status: HIT.*SEE-THIS-1/s,
+	'cached response');
+
+# inactive entries are removed from all shards, the cache manager
+# wakes up at most every 10 seconds
+
+sleep 11;
+
+is(cached_files($t), 0, 'inactive files removed');
+
+like(http_get('/t1.html'), qr/X-Cache-Status: MISS.*NEW/s, 'miss after expire');
+like(http_get('/t1.html'), qr/X-Cache-Status: HIT.*NEW/s, 'hit after expire');
+like(http_get('/t2.html'), qr/X-Cache-Status: MISS.*SEE-THIS-2/s,
+	'other shard miss');
+
+###############################################################################
+
+sub cached_files {
+	my ($t) = @_;
+	my $n = 0;
+
+	my @dirs = ($t->testdir() . '/cache');
+
+	while (my $dir = shift @dirs) {
+		opendir my $dh, $dir or return $n;
+
+		for my $e (grep { !/^\./ } readdir $dh) {
+			my $path = "$dir/$e";
+			if (-d $path) { push @dirs, $path; } else { $n++; }
+		}
+
+		closedir $dh;
+	}
+
+	return $n;
+}
+
+###############################################################################
@@ -0,0 +1,204 @@
+#!/usr/bin/perl
+
+# Tests for http proxy cache temporary files.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+use Socket qw/ CRLF /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+plan(skip_all => 'win32') if $^O eq 'MSWin32';
+
+my $t = Test::Nginx->new()->has(qw/http proxy cache/)->plan(8)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    proxy_cache_path   %%TESTDIR%%/cache  levels=1:2
+                       keys_zone=NAME:10m;
+
+    proxy_cache_path   %%TESTDIR%%/cache2  levels=1:2
+                       keys_zone=TEMP:10m use_temp_path=on;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   NAME;
+
+            add_header X-Cache-Status $upstream_cache_status;
+        }
+
+        location /temp/ {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   TEMP;
+
+            add_header X-Cache-Status $upstream_cache_status;
+        }
+    }
+}
+
+EOF
+
+$t->run_daemon(\&http_fake_daemon);
+$t->run()->waitforsocket('127.0.0.1:8081');
+
+###############################################################################
+
+my $d = $t->testdir();
+
+# by default, responses are received into the cache directory;
+# the response is larger than proxy_buffers to be written to disk
+# before it is complete
+
+my $s = http_start('/t');
+
+select undef, undef, undef, 0.3;
+
+is(count_files("$d/cache/temp"), 1, 'temp file in cache');
+is(count_files("$d/proxy_temp"), 0, 'no temp file in proxy_temp_path');
+
+like(http_end($s), qr/MISS.*SEE-THIS/s, 'response');
+
+is(count_files("$d/cache/temp"), 0, 'temp file renamed');
+like(http_get('/t'), qr/HIT.*SEE-THIS/s, 'cached');
+
+# use_temp_path=on
+
+$s = http_start('/temp/t');
+
+select undef, undef, undef, 0.3;
+
+is(count_files("$d/proxy_temp"), 1, 'temp file in proxy_temp_path');
+
+like(http_end($s), qr/MISS.*SEE-THIS/s, 'use_temp_path response');
+like(http_get('/temp/t'), qr/HIT.*SEE-THIS/s, 'use_temp_path cached');
+
+###############################################################################
+
+sub count_files {
+	my ($dir) = @_;
+	my $n = 0;
+
+	my @dirs = ($dir);
+
+	while (my $dir = shift @dirs) {
+		opendir my $dh, $dir or next;
+
+		for my $e (grep { !/^\./ } readdir $dh) {
+			my $path = "$dir/$e";
+			if (-d $path) { push @dirs, $path; } else { $n++; }
+		}
+
+		closedir $dh;
+	}
+
+	return $n;
+}
+
+sub http_start {
+	my ($uri) = @_;
+
+	my $s;
+	my $request = "GET $uri HTTP/1.0" . CRLF . CRLF;
+
+	eval {
+		local $SIG{ALRM} = sub { die "timeout\n" };
+		local $SIG{PIPE} = sub { die "sigpipe\n" };
+		alarm(3);
+		$s = IO::Socket::INET->new(
+			Proto => 'tcp',
+			PeerAddr => '127.0.0.1:8080'
+		);
+		log_out($request);
+		$s->print($request);
+		alarm(0);
+	};
+	alarm(0);
+	if ($@) {
+		log_in("died: $@");
+		return undef;
+	}
+	return $s;
+}
+
+sub http_end {
+	my ($s) = @_;
+	my $reply;
+
+	eval {
+		local $SIG{ALRM} = sub { die "timeout\n" };
+		local $SIG{PIPE} = sub { die "sigpipe\n" };
+		alarm(3);
+		local $/;
+		$reply = $s->getline();
+		log_in($reply);
+		alarm(0);
+	};
+	alarm(0);
+	if ($@) {
+		log_in("died: $@");
+		return undef;
+	}
+	return $reply;
+}
+
+###############################################################################
+
+sub http_fake_daemon {
+	my $server = IO::Socket::INET->new(
+		Proto => 'tcp',
+		LocalAddr => '127.0.0.1:8081',
+		Listen => 5,
+		Reuse => 1
+	)
+		or die "Can't create listening socket: $!\n";
+
+	while (my $client = $server->accept()) {
+		$client->autoflush(1);
+
+		my $uri = '';
+
+		while (<$client>) {
+			$uri = $1 if /GET (.*) HTTP/;
+			last if /^\x0d?\x0a?$/;
+		}
+
+		next unless $uri;
+
+		print $client 'HTTP/1.1 200 OK' . CRLF
+			. 'Cache-Control: max-age=300' . CRLF
+			. 'Content-Length: 65544' . CRLF
+			. 'Connection: close' . CRLF . CRLF
+			. ('X' x 65536);
+
+		select(undef, undef, undef, 0.6);
+
+		print $client 'SEE-THIS';
+	}
+}
+
+###############################################################################
@@ -0,0 +1,140 @@
+#!/usr/bin/perl
+
+# Tests for http proxy response headers kept in the upstream buffer.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy/)->plan(12);
+
+my $long = 'x' x 600;
+my $body = join('', map { sprintf("%08d\n", $_) } 1 .. 8192);
+
+my $conf = <<'EOF';
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    log_format  headers  '$uri $upstream_http_x_test $sent_http_x_test '
+                         '$upstream_http_x_long';
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        proxy_buffer_size  1k;
+        proxy_buffers      4 1k;
+
+        access_log  %%TESTDIR%%/headers.log headers;
+
+        location / {
+            proxy_pass    http://127.0.0.1:8081;
+        }
+
+        location /nb/ {
+            proxy_pass    http://127.0.0.1:8081/;
+            proxy_buffering  off;
+        }
+
+        location /hide/ {
+            proxy_pass    http://127.0.0.1:8081/;
+            proxy_hide_header  X-Test;
+            proxy_pass_header  X-Pad;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / {
+            add_header  X-Test  test;
+            add_header  X-Pad   pad;
+        }
+
+        location /long {
+            alias  %%TESTDIR%%/t.html;
+
+            add_header  X-Test  test;
+            add_header  X-Long  %%LONG%%;
+        }
+    }
+}
+
+EOF
+
+$conf =~ s/%%LONG%%/$long/;
+
+$t->write_file_expand('nginx.conf', $conf);
+$t->write_file('t.html', $body);
+$t->run();
+
+###############################################################################
+
+my $r = http_get('/t.html');
+like($r, qr/X-Test: test/, 'header');
+is(http_content($r), $body, 'body');
+
+$r = http_get('/long');
+like($r, qr/X-Long: $long/, 'long header');
+is(http_content($r), $body, 'long header body');
+
+$r = http_get('/nb/t.html');
+like($r, qr/X-Test: test/, 'unbuffered header');
+is(http_content($r), $body, 'unbuffered body');
+
+$r = http_get('/nb/long');
+like($r, qr/X-Long: $long/, 'unbuffered long header');
+is(http_content($r), $body, 'unbuffered long header body');
+
+$r = http_get('/hide/t.html');
+unlike($r, qr/X-Test/, 'hidden');
+like($r, qr/X-Pad: pad/, 'passed');
+
+$t->stop();
+
+# the headers are still intact after the response body was read
+
+my $log = read_file($t, 'headers.log');
+
+like($log, qr!^/t.html test test -$!m, 'log');
+like($log, qr!^/nb/long test test $long$!m, 'unbuffered log');
+
+###############################################################################
+
+sub http_content {
+	my ($r) = @_;
+	return $r =~ /\x0d\x0a\x0d\x0a(.*)/s ? $1 : undef;
+}
+
+sub read_file {
+	my ($t, $name) = @_;
+
+	open my $fh, '<', $t->testdir() . '/' . $name
+		or die "Can't open $name: $!";
+	local $/;
+	return <$fh>;
+}
+
+###############################################################################
@@ -0,0 +1,242 @@
+#!/usr/bin/perl
+
+# Tests for http proxy request hedging.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+use Socket qw/ CRLF /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+plan(skip_all => 'win32') if $^O eq 'MSWin32';
+
+my $t = Test::Nginx->new()->has(qw/http proxy/)->plan(11)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    log_format  hedge  '$uri $upstream_addr';
+
+    upstream fast {
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082;
+    }
+
+    upstream slow {
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8083;
+    }
+
+    upstream failed {
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8084;
+    }
+
+    upstream post {
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082;
+    }
+
+    upstream budget {
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082;
+    }
+
+    upstream percentile {
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082;
+    }
+
+    upstream off {
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082;
+    }
+
+    upstream reported {
+        server 127.0.0.1:8085 max_fails=1 fail_timeout=1m;
+        server 127.0.0.1:8081;
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        access_log  %%TESTDIR%%/hedge.log hedge;
+
+        proxy_hedge  100ms budget=100%;
+
+        location /fast {
+            proxy_pass    http://fast;
+        }
+
+        location /slow {
+            proxy_pass    http://slow;
+        }
+
+        location /failed {
+            proxy_pass    http://failed;
+        }
+
+        location /post {
+            proxy_pass    http://post;
+        }
+
+        location /budget {
+            proxy_pass    http://budget;
+            proxy_hedge   100ms budget=0;
+        }
+
+        location /percentile {
+            proxy_pass    http://percentile;
+            proxy_hedge   p95;
+        }
+
+        location /off {
+            proxy_pass    http://off;
+            proxy_hedge   off;
+        }
+
+        location /reported/ {
+            proxy_pass    http://reported;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8082;
+        server_name  localhost;
+
+        location / {
+            add_header  X-Port  $server_port;
+            try_files   /t.html =404;
+        }
+    }
+}
+
+EOF
+
+$t->write_file('t.html', 'SEE-THIS');
+
+$t->run_daemon(\&http_slow_daemon, 8081, 0.5);
+$t->run_daemon(\&http_slow_daemon, 8083, 2);
+$t->run_daemon(\&http_slow_daemon, 8085, 0.3, 1);
+$t->run()->waitforsocket('127.0.0.1:8081');
+$t->waitforsocket('127.0.0.1:8083');
+$t->waitforsocket('127.0.0.1:8085');
+
+###############################################################################
+
+# the hedged request to the fast peer wins
+
+like(http_get('/fast'), qr/X-Port: 8082/, 'hedged');
+
+# the original request wins if it responds first
+
+like(http_get('/slow'), qr/X-Port: 8081/, 'original');
+
+# the original request is used if the hedged one fails
+
+like(http_get('/failed'), qr/X-Port: 8081/, 'hedged failed');
+
+# only GET and HEAD requests are hedged
+
+like(http_post('/post'), qr/X-Port: 8081/, 'post');
+
+like(http_get('/budget'), qr/X-Port: 8081/, 'budget');
+like(http_get('/off'), qr/X-Port: 8081/, 'off');
+
+# no hedging until response times are known
+
+like(http_get('/percentile'), qr/X-Port: 8081/, 'percentile');
+
+# the original peer failing after the request was hedged is reported
+
+like(http_get('/reported/1'), qr/X-Port: 8081/, 'original failed');
+http_get('/reported/2');
+
+$t->stop();
+
+my $log = read_file($t, 'hedge.log');
+
+like($log, qr!^/fast 127.0.0.1:8081, 127.0.0.1:8082$!m, 'hedged log');
+like($log, qr!^/post 127.0.0.1:8081$!m, 'post log');
+unlike($log, qr!^/reported/2 .*8085!m, 'original failure reported');
+
+###############################################################################
+
+sub http_post {
+	my ($uri) = @_;
+	return http(<<EOF);
+POST $uri HTTP/1.0
+Host: localhost
+Content-Length: 0
+
+EOF
+}
+
+sub read_file {
+	my ($t, $name) = @_;
+
+	open my $fh, '<', $t->testdir() . '/' . $name
+		or die "Can't open $name: $!";
+	local $/;
+	return <$fh>;
+}
+
+###############################################################################
+
+sub http_slow_daemon {
+	my ($port, $delay, $close) = @_;
+
+	my $server = IO::Socket::INET->new(
+		Proto => 'tcp',
+		LocalAddr => "127.0.0.1:$port",
+		Listen => 5,
+		Reuse => 1
+	)
+		or die "Can't create listening socket: $!\n";
+
+	local $SIG{PIPE} = 'IGNORE';
+
+	while (my $client = $server->accept()) {
+		$client->autoflush(1);
+
+		while (<$client>) {
+			last if /^\x0d?\x0a?$/;
+		}
+
+		select(undef, undef, undef, $delay);
+
+		if ($close) {
+			close $client;
+			next;
+		}
+
+		print $client 'HTTP/1.1 200 OK' . CRLF
+			. "X-Port: $port" . CRLF
+			. 'Connection: close' . CRLF . CRLF;
+
+		close $client;
+	}
+}
+
+###############################################################################
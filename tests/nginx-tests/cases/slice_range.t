@@ -0,0 +1,153 @@
+#!/usr/bin/perl
+
+# Tests for slice range filter module.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy cache slice_range/)->plan(16)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    proxy_cache_path   %%TESTDIR%%/cache  levels=1:2
+                       keys_zone=NAME:10m;
+
+    log_format range   '$uri $status $http_range';
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            slice_range        1k;
+
+            proxy_pass         http://127.0.0.1:8081;
+            proxy_cache        NAME;
+            proxy_cache_key    $uri$slice_range;
+            proxy_cache_valid  200 206 1h;
+
+            proxy_set_header   Range $slice_range;
+        }
+
+        location /nocache/ {
+            slice_range        1k;
+
+            proxy_pass         http://127.0.0.1:8081/;
+            proxy_set_header   Range $slice_range;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        access_log   %%TESTDIR%%/backend.log range;
+    }
+}
+
+EOF
+
+my $data = join('', map { sprintf('%04d', $_) } 0 .. 2499);
+
+$t->write_file('t.bin', $data);
+$t->write_file('t2.bin', $data);
+
+$t->run();
+
+###############################################################################
+
+my $r;
+
+$r = http_get('/t.bin');
+like($r, qr/^HTTP\/1.1 200 /, 'whole response');
+like($r, qr/Content-Length: 10000/, 'whole length');
+is(body($r), $data, 'whole body');
+
+is(backend_requests($t, '/t.bin'), 10, 'slices fetched');
+
+$r = http_get_range('/t.bin', 'bytes=5000-5099');
+like($r, qr/^HTTP\/1.1 206 /, 'range');
+like($r, qr/Content-Range: bytes 5000-5099\/10000/, 'range content range');
+is(body($r), substr($data, 5000, 100), 'range body');
+
+$r = http_get_range('/t.bin', 'bytes=1000-3999');
+is(body($r), substr($data, 1000, 3000), 'range across slices');
+
+is(backend_requests($t, '/t.bin'), 10, 'ranges cached');
+
+# only the slices covering the requested range are fetched
+
+$r = http_get_range('/t2.bin', 'bytes=5000-5099');
+is(body($r), substr($data, 5000, 100), 'uncached range body');
+like(read_file($t, 'backend.log'), qr!^/t2.bin 206 bytes=4096-5119$!m,
+	'uncached range slice');
+is(backend_requests($t, '/t2.bin'), 1, 'uncached range slices');
+
+$r = http_get_range('/t2.bin', 'bytes=-100');
+is(body($r), substr($data, -100), 'suffix range');
+
+$r = http_get_range('/t2.bin', 'bytes=0-9,100-109');
+like($r, qr/^HTTP\/1.1 200 .*Content-Length: 10000/s, 'multiple ranges');
+
+$r = http_get_range('/nocache/t.bin', 'bytes=9990-');
+like($r, qr/Content-Range: bytes 9990-9999\/10000/, 'last slice');
+is(body($r), substr($data, 9990), 'last slice body');
+
+###############################################################################
+
+sub http_get_range {
+	my ($uri, $range) = @_;
+	return http(<<EOF);
+GET $uri HTTP/1.1
+Host: localhost
+Connection: close
+Range: $range
+
+EOF
+}
+
+sub body {
+	my ($r) = @_;
+	return '' unless defined $r;
+	$r =~ s/^.*?\x0d\x0a\x0d\x0a//s;
+	return $r;
+}
+
+sub backend_requests {
+	my ($t, $uri) = @_;
+	return () = read_file($t, 'backend.log') =~ /^\Q$uri\E /mg;
+}
+
+sub read_file {
+	my ($t, $name) = @_;
+
+	open my $fh, '<', $t->testdir() . '/' . $name
+		or die "Can't open $name: $!";
+	local $/;
+	return <$fh>;
+}
+
+###############################################################################
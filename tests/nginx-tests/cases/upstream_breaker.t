@@ -0,0 +1,201 @@
+#!/usr/bin/perl
+
+# Tests for upstream circuit breaker.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+use Socket qw/ CRLF /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+plan(skip_all => 'win32') if $^O eq 'MSWin32';
+
+my $t = Test::Nginx->new()->has(qw/http proxy/)->plan(9)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    log_format  breaker  '$uri $upstream_addr';
+
+    upstream u {
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082 max_fails=0;
+
+        circuit_breaker  min_requests=2 error_rate=50% open_time=1s probes=1;
+    }
+
+    upstream slow {
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082;
+
+        circuit_breaker  min_requests=2 latency=200ms open_time=1m;
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        access_log  %%TESTDIR%%/breaker.log breaker;
+
+        proxy_next_upstream  error timeout http_500;
+
+        location / {
+            proxy_pass    http://u;
+        }
+
+        location /slow {
+            proxy_pass    http://slow;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / {
+            add_header  X-Port  $server_port;
+            try_files   /t.html =404;
+        }
+    }
+}
+
+EOF
+
+$t->write_file('t.html', 'SEE-THIS');
+$t->write_file('fail', '');
+
+$t->run_daemon(\&http_daemon, $t->testdir());
+$t->run()->waitforsocket('127.0.0.1:8082');
+
+###############################################################################
+
+# the circuit is opened after the peer failed in half of the requests
+
+http_get('/t.html') for 1 .. 6;
+
+is(count($t, '/t.html', 8082), 2, 'opened');
+like(read_file($t, 'error.log'), qr/circuit breaker opened for upstream server 127.0.0.1:8082 in upstream "u", 2 of 2 requests failed/, 'opened log');
+
+# a failed probe opens the circuit again
+
+select undef, undef, undef, 1.1;
+
+http_get('/t.html') for 1 .. 4;
+
+is(count($t, '/t.html', 8082), 3, 'probe');
+like(read_file($t, 'error.log'), qr/circuit breaker opened again/, 'probe log');
+
+# a successful probe closes the circuit
+
+unlink($t->testdir() . '/fail');
+
+select undef, undef, undef, 1.1;
+
+like(http_get('/t.html'), qr/X-Port: 808[12]/, 'request');
+
+http_get('/t.html') for 1 .. 4;
+
+cmp_ok(count($t, '/t.html', 8082), '>=', 5, 'closed');
+like(read_file($t, 'error.log'), qr/circuit breaker closed for upstream server 127.0.0.1:8082/, 'closed log');
+
+# slow responses are counted as failures
+
+http_get('/slow') for 1 .. 8;
+
+is(count($t, '/slow', 8082), 2, 'latency');
+
+# the state is kept on reload, found by the address of a peer
+
+my $conf = read_file($t, 'nginx.conf');
+
+$conf =~ s/(server 127.0.0.1:8081;)(\s+)(server 127.0.0.1:8082;)(\s+circuit_breaker  min_requests=2 latency)/$3$2$1$2server 127.0.0.1:8083 backup;$4/;
+
+$t->write_file('nginx.conf', $conf);
+$t->reload();
+
+http_get('/slow') for 1 .. 4;
+
+is(count($t, '/slow', 8082), 2, 'reload');
+
+###############################################################################
+
+sub count {
+	my ($t, $uri, $port) = @_;
+	my $log = read_file($t, 'breaker.log');
+	my @m = $log =~ m!^\Q$uri\E .*127.0.0.1:$port!mg;
+	return scalar @m;
+}
+
+sub read_file {
+	my ($t, $name) = @_;
+
+	open my $fh, '<', $t->testdir() . '/' . $name
+		or die "Can't open $name: $!";
+	local $/;
+	return <$fh>;
+}
+
+###############################################################################
+
+sub http_daemon {
+	my ($dir) = @_;
+
+	my $server = IO::Socket::INET->new(
+		Proto => 'tcp',
+		LocalAddr => '127.0.0.1:8082',
+		Listen => 5,
+		Reuse => 1
+	)
+		or die "Can't create listening socket: $!\n";
+
+	local $SIG{PIPE} = 'IGNORE';
+
+	while (my $client = $server->accept()) {
+		$client->autoflush(1);
+
+		my $uri = '';
+
+		while (<$client>) {
+			$uri = $1 if /^GET (\S+)/;
+			last if /^\x0d?\x0a?$/;
+		}
+
+		if ($uri =~ /^\/slow/) {
+			select undef, undef, undef, 0.3;
+
+		} elsif (-e "$dir/fail") {
+			print $client 'HTTP/1.1 500 Internal Server Error' . CRLF
+				. 'Connection: close' . CRLF . CRLF;
+			close $client;
+			next;
+		}
+
+		print $client 'HTTP/1.1 200 OK' . CRLF
+			. 'X-Port: 8082' . CRLF
+			. 'Connection: close' . CRLF . CRLF;
+
+		close $client;
+	}
+}
+
+###############################################################################
@@ -0,0 +1,147 @@
+#!/usr/bin/perl
+
+# Tests for upstream ewma balancer module.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+use Socket qw/ CRLF /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+plan(skip_all => 'win32') if $^O eq 'MSWin32';
+
+my $t = Test::Nginx->new()->has(qw/http proxy/)->plan(5)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    upstream u {
+        ewma;
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082;
+    }
+
+    upstream failed {
+        ewma decay=1s;
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8083;
+    }
+
+    upstream backup {
+        ewma;
+        server 127.0.0.1:8083;
+        server 127.0.0.1:8084;
+        server 127.0.0.1:8081 backup;
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass    http://u;
+        }
+
+        location /failed {
+            proxy_pass    http://failed/;
+        }
+
+        location /backup {
+            proxy_pass    http://backup/;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / {
+            add_header  X-Port  $server_port;
+        }
+    }
+}
+
+EOF
+
+$t->write_file('index.html', 'SEE-THIS');
+$t->run_daemon(\&http_slow_daemon);
+$t->run()->waitforsocket('127.0.0.1:8082');
+
+###############################################################################
+
+# the slow peer is avoided once its response time is known
+
+my %ports;
+
+for (1 .. 20) {
+	my ($port) = http_get('/') =~ /X-Port: (\d+)/;
+	$ports{$port || 'none'}++;
+}
+
+ok($ports{8081} >= 18, 'fast peer preferred');
+ok($ports{8082} >= 1, 'slow peer tried');
+
+# a peer failed to connect is not selected again
+
+%ports = ();
+
+for (1 .. 10) {
+	my ($port) = http_get('/failed') =~ /X-Port: (\d+)/;
+	$ports{$port || 'none'}++;
+}
+
+is($ports{8081}, 10, 'failed peer skipped');
+
+like(http_get('/backup'), qr/X-Port: 8081/, 'backup');
+like(http_get('/backup'), qr/SEE-THIS/, 'backup again');
+
+###############################################################################
+
+sub http_slow_daemon {
+	my $server = IO::Socket::INET->new(
+		Proto => 'tcp',
+		LocalAddr => '127.0.0.1:8082',
+		Listen => 5,
+		Reuse => 1
+	)
+		or die "Can't create listening socket: $!\n";
+
+	while (my $client = $server->accept()) {
+		$client->autoflush(1);
+
+		while (<$client>) {
+			last if /^\x0d?\x0a?$/;
+		}
+
+		select(undef, undef, undef, 0.3);
+
+		print $client 'HTTP/1.1 200 OK' . CRLF
+			. 'X-Port: 8082' . CRLF
+			. 'Connection: close' . CRLF . CRLF
+			. 'SLOW';
+
+		close $client;
+	}
+}
+
+###############################################################################
@@ -0,0 +1,124 @@
+#!/usr/bin/perl
+
+# Tests for upstream keepalive limits and statistics.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy upstream_keepalive/)->plan(13)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    upstream requests {
+        server 127.0.0.1:8081;
+        keepalive 4 max_per_peer=2 min_per_peer=1;
+        keepalive_requests 2;
+    }
+
+    upstream timeout {
+        server 127.0.0.1:8081;
+        keepalive 1;
+        keepalive_timeout 1s;
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        proxy_http_version  1.1;
+        proxy_set_header    Connection "";
+
+        location /requests/ {
+            proxy_pass    http://requests/;
+        }
+
+        location /timeout/ {
+            proxy_pass    http://timeout/;
+        }
+
+        location /status {
+            keepalive_status;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / {
+            add_header  X-Requests  $connection_requests;
+        }
+    }
+}
+
+EOF
+
+$t->write_file('t.html', 'SEE-THIS');
+$t->run();
+
+###############################################################################
+
+# connections are closed after keepalive_requests requests
+
+like(http_get('/requests/t.html'), qr/X-Requests: 1/, 'first');
+like(http_get('/requests/t.html'), qr/X-Requests: 2/, 'cached');
+like(http_get('/requests/t.html'), qr/X-Requests: 1/, 'retired');
+like(http_get('/requests/t.html'), qr/X-Requests: 2/, 'cached again');
+
+# idle connections are closed after keepalive_timeout
+
+like(http_get('/timeout/t.html'), qr/X-Requests: 1/, 'timeout first');
+
+select undef, undef, undef, 1.5;
+
+like(http_get('/timeout/t.html'), qr/X-Requests: 1/, 'timeout expired');
+like(http_get('/timeout/t.html'), qr/X-Requests: 2/, 'timeout cached');
+
+my $s = http_get('/status');
+
+like($s, qr!Content-Type: application/json!, 'content type');
+like($s, qr/"requests": \{"idle": 0, "hits": 2, "misses": 2, "evicted": 0, "expired": 0, "retired": 2\}/, 'requests stats');
+like($s, qr/"timeout": \{"idle": 1, "hits": 1, "misses": 2, "evicted": 0, "expired": 1, "retired": 0\}/, 'timeout stats');
+
+# the statistics are kept on reload whatever the order of upstreams
+
+open my $fh, '<', $t->testdir() . '/nginx.conf'
+	or die "Can't open nginx.conf: $!";
+my $conf = do { local $/; <$fh> };
+close $fh;
+
+$conf =~ s/(    upstream requests \{.*?\n    \}\n)\n(    upstream timeout \{.*?\n    \}\n)/    upstream added {\n        server 127.0.0.1:8081;\n        keepalive 1;\n    }\n\n$2\n$1/s;
+
+$t->write_file('nginx.conf', $conf);
+$t->reload();
+
+$s = http_get('/status');
+
+like($s, qr/"requests": \{"idle": \d+, "hits": 2, "misses": 2, "evicted": 0, "expired": 0, "retired": 2\}/, 'requests stats after reload');
+like($s, qr/"timeout": \{"idle": \d+, "hits": 1, "misses": 2, "evicted": 0, "expired": 1, "retired": 0\}/, 'timeout stats after reload');
+like($s, qr/"added": \{"idle": 0, "hits": 0, "misses": 0,/, 'added stats after reload');
+
+###############################################################################
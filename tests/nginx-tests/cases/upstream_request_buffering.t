@@ -0,0 +1,240 @@
+#!/usr/bin/perl
+
+# Tests for unbuffered request body with scgi and uwsgi backends.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+use IO::Socket::INET;
+use Socket qw/ CRLF /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http scgi uwsgi/)->plan(10)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        client_max_body_size       10m;
+        client_body_postpone_size  1;
+
+        location /scgi/ {
+            scgi_pass  127.0.0.1:8081;
+            scgi_param  REQUEST_URI  $request_uri;
+
+            scgi_request_buffering  off;
+        }
+
+        location /scgi/buffered/ {
+            scgi_pass  127.0.0.1:8081;
+            scgi_param  REQUEST_URI  $request_uri;
+        }
+
+        location /uwsgi/ {
+            uwsgi_pass  127.0.0.1:8082;
+            uwsgi_param  CONTENT_LENGTH  $content_length;
+            uwsgi_param  REQUEST_URI     $request_uri;
+
+            uwsgi_request_buffering  off;
+        }
+
+        location /uwsgi/buffered/ {
+            uwsgi_pass  127.0.0.1:8082;
+            uwsgi_param  CONTENT_LENGTH  $content_length;
+            uwsgi_param  REQUEST_URI     $request_uri;
+        }
+    }
+}
+
+EOF
+
+$t->run_daemon(\&backend_daemon, 'scgi', 8081, $t->testdir());
+$t->run_daemon(\&backend_daemon, 'uwsgi', 8082, $t->testdir());
+$t->run()->waitforsocket('127.0.0.1:8081')
+	or die "Can't start scgi backend";
+$t->waitforsocket('127.0.0.1:8082')
+	or die "Can't start uwsgi backend";
+
+###############################################################################
+
+my $large = 'x' x (1024 * 1024);
+
+for my $p (qw/ scgi uwsgi /) {
+	like(http_post("/$p/t", 'foobar'),
+		qr/X-Length: 6\x0d\x0aX-Body: 6 foobar\x0d\x0a/, "$p body");
+	like(http_post("/$p/t", $large),
+		qr/X-Length: 1048576\x0d\x0aX-Body: 1048576 x+\x0d\x0a/,
+		"$p large body");
+	like(http_post("/$p/buffered/t", $large),
+		qr/X-Length: 1048576\x0d\x0aX-Body: 1048576 x+\x0d\x0a/,
+		"$p large body buffered");
+
+	# the request reaches the backend before the body is complete
+
+	like(http_post_split($t->testdir(), "/$p/split"),
+		qr/X-Early: 1.*X-Body: 6 foobar\x0d\x0a/s, "$p streamed");
+	like(http_post_split($t->testdir(), "/$p/buffered/split"),
+		qr/X-Early: 0.*X-Body: 6 foobar\x0d\x0a/s, "$p buffered");
+}
+
+###############################################################################
+
+sub http_post {
+	my ($uri, $body) = @_;
+
+	return http('POST ' . $uri . ' HTTP/1.0' . CRLF
+		. 'Host: localhost' . CRLF
+		. 'Content-Length: ' . length($body) . CRLF . CRLF
+		. $body);
+}
+
+sub http_post_split {
+	my ($dir, $uri) = @_;
+
+	my $s = IO::Socket::INET->new(
+		Proto => 'tcp',
+		PeerAddr => '127.0.0.1:8080'
+	)
+		or die "Can't connect to nginx: $!\n";
+
+	$s->syswrite('POST ' . $uri . ' HTTP/1.0' . CRLF
+		. 'Host: localhost' . CRLF
+		. 'Content-Length: 6' . CRLF . CRLF
+		. 'foo');
+
+	select undef, undef, undef, 0.3;
+
+	my $early = -e "$dir/started" ? 1 : 0;
+	unlink "$dir/started";
+
+	my $r = http('bar', socket => $s);
+	$r =~ s/^/X-Early: $early\x0d\x0a/;
+
+	return $r;
+}
+
+###############################################################################
+
+sub backend_daemon {
+	my ($proto, $port, $dir) = @_;
+
+	my $server = IO::Socket::INET->new(
+		Proto => 'tcp',
+		LocalAddr => "127.0.0.1:$port",
+		Listen => 5,
+		Reuse => 1
+	)
+		or die "Can't create listening socket: $!\n";
+
+	local $SIG{PIPE} = 'IGNORE';
+
+	while (my $client = $server->accept()) {
+		$client->autoflush(1);
+
+		my @params = $proto eq 'scgi'
+			? read_scgi($client) : read_uwsgi($client);
+
+		# the first one of duplicate parameters is used
+
+		my %params;
+
+		while (my ($k, $v) = splice @params, 0, 2) {
+			$params{$k} = $v unless exists $params{$k};
+		}
+
+		next unless defined $params{REQUEST_URI};
+
+		if ($params{REQUEST_URI} =~ /split/) {
+			open my $fh, '>', "$dir/started";
+			close $fh;
+		}
+
+		my $body = read_bytes($client, $params{CONTENT_LENGTH} || 0);
+
+		print $client ($proto eq 'scgi'
+				? 'Status: 200 OK' : 'HTTP/1.0 200 OK') . CRLF
+			. 'X-Length: ' . ($params{CONTENT_LENGTH} || 0) . CRLF
+			. 'X-Body: ' . length($body) . ' ' . substr($body, 0, 16)
+			. CRLF . CRLF;
+
+		close $client;
+	}
+}
+
+sub read_scgi {
+	my ($client) = @_;
+
+	my $len = '';
+
+	while ((my $c = read_bytes($client, 1)) ne '') {
+		last if $c eq ':';
+		$len .= $c;
+	}
+
+	return unless length $len;
+
+	my $headers = read_bytes($client, $len + 1);
+
+	chop $headers;
+
+	return split /\x00/, $headers;
+}
+
+sub read_uwsgi {
+	my ($client) = @_;
+
+	my $h = read_bytes($client, 4);
+	return unless length($h) == 4;
+
+	my $vars = read_bytes($client, unpack('x v', $h));
+	my @params;
+
+	while (length $vars) {
+		my $k = substr($vars, 2, unpack('v', $vars));
+		$vars = substr($vars, 2 + length($k));
+		my $v = substr($vars, 2, unpack('v', $vars));
+		$vars = substr($vars, 2 + length($v));
+		push @params, $k, $v;
+	}
+
+	return @params;
+}
+
+sub read_bytes {
+	my ($client, $n) = @_;
+
+	my $buf = '';
+
+	while (length($buf) < $n) {
+		my $got = $client->sysread($buf, $n - length($buf), length($buf));
+		last unless $got;
+	}
+
+	return $buf;
+}
+
+###############################################################################
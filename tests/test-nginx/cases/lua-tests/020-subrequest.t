@@ -1851,3 +1851,60 @@ F(ngx_pool_run_cleanup_file) {
 --- error_log
 a client request body is buffered to a temporary file
 
+
+
+
+=== TEST 55: per-subrequest timeout
+--- config
+    location /slow {
+        content_by_lua '
+            ngx.sleep(1)
+            ngx.say("slow")
+        ';
+    }
+
+    location /fast {
+        echo fast;
+    }
+
+    location /lua {
+        content_by_lua '
+            local res1, res2 = ngx.location.capture_multi{
+                { "/slow", { timeout = 100 } },
+                { "/fast", { timeout = 1000 } },
+            }
+
+            ngx.say("slow: ", res1.status, " [", res1.body, "]")
+            ngx.print("fast: ", res2.status, " [", res2.body, "]")
+        ';
+    }
+--- request
+GET /lua
+--- response_body
+slow: 504 []
+fast: 200 [fast
+]
+--- timeout: 0.4
+--- no_error_log
+[error]
+[alert]
+
+
+
+=== TEST 56: bad timeout option value
+--- config
+    location /fast {
+        echo fast;
+    }
+
+    location /lua {
+        content_by_lua '
+            local res = ngx.location.capture("/fast", { timeout = "blah" })
+        ';
+    }
+--- request
+GET /lua
+--- response_body_like: 500 Internal Server Error
+--- error_code: 500
+--- error_log
+Bad timeout option value
@@ -588,3 +588,57 @@ found
 --- response_body
 _G.foo: 1
 
+
+
+
+=== TEST 18: on-disk bytecode cache
+--- http_config eval
+    "lua_code_cache_path $::HtmlDir;"
+--- config eval
+qq{
+    location /lua {
+        content_by_lua_file html/test.lua;
+    }
+
+    location /t {
+        content_by_lua '
+            local res = ngx.location.capture("/lua")
+            ngx.print(res.body)
+
+            local f = io.popen("ls $::HtmlDir")
+            local files = f:read("*a")
+            f:close()
+
+            if string.find(files, "%x+%-%d+%-%d+%.luac") then
+                ngx.say("cached")
+            else
+                ngx.say("not cached")
+            end
+        ';
+    }
+}
+--- user_files
+>>> test.lua
+ngx.say("hello")
+--- request
+    GET /t
+--- response_body
+hello
+cached
+
+
+
+=== TEST 19: bytecode cache directory not writable
+--- http_config
+    lua_code_cache_path /no/such/dir;
+--- config
+    location /lua {
+        content_by_lua_file html/test.lua;
+    }
+--- user_files
+>>> test.lua
+ngx.say("hello")
+--- request
+    GET /lua
+--- response_body
+hello
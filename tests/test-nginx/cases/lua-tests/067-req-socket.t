@@ -752,3 +752,67 @@ failed to get socket: no body
 --- no_error_log
 [error]
 
+
+
+
+=== TEST 13: receiveany returns data as it arrives
+--- config
+    location /t {
+        content_by_lua '
+            local sock, err = ngx.req.socket()
+            if not sock then
+                ngx.say("failed to get the request socket: ", err)
+                return
+            end
+
+            local total = 0
+            while true do
+                local data, err = sock:receiveany(4)
+                if not data then
+                    ngx.say("failed to receive: ", err)
+                    break
+                end
+
+                total = total + #data
+                ngx.say("received: ", data)
+            end
+
+            ngx.say("total: ", total)
+        ';
+    }
+--- request
+POST /t
+hello world
+--- response_body
+received: hell
+received: o wo
+received: rld
+failed to receive: closed
+total: 11
+--- no_error_log
+[error]
+
+
+
+=== TEST 14: receiveany with bad max argument
+--- config
+    location /t {
+        content_by_lua '
+            local sock, err = ngx.req.socket()
+            if not sock then
+                ngx.say("failed to get the request socket: ", err)
+                return
+            end
+
+            local ok, err = pcall(sock.receiveany, sock, 0)
+            ngx.say(ok, " ", string.find(err, "bad max argument", 1, true)
+                             ~= nil)
+        ';
+    }
+--- request
+POST /t
+hello world
+--- response_body
+false true
+--- no_error_log
+[error]
@@ -507,3 +507,48 @@ hello worldhello world
 --- no_error_log
 [error]
 
+
+
+
+=== TEST 19: overwrite the chunk in place
+--- config
+    location /t {
+        proxy_pass http://127.0.0.1:$server_port/back;
+        body_filter_by_lua '
+            ngx.arg[1] = string.upper(ngx.arg[1])
+        ';
+    }
+
+    location /back {
+        echo hello world;
+    }
+--- request
+GET /t
+--- response_body
+HELLO WORLD
+--- error_log
+lua body filter reused buffer in place, size 12
+
+
+
+=== TEST 20: inspect the chunk via ngx.arg.buffers
+--- config
+    location /t {
+        echo -n hello world;
+        body_filter_by_lua '
+            local bufs = ngx.arg.buffers
+            local n = 0
+            for i = 2, #bufs, 2 do
+                n = n + bufs[i]
+            end
+            if n > 0 then
+                ngx.log(ngx.WARN, "buffers: ", n, " ", #ngx.arg[1])
+            end
+        ';
+    }
+--- request
+GET /t
+--- response_body chop
+hello world
+--- error_log
+buffers: 11 11
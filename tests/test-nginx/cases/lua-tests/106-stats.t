@@ -0,0 +1,116 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+use lib 'lib';
+use Test::Nginx::Socket;
+
+#worker_connections(1014);
+#master_on();
+#workers(2);
+#log_level('warn');
+
+repeat_each(1);
+
+plan tests => repeat_each() * (blocks() * 3);
+
+#no_diff();
+#no_long_string();
+run_tests();
+
+__DATA__
+
+=== TEST 1: per-location accounting
+--- http_config
+    lua_stats on;
+--- config
+    location /lua {
+        rewrite_by_lua 'ngx.sleep(0.001)';
+        content_by_lua 'ngx.say("ok")';
+    }
+
+    location /stats {
+        lua_stats_show;
+    }
+
+    location /t {
+        content_by_lua '
+            ngx.location.capture("/lua")
+            ngx.location.capture("/lua")
+            local res = ngx.location.capture("/stats")
+            ngx.print(res.body)
+        ';
+    }
+--- request
+GET /t
+--- response_body_like chop
+^pid: \d+
+sample rate: 1
+location phase invocations resumes sampled wall_us cpu_us gc_bytes
+/lua rewrite 2 4 4 \d+ \d+ \d+
+/lua content 2 2 2 \d+ \d+ \d+
+/t content 1 3 3 \d+ \d+ \d+$
+--- no_error_log
+[error]
+
+
+
+=== TEST 2: stats disabled
+--- config
+    location /lua {
+        content_by_lua 'ngx.say("ok")';
+    }
+
+    location /stats {
+        lua_stats_show;
+    }
+
+    location /t {
+        content_by_lua '
+            ngx.location.capture("/lua")
+            local res = ngx.location.capture("/stats")
+            ngx.print(res.body)
+        ';
+    }
+--- request
+GET /t
+--- response_body_like chop
+^pid: \d+
+sample rate: 1
+location phase invocations resumes sampled wall_us cpu_us gc_bytes
+/lua content 0 0 0 0 0 0
+/t content 0 0 0 0 0 0$
+--- no_error_log
+[error]
+
+
+
+=== TEST 3: sampling
+--- http_config
+    lua_stats on;
+    lua_stats_sample_rate 2;
+--- config
+    location /lua {
+        content_by_lua 'ngx.say("ok")';
+    }
+
+    location /stats {
+        lua_stats_show;
+    }
+
+    location /t {
+        content_by_lua '
+            for i = 1, 4 do
+                ngx.location.capture("/lua")
+            end
+            local res = ngx.location.capture("/stats")
+            ngx.print(res.body)
+        ';
+    }
+--- request
+GET /t
+--- response_body_like chop
+^pid: \d+
+sample rate: 2
+location phase invocations resumes sampled wall_us cpu_us gc_bytes
+/lua content 4 4 0 0 0 0
+/t content 1 5 5 \d+ \d+ \d+$
+--- no_error_log
+[error]